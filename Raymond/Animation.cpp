@@ -0,0 +1,413 @@
+#include "pch.h"
+#include "Animation.h"
+
+// ------------------------------------------------------------------------
+//
+// Render Worker Pool
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+RenderWorkerPool::RenderWorkerPool(int threads)
+{
+	this->wp_task_ = nullptr;
+	this->wp_count_ = 0;
+	this->wp_next_ = 0;
+	this->wp_busy_ = 0;
+	this->wp_job_ = 0;
+	this->wp_stopping_ = false;
+
+	if (threads <= 0)
+	{
+		threads = std::max(int(std::thread::hardware_concurrency()), 1);
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		this->wp_threads_.emplace_back(&RenderWorkerPool::wp_work_, this);
+	}
+}
+
+RenderWorkerPool::~RenderWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->wp_mutex_);
+		this->wp_stopping_ = true;
+	}
+	this->wp_start_.notify_all();
+
+	for (std::thread & thread : this->wp_threads_)
+	{
+		thread.join();
+	}
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+void RenderWorkerPool::run(size_t count, const std::function<void(size_t)> & task)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(this->wp_mutex_);
+
+	this->wp_task_ = &task;
+	this->wp_count_ = count;
+	this->wp_next_ = 0;
+	this->wp_busy_ = int(this->wp_threads_.size());
+	this->wp_error_ = nullptr;
+	this->wp_job_++;
+
+	this->wp_start_.notify_all();
+	this->wp_done_.wait(lock, [this]() { return this->wp_busy_ == 0; });
+
+	this->wp_task_ = nullptr;
+
+	if (this->wp_error_)
+	{
+		std::exception_ptr error = this->wp_error_;
+		this->wp_error_ = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+int RenderWorkerPool::size() const
+{
+	return int(this->wp_threads_.size());
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void RenderWorkerPool::wp_work_()
+{
+	uint64_t last_job = 0;
+	std::unique_lock<std::mutex> lock(this->wp_mutex_);
+
+	while (true)
+	{
+		this->wp_start_.wait(lock, [this, last_job]() { return this->wp_stopping_ || this->wp_job_ != last_job; });
+
+		if (this->wp_stopping_)
+		{
+			return;
+		}
+
+		last_job = this->wp_job_;
+
+		// Tasks are whole buckets, so taking the lock for each one costs nothing next to the task
+		while (this->wp_next_ < this->wp_count_)
+		{
+			const size_t index = this->wp_next_++;
+			const std::function<void(size_t)> & task = *this->wp_task_;
+
+			lock.unlock();
+
+			try
+			{
+				task(index);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> error_lock(this->wp_mutex_);
+
+				if (!this->wp_error_)
+				{
+					this->wp_error_ = std::current_exception();
+				}
+				// The rest of the job is skipped
+				this->wp_next_ = this->wp_count_;
+			}
+
+			lock.lock();
+		}
+
+		if (--this->wp_busy_ == 0)
+		{
+			this->wp_done_.notify_one();
+		}
+	}
+}
+
+// ------------------------------------------------------------------------
+//
+// Frame Stats
+//
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+double FrameStats::overhead_seconds() const
+{
+	return this->setup_seconds + this->stitch_seconds + this->write_wait_seconds;
+}
+
+// ------------------------------------------------------------------------
+//
+// Animation Renderer
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+AnimationRenderer::AnimationRenderer(const World & w, int threads, std::ostream & output) : ar_world_(w), ar_pool_(threads), ar_output_(output)
+{
+	this->scheduler = nullptr;
+	this->ar_wall_seconds_ = 0.0;
+}
+
+AnimationRenderer::~AnimationRenderer()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+void AnimationRenderer::render(int first_frame, int frame_count, const CameraForFrame & camera_for_frame, const FrameWriter & write_frame)
+{
+	using clock = std::chrono::steady_clock;
+	auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+	const auto render_start = clock::now();
+
+	this->ar_frames_.assign(size_t(std::max(frame_count, 0)), FrameStats());
+
+	// One reporter, and so one thread, for the whole sequence.  It is made once the first
+	// camera gives the size of a frame.
+	std::unique_ptr<ProgressReporter> reporter;
+
+	// The frame being written, while the next one traces
+	std::future<void> writing;
+
+	for (int i = 0; i < frame_count; i++)
+	{
+		FrameStats & stats = this->ar_frames_[i];
+		stats.frame = first_frame + i;
+
+		auto setup_start = clock::now();
+		const Camera c = camera_for_frame(stats.frame);
+		stats.setup_seconds = seconds_since(setup_start);
+
+		if (!reporter)
+		{
+			const uint64_t total_pixels = uint64_t(c.get_horizontal_size()) * uint64_t(c.get_vertical_size()) * uint64_t(frame_count);
+			reporter = std::make_unique<ProgressReporter>("Animation", total_pixels, this->ar_output_);
+			reporter->start();
+		}
+
+		SampleBuffer image = this->ar_render_frame_(c, stats, *reporter);
+
+		// Only one frame is written at a time, so a slow disk holds the render up rather than
+		// letting finished frames pile up in memory
+		auto wait_start = clock::now();
+		if (writing.valid())
+		{
+			writing.get();
+		}
+		stats.write_wait_seconds = seconds_since(wait_start);
+
+		// Frames do not move once assigned, so the writer can fill in its own time
+		FrameStats * frame_stats = &stats;
+		writing = std::async(std::launch::async, [&write_frame, frame_stats, seconds_since, frame_image = std::move(image)]() mutable
+		{
+			auto write_start = clock::now();
+			write_frame(frame_stats->frame, frame_image);
+			frame_stats->write_seconds = seconds_since(write_start);
+		});
+	}
+
+	if (writing.valid())
+	{
+		writing.get();
+	}
+
+	if (reporter)
+	{
+		reporter->finish();
+	}
+
+	this->ar_wall_seconds_ = seconds_since(render_start);
+}
+
+std::string AnimationRenderer::stats_json() const
+{
+	double trace = 0.0;
+	double overhead = 0.0;
+	double write = 0.0;
+	RenderCounters totals = RenderCounters();
+
+	for (const FrameStats & frame : this->ar_frames_)
+	{
+		trace += frame.trace_seconds;
+		overhead += frame.overhead_seconds();
+		write += frame.write_seconds;
+		totals += frame.counters;
+	}
+
+	std::ostringstream oss;
+	oss.precision(9);
+
+	oss << "{\n";
+	oss << "\t\"frame_count\": " << this->ar_frames_.size() << ",\n";
+	oss << "\t\"threads\": " << this->ar_pool_.size() << ",\n";
+	oss << "\t\"wall_seconds\": " << this->ar_wall_seconds_ << ",\n";
+	oss << "\t\"trace_seconds\": " << trace << ",\n";
+	oss << "\t\"overhead_seconds\": " << overhead << ",\n";
+	oss << "\t\"write_seconds\": " << write << ",\n";
+	oss << "\t\"rays\": " << totals.total_rays() << ",\n";
+
+	oss << "\t\"frames\": [";
+	for (size_t i = 0; i < this->ar_frames_.size(); i++)
+	{
+		const FrameStats & frame = this->ar_frames_[i];
+
+		oss << (i == 0 ? "\n" : ",\n")
+			<< "\t\t{ \"frame\": " << frame.frame
+			<< ", \"setup_seconds\": " << frame.setup_seconds
+			<< ", \"trace_seconds\": " << frame.trace_seconds
+			<< ", \"stitch_seconds\": " << frame.stitch_seconds
+			<< ", \"write_wait_seconds\": " << frame.write_wait_seconds
+			<< ", \"write_seconds\": " << frame.write_seconds
+			<< ", \"overhead_seconds\": " << frame.overhead_seconds()
+			<< ", \"rays\": " << frame.counters.total_rays()
+			<< ", \"samples\": " << frame.counters.samples << " }";
+	}
+	oss << (this->ar_frames_.empty() ? "]\n" : "\n\t]\n");
+
+	oss << "}\n";
+
+	return oss.str();
+}
+
+bool AnimationRenderer::write_stats_json(const std::string & file_path) const
+{
+	std::ofstream output_file(file_path, std::ios::out);
+
+	if (!output_file.is_open())
+	{
+		return false;
+	}
+
+	output_file << this->stats_json();
+
+	return bool(output_file);
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+const std::vector<FrameStats> & AnimationRenderer::get_frame_stats() const
+{
+	return this->ar_frames_;
+}
+
+double AnimationRenderer::get_wall_seconds() const
+{
+	return this->ar_wall_seconds_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+SampleBuffer AnimationRenderer::ar_render_frame_(const Camera & c, FrameStats & stats, ProgressReporter & progress)
+{
+	using clock = std::chrono::steady_clock;
+
+	const World & w = this->ar_world_;
+	const int width = c.get_horizontal_size();
+	const int height = c.get_vertical_size();
+
+	auto layout_start = clock::now();
+
+	// Records from the last frame are of the scene before it moved
+	w.begin_frame();
+
+	const int bucket_size = std::max(w.bucket_size, 1);
+	auto buckets = std::vector<Bucket>();
+	for (int y = 0; y < height; y += bucket_size)
+	{
+		for (int x = 0; x < width; x += bucket_size)
+		{
+			buckets.push_back({ x, y, std::min(bucket_size, width - x), std::min(bucket_size, height - y), int(buckets.size()) + 1 });
+		}
+	}
+
+	auto results = std::vector<SampleBuffer>(buckets.size());
+	auto counters = std::vector<RenderCounters>(buckets.size());
+
+	DeadlineScheduler * deadline = this->scheduler.get();
+	RenderQuality full_quality = DeadlineScheduler::quality_of(w);
+
+	if (deadline != nullptr)
+	{
+		deadline->begin_frame(w, width * height, this->ar_pool_.size());
+	}
+
+	stats.setup_seconds += std::chrono::duration<double>(clock::now() - layout_start).count();
+
+	auto render_bucket = [&](size_t index)
+	{
+		const Bucket & bucket = buckets[index];
+		const int pixel_count = bucket.width * bucket.height;
+		const RenderCounters counters_before = thread_counters();
+		auto bucket_start = clock::now();
+
+		if (deadline == nullptr)
+		{
+			results[index] = c.multi_sample_render_bucket(w, bucket.x, bucket.y, bucket.width, bucket.height, bucket.id);
+		}
+		else
+		{
+			RenderQuality quality = deadline->next_bucket(pixel_count, bucket.id);
+
+			// The world is only copied for buckets that are lowered
+			if (quality.aa_sample_max == full_quality.aa_sample_max && quality.shadow_subdivs == full_quality.shadow_subdivs && quality.max_ray_depth == full_quality.max_ray_depth)
+			{
+				results[index] = c.multi_sample_render_bucket(w, bucket.x, bucket.y, bucket.width, bucket.height, bucket.id);
+			}
+			else
+			{
+				World bucket_world = w;
+				DeadlineScheduler::apply(quality, bucket_world);
+				results[index] = c.multi_sample_render_bucket(bucket_world, bucket.x, bucket.y, bucket.width, bucket.height, bucket.id);
+			}
+
+			deadline->finish_bucket(quality, pixel_count, std::chrono::duration<double>(clock::now() - bucket_start).count());
+		}
+
+		counters[index] = thread_counters() - counters_before;
+		progress.advance(uint64_t(pixel_count));
+		progress.add_rays(counters[index].total_rays());
+	};
+
+	auto trace_start = clock::now();
+	this->ar_pool_.run(buckets.size(), render_bucket);
+	stats.trace_seconds = std::chrono::duration<double>(clock::now() - trace_start).count();
+
+	auto stitch_start = clock::now();
+
+	SampleBuffer image = c.frame_buffer();
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		image.write_portion(results[i]);
+		stats.counters += counters[i];
+	}
+
+	if (deadline != nullptr)
+	{
+		deadline->end_frame();
+	}
+
+	stats.stitch_seconds = std::chrono::duration<double>(clock::now() - stitch_start).count();
+
+	return image;
+}
@@ -0,0 +1,130 @@
+#ifndef H_RAYMOND_ANIMATION
+#define H_RAYMOND_ANIMATION
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Camera.h"
+#include "World.h"
+#include "SampleBuffer.h"
+#include "RenderStats.h"
+#include "DeadlineScheduler.h"
+
+// Threads that stay alive between jobs, so a job only costs a wake up instead of a thread
+// per task
+class RenderWorkerPool
+{
+public:
+	// 0 threads is one per hardware thread
+	explicit RenderWorkerPool(int threads = 0);
+	// Waits for the threads to finish the job they are on
+	~RenderWorkerPool();
+
+	RenderWorkerPool(const RenderWorkerPool &) = delete;
+	RenderWorkerPool & operator=(const RenderWorkerPool &) = delete;
+
+	// Methods
+	// Calls task once for every index below count, spread over the threads, and returns when
+	// they have all finished.  The first exception a task throws is rethrown here.
+	void run(size_t count, const std::function<void(size_t)> & task);
+
+	[[nodiscard]] int size() const;
+
+private:
+	void wp_work_();
+
+	std::vector<std::thread> wp_threads_;
+	std::mutex wp_mutex_;
+	std::condition_variable wp_start_;
+	std::condition_variable wp_done_;
+
+	// The job being run, guarded by the mutex
+	const std::function<void(size_t)> * wp_task_;
+	size_t wp_count_;
+	size_t wp_next_;
+	// Threads still on the job
+	int wp_busy_;
+	// Goes up with every job, so a thread never runs the same job twice
+	uint64_t wp_job_;
+	bool wp_stopping_;
+	std::exception_ptr wp_error_;
+};
+
+// Where the time of one frame went.  Only trace_seconds is spent rendering, the rest is the
+// overhead of the frame.
+struct FrameStats
+{
+	int frame = 0;
+	// Making the frame's camera and laying out its buckets
+	double setup_seconds = 0.0;
+	// First bucket started to last bucket finished
+	double trace_seconds = 0.0;
+	// Buckets copied into the frame
+	double stitch_seconds = 0.0;
+	// Waiting for the previous frame to finish writing, before this one could be handed over
+	double write_wait_seconds = 0.0;
+	// Writing the frame, on the writer thread while the next frame traces
+	double write_seconds = 0.0;
+
+	RenderCounters counters;
+
+	// Time the render threads were not tracing
+	[[nodiscard]] double overhead_seconds() const;
+};
+
+// Renders a sequence of frames of a world that does not change, only the camera does.
+// The world, with its light tree, caches and bakes, is built once by the caller and shared
+// by every frame without being copied.  Buckets run on a pool of threads kept for the whole
+// sequence, and each finished frame is written on a thread of its own while the next one
+// traces.
+class AnimationRenderer
+{
+public:
+	using CameraForFrame = std::function<Camera(int frame)>;
+	// Called on the writer thread, with frames in order.  The image is not used after this.
+	using FrameWriter = std::function<void(int frame, SampleBuffer & image)>;
+
+	// 0 threads is one per hardware thread
+	explicit AnimationRenderer(const World & w, int threads = 0, std::ostream & output = std::cout);
+	~AnimationRenderer();
+
+	// Properties
+	// When set, buckets are rendered at whatever quality keeps each frame within its budget
+	std::shared_ptr<DeadlineScheduler> scheduler;
+
+	// Methods
+	// Renders frame_count frames from first_frame.  Returns once the last frame is written.
+	void render(int first_frame, int frame_count, const CameraForFrame & camera_for_frame, const FrameWriter & write_frame);
+
+	[[nodiscard]] std::string stats_json() const;
+	bool write_stats_json(const std::string & file_path) const;
+
+	// Accessors
+	// The frames of the last render
+	[[nodiscard]] const std::vector<FrameStats> & get_frame_stats() const;
+	[[nodiscard]] double get_wall_seconds() const;
+
+private:
+	struct Bucket
+	{
+		int x, y, width, height, id;
+	};
+
+	SampleBuffer ar_render_frame_(const Camera & c, FrameStats & stats, ProgressReporter & progress);
+
+	const World & ar_world_;
+	RenderWorkerPool ar_pool_;
+	std::ostream & ar_output_;
+
+	std::vector<FrameStats> ar_frames_;
+	double ar_wall_seconds_;
+};
+
+#endif
@@ -1,5 +1,13 @@
 #include "Background.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+#include "TextureCache.h"
+
 // ------------------------------------------------------------------------
 //
 // Default Background
@@ -27,6 +35,30 @@ Sample Background::sample_at(IxComps & comps) const
 	return sample;
 }
 
+// ------------------------------------------------------------------------
+// Importance Sampling
+// ------------------------------------------------------------------------
+
+Color Background::radiance(const Tuple & direction) const
+{
+	return Color(0.0);
+}
+
+bool Background::is_importance_sampled() const
+{
+	return false;
+}
+
+bool Background::sample_direction(double u1, double u2, Tuple & direction, double & pdf) const
+{
+	return false;
+}
+
+double Background::direction_pdf(const Tuple & direction) const
+{
+	return 0.0;
+}
+
 // ------------------------------------------------------------------------
 //
 // Normal Gradient Background
@@ -58,6 +90,299 @@ Sample NormalGradientBackground::sample_at(IxComps & comps) const
     return sample;
 }
 
+// Background comps face back along the ray
+Color NormalGradientBackground::radiance(const Tuple & direction) const
+{
+	IxComps comps = IxComps();
+	comps.normal_v = direction * -1.0;
+
+	return this->sample_at(comps).Background;
+}
+
+// ------------------------------------------------------------------------
+//
+// Sky Background
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+SkyBackground::SkyBackground(const Tuple & sun_vector)
+{
+	this->sun_vector_ = sun_vector.normalize();
+	this->multiplier = 1.0;
+}
+
+SkyBackground::~SkyBackground()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Sample SkyBackground::sample_at(IxComps & comps) const
+{
+    Sample sample = Sample();
+    sample.Background = this->radiance(comps.normal_v * -1.0);
+    sample.Diffuse = Color(0.0);
+    sample.Alpha = 0.0;
+    return sample;
+}
+
+// Bilinear between texel centers, wrapping around the horizon
+Color SkyBackground::radiance(const Tuple & direction) const
+{
+	const Tuple d = direction.normalize();
+
+	if (d.y <= 0.0)
+	{
+		return Color(0.0);
+	}
+
+	const double u = (atan2(d.z, d.x) + M_PI) / (2.0 * M_PI);
+	const double v = acos(clip(d.y, 0.0, 1.0)) / (M_PI / 2.0);
+
+	const double fx = (u * TABLE_WIDTH) - 0.5;
+	const double fy = clip((v * TABLE_HEIGHT) - 0.5, 0.0, double(TABLE_HEIGHT - 1));
+
+	const int x0 = static_cast<int>(floor(fx));
+	const int y0 = std::min(static_cast<int>(fy), TABLE_HEIGHT - 2);
+	const double tx = fx - x0;
+	const double ty = fy - y0;
+
+	const int column0 = (x0 + TABLE_WIDTH) % TABLE_WIDTH;
+	const int column1 = (x0 + 1) % TABLE_WIDTH;
+
+	const Color & c00 = this->sb_table_[(y0 * TABLE_WIDTH) + column0];
+	const Color & c10 = this->sb_table_[(y0 * TABLE_WIDTH) + column1];
+	const Color & c01 = this->sb_table_[((y0 + 1) * TABLE_WIDTH) + column0];
+	const Color & c11 = this->sb_table_[((y0 + 1) * TABLE_WIDTH) + column1];
+
+	const Color top = (c00 * (1.0 - tx)) + (c10 * tx);
+	const Color bottom = (c01 * (1.0 - tx)) + (c11 * tx);
+
+	return ((top * (1.0 - ty)) + (bottom * ty)) * this->multiplier;
+}
+
+bool SkyBackground::is_importance_sampled() const
+{
+	return !this->sb_distribution_.empty();
+}
+
+bool SkyBackground::sample_direction(double u1, double u2, Tuple & direction, double & pdf) const
+{
+	double u, v, table_pdf;
+
+	if (!this->sb_distribution_.sample(u1, u2, u, v, table_pdf))
+	{
+		return false;
+	}
+
+	const double theta = v * (M_PI / 2.0);
+	const double phi = (u * 2.0 * M_PI) - M_PI;
+	const double sin_theta = sin(theta);
+
+	if (sin_theta <= 0.0)
+	{
+		return false;
+	}
+
+	direction = Tuple::Vector(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+	// The table spans 2 pi by pi / 2, and a texel's solid angle shrinks with sin(theta)
+	pdf = table_pdf / (M_PI * M_PI * sin_theta);
+
+	return pdf > 0.0;
+}
+
+double SkyBackground::direction_pdf(const Tuple & direction) const
+{
+	const Tuple d = direction.normalize();
+
+	if (d.y <= 0.0)
+	{
+		return 0.0;
+	}
+
+	const double theta = acos(clip(d.y, 0.0, 1.0));
+	const double sin_theta = sin(theta);
+
+	if (sin_theta <= 0.0)
+	{
+		return 0.0;
+	}
+
+	const double u = (atan2(d.z, d.x) + M_PI) / (2.0 * M_PI);
+	const double v = theta / (M_PI / 2.0);
+
+	return this->sb_distribution_.pdf(u, v) / (M_PI * M_PI * sin_theta);
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+Tuple SkyBackground::get_sun_vector() const
+{
+	return this->sun_vector_;
+}
+
+// ------------------------------------------------------------------------
+// Protected Methods
+// ------------------------------------------------------------------------
+
+// The table holds the model before the multiplier, so the multiplier can change afterwards
+void SkyBackground::sb_build_table_()
+{
+	const double saved_multiplier = this->multiplier;
+	this->multiplier = 1.0;
+
+	this->sb_table_ = std::vector<Color>(TABLE_WIDTH * TABLE_HEIGHT);
+	std::vector<double> weights = std::vector<double>(TABLE_WIDTH * TABLE_HEIGHT);
+
+	for (int row = 0; row < TABLE_HEIGHT; row++)
+	{
+		const double theta = ((row + 0.5) / TABLE_HEIGHT) * (M_PI / 2.0);
+		const double sin_theta = sin(theta);
+
+		for (int column = 0; column < TABLE_WIDTH; column++)
+		{
+			const double phi = (((column + 0.5) / TABLE_WIDTH) * 2.0 * M_PI) - M_PI;
+			const Tuple direction = Tuple::Vector(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+
+			const Color value = this->evaluate(direction);
+			this->sb_table_[(row * TABLE_WIDTH) + column] = value;
+			weights[(row * TABLE_WIDTH) + column] = std::max(0.0, value.luminosity()) * sin_theta;
+		}
+	}
+
+	this->sb_distribution_ = Distribution2D(weights, TABLE_WIDTH, TABLE_HEIGHT);
+	this->multiplier = saved_multiplier;
+}
+
+// ------------------------------------------------------------------------
+//
+// Preetham Sky Background
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+PreethamSkyBackground::PreethamSkyBackground(const Tuple & sun_vector) : PreethamSkyBackground(sun_vector, 3.0)
+{
+}
+
+PreethamSkyBackground::PreethamSkyBackground(const Tuple & sun_vector, double turbidity) : SkyBackground(sun_vector)
+{
+	this->ps_turbidity_ = turbidity;
+	// The model gives luminance in kcd/m^2, this scales a clear noon sky to around 1
+	this->multiplier = 0.05;
+
+	const double t = turbidity;
+
+	// Preetham et al., appendix A.2
+	const double perez[3][5] = {
+		{ (0.1787 * t) - 1.4630, (-0.3554 * t) + 0.4275, (-0.0227 * t) + 5.3251, (0.1206 * t) - 2.5771, (-0.0670 * t) + 0.3703 },
+		{ (-0.0193 * t) - 0.2592, (-0.0665 * t) + 0.0008, (-0.0004 * t) + 0.2125, (-0.0641 * t) - 0.8989, (-0.0033 * t) + 0.0452 },
+		{ (-0.0167 * t) - 0.2608, (-0.0950 * t) + 0.0092, (-0.0079 * t) + 0.2102, (-0.0441 * t) - 1.6537, (-0.0109 * t) + 0.0529 }
+	};
+
+	for (int channel = 0; channel < 3; channel++)
+	{
+		std::copy(perez[channel], perez[channel] + 5, this->ps_coefficients_[channel]);
+	}
+
+	// The model only covers a sun above the horizon
+	this->ps_sun_theta_ = std::min(acos(clip(this->sun_vector_.y, -1.0, 1.0)), (M_PI / 2.0) - 0.01);
+	const double sun_theta = this->ps_sun_theta_;
+	const double theta2 = sun_theta * sun_theta;
+	const double theta3 = theta2 * sun_theta;
+
+	const double chi = ((4.0 / 9.0) - (t / 120.0)) * (M_PI - (2.0 * sun_theta));
+	this->ps_zenith_[0] = (((4.0453 * t) - 4.9710) * tan(chi)) - (0.2155 * t) + 2.4192;
+
+	this->ps_zenith_[1] =
+		(t * t * ((0.00166 * theta3) - (0.00375 * theta2) + (0.00209 * sun_theta))) +
+		(t * ((-0.02903 * theta3) + (0.06377 * theta2) - (0.03202 * sun_theta) + 0.00394)) +
+		((0.11693 * theta3) - (0.21196 * theta2) + (0.06052 * sun_theta) + 0.25886);
+
+	this->ps_zenith_[2] =
+		(t * t * ((0.00275 * theta3) - (0.00610 * theta2) + (0.00317 * sun_theta))) +
+		(t * ((-0.04214 * theta3) + (0.08970 * theta2) - (0.04153 * sun_theta) + 0.00516)) +
+		((0.15346 * theta3) - (0.26756 * theta2) + (0.06670 * sun_theta) + 0.26688);
+
+	this->sb_build_table_();
+}
+
+PreethamSkyBackground::~PreethamSkyBackground()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Color PreethamSkyBackground::evaluate(const Tuple & direction) const
+{
+	const Tuple d = direction.normalize();
+
+	if (d.y <= 0.0)
+	{
+		return Color(0.0);
+	}
+
+	const double cos_theta = d.y;
+	const double gamma = acos(clip(Tuple::dot(d, this->sun_vector_), -1.0, 1.0));
+
+	// Each value relative to the zenith, Preetham et al. equation 3
+	double values[3];
+	for (int channel = 0; channel < 3; channel++)
+	{
+		values[channel] = this->ps_zenith_[channel] *
+			ps_perez_(this->ps_coefficients_[channel], cos_theta, gamma) /
+			ps_perez_(this->ps_coefficients_[channel], 1.0, this->ps_sun_theta_);
+	}
+
+	// xyY to XYZ to linear sRGB
+	const double luminance = values[0];
+	const double x = values[1];
+	const double y = std::max(values[2], EPSILON);
+
+	const double cie_x = x * luminance / y;
+	const double cie_z = (1.0 - x - y) * luminance / y;
+
+	const Color rgb = Color(
+		std::max(0.0, (3.2406 * cie_x) - (1.5372 * luminance) - (0.4986 * cie_z)),
+		std::max(0.0, (-0.9689 * cie_x) + (1.8758 * luminance) + (0.0415 * cie_z)),
+		std::max(0.0, (0.0557 * cie_x) - (0.2040 * luminance) + (1.0570 * cie_z))
+	);
+
+	return rgb * this->multiplier;
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+double PreethamSkyBackground::get_turbidity() const
+{
+	return this->ps_turbidity_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+double PreethamSkyBackground::ps_perez_(const double coefficients[5], double cos_theta, double gamma)
+{
+	const double a = coefficients[0], b = coefficients[1], c = coefficients[2];
+	const double d = coefficients[3], e = coefficients[4];
+
+	const double cos_gamma = cos(gamma);
+
+	// Offset so directions at the horizon stay finite
+	return (1.0 + (a * exp(b / (cos_theta + 0.01)))) *
+		(1.0 + (c * exp(d * gamma)) + (e * cos_gamma * cos_gamma));
+}
+
 // ------------------------------------------------------------------------
 //
 // Hosek Wilkie Background
@@ -66,19 +391,649 @@ Sample NormalGradientBackground::sample_at(IxComps & comps) const
 // Constructors
 // ------------------------------------------------------------------------
 
-HosekWilkieBackground::HosekWilkieBackground(const Tuple & sun_vector)
+HosekWilkieBackground::HosekWilkieBackground(const std::string & dataset_path, const Tuple & sun_vector) :
+	HosekWilkieBackground(dataset_path, sun_vector, 3.0, 0.0)
 {
-	this->sun_vector_ = sun_vector;
+}
+
+HosekWilkieBackground::HosekWilkieBackground(const std::string & dataset_path, const Tuple & sun_vector, double turbidity, double albedo) :
+	SkyBackground(sun_vector)
+{
+	if (turbidity < 1.0 || turbidity > 10.0)
+	{
+		throw std::invalid_argument("Hosek Wilkie turbidity must be between 1 and 10");
+	}
+
+	if (albedo < 0.0 || albedo > 1.0)
+	{
+		throw std::invalid_argument("Hosek Wilkie albedo must be between 0 and 1");
+	}
+
+	this->hw_turbidity_ = turbidity;
+	this->hw_albedo_ = albedo;
+	// The same scale as the Preetham sky's
+	this->multiplier = 0.05;
+
+	const HosekWilkieDataset dataset = HosekWilkieBackground::read_dataset(dataset_path);
+
+	// The fit covers a sun from the horizon to the zenith
+	const double elevation = clip((M_PI / 2.0) - acos(clip(this->sun_vector_.y, -1.0, 1.0)), 0.0, M_PI / 2.0);
+
+	for (int channel = 0; channel < 3; channel++)
+	{
+		hw_cook_(dataset.coefficients[channel], 9, turbidity, albedo, elevation, this->hw_configuration_[channel]);
+		hw_cook_(dataset.radiances[channel], 1, turbidity, albedo, elevation, &this->hw_radiance_[channel]);
+	}
+
+	this->sb_build_table_();
 }
 
 HosekWilkieBackground::~HosekWilkieBackground()
 = default;
 
-Sample HosekWilkieBackground::sample_at(IxComps & comps) const
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Color HosekWilkieBackground::evaluate(const Tuple & direction) const
+{
+	const Tuple d = direction.normalize();
+
+	if (d.y <= 0.0)
+	{
+		return Color(0.0);
+	}
+
+	const double cos_theta = d.y;
+	const double gamma = acos(clip(Tuple::dot(d, this->sun_vector_), -1.0, 1.0));
+
+	const Color rgb = Color(
+		std::max(0.0, hw_radiance_function_(this->hw_configuration_[0], cos_theta, gamma) * this->hw_radiance_[0]),
+		std::max(0.0, hw_radiance_function_(this->hw_configuration_[1], cos_theta, gamma) * this->hw_radiance_[1]),
+		std::max(0.0, hw_radiance_function_(this->hw_configuration_[2], cos_theta, gamma) * this->hw_radiance_[2])
+	);
+
+	return rgb * this->multiplier;
+}
+
+// The published file is C source.  Each array is found by name and its numbers read in order.
+HosekWilkieDataset HosekWilkieBackground::read_dataset(const std::string & file_path)
+{
+	std::ifstream input_file(file_path, std::ios::in);
+
+	if (!input_file.is_open())
+	{
+		throw std::runtime_error("Cannot open Hosek Wilkie dataset: " + file_path);
+	}
+
+	const std::string text = std::string(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>());
+
+	auto read_array = [&text, &file_path](const std::string & name, size_t count)
+	{
+		const size_t declared = text.find(name + "[]");
+		const size_t open = (declared == std::string::npos) ? std::string::npos : text.find('{', declared);
+		const size_t close = (open == std::string::npos) ? std::string::npos : text.find('}', open);
+
+		if (close == std::string::npos)
+		{
+			throw std::runtime_error("Hosek Wilkie dataset has no " + name + ": " + file_path);
+		}
+
+		std::vector<double> values;
+		values.reserve(count);
+
+		const char * position = text.c_str() + open + 1;
+		const char * end = text.c_str() + close;
+
+		while (position < end)
+		{
+			// The published arrays are commented with the albedo and turbidity of each block
+			if (position[0] == '/' && position[1] == '/')
+			{
+				const char * line_end = std::find(position, end, '\n');
+				position = line_end;
+				continue;
+			}
+
+			if (position[0] == '/' && position[1] == '*')
+			{
+				const char * comment_end = std::search(position + 2, end, "*/", "*/" + 2);
+				position = std::min(comment_end + 2, end);
+				continue;
+			}
+
+			char * number_end = nullptr;
+			const double value = std::strtod(position, &number_end);
+
+			if (number_end == position)
+			{
+				position++;
+				continue;
+			}
+
+			values.push_back(value);
+			position = number_end;
+		}
+
+		if (values.size() != count)
+		{
+			throw std::runtime_error("Hosek Wilkie dataset's " + name + " has " + std::to_string(values.size()) + " values, not " + std::to_string(count) + ": " + file_path);
+		}
+
+		return values;
+	};
+
+	HosekWilkieDataset dataset = HosekWilkieDataset();
+
+	for (int channel = 0; channel < 3; channel++)
+	{
+		const std::string number = std::to_string(channel + 1);
+		dataset.coefficients[channel] = read_array("datasetRGB" + number, HosekWilkieDataset::COEFFICIENT_COUNT);
+		dataset.radiances[channel] = read_array("datasetRGBRad" + number, HosekWilkieDataset::RADIANCE_COUNT);
+	}
+
+	return dataset;
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+double HosekWilkieBackground::get_turbidity() const
+{
+	return this->hw_turbidity_;
+}
+
+double HosekWilkieBackground::get_albedo() const
+{
+	return this->hw_albedo_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// Hosek and Wilkie's reference implementation, ArHosekSkyModel_CookConfiguration.  The
+// dataset holds, for ground albedo 0 and then 1 and for each whole turbidity from 1 to 10,
+// six control points of a quintic Bezier curve over the cube root of the sun's elevation,
+// each of them count values.  Turbidity and albedo are interpolated linearly.
+void HosekWilkieBackground::hw_cook_(const std::vector<double> & dataset, int count, double turbidity, double albedo, double elevation, double * result)
+{
+	const int whole_turbidity = std::min(static_cast<int>(turbidity), 10);
+	const double turbidity_fraction = turbidity - whole_turbidity;
+	const double t = pow(elevation / (M_PI / 2.0), 1.0 / 3.0);
+
+	const double bezier[6] = {
+		pow(1.0 - t, 5.0),
+		5.0 * pow(1.0 - t, 4.0) * t,
+		10.0 * pow(1.0 - t, 3.0) * t * t,
+		10.0 * pow(1.0 - t, 2.0) * t * t * t,
+		5.0 * (1.0 - t) * pow(t, 4.0),
+		pow(t, 5.0)
+	};
+
+	std::fill(result, result + count, 0.0);
+
+	auto add = [&](int albedo_index, int turbidity_index, double weight)
+	{
+		if (weight == 0.0)
+		{
+			return;
+		}
+
+		const double * control = dataset.data() + (size_t(count) * 6 * ((albedo_index * 10) + (turbidity_index - 1)));
+
+		for (int i = 0; i < count; i++)
+		{
+			double value = 0.0;
+
+			for (int point = 0; point < 6; point++)
+			{
+				value += bezier[point] * control[i + (point * count)];
+			}
+
+			result[i] += weight * value;
+		}
+	};
+
+	add(0, whole_turbidity, (1.0 - albedo) * (1.0 - turbidity_fraction));
+	add(1, whole_turbidity, albedo * (1.0 - turbidity_fraction));
+
+	if (whole_turbidity < 10)
+	{
+		add(0, whole_turbidity + 1, (1.0 - albedo) * turbidity_fraction);
+		add(1, whole_turbidity + 1, albedo * turbidity_fraction);
+	}
+}
+
+// Hosek and Wilkie's F(theta, gamma), equation 9.  The dataset keeps the coefficients in the
+// order A, B, C, D, E, F, G, I, H.
+double HosekWilkieBackground::hw_radiance_function_(const double configuration[9], double cos_theta, double gamma)
+{
+	const double cos_gamma = cos(gamma);
+	const double h = configuration[8];
+
+	const double exponential = exp(configuration[4] * gamma);
+	const double rayleigh = cos_gamma * cos_gamma;
+	const double mie = (1.0 + (cos_gamma * cos_gamma)) / pow(1.0 + (h * h) - (2.0 * h * cos_gamma), 1.5);
+	const double zenith = sqrt(std::max(cos_theta, 0.0));
+
+	return (1.0 + (configuration[0] * exp(configuration[1] / (cos_theta + 0.01)))) *
+		(configuration[2] + (configuration[3] * exponential) + (configuration[5] * rayleigh) + (configuration[6] * mie) + (configuration[7] * zenith));
+}
+
+// ------------------------------------------------------------------------
+//
+// Distribution 2D
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+Distribution2D::Distribution2D()
+{
+	this->d2_width_ = 0;
+	this->d2_height_ = 0;
+	this->d2_total_ = 0.0;
+}
+
+Distribution2D::Distribution2D(const std::vector<double> & weights, int width, int height)
+{
+	if (weights.size() != size_t(width) * size_t(height))
+	{
+		throw std::invalid_argument("Distribution2D needs width * height weights");
+	}
+
+	this->d2_width_ = width;
+	this->d2_height_ = height;
+	this->d2_weights_ = weights;
+
+	this->d2_row_cdf_ = std::vector<double>(height + 1, 0.0);
+	this->d2_column_cdf_ = std::vector<double>(size_t(width + 1) * height, 0.0);
+
+	for (int row = 0; row < height; row++)
+	{
+		double * cdf = &this->d2_column_cdf_[size_t(row) * (width + 1)];
+
+		for (int column = 0; column < width; column++)
+		{
+			cdf[column + 1] = cdf[column] + std::max(0.0, weights[(size_t(row) * width) + column]);
+		}
+
+		this->d2_row_cdf_[row + 1] = this->d2_row_cdf_[row] + cdf[width];
+	}
+
+	this->d2_total_ = this->d2_row_cdf_[height];
+}
+
+Distribution2D::~Distribution2D()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool Distribution2D::sample(double u1, double u2, double & u, double & v, double & pdf) const
+{
+	if (this->empty())
+	{
+		return false;
+	}
+
+	// Row, from the first number
+	const double row_target = u1 * this->d2_total_;
+	int row = static_cast<int>(std::upper_bound(this->d2_row_cdf_.begin(), this->d2_row_cdf_.end(), row_target) - this->d2_row_cdf_.begin()) - 1;
+	row = clip(row, 0, this->d2_height_ - 1);
+
+	// Skip rows with nothing in them, which the search can land on at their edges
+	while (this->d2_row_cdf_[row + 1] <= this->d2_row_cdf_[row] && row < this->d2_height_ - 1)
+	{
+		row++;
+	}
+
+	const double row_weight = this->d2_row_cdf_[row + 1] - this->d2_row_cdf_[row];
+	const double row_offset = clip((row_target - this->d2_row_cdf_[row]) / row_weight, 0.0, 1.0);
+
+	// Column within the row, from the second
+	const double * cdf = &this->d2_column_cdf_[size_t(row) * (this->d2_width_ + 1)];
+	const double column_target = u2 * cdf[this->d2_width_];
+	int column = static_cast<int>(std::upper_bound(cdf, cdf + this->d2_width_ + 1, column_target) - cdf) - 1;
+	column = clip(column, 0, this->d2_width_ - 1);
+
+	while (cdf[column + 1] <= cdf[column] && column < this->d2_width_ - 1)
+	{
+		column++;
+	}
+
+	const double column_weight = cdf[column + 1] - cdf[column];
+	const double column_offset = clip((column_target - cdf[column]) / column_weight, 0.0, 1.0);
+
+	u = std::min((column + column_offset) / this->d2_width_, 1.0 - std::numeric_limits<double>::epsilon());
+	v = std::min((row + row_offset) / this->d2_height_, 1.0 - std::numeric_limits<double>::epsilon());
+	pdf = column_weight * this->d2_width_ * this->d2_height_ / this->d2_total_;
+
+	return pdf > 0.0;
+}
+
+double Distribution2D::pdf(double u, double v) const
+{
+	if (this->empty())
+	{
+		return 0.0;
+	}
+
+	const int column = clip(static_cast<int>(u * this->d2_width_), 0, this->d2_width_ - 1);
+	const int row = clip(static_cast<int>(v * this->d2_height_), 0, this->d2_height_ - 1);
+
+	return std::max(0.0, this->d2_weights_[(size_t(row) * this->d2_width_) + column]) * this->d2_width_ * this->d2_height_ / this->d2_total_;
+}
+
+bool Distribution2D::empty() const
+{
+	return this->d2_total_ <= 0.0;
+}
+
+// ------------------------------------------------------------------------
+//
+// Alias Table
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+AliasTable::AliasTable()
+= default;
+
+AliasTable::AliasTable(const std::vector<double> & weights)
+{
+	const size_t count = weights.size();
+
+	double total = 0.0;
+	for (double weight : weights)
+	{
+		total += std::max(weight, 0.0);
+	}
+
+	if (count == 0 || total <= 0.0)
+	{
+		return;
+	}
+
+	this->at_probabilities_ = std::vector<double>(count);
+	this->at_thresholds_ = std::vector<double>(count);
+	this->at_aliases_ = std::vector<int>(count);
+
+	// Scaled so the average entry is 1, then small entries are topped up from large ones
+	std::vector<double> scaled = std::vector<double>(count);
+	std::vector<int> small, large;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		this->at_probabilities_[i] = std::max(weights[i], 0.0) / total;
+		scaled[i] = this->at_probabilities_[i] * double(count);
+		this->at_aliases_[i] = static_cast<int>(i);
+
+		if (scaled[i] < 1.0)
+		{
+			small.push_back(static_cast<int>(i));
+		}
+		else
+		{
+			large.push_back(static_cast<int>(i));
+		}
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		const int less = small.back();
+		small.pop_back();
+		const int more = large.back();
+
+		this->at_thresholds_[less] = scaled[less];
+		this->at_aliases_[less] = more;
+
+		scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+
+		if (scaled[more] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	// What is left is 1 up to rounding
+	for (int index : large)
+	{
+		this->at_thresholds_[index] = 1.0;
+	}
+	for (int index : small)
+	{
+		this->at_thresholds_[index] = 1.0;
+	}
+}
+
+AliasTable::~AliasTable()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+int AliasTable::sample(double u, double & remapped) const
+{
+	const double scaled = u * double(this->at_thresholds_.size());
+	const int index = std::min(static_cast<int>(scaled), static_cast<int>(this->at_thresholds_.size()) - 1);
+	const double fraction = scaled - index;
+	const double threshold = this->at_thresholds_[index];
+
+	if (fraction < threshold)
+	{
+		remapped = std::min(fraction / threshold, 1.0 - std::numeric_limits<double>::epsilon());
+		return index;
+	}
+
+	remapped = std::min((fraction - threshold) / (1.0 - threshold), 1.0 - std::numeric_limits<double>::epsilon());
+	return this->at_aliases_[index];
+}
+
+double AliasTable::probability(int index) const
+{
+	return this->at_probabilities_[index];
+}
+
+size_t AliasTable::size() const
+{
+	return this->at_thresholds_.size();
+}
+
+bool AliasTable::empty() const
+{
+	return this->at_thresholds_.empty();
+}
+
+// ------------------------------------------------------------------------
+//
+// Environment Map Background
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+EnvironmentMapBackground::EnvironmentMapBackground(const std::string & file_path)
+{
+	this->multiplier = 1.0;
+
+	TextureFile file = TextureFile(file_path);
+
+	if (file.format != PFMFormat)
+	{
+		throw std::runtime_error("Environment maps must be PFM images, " + file_path + " is not");
+	}
+
+	this->em_width_ = file.width;
+	this->em_height_ = file.height;
+	file.read_block(0, 0, file.width, file.height, this->em_texels_);
+
+	std::vector<double> luminance = std::vector<double>(size_t(this->em_width_) * size_t(this->em_height_));
+
+	for (int y = 0; y < this->em_height_; y++)
+	{
+		for (int x = 0; x < this->em_width_; x++)
+		{
+			luminance[(size_t(y) * this->em_width_) + x] = std::max(0.0, this->em_texel_(x, y).luminosity());
+		}
+	}
+
+	// Lookups blend neighbouring texels, so a texel is weighted by the brightest one around it.
+	// Otherwise a dark texel next to a bright one returns far more light than its density
+	// allows for, and those samples show up as fireflies.
+	// Rows near the poles cover less of the sphere.
+	std::vector<double> weights = std::vector<double>(luminance.size());
+
+	for (int y = 0; y < this->em_height_; y++)
+	{
+		const double sin_theta = sin(((y + 0.5) / this->em_height_) * M_PI);
+
+		for (int x = 0; x < this->em_width_; x++)
+		{
+			double brightest = 0.0;
+
+			for (int row = std::max(y - 1, 0); row <= std::min(y + 1, this->em_height_ - 1); row++)
+			{
+				for (int offset = -1; offset <= 1; offset++)
+				{
+					const int column = (x + offset + this->em_width_) % this->em_width_;
+					brightest = std::max(brightest, luminance[(size_t(row) * this->em_width_) + column]);
+				}
+			}
+
+			weights[(size_t(y) * this->em_width_) + x] = brightest * sin_theta;
+		}
+	}
+
+	this->em_alias_table_ = AliasTable(weights);
+}
+
+EnvironmentMapBackground::~EnvironmentMapBackground()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Sample EnvironmentMapBackground::sample_at(IxComps & comps) const
 {
     Sample sample = Sample();
-    sample.Background = Color(0.0);
+    sample.Background = this->radiance(comps.normal_v * -1.0);
     sample.Diffuse = Color(0.0);
     sample.Alpha = 0.0;
     return sample;
 }
+
+// Bilinear between texel centers, wrapping around the horizon
+Color EnvironmentMapBackground::radiance(const Tuple & direction) const
+{
+	const Tuple d = direction.normalize();
+
+	const double u = (atan2(d.z, d.x) + M_PI) / (2.0 * M_PI);
+	const double v = acos(clip(d.y, -1.0, 1.0)) / M_PI;
+
+	const double fx = (u * this->em_width_) - 0.5;
+	const double fy = clip((v * this->em_height_) - 0.5, 0.0, double(this->em_height_ - 1));
+
+	const int x0 = static_cast<int>(floor(fx));
+	const int y0 = std::min(static_cast<int>(fy), std::max(this->em_height_ - 2, 0));
+	const int y1 = std::min(y0 + 1, this->em_height_ - 1);
+	const double tx = fx - x0;
+	const double ty = fy - y0;
+
+	const int column0 = (x0 + this->em_width_) % this->em_width_;
+	const int column1 = (x0 + 1) % this->em_width_;
+
+	const Color top = (this->em_texel_(column0, y0) * (1.0 - tx)) + (this->em_texel_(column1, y0) * tx);
+	const Color bottom = (this->em_texel_(column0, y1) * (1.0 - tx)) + (this->em_texel_(column1, y1) * tx);
+
+	return ((top * (1.0 - ty)) + (bottom * ty)) * this->multiplier;
+}
+
+bool EnvironmentMapBackground::is_importance_sampled() const
+{
+	return !this->em_alias_table_.empty();
+}
+
+// One pick from the alias table, and the rest of both numbers places the point within the texel
+bool EnvironmentMapBackground::sample_direction(double u1, double u2, Tuple & direction, double & pdf) const
+{
+	if (this->em_alias_table_.empty())
+	{
+		return false;
+	}
+
+	double remapped;
+	const int index = this->em_alias_table_.sample(u1, remapped);
+	const int x = index % this->em_width_;
+	const int y = index / this->em_width_;
+
+	const double theta = ((y + remapped) / this->em_height_) * M_PI;
+	const double phi = (((x + u2) / this->em_width_) * 2.0 * M_PI) - M_PI;
+	const double sin_theta = sin(theta);
+
+	if (sin_theta <= 0.0)
+	{
+		return false;
+	}
+
+	direction = Tuple::Vector(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+	// Texels span 2 pi / width by pi / height, shrinking with sin(theta)
+	pdf = this->em_alias_table_.probability(index) * this->em_width_ * this->em_height_ / (2.0 * M_PI * M_PI * sin_theta);
+
+	return pdf > 0.0;
+}
+
+double EnvironmentMapBackground::direction_pdf(const Tuple & direction) const
+{
+	if (this->em_alias_table_.empty())
+	{
+		return 0.0;
+	}
+
+	const Tuple d = direction.normalize();
+	const double theta = acos(clip(d.y, -1.0, 1.0));
+	const double sin_theta = sin(theta);
+
+	if (sin_theta <= 0.0)
+	{
+		return 0.0;
+	}
+
+	const double u = (atan2(d.z, d.x) + M_PI) / (2.0 * M_PI);
+	const int x = clip(static_cast<int>(u * this->em_width_), 0, this->em_width_ - 1);
+	const int y = clip(static_cast<int>((theta / M_PI) * this->em_height_), 0, this->em_height_ - 1);
+
+	return this->em_alias_table_.probability((y * this->em_width_) + x) * this->em_width_ * this->em_height_ / (2.0 * M_PI * M_PI * sin_theta);
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+int EnvironmentMapBackground::get_width() const
+{
+	return this->em_width_;
+}
+
+int EnvironmentMapBackground::get_height() const
+{
+	return this->em_height_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+Color EnvironmentMapBackground::em_texel_(int x, int y) const
+{
+	const size_t index = ((size_t(y) * this->em_width_) + x) * 3;
+
+	return Color(this->em_texels_[index], this->em_texels_[index + 1], this->em_texels_[index + 2]);
+}
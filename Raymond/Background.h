@@ -1,9 +1,61 @@
 #ifndef H_RAYMOND_BACKGROUND
 #define H_RAYMOND_BACKGROUND
 
+#include <vector>
+#include <string>
+
 #include "IxComps.h"
 #include "Sample.h"
 
+// Piecewise constant density over a width x height grid covering [0,1) x [0,1),
+// sampled by inverting the density of the rows and then the columns within the row
+class Distribution2D
+{
+public:
+	Distribution2D();
+	Distribution2D(const std::vector<double> & weights, int width, int height);
+	~Distribution2D();
+
+	// Methods
+	// Density is over the unit square
+	bool sample(double u1, double u2, double & u, double & v, double & pdf) const;
+	double pdf(double u, double v) const;
+
+	bool empty() const;
+
+private:
+	int d2_width_, d2_height_;
+	double d2_total_;
+	std::vector<double> d2_weights_;
+	// Running sums, height + 1 for the rows and width + 1 within each row
+	std::vector<double> d2_row_cdf_;
+	std::vector<double> d2_column_cdf_;
+};
+
+// Walker's alias method, as built by Vose, A Linear Algorithm for Generating Random Numbers
+// With a Given Distribution.  Picks an index in proportion to its weight in constant time.
+class AliasTable
+{
+public:
+	AliasTable();
+	explicit AliasTable(const std::vector<double> & weights);
+	~AliasTable();
+
+	// Methods
+	// remapped is a fresh number in [0,1), left over from u after the pick
+	int sample(double u, double & remapped) const;
+	// Chance of an index being picked
+	double probability(int index) const;
+
+	size_t size() const;
+	bool empty() const;
+
+private:
+	std::vector<double> at_thresholds_;
+	std::vector<int> at_aliases_;
+	std::vector<double> at_probabilities_;
+};
+
 class Background
 {
 public:
@@ -12,6 +64,14 @@ public:
 
 	// Methods
 	virtual Sample sample_at(IxComps & comps) const;
+
+	// Backgrounds that light the scene.  radiance is what sample_at shows along a direction
+	virtual Color radiance(const Tuple & direction) const;
+	// When true, sample_direction picks directions in proportion to the light they bring
+	virtual bool is_importance_sampled() const;
+	// Density is per unit solid angle
+	virtual bool sample_direction(double u1, double u2, Tuple & direction, double & pdf) const;
+	virtual double direction_pdf(const Tuple & direction) const;
 };
 
 class NormalGradientBackground :
@@ -23,21 +83,159 @@ public:
 
 	// Methods
 	Sample sample_at(IxComps & comps) const override;
+	Color radiance(const Tuple & direction) const override;
 };
 
-class HosekWilkieBackground :
+// A daylight sky over the upper hemisphere, with y up, for a sun direction.  The sky's model
+// is evaluated once per texel of a lat-long table when the sky is made, misses look the
+// table up, and the table's luminance drives importance sampling for rays lit by the sky.
+// Below the horizon is black, and the sun's own disk is not drawn, so scenes light the sun
+// with a light of their own.
+class SkyBackground :
 	public Background
 {
 public:
-	explicit HosekWilkieBackground(const Tuple & sun_vector);
-	~HosekWilkieBackground();
+	explicit SkyBackground(const Tuple & sun_vector);
+	~SkyBackground();
 
 	// Methods
 	Sample sample_at(IxComps & comps) const override;
+	Color radiance(const Tuple & direction) const override;
+	bool is_importance_sampled() const override;
+	bool sample_direction(double u1, double u2, Tuple & direction, double & pdf) const override;
+	double direction_pdf(const Tuple & direction) const override;
+
+	// The sky model itself, without the table
+	virtual Color evaluate(const Tuple & direction) const = 0;
+
+	// Accessors
+	Tuple get_sun_vector() const;
 
-private:
 	// Properties
+	double multiplier;
+
+	static const int TABLE_WIDTH = 256;
+	static const int TABLE_HEIGHT = 64;
+
+protected:
+	// Called by the model's constructor once evaluate works
+	void sb_build_table_();
+
 	Tuple sun_vector_;
+
+private:
+	std::vector<Color> sb_table_;
+	Distribution2D sb_distribution_;
+};
+
+// Preetham, Shirley and Smits' A Practical Analytic Model for Daylight, the Perez sky
+// function with coefficients fit to turbidity.  It is brighter at the horizon than measured
+// skies and is not meant for turbidity below 2, but needs no data.
+class PreethamSkyBackground :
+	public SkyBackground
+{
+public:
+	explicit PreethamSkyBackground(const Tuple & sun_vector);
+	PreethamSkyBackground(const Tuple & sun_vector, double turbidity);
+	~PreethamSkyBackground();
+
+	// Methods
+	Color evaluate(const Tuple & direction) const override;
+
+	// Accessors
+	double get_turbidity() const;
+
+private:
+	// Perez et al.'s F(theta, gamma), Preetham et al. equation 1
+	static double ps_perez_(const double coefficients[5], double cos_theta, double gamma);
+
+	double ps_turbidity_;
+	// Angle from the zenith, kept above the horizon
+	double ps_sun_theta_;
+	// Coefficients and zenith values for luminance Y and chromaticities x and y
+	double ps_coefficients_[3][5];
+	double ps_zenith_[3];
+};
+
+// The RGB tables of Hosek and Wilkie's ArHosekSkyModelData_RGB.h, one for each channel
+struct HosekWilkieDataset
+{
+	// Two albedos, ten turbidities, six control points and nine coefficients
+	static const int COEFFICIENT_COUNT = 2 * 10 * 6 * 9;
+	// Two albedos, ten turbidities and six control points
+	static const int RADIANCE_COUNT = 2 * 10 * 6;
+
+	std::vector<double> coefficients[3];
+	std::vector<double> radiances[3];
+};
+
+// Hosek and Wilkie's An Analytic Model for Full Spectral Sky-Dome Radiance, in its RGB form.
+// The nine coefficients of their extended Perez function, and the radiance it is scaled by,
+// are fitted over turbidity 1 to 10, ground albedo 0 to 1 and the sun's elevation.  The fit
+// is their published dataset, which is not part of Raymond: the model is made from a copy
+// of ArHosekSkyModelData_RGB.h, read as it was published.
+class HosekWilkieBackground :
+	public SkyBackground
+{
+public:
+	HosekWilkieBackground(const std::string & dataset_path, const Tuple & sun_vector);
+	// Throws an invalid_argument for turbidity outside 1 to 10 or albedo outside 0 to 1
+	HosekWilkieBackground(const std::string & dataset_path, const Tuple & sun_vector, double turbidity, double albedo);
+	~HosekWilkieBackground();
+
+	// Methods
+	Color evaluate(const Tuple & direction) const override;
+
+	// Throws a runtime_error when the file cannot be read or an array is missing or short
+	static HosekWilkieDataset read_dataset(const std::string & file_path);
+
+	// Accessors
+	double get_turbidity() const;
+	double get_albedo() const;
+
+private:
+	// Interpolates count values from the dataset for the turbidity, albedo and elevation
+	static void hw_cook_(const std::vector<double> & dataset, int count, double turbidity, double albedo, double elevation, double * result);
+	// Hosek and Wilkie's F(theta, gamma), equation 9
+	static double hw_radiance_function_(const double configuration[9], double cos_theta, double gamma);
+
+	double hw_turbidity_;
+	double hw_albedo_;
+	// Coefficients and radiance for each channel, for this sun
+	double hw_configuration_[3][9];
+	double hw_radiance_[3];
+};
+
+// An equirectangular HDR image, read from a PFM file, with y up and the center of the
+// image looking down +x.  The whole image is held in memory, and an alias table over its
+// texels, weighted by luminance and the solid angle they cover, picks light directions.
+class EnvironmentMapBackground :
+	public Background
+{
+public:
+	explicit EnvironmentMapBackground(const std::string & file_path);
+	~EnvironmentMapBackground();
+
+	// Methods
+	Sample sample_at(IxComps & comps) const override;
+	Color radiance(const Tuple & direction) const override;
+	bool is_importance_sampled() const override;
+	bool sample_direction(double u1, double u2, Tuple & direction, double & pdf) const override;
+	double direction_pdf(const Tuple & direction) const override;
+
+	// Accessors
+	int get_width() const;
+	int get_height() const;
+
+	// Properties
+	double multiplier;
+
+private:
+	Color em_texel_(int x, int y) const;
+
+	int em_width_, em_height_;
+	std::vector<float> em_texels_;
+	AliasTable em_alias_table_;
 };
 
 #endif
@@ -0,0 +1,423 @@
+#include "pch.h"
+#include "BakedMap.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <cstring>
+
+// Identifies the file layout, bumped whenever it changes
+static const char BAKE_MAGIC[8] = { 'R', 'B', 'A', 'K', 'E', '0', '1', '\n' };
+
+static std::string default_bake_directory()
+{
+	std::error_code error;
+	std::filesystem::path temp = std::filesystem::temp_directory_path(error);
+
+	if (error)
+	{
+		return std::string();
+	}
+
+	return (temp / "raymond_bakes").string();
+}
+
+// ------------------------------------------------------------------------
+//
+// Baked Map
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+BakedMap::BakedMap() : BakedMap(std::make_shared<SolidColorMap>(), BoundingBox(Tuple::Point(-1.0, -1.0, -1.0), Tuple::Point(1.0, 1.0, 1.0)), 32)
+{
+}
+
+BakedMap::BakedMap(std::shared_ptr<TexMap> source, const BoundingBox & bounds, int resolution) : TexMap()
+{
+	this->source = std::move(source);
+	this->bounds = bounds;
+	this->resolution = resolution;
+	this->cache_directory = default_bake_directory();
+
+	this->bm_width_ = this->bm_height_ = this->bm_depth_ = 0;
+	this->bm_baked_key_ = 0;
+	this->bm_baked_ = false;
+}
+
+BakedMap::~BakedMap()
+= default;
+
+// ------------------------------------------------------------------------
+// Shade
+// ------------------------------------------------------------------------
+
+Color BakedMap::local_sample_at(const IxComps & comps) const
+{
+	const Tuple & p = comps.texmap_point;
+
+	if (!this->bm_baked_ || !this->bm_contains_(p))
+	{
+		return this->source->sample_at(comps);
+	}
+
+	// Continuous grid coordinates, grid points sit on the corners of the bounds
+	const Tuple extent = this->bounds.maximum - this->bounds.minimum;
+	const double gx = extent.x > 0.0 ? ((p.x - this->bounds.minimum.x) / extent.x) * (this->bm_width_ - 1) : 0.0;
+	const double gy = extent.y > 0.0 ? ((p.y - this->bounds.minimum.y) / extent.y) * (this->bm_height_ - 1) : 0.0;
+	const double gz = extent.z > 0.0 ? ((p.z - this->bounds.minimum.z) / extent.z) * (this->bm_depth_ - 1) : 0.0;
+
+	// The last cell is used for points on the far faces
+	const int x0 = clip(static_cast<int>(floor(gx)), 0, this->bm_width_ - 2);
+	const int y0 = clip(static_cast<int>(floor(gy)), 0, this->bm_height_ - 2);
+	const int z0 = clip(static_cast<int>(floor(gz)), 0, this->bm_depth_ - 2);
+
+	const double fx = clip(gx - x0, 0.0, 1.0);
+	const double fy = clip(gy - y0, 0.0, 1.0);
+	const double fz = clip(gz - z0, 0.0, 1.0);
+
+	const Color c00 = lerp(fx, this->bm_texel_(x0, y0, z0), this->bm_texel_(x0 + 1, y0, z0));
+	const Color c10 = lerp(fx, this->bm_texel_(x0, y0 + 1, z0), this->bm_texel_(x0 + 1, y0 + 1, z0));
+	const Color c01 = lerp(fx, this->bm_texel_(x0, y0, z0 + 1), this->bm_texel_(x0 + 1, y0, z0 + 1));
+	const Color c11 = lerp(fx, this->bm_texel_(x0, y0 + 1, z0 + 1), this->bm_texel_(x0 + 1, y0 + 1, z0 + 1));
+
+	return lerp(fz, lerp(fy, c00, c10), lerp(fy, c01, c11));
+}
+
+// ------------------------------------------------------------------------
+// Hashing
+// ------------------------------------------------------------------------
+
+uint64_t BakedMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->source);
+	hash = hash_value(hash, this->bounds.minimum.x);
+	hash = hash_value(hash, this->bounds.minimum.y);
+	hash = hash_value(hash, this->bounds.minimum.z);
+	hash = hash_value(hash, this->bounds.maximum.x);
+	hash = hash_value(hash, this->bounds.maximum.y);
+	hash = hash_value(hash, this->bounds.maximum.z);
+	hash = hash_value(hash, this->resolution);
+
+	return hash;
+}
+
+// The object only matters while baking, so it is part of the key but not of the graph hash
+uint64_t BakedMap::key() const
+{
+	uint64_t hash = this->graph_hash();
+
+	if (this->object != nullptr)
+	{
+		const Matrix4 m = this->object->get_world_transform();
+		for (int row = 0; row < 4; row++)
+		{
+			for (double element : m.get_row(row))
+			{
+				hash = hash_value(hash, element);
+			}
+		}
+	}
+
+	return hash;
+}
+
+// ------------------------------------------------------------------------
+// Baking
+// ------------------------------------------------------------------------
+
+bool BakedMap::bake()
+{
+	if (this->source == nullptr)
+	{
+		throw std::runtime_error("BakedMap has no source to bake");
+	}
+
+	if (this->get_mapping_space() == ObjectSpace && this->object == nullptr)
+	{
+		throw std::runtime_error("BakedMap mapped in object space needs an object to bake");
+	}
+
+	this->bm_size_grid_();
+
+	const uint64_t bake_key = this->key();
+	const std::string file_path = this->cache_path();
+
+	this->bm_baked_ = false;
+
+	if (!file_path.empty() && this->bm_load_(file_path))
+	{
+		this->bm_baked_key_ = bake_key;
+		this->bm_baked_ = true;
+		return true;
+	}
+
+	const size_t slice_size = size_t(this->bm_width_) * this->bm_height_ * 3;
+	this->bm_texels_.assign(slice_size * this->bm_depth_, 0);
+
+	// Every slice writes its own part of the grid
+	auto f = [this, slice_size](int z)
+	{
+		uint16_t * texels = this->bm_texels_.data() + (slice_size * z);
+
+		for (int y = 0; y < this->bm_height_; y++)
+		{
+			for (int x = 0; x < this->bm_width_; x++)
+			{
+				const Color c = this->bm_evaluate_(x, y, z);
+				*texels++ = float_to_half(static_cast<float>(c.x));
+				*texels++ = float_to_half(static_cast<float>(c.y));
+				*texels++ = float_to_half(static_cast<float>(c.z));
+			}
+		}
+	};
+
+	// A fixed set of workers takes the slices in turn, however deep the grid is
+	std::atomic<int> next_slice{ 0 };
+	const int worker_count = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), this->bm_depth_));
+
+	auto worker = [&f, &next_slice, this]()
+	{
+		for (int z = next_slice++; z < this->bm_depth_; z = next_slice++)
+		{
+			f(z);
+		}
+	};
+
+	std::vector<std::future<void>> workers;
+	workers.reserve(worker_count);
+
+	for (int i = 0; i < worker_count; i++)
+	{
+		workers.push_back(std::async(std::launch::async, worker));
+	}
+
+	for (auto & w : workers)
+	{
+		w.get();
+	}
+
+	this->bm_baked_key_ = bake_key;
+	this->bm_baked_ = true;
+
+	if (!file_path.empty())
+	{
+		// A bake that cannot be saved is still usable for this render
+		this->bm_save_(file_path);
+	}
+
+	return false;
+}
+
+bool BakedMap::is_baked() const
+{
+	return this->bm_baked_;
+}
+
+void BakedMap::clear()
+{
+	this->bm_baked_ = false;
+	this->bm_texels_.clear();
+	this->bm_texels_.shrink_to_fit();
+}
+
+int BakedMap::grid_width() const
+{
+	return this->bm_width_;
+}
+
+int BakedMap::grid_height() const
+{
+	return this->bm_height_;
+}
+
+int BakedMap::grid_depth() const
+{
+	return this->bm_depth_;
+}
+
+std::string BakedMap::cache_path() const
+{
+	if (this->cache_directory.empty())
+	{
+		return std::string();
+	}
+
+	std::stringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << this->key() << ".rbake";
+
+	return (std::filesystem::path(this->cache_directory) / name.str()).string();
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void BakedMap::bm_size_grid_()
+{
+	if (this->resolution < 2)
+	{
+		throw std::out_of_range("BakedMap resolution must be at least 2, got " + std::to_string(this->resolution));
+	}
+
+	const Tuple extent = this->bounds.maximum - this->bounds.minimum;
+	const double longest = std::max(extent.x, std::max(extent.y, extent.z));
+
+	if (!(longest > 0.0))
+	{
+		throw std::out_of_range("BakedMap bounds are empty");
+	}
+
+	// Keeps the spacing close to equal on every axis
+	auto samples = [this, longest](double side)
+	{
+		return std::max(2, static_cast<int>(ceil((this->resolution - 1) * (std::max(side, 0.0) / longest) - EPSILON)) + 1);
+	};
+
+	this->bm_width_ = samples(extent.x);
+	this->bm_height_ = samples(extent.y);
+	this->bm_depth_ = samples(extent.z);
+}
+
+bool BakedMap::bm_contains_(const Tuple & point) const
+{
+	return point.x >= this->bounds.minimum.x - EPSILON && point.x <= this->bounds.maximum.x + EPSILON &&
+		point.y >= this->bounds.minimum.y - EPSILON && point.y <= this->bounds.maximum.y + EPSILON &&
+		point.z >= this->bounds.minimum.z - EPSILON && point.z <= this->bounds.maximum.z + EPSILON;
+}
+
+Color BakedMap::bm_texel_(int x, int y, int z) const
+{
+	const size_t index = ((size_t(z) * this->bm_height_ + y) * this->bm_width_ + x) * 3;
+
+	return Color(
+		half_to_float(this->bm_texels_[index]),
+		half_to_float(this->bm_texels_[index + 1]),
+		half_to_float(this->bm_texels_[index + 2])
+	);
+}
+
+Tuple BakedMap::bm_grid_point_(int x, int y, int z) const
+{
+	const Tuple extent = this->bounds.maximum - this->bounds.minimum;
+
+	return Tuple::Point(
+		this->bounds.minimum.x + extent.x * (double(x) / (this->bm_width_ - 1)),
+		this->bounds.minimum.y + extent.y * (double(y) / (this->bm_height_ - 1)),
+		this->bounds.minimum.z + extent.z * (double(z) / (this->bm_depth_ - 1))
+	);
+}
+
+// Undoes this map's own mapping so the source sees the world point that lands on the grid point
+Color BakedMap::bm_evaluate_(int x, int y, int z) const
+{
+	IxComps comps = IxComps();
+	comps.object = this->object;
+	comps.normal_v = Tuple::Vector(0.0, 1.0, 0.0);
+
+	const Tuple local_point = this->transform->get_transform() * this->bm_grid_point_(x, y, z);
+
+	switch (this->get_mapping_space())
+	{
+	case WorldSpace:
+		comps.point = local_point;
+		break;
+
+	case ObjectSpace:
+		comps.point = this->object->point_to_world_space(local_point);
+		break;
+	}
+
+	return this->source->sample_at(comps);
+}
+
+bool BakedMap::bm_load_(const std::string & file_path)
+{
+	std::ifstream input_file(file_path, std::ios::in | std::ios::binary);
+
+	if (!input_file.is_open())
+	{
+		return false;
+	}
+
+	char magic[sizeof(BAKE_MAGIC)];
+	uint64_t file_key;
+	int32_t dimensions[3];
+
+	input_file.read(magic, sizeof(magic));
+	input_file.read(reinterpret_cast<char *>(&file_key), sizeof(file_key));
+	input_file.read(reinterpret_cast<char *>(dimensions), sizeof(dimensions));
+
+	// Anything unexpected is treated as a stale bake and baked again
+	if (!input_file ||
+		memcmp(magic, BAKE_MAGIC, sizeof(BAKE_MAGIC)) != 0 ||
+		file_key != this->key() ||
+		dimensions[0] != this->bm_width_ || dimensions[1] != this->bm_height_ || dimensions[2] != this->bm_depth_)
+	{
+		return false;
+	}
+
+	std::vector<uint16_t> texels = std::vector<uint16_t>(size_t(this->bm_width_) * this->bm_height_ * this->bm_depth_ * 3);
+	input_file.read(reinterpret_cast<char *>(texels.data()), static_cast<std::streamsize>(texels.size() * sizeof(uint16_t)));
+
+	if (!input_file)
+	{
+		return false;
+	}
+
+	this->bm_texels_ = std::move(texels);
+	return true;
+}
+
+bool BakedMap::bm_save_(const std::string & file_path) const
+{
+	std::error_code error;
+	const std::filesystem::path path = std::filesystem::path(file_path);
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	if (error)
+	{
+		return false;
+	}
+
+	// Written next to the destination and renamed, so other renders never read half a file
+	const std::filesystem::path temp_path = temp_file_path(path.string());
+
+	{
+		std::ofstream output_file(temp_path, std::ios::out | std::ios::binary);
+
+		if (!output_file.is_open())
+		{
+			return false;
+		}
+
+		const uint64_t file_key = this->bm_baked_key_;
+		const int32_t dimensions[3] = { this->bm_width_, this->bm_height_, this->bm_depth_ };
+
+		output_file.write(BAKE_MAGIC, sizeof(BAKE_MAGIC));
+		output_file.write(reinterpret_cast<const char *>(&file_key), sizeof(file_key));
+		output_file.write(reinterpret_cast<const char *>(dimensions), sizeof(dimensions));
+		output_file.write(reinterpret_cast<const char *>(this->bm_texels_.data()), static_cast<std::streamsize>(this->bm_texels_.size() * sizeof(uint16_t)));
+
+		if (!output_file)
+		{
+			output_file.close();
+			std::filesystem::remove(temp_path, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temp_path, path, error);
+
+	if (error)
+	{
+		std::filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	return true;
+}
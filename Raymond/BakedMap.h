@@ -0,0 +1,70 @@
+#ifndef H_RAYMOND_BAKEDMAP
+#define H_RAYMOND_BAKEDMAP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "Texmap.h"
+#include "BoundingBox.h"
+
+// A TexMap graph evaluated once over a grid of points and sampled with trilinear interpolation.
+// Colors are stored as half floats.  Bakes are named by the source's graph hash and
+// saved to the cache directory, so renders of an unchanged graph load them instead.
+// Outside the bounds, or until bake() is called, the source is sampled directly.
+class BakedMap :
+	public TexMap
+{
+public:
+	BakedMap();
+	BakedMap(std::shared_ptr<TexMap> source, const BoundingBox & bounds, int resolution);
+	~BakedMap();
+
+	// Methods
+	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
+
+	// Loads the grid from the cache directory when a matching bake exists, otherwise
+	// evaluates the source and saves the result.  Returns true when it was loaded.
+	// Call again after editing the source.
+	bool bake();
+	bool is_baked() const;
+	void clear();
+
+	// Samples on each axis, the longest side of the bounds gets the resolution
+	int grid_width() const;
+	int grid_height() const;
+	int grid_depth() const;
+
+	uint64_t key() const;
+	std::string cache_path() const;
+
+	// Properties
+	std::shared_ptr<TexMap> source;
+	// Passed to the source while baking, needed when it is mapped in object space
+	std::shared_ptr<ObjectBase> object;
+	// In the texture space of this map
+	BoundingBox bounds;
+	int resolution;
+	// Left empty, bakes are kept in memory only
+	std::string cache_directory;
+
+private:
+	void bm_size_grid_();
+	bool bm_contains_(const Tuple & point) const;
+	Color bm_texel_(int x, int y, int z) const;
+	Color bm_evaluate_(int x, int y, int z) const;
+	Tuple bm_grid_point_(int x, int y, int z) const;
+
+	bool bm_load_(const std::string & file_path);
+	bool bm_save_(const std::string & file_path) const;
+
+	int bm_width_, bm_height_, bm_depth_;
+	uint64_t bm_baked_key_;
+	bool bm_baked_;
+	// Three halves per grid point, x varies fastest
+	std::vector<uint16_t> bm_texels_;
+};
+
+#endif
@@ -1,4 +1,10 @@
 #include "Camera.h"
+#include "Checkpoint.h"
+#include "Animation.h"
+
+#include <chrono>
+#include <filesystem>
+#include <atomic>
 
 // ------------------------------------------------------------------------
 //
@@ -18,6 +24,16 @@ Camera::Camera(int width, int height, double fov)
 	this->c_v_size_ = height;
 	this->c_fov_ = fov;
 
+	this->shutter_open = 0.0;
+	this->shutter_close = 0.0;
+
+	this->aperture = 0.0;
+	this->focal_distance = 1.0;
+	this->aperture_blades = 0;
+	this->aperture_rotation = 0.0;
+
+	this->c_crop_ = PixelRect();
+
     this->c_pixel_size_= 0.0;
     this->c_half_width_ = 0.0;
     this->c_half_height_ = 0.0;
@@ -39,170 +55,283 @@ Ray Camera::ray_from_pixel(int x, int y) const
 }
 
 Ray Camera::ray_from_pixel(int x, int y, double px_os_x, double px_os_y) const
+{
+    return this->ray_from_pixel(x, y, px_os_x, px_os_y, this->shutter_open);
+}
+
+Ray Camera::ray_from_pixel(int x, int y, double px_os_x, double px_os_y, double time) const
+{
+    CameraSample sample = CameraSample();
+    sample.px_os_x = px_os_x;
+    sample.px_os_y = px_os_y;
+    sample.time = time;
+
+    return this->ray_from_sample(x, y, sample);
+}
+
+Ray Camera::ray_from_sample(int x, int y, const CameraSample & sample) const
 {
     // px_os: pixel offset: A value between 0.0 and 1.0 that controls where in the pixel the ray is generated
-    // Offset from the edge of the canvas to the pixel's center
-    double x_offset = (double(x) + px_os_x) * this->c_pixel_size_;
-    double y_offset = (double(y) + px_os_y) * this->c_pixel_size_;
+    double film_x = double(x) + sample.px_os_x;
+    double film_y = double(y) + sample.px_os_y;
 
-    // The untransformed coordinates of the pixel in world space
-    // Camera looks towards -z, so +x is to the left
-    double world_x = this->c_half_width_ - x_offset;
-    double world_y = this->c_half_height_ - y_offset;
+    // A thin lens bends every ray through a point on the lens towards the same point on the
+    // plane in focus.  A pinhole keeps its film at 1.
+    const bool thin_lens = this->aperture > 0.0;
+    const double focus = thin_lens ? this->focal_distance : 1.0;
+    const Tuple lens = thin_lens ? this->lens_point(sample.lens_u, sample.lens_v) : Tuple::Point(0.0, 0.0, 0.0);
 
-    // Pre invert matrix so this is only done once
-    Matrix4 inv_x_form = this->get_transform().inverse();
+    auto cast = [&](const Matrix4 & inv_x_form)
+    {
+        // Using the camera's matrix, transform the origin
+        Tuple origin = inv_x_form * lens;
 
-    // Using the camera's matrix, transform the canvas point and the origin
-    // and then compute the ray's direction vector
-    // The camera is at z=-1.0
-    Tuple pixel = inv_x_form * Tuple::Point(world_x, world_y, -1.0);
-    Tuple origin = inv_x_form * Tuple::Point(0.0, 0.0, 0.0);
-    Tuple direction = (pixel - origin).normalize();
+        Ray r = Ray(origin, this->c_direction_from_film_(inv_x_form, origin, film_x, film_y, focus), 0, sample.time);
 
-    return {origin, direction};
+        // Differentials are the rays through the neighboring pixels, one pixel over on each axis
+        r.set_differentials(
+            origin,
+            this->c_direction_from_film_(inv_x_form, origin, film_x + 1.0, film_y, focus),
+            origin,
+            this->c_direction_from_film_(inv_x_form, origin, film_x, film_y + 1.0, focus)
+        );
+
+        return r;
+    };
+
+    // A moving camera's matrix is blended for the time, a still one's is cached by the transform controller
+    if (this->is_moving())
+    {
+        return cast(this->get_inverse_transform_at(sample.time));
+    }
+
+    return cast(this->get_inverse_transform());
 }
 
 // ------------------------------------------------------------------------
-// Render
+// Samples
 // ------------------------------------------------------------------------
 
-Canvas Camera::render(const World & w) const
+CameraSample Camera::pixel_sample(int x, int y, int index, double sample_size) const
 {
-	Canvas image = Canvas(this->c_h_size_, this->c_v_size_);
+    const uint64_t pixel_hash = hash_value(hash_value(HASH_SEED, x), y);
 
-	for (int y = 0; y < this->c_v_size_; y++)
-	{
-		std::cout << "Scanline: " << y + 1 << "/" << this->c_v_size_ << "\n";
+    // Cranley-Patterson rotation, the whole sequence is shifted by a fixed amount per pixel
+    auto dimension = [&](int d, int base)
+    {
+        const double rotation = double(hash_value(pixel_hash, d) >> 11) / 9007199254740992.0;
+        const double value = radical_inverse(base, uint64_t(index)) + rotation;
+        return (value >= 1.0) ? value - 1.0 : value;
+    };
+
+    CameraSample sample = CameraSample();
+    sample.px_os_x = dimension(0, 2) * sample_size;
+    sample.px_os_y = dimension(1, 3) * sample_size;
+    sample.lens_u = dimension(2, 5);
+    sample.lens_v = dimension(3, 7);
+    sample.time = this->shutter_open;
+
+    if (this->shutter_close > this->shutter_open)
+    {
+        sample.time += dimension(4, 11) * (this->shutter_close - this->shutter_open);
+    }
 
-		for (int x = 0; x < this->c_h_size_; x++)
-		{
-			// std::cout << "Pixel: (" << x << ", " << y << ")\n";
-			Ray r = this->ray_from_pixel(x, y);
-			Color color = w.color_at(r);
-			image.write_pixel(x, y, color);
-		}
-	}
+    return sample;
+}
 
-	return image;
+Tuple Camera::lens_point(double u, double v) const
+{
+    const double radius = this->aperture * 0.5;
+
+    if (this->aperture_blades >= 3)
+    {
+        // u picks a blade's triangle and how far out in it, so the area stays evenly covered
+        const double scaled = u * double(this->aperture_blades);
+        const int blade = std::min(int(scaled), this->aperture_blades - 1);
+        const double out = sqrt(scaled - double(blade));
+
+        const double angle_0 = this->aperture_rotation + 2.0 * M_PI * double(blade) / double(this->aperture_blades);
+        const double angle_1 = this->aperture_rotation + 2.0 * M_PI * double(blade + 1) / double(this->aperture_blades);
+
+        const double lx = out * ((1.0 - v) * cos(angle_0) + v * cos(angle_1));
+        const double ly = out * ((1.0 - v) * sin(angle_0) + v * sin(angle_1));
+
+        return Tuple::Point(lx * radius, ly * radius, 0.0);
+    }
+
+    // Shirley's concentric mapping, which keeps strata together on the disk
+    const double a = 2.0 * u - 1.0;
+    const double b = 2.0 * v - 1.0;
+
+    if (a == 0.0 && b == 0.0)
+    {
+        return Tuple::Point(0.0, 0.0, 0.0);
+    }
+
+    double r, phi;
+    if (std::abs(a) > std::abs(b))
+    {
+        r = a;
+        phi = (M_PI / 4.0) * (b / a);
+    }
+    else
+    {
+        r = b;
+        phi = (M_PI / 2.0) - (M_PI / 4.0) * (a / b);
+    }
+
+    return Tuple::Point(r * cos(phi) * radius, r * sin(phi) * radius, 0.0);
 }
 
-Canvas Camera::threaded_render(const World & w) const
+double Camera::circle_of_confusion(const World & w, int x, int y) const
 {
-	Canvas image = Canvas(this->c_h_size_, this->c_v_size_);
+    if (this->aperture <= 0.0)
+    {
+        return 0.0;
+    }
 
-	auto line_results = std::vector<std::future<Canvas>>();
+    Ray r = this->ray_from_pixel(x, y, 0.5, 0.5, this->shutter_open);
+    thread_counters().camera_rays++;
+    Intersection hit = w.intersect_world(r).hit();
 
-	// lambda to execute rendering of the line
-	auto f = [](const Camera * camera, const World & w, int line) {
-		return camera->render_scanline(w, line);
-	};
+    // The blur on a film at 1, for something at depth along the view direction.  Nothing hit
+    // is at infinity, where it tends to aperture / focal_distance.
+    double blur;
 
-	// Queue up all the lines
-	for (int y = 0; y < this->c_v_size_; y++)
-	{
-		line_results.push_back(std::async(f, this, w, y));
-	}
+    if (hit.is_valid())
+    {
+        const Tuple camera_point = this->get_transform() * r.position(hit.t_value);
+        const double depth = std::max(-camera_point.z, EPSILON);
 
-	// stitch them back together
-	for (int i = 0; i < line_results.size(); i++)
+        blur = this->aperture * std::abs(depth - this->focal_distance) / (this->focal_distance * depth);
+    }
+    else
+    {
+        blur = this->aperture / this->focal_distance;
+    }
+
+    return blur / this->c_pixel_size_;
+}
+
+int Camera::min_samples(const World & w, int x, int y) const
+{
+    const double blur = this->circle_of_confusion(w, x, y);
+
+    if (blur <= 1.0)
+    {
+        return w.aa_sample_min;
+    }
+
+    const double samples = std::ceil(double(std::max(w.aa_sample_min, 1)) * blur * blur);
+    return std::max(w.aa_sample_min, int(std::min(samples, double(w.aa_sample_max))));
+}
+
+// ------------------------------------------------------------------------
+// Crop Window
+// ------------------------------------------------------------------------
+
+void Camera::set_crop_window(int x, int y, int width, int height)
+{
+	// Clip to the frame
+	const int left = std::max(x, 0);
+	const int top = std::max(y, 0);
+	const int right = std::min(x + width, this->c_h_size_);
+	const int bottom = std::min(y + height, this->c_v_size_);
+
+	if (right <= left || bottom <= top)
 	{
-		image.write_canvas_as_line(i, line_results[i].get());
+		throw std::invalid_argument(
+			"The crop window (" + std::to_string(x) + ", " + std::to_string(y) + ", " +
+			std::to_string(width) + ", " + std::to_string(height) + ") is outside the frame"
+		);
 	}
 
-	return image;
+	this->c_crop_ = { left, top, right - left, bottom - top };
 }
 
-SampleBuffer Camera::multi_sample_threaded_render(const World &w) const
+void Camera::clear_crop_window()
 {
-    int horizontal_buckets = std::ceil(double(this->c_h_size_) / double(w.bucket_size));
-    int vertical_buckets = std::ceil(double(this->c_v_size_) / double(w.bucket_size));
+	this->c_crop_ = PixelRect();
+}
 
-    int total_buckets = horizontal_buckets * vertical_buckets;
+bool Camera::has_crop_window() const
+{
+	return this->c_crop_.width > 0 && this->c_crop_.height > 0;
+}
 
-    auto bucket_results = std::vector<std::future<SampleBuffer>>();
+bool Camera::clip_to_crop_window(int & x, int & y, int & width, int & height) const
+{
+	const PixelRect crop = this->get_crop_window();
 
-    // lambda to execute rendering of the line
-    auto f = [](const Camera * l_camera, const World & l_w, int l_x, int l_y, int l_width, int l_height, int l_bucket_id, int l_total_buckets)
-            {
-                std::ostringstream oss;
-                oss << "Starting Bucket: " << l_bucket_id << "/" << l_total_buckets
-                    << " - Start Coordinates: (" << l_x << ", " << l_y << ") - Dimensions ["
-                    << l_width << ", " << l_height << "]" << std::endl;
+	const int left = std::max(x, crop.x);
+	const int top = std::max(y, crop.y);
+	const int right = std::min(x + width, crop.x + crop.width);
+	const int bottom = std::min(y + height, crop.y + crop.height);
 
-                std::cout << oss.str();
-                return l_camera->multi_sample_render_bucket(l_w, l_x, l_y, l_width, l_height, l_bucket_id);
-            };
+	if (right <= left || bottom <= top)
+	{
+		return false;
+	}
 
-    // Queue up all the lines
-    for (int x = 0; x < horizontal_buckets; x++)
-    {
-        for (int y = 0; y < vertical_buckets; y++)
-        {
-            // Default Bucket Size
-            int width = w.bucket_size;
-            int height = w.bucket_size;
+	x = left;
+	y = top;
+	width = right - left;
+	height = bottom - top;
 
-            // On the edges of the image, the buckets may not be square.
-            // This ensures that the overflow is not rendered, as that may result in thousands of discarded pixels
-            if (x == horizontal_buckets - 1)
-            {
-                int mod = int(fmod(double(this->c_h_size_), double(w.bucket_size)));
-                width = (mod == 0) ? w.bucket_size : mod;
-            }
-            if (y == vertical_buckets - 1)
-            {
-                int mod = int(fmod(double(this->c_h_size_), double(w.bucket_size)));
-                height = (mod == 0) ? w.bucket_size : mod;
-            }
+	return true;
+}
 
-            // Prevent buckets with no pixels
-            if (width > 0 && height > 0)
-            {
-                // Calculate the number of this bucket
-                int bucket_id = (x * vertical_buckets) + y + 1;
+// ------------------------------------------------------------------------
+// Render
+// ------------------------------------------------------------------------
 
-                // Offset of the bucket from top left (0, 0)
-                int x_offset = x * w.bucket_size;
-                int y_offset = y * w.bucket_size;
+Canvas Camera::render(const World & w) const
+{
+	return this->c_render_(w, nullptr);
+}
 
-                // Adds bucket to the queue
-                 bucket_results.push_back(std::async(std::launch::async,f, this, w, x_offset, y_offset, width, height, bucket_id, total_buckets));
-            }
-        }
-    }
+Canvas Camera::render(const World & w, const Canvas & previous) const
+{
+	return this->c_render_(w, &previous);
+}
 
-    // Create bounding box and final SampleBuffer
-    AABB2D extents = this->extent_from_bucket_(0, 0, this->c_h_size_, this->c_v_size_);
-    SampleBuffer image = SampleBuffer(0, 0, this->c_h_size_, this->c_v_size_, extents);
+Canvas Camera::threaded_render(const World & w) const
+{
+	return this->c_threaded_render_(w, nullptr);
+}
 
-    // stitch them back together
-    for (auto & br : bucket_results)
-    {
-        image.write_portion(br.get());
-    }
+Canvas Camera::threaded_render(const World & w, const Canvas & previous) const
+{
+	return this->c_threaded_render_(w, &previous);
+}
 
-    std::ostringstream oss;
-    oss << "Stitching final image from " << bucket_results.size() << " buckets.\n";
-    std::cout << oss.str();
+SampleBuffer Camera::multi_sample_threaded_render(const World &w) const
+{
+    RenderStats stats = RenderStats();
+    return this->multi_sample_threaded_render(w, stats);
+}
 
-    std::cout << image << std::endl;
+SampleBuffer Camera::multi_sample_threaded_render(const World &w, RenderStats & stats) const
+{
+    return this->c_multi_sample_threaded_render_(w, stats, nullptr, nullptr);
+}
 
-    std::cout << "Imaged stitched!\n";
+SampleBuffer Camera::multi_sample_threaded_render(const World & w, RenderStats & stats, RenderCheckpoint & checkpoint) const
+{
+    return this->c_multi_sample_threaded_render_(w, stats, &checkpoint, nullptr);
+}
 
-    return image;
+SampleBuffer Camera::multi_sample_threaded_render(const World & w, RenderStats & stats, const SampleBuffer & previous) const
+{
+    return this->c_multi_sample_threaded_render_(w, stats, nullptr, &previous);
 }
 
+
 Canvas Camera::render_scanline(const World & w, int line) const
 {
 	// Create a canvas with the full image width but only 1 height
 	Canvas image_line = Canvas(this->c_h_size_, 1);
 
-    std::ostringstream oss;
-	oss << "Scanline: " << line + 1 << "/" << this->c_v_size_ << std::endl;
-    std::cout << oss.str();
-
-
 	for (int x = 0; x < this->c_h_size_; x++)
 	{
 		// Cast Rays
@@ -222,6 +351,9 @@ SampleBuffer Camera::multi_sample_render_bucket(const World & w, int x, int y, i
     // Create new sample buffer to place buckets into
     SampleBuffer bucket = SampleBuffer(x, y, width, height, extents);
 
+    // Texture footprints shrink as more samples are taken, but never below an eighth of a pixel
+    double differential_scale = std::max(0.125, 1.0 / sqrt(double(std::max(w.aa_sample_max, 1))));
+
 
     // Iterate through the pixels of the sample buffer (Bucket x and y)
     for (int bk_y = 0; bk_y < height; bk_y++)
@@ -230,21 +362,19 @@ SampleBuffer Camera::multi_sample_render_bucket(const World & w, int x, int y, i
         for (int bk_x = 0; bk_x < width; bk_x++)
         {
 
+            // Out of focus pixels are held to more samples before the noise threshold can stop them
+            const int pixel_min_samples = this->min_samples(w, bk_x + x, bk_y + y);
+
             // While the noise threshold has not been reached, and the sample number is below the minimum
             for (int i = 0; i < w.aa_sample_max; ++i) {
-                // Random between 0.0 and 1.0 that translates to a pixel offset
+                // A stratified point within the pixel, and on the lens
                 // TODO: Implement a Lanczos transform that spreads samples outside of the pixel (Filter Importance Sampling)
-                // TODO: This function should take a 0.0-1.0 value and the sample size to produce a pleasant distribution
-                // TODO: Link this to world.sample_size
-                double px_os_x = random_double() * w.sample_size;
-                double px_os_y = random_double() * w.sample_size;
-
-                // Casts ray to a random point within the pixel
-                Ray r = this->ray_from_pixel(bk_x + x, bk_y + y, px_os_x, px_os_y);
-                // Samples at the Ray
-                Sample sample = w.sample_at(r);
+                CameraSample camera_sample = this->pixel_sample(bk_x + x, bk_y + y, i, w.sample_size);
+
+                // Casts ray to a point within the pixel
+                Sample sample = this->c_trace_sample_(w, bk_x + x, bk_y + y, camera_sample, differential_scale);
                 // Assign origin coordinate
-                sample.CanvasOrigin = bucket.coordinates_from_pixel(bk_x, bk_y, px_os_x, px_os_y);
+                sample.CanvasOrigin = bucket.coordinates_from_pixel(bk_x, bk_y, camera_sample.px_os_x, camera_sample.px_os_y);
                 sample.BucketID = bucket_id;
                 sample.calculate_sample();
 
@@ -252,7 +382,7 @@ SampleBuffer Camera::multi_sample_render_bucket(const World & w, int x, int y, i
                 bucket.write_sample(bk_x, bk_y, sample);
 
                 // Test samples to determine if the noise threshold has been reached
-                if (bucket.test_noise_threshold(bk_x, bk_y, w.noise_threshold) && i > w.aa_sample_min)
+                if (bucket.test_noise_threshold(bk_x, bk_y, w.noise_threshold) && i > pixel_min_samples)
                     break;
 
             }
@@ -264,12 +394,230 @@ SampleBuffer Camera::multi_sample_render_bucket(const World & w, int x, int y, i
         s->full_average();
     }
 
-    std::ostringstream oss;
-    oss << "Bucket: " << bucket_id << " Completed!" << std::endl;
+    return bucket;
+}
 
-    std::cout << oss.str();
+SampleBuffer Camera::progressive_render(const World & w, const ProgressiveSettings & settings) const
+{
+    if (settings.time_budget <= 0.0 && settings.max_passes <= 0 && settings.noise_target <= 0.0)
+    {
+        throw std::invalid_argument("A progressive render needs a time budget, a pass count or a noise target");
+    }
 
-    return bucket;
+    auto start = std::chrono::steady_clock::now();
+    // Records are kept across passes, which all render the same frame
+    w.begin_frame();
+
+    AABB2D extents = this->extent_from_bucket_(0, 0, this->c_h_size_, this->c_v_size_);
+    SampleBuffer image = SampleBuffer(0, 0, this->c_h_size_, this->c_v_size_, extents);
+
+    const int bucket_size = std::max(w.bucket_size, 1);
+
+    ProgressiveStats stats = ProgressiveStats();
+    double last_pass_seconds = 0.0;
+
+    // Carries on from the passes saved before the render was stopped
+    if (settings.checkpoint)
+    {
+        stats.pass = settings.checkpoint->restore_passes(image);
+    }
+
+    struct ProgressiveBucket
+    {
+        int x, y, width, height, id;
+    };
+
+    auto buckets = std::vector<ProgressiveBucket>();
+    for (int y = 0; y < this->c_v_size_; y += bucket_size)
+    {
+        for (int x = 0; x < this->c_h_size_; x += bucket_size)
+        {
+            buckets.push_back({ x, y, std::min(bucket_size, this->c_h_size_ - x), std::min(bucket_size, this->c_v_size_ - y), int(buckets.size()) + 1 });
+        }
+    }
+
+    // The same threads run every pass, rather than a thread for every bucket of every pass
+    RenderWorkerPool pool = RenderWorkerPool();
+
+    // Buckets cover separate pixels, so they all write into the one image
+    auto pass = [this, &w, &image, &buckets](size_t index)
+    {
+        const ProgressiveBucket & bucket = buckets[index];
+        this->c_progressive_pass_(w, image, bucket.x, bucket.y, bucket.width, bucket.height, bucket.id);
+    };
+
+    while (true)
+    {
+        auto pass_start = std::chrono::steady_clock::now();
+
+        pool.run(buckets.size(), pass);
+
+        auto now = std::chrono::steady_clock::now();
+        last_pass_seconds = std::chrono::duration<double>(now - pass_start).count();
+
+        // Convergence
+        stats.pass++;
+        stats.elapsed_seconds = std::chrono::duration<double>(now - start).count();
+        stats.mean_error = 0.0;
+        stats.max_error = 0.0;
+        int converged = 0;
+
+        for (std::shared_ptr<SampledPixel> & s : image)
+        {
+            double error = s->relative_error();
+            stats.mean_error += error;
+            stats.max_error = std::max(stats.max_error, error);
+
+            if (settings.noise_target > 0.0 && error <= settings.noise_target)
+            {
+                converged++;
+            }
+        }
+
+        const double pixel_count = std::max(double(this->c_h_size_) * double(this->c_v_size_), 1.0);
+        stats.mean_error /= pixel_count;
+        stats.converged_fraction = double(converged) / pixel_count;
+
+        std::ostringstream oss;
+        oss << "Pass " << stats.pass << " - " << stats.elapsed_seconds << "s - Mean Error: " << stats.mean_error
+            << " - Max Error: " << stats.max_error;
+        if (settings.noise_target > 0.0)
+        {
+            oss << " - Converged: " << stats.converged_fraction * 100.0 << "%";
+        }
+        oss << std::endl;
+        std::cout << oss.str();
+
+        if (!settings.preview_path.empty() && !Camera::c_write_preview_(image, settings.preview_path))
+        {
+            std::cout << "Could not write preview to " << settings.preview_path << std::endl;
+        }
+
+        if (settings.on_pass)
+        {
+            settings.on_pass(stats);
+        }
+
+        // Stopping
+        bool done = false;
+        if (settings.max_passes > 0 && stats.pass >= settings.max_passes)
+        {
+            done = true;
+        }
+        // Two samples are the fewest that give an error at all
+        if (settings.noise_target > 0.0 && stats.pass >= std::max(w.aa_sample_min, 2) && stats.mean_error <= settings.noise_target)
+        {
+            done = true;
+        }
+        // Stop before a pass that would run past the budget, rather than after it
+        if (settings.time_budget > 0.0 && stats.elapsed_seconds + last_pass_seconds > settings.time_budget)
+        {
+            done = true;
+        }
+
+        // The last pass is always saved, so a render stopped by its budget can be given more time
+        if (settings.checkpoint && (done || settings.checkpoint->is_save_due()))
+        {
+            settings.checkpoint->save_passes(image, stats.pass);
+        }
+
+        if (done)
+        {
+            break;
+        }
+    }
+
+    if (settings.checkpoint)
+    {
+        settings.checkpoint->flush();
+    }
+
+    return image;
+}
+
+SampleBuffer Camera::deadline_render(const World & w, DeadlineScheduler & scheduler) const
+{
+    struct DeadlineBucket
+    {
+        int x, y, width, height, id;
+    };
+
+    const int bucket_size = std::max(w.bucket_size, 1);
+    const int threads = std::max(int(std::thread::hardware_concurrency()), 1);
+
+    auto buckets = std::vector<DeadlineBucket>();
+    for (int y = 0; y < this->c_v_size_; y += bucket_size)
+    {
+        for (int x = 0; x < this->c_h_size_; x += bucket_size)
+        {
+            buckets.push_back({ x, y, std::min(bucket_size, this->c_h_size_ - x), std::min(bucket_size, this->c_v_size_ - y), int(buckets.size()) + 1 });
+        }
+    }
+
+    w.begin_frame();
+    scheduler.begin_frame(w, this->c_h_size_ * this->c_v_size_, threads);
+
+    // Buckets are handed out one at a time, so each one is planned with the timings of the ones before it
+    auto results = std::vector<SampleBuffer>(buckets.size());
+    std::atomic<size_t> next_bucket(0);
+
+    ProgressReporter progress = ProgressReporter("Rendering", uint64_t(this->c_h_size_) * uint64_t(this->c_v_size_));
+    progress.start();
+
+    auto worker = [this, &w, &scheduler, &buckets, &results, &next_bucket, &progress]()
+    {
+        size_t index;
+
+        while ((index = next_bucket++) < buckets.size())
+        {
+            const DeadlineBucket & bucket = buckets[index];
+            const int pixel_count = bucket.width * bucket.height;
+
+            RenderQuality quality = scheduler.next_bucket(pixel_count, bucket.id);
+            World bucket_world = w;
+            DeadlineScheduler::apply(quality, bucket_world);
+
+            const uint64_t rays_before = thread_counters().total_rays();
+            auto bucket_start = std::chrono::steady_clock::now();
+            results[index] = this->multi_sample_render_bucket(bucket_world, bucket.x, bucket.y, bucket.width, bucket.height, bucket.id);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bucket_start).count();
+
+            scheduler.finish_bucket(quality, pixel_count, seconds);
+            progress.advance(pixel_count);
+            progress.add_rays(thread_counters().total_rays() - rays_before);
+        }
+    };
+
+    auto workers = std::vector<std::future<void>>();
+    for (int i = 0; i < threads; i++)
+    {
+        workers.push_back(std::async(std::launch::async, worker));
+    }
+
+    for (auto & wk : workers)
+    {
+        wk.get();
+    }
+
+    progress.finish();
+
+    AABB2D extents = this->extent_from_bucket_(0, 0, this->c_h_size_, this->c_v_size_);
+    SampleBuffer image = SampleBuffer(0, 0, this->c_h_size_, this->c_v_size_, extents);
+
+    for (const SampleBuffer & bucket : results)
+    {
+        image.write_portion(bucket);
+    }
+
+    scheduler.end_frame();
+
+    return image;
+}
+
+SampleBuffer Camera::frame_buffer() const
+{
+    AABB2D extents = this->extent_from_bucket_(0, 0, this->c_h_size_, this->c_v_size_);
+    return SampleBuffer(0, 0, this->c_h_size_, this->c_v_size_, extents);
 }
 
 // ------------------------------------------------------------------------
@@ -296,6 +644,16 @@ double Camera::get_pixel_size() const
 	return this->c_pixel_size_;
 }
 
+PixelRect Camera::get_crop_window() const
+{
+	if (this->has_crop_window())
+	{
+		return this->c_crop_;
+	}
+
+	return { 0, 0, this->c_h_size_, this->c_v_size_ };
+}
+
 // ------------------------------------------------------------------------
 // Private Functions
 // ------------------------------------------------------------------------
@@ -319,6 +677,249 @@ void Camera::pixel_size_()
 	this->c_pixel_size_ = (this->c_half_width_ * 2.0) / double(this->c_h_size_);
 }
 
+Tuple Camera::c_direction_from_film_(const Matrix4 & inv_x_form, const Tuple & origin, double film_x, double film_y, double focus) const
+{
+    // Offset from the edge of the canvas to the point on the film, in pixels
+    double x_offset = film_x * this->c_pixel_size_;
+    double y_offset = film_y * this->c_pixel_size_;
+
+    // The untransformed coordinates of the pixel in world space
+    // Camera looks towards -z, so +x is to the left
+    double world_x = this->c_half_width_ - x_offset;
+    double world_y = this->c_half_height_ - y_offset;
+
+    // Using the camera's matrix, transform the canvas point
+    // and then compute the ray's direction vector
+    // The film is at z=-focus, -1.0 for a pinhole
+    Tuple pixel = inv_x_form * Tuple::Point(world_x * focus, world_y * focus, -focus);
+    return (pixel - origin).normalize();
+}
+
+Canvas Camera::c_render_(const World & w, const Canvas * previous) const
+{
+	Canvas image = this->c_start_canvas_(previous);
+	const PixelRect crop = this->get_crop_window();
+	w.begin_frame();
+
+	ProgressReporter progress = ProgressReporter("Rendering", crop.height);
+	progress.start();
+
+	for (int y = crop.y; y < crop.y + crop.height; y++)
+	{
+		const RenderCounters counters_before = thread_counters();
+
+		for (int x = crop.x; x < crop.x + crop.width; x++)
+		{
+			// std::cout << "Pixel: (" << x << ", " << y << ")\n";
+			Ray r = this->ray_from_pixel(x, y);
+			Color color = w.color_at(r);
+			image.write_pixel(x, y, color);
+		}
+
+		progress.advance(1);
+		progress.add_rays((thread_counters() - counters_before).total_rays());
+	}
+
+	progress.finish();
+
+	return image;
+}
+
+Canvas Camera::c_threaded_render_(const World & w, const Canvas * previous) const
+{
+	Canvas image = this->c_start_canvas_(previous);
+	const PixelRect crop = this->get_crop_window();
+	w.begin_frame();
+
+	auto line_results = std::vector<std::future<Canvas>>();
+
+	ProgressReporter progress = ProgressReporter("Rendering", crop.height);
+	progress.start();
+
+	// lambda to execute rendering of the part of the line inside the crop window
+	auto f = [](const Camera * camera, const World & w, int line, PixelRect l_crop, ProgressReporter * l_progress) {
+		// Counters are per thread, the line's share is what they went up by
+		const RenderCounters counters_before = thread_counters();
+		Canvas result = Canvas(l_crop.width, 1);
+
+		for (int x = 0; x < l_crop.width; x++)
+		{
+			Ray r = camera->ray_from_pixel(l_crop.x + x, line);
+			result.write_pixel(x, 0, w.color_at(r));
+		}
+
+		l_progress->advance(1);
+		l_progress->add_rays((thread_counters() - counters_before).total_rays());
+		return result;
+	};
+
+	// Queue up all the lines
+	for (int y = crop.y; y < crop.y + crop.height; y++)
+	{
+		line_results.push_back(std::async(f, this, w, y, crop, &progress));
+	}
+
+	// stitch them back together
+	for (int i = 0; i < line_results.size(); i++)
+	{
+		Canvas line = line_results[i].get();
+
+		for (int x = 0; x < crop.width; x++)
+		{
+			image.write_pixel(crop.x + x, crop.y + i, line.pixel_at(x, 0));
+		}
+	}
+
+	progress.finish();
+
+	return image;
+}
+
+Canvas Camera::c_start_canvas_(const Canvas * previous) const
+{
+	if (previous == nullptr)
+	{
+		return Canvas(this->c_h_size_, this->c_v_size_);
+	}
+
+	if (previous->width() != this->c_h_size_ || previous->height() != this->c_v_size_)
+	{
+		throw std::invalid_argument("The previous frame is not the size of the camera's frame");
+	}
+
+	return Canvas(*previous);
+}
+
+SampleBuffer Camera::c_multi_sample_threaded_render_(const World & w, RenderStats & stats, RenderCheckpoint * checkpoint, const SampleBuffer * previous) const
+{
+    if (previous != nullptr && (previous->width() != this->c_h_size_ || previous->height() != this->c_v_size_))
+    {
+        throw std::invalid_argument("The previous frame is not the size of the camera's frame");
+    }
+
+    const PixelRect crop = this->get_crop_window();
+    w.begin_frame();
+
+    auto render_start = std::chrono::steady_clock::now();
+
+    int horizontal_buckets = std::ceil(double(this->c_h_size_) / double(w.bucket_size));
+    int vertical_buckets = std::ceil(double(this->c_v_size_) / double(w.bucket_size));
+
+    auto bucket_results = std::vector<std::future<std::pair<SampleBuffer, BucketStats>>>();
+
+    ProgressReporter progress = ProgressReporter("Rendering", uint64_t(crop.width) * uint64_t(crop.height));
+    progress.start();
+
+    // lambda to execute rendering of the line
+    auto f = [](const Camera * l_camera, const World & l_w, int l_x, int l_y, int l_width, int l_height, int l_bucket_id, ProgressReporter * l_progress, RenderCheckpoint * l_checkpoint)
+            {
+                // Counters are per thread, the bucket's share is what they went up by
+                const RenderCounters counters_before = thread_counters();
+                auto bucket_start = std::chrono::steady_clock::now();
+
+                SampleBuffer bucket = l_camera->multi_sample_render_bucket(l_w, l_x, l_y, l_width, l_height, l_bucket_id);
+
+                BucketStats bucket_stats = BucketStats();
+                bucket_stats.id = l_bucket_id;
+                bucket_stats.x = l_x;
+                bucket_stats.y = l_y;
+                bucket_stats.width = l_width;
+                bucket_stats.height = l_height;
+                bucket_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bucket_start).count();
+                bucket_stats.counters = thread_counters() - counters_before;
+
+                l_progress->advance(uint64_t(l_width) * uint64_t(l_height));
+                l_progress->add_rays(bucket_stats.counters.total_rays());
+
+                if (l_checkpoint != nullptr)
+                {
+                    NodeBucketResult result = NodeBucketResult();
+                    result.bucket = { l_bucket_id, l_x, l_y, l_width, l_height, 0 };
+                    result.seconds = bucket_stats.seconds;
+                    result.counters = bucket_stats.counters;
+
+                    l_checkpoint->add_bucket(result, bucket);
+                }
+
+                return std::make_pair(bucket, bucket_stats);
+            };
+
+    // Queue up all the lines
+    for (int x = 0; x < horizontal_buckets; x++)
+    {
+        for (int y = 0; y < vertical_buckets; y++)
+        {
+            // Default Bucket Size
+            int width = w.bucket_size;
+            int height = w.bucket_size;
+
+            // On the edges of the image, the buckets may not be square.
+            // This ensures that the overflow is not rendered, as that may result in thousands of discarded pixels
+            if (x == horizontal_buckets - 1)
+            {
+                int mod = int(fmod(double(this->c_h_size_), double(w.bucket_size)));
+                width = (mod == 0) ? w.bucket_size : mod;
+            }
+            if (y == vertical_buckets - 1)
+            {
+                int mod = int(fmod(double(this->c_v_size_), double(w.bucket_size)));
+                height = (mod == 0) ? w.bucket_size : mod;
+            }
+
+            // Calculate the number of this bucket
+            int bucket_id = (x * vertical_buckets) + y + 1;
+
+            // Offset of the bucket from top left (0, 0)
+            int x_offset = x * w.bucket_size;
+            int y_offset = y * w.bucket_size;
+
+            // Buckets outside the crop window are skipped, and the ones on its edge only
+            // render what is inside it.  They keep their ids, so they stay where they are.
+            if (!this->clip_to_crop_window(x_offset, y_offset, width, height))
+            {
+                continue;
+            }
+
+            // Prevent buckets with no pixels, and buckets finished before the render was stopped
+            if (width > 0 && height > 0 && (checkpoint == nullptr || !checkpoint->has_bucket(bucket_id)))
+            {
+                // Adds bucket to the queue
+                 bucket_results.push_back(std::async(std::launch::async,f, this, w, x_offset, y_offset, width, height, bucket_id, &progress, checkpoint));
+            }
+        }
+    }
+
+    // The buckets are written over the previous frame, which shares its pixels with the copy
+    // but is not changed, as writing a bucket replaces the pixels rather than writing into them
+    SampleBuffer image = (previous != nullptr) ? SampleBuffer(*previous) : this->frame_buffer();
+
+    if (checkpoint != nullptr)
+    {
+        progress.advance(checkpoint->restore_buckets(image));
+    }
+
+    // stitch them back together, and add up the buckets' counters
+    for (auto & br : bucket_results)
+    {
+        std::pair<SampleBuffer, BucketStats> result = br.get();
+
+        image.write_portion(result.first);
+        stats.add_bucket(result.second);
+    }
+
+    progress.finish();
+
+    if (checkpoint != nullptr)
+    {
+        checkpoint->flush();
+    }
+
+    stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+    stats.measure_image(image);
+
+    return image;
+}
+
 AABB2D Camera::extent_from_bucket_(const int x, const int y, const int w, const int h) const {
     // AABB2Ds are square, so the largest dimension sets the square size
     int size = (w > h) ? w : h;
@@ -334,6 +935,74 @@ AABB2D Camera::extent_from_bucket_(const int x, const int y, const int w, const
     return {Tuple::Point2D(ne_x_offset, ne_y_offset), Tuple::Point2D(sw_x_offset, sw_y_offset)};
 }
 
+void Camera::c_progressive_pass_(const World & w, SampleBuffer & image, int x, int y, int width, int height, int bucket_id) const
+{
+    // The number of passes is not known up front, so footprints are kept at the smallest size
+    double differential_scale = 0.125;
+
+    for (int px_y = y; px_y < y + height; px_y++)
+    {
+        for (int px_x = x; px_x < x + width; px_x++)
+        {
+            // Every pass takes the next sample in the pixel's sequence
+            CameraSample camera_sample = this->pixel_sample(px_x, px_y, image.pixel_at(px_x, px_y)->sample_count(), w.sample_size);
+
+            Sample sample = this->c_trace_sample_(w, px_x, px_y, camera_sample, differential_scale);
+            sample.CanvasOrigin = image.coordinates_from_pixel(px_x, px_y, camera_sample.px_os_x, camera_sample.px_os_y);
+            sample.BucketID = bucket_id;
+            sample.calculate_sample();
+
+            image.pixel_at(px_x, px_y)->accumulate_sample(sample);
+        }
+    }
+}
+
+// Written next to the destination and renamed, so a viewer never opens half an image
+bool Camera::c_write_preview_(SampleBuffer & image, const std::string & file_path)
+{
+    const std::filesystem::path path = std::filesystem::path(file_path);
+    const std::filesystem::path temp_path = path.string() + ".tmp";
+    const Canvas canvas = image.to_canvas(rgb);
+
+    if (path.extension() == ".pfm")
+    {
+        canvas_to_pfm(canvas, temp_path.string());
+    }
+    else
+    {
+        canvas_to_ppm(canvas, temp_path.string());
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+
+    if (error)
+    {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    return true;
+}
+
+// Traces one camera sample, with its time and rays recorded for the heat maps
+Sample Camera::c_trace_sample_(const World & w, int x, int y, const CameraSample & camera_sample, double differential_scale) const
+{
+    RenderCounters & counters = thread_counters();
+    const uint64_t rays_before = counters.total_rays();
+    auto sample_start = std::chrono::steady_clock::now();
+
+    Ray r = this->ray_from_sample(x, y, camera_sample);
+    // Each sample only has to filter its share of the pixel
+    r.scale_differentials(differential_scale);
+
+    counters.camera_rays++;
+    counters.samples++;
 
+    Sample sample = w.sample_at(r);
 
+    sample.Time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sample_start).count();
+    sample.Rays = double(counters.total_rays() - rays_before);
 
+    return sample;
+}
@@ -3,6 +3,8 @@
 
 #include <thread>
 #include <future>
+#include <functional>
+#include <string>
 
 #include "Tuple.h"
 #include "Object.h"
@@ -11,6 +13,60 @@
 #include "Canvas.h"
 #include "SampleBuffer.h"
 #include "Utilities.h"
+#include "DeadlineScheduler.h"
+#include "RenderStats.h"
+#include "ProgressReporter.h"
+
+class RenderCheckpoint;
+
+// How far a progressive render has come, reported after every pass
+struct ProgressiveStats
+{
+	// Passes finished, which is also the samples taken in every pixel
+	int pass;
+	double elapsed_seconds;
+	// Relative standard error of the pixels, see SampledPixel::relative_error
+	double mean_error;
+	double max_error;
+	// Fraction of pixels at or below the noise target, 0 without one
+	double converged_fraction;
+};
+
+// A progressive render stops at whichever limit it reaches first.  Limits left at 0 are off,
+// but at least one of them has to be set.
+struct ProgressiveSettings
+{
+	double time_budget = 0.0;
+	int max_passes = 0;
+	double noise_target = 0.0;
+
+	// Written after every pass, as a .pfm or else a .ppm.  Nothing is written when empty.
+	std::string preview_path;
+	// Called on the rendering thread after every pass
+	std::function<void(const ProgressiveStats &)> on_pass;
+	// Saved to every checkpoint interval, and carried on from when the render starts
+	std::shared_ptr<RenderCheckpoint> checkpoint;
+};
+
+// Where in its pixel one camera sample is taken, in pixels, where on the lens, with u and v in
+// [0,1), and when in the shutter
+struct CameraSample
+{
+	double px_os_x = 0.5;
+	double px_os_y = 0.5;
+	double lens_u = 0.5;
+	double lens_v = 0.5;
+	double time = 0.0;
+};
+
+// A rectangle of pixels, from its top left corner
+struct PixelRect
+{
+	int x = 0;
+	int y = 0;
+	int width = 0;
+	int height = 0;
+};
 
 class Camera :
 	public ObjectBase
@@ -25,20 +81,89 @@ public:
 	// Rays
 	Ray ray_from_pixel(int x, int y) const;
     Ray ray_from_pixel(int x, int y, double px_os_x, double px_os_y) const;
+    // A keyframed camera is placed where it is at time
+    Ray ray_from_pixel(int x, int y, double px_os_x, double px_os_y, double time) const;
+    // Through the sample's point on the lens, when the camera has an aperture
+    Ray ray_from_sample(int x, int y, const CameraSample & sample) const;
+
+    // Samples
+    // The index-th sample of a pixel.  The offset in the pixel, the point on the lens and the
+    // time all come from one Halton sequence, so they are stratified together, and the
+    // sequence is rotated differently in every pixel so neighbours do not share a pattern.
+    CameraSample pixel_sample(int x, int y, int index, double sample_size) const;
+    // A point on the aperture in camera space, from u and v in [0,1).  Round, or a polygon
+    // with aperture_blades sides, which is the shape out of focus highlights take.
+    Tuple lens_point(double u, double v) const;
+    // Estimated diameter in pixels of the blur at a pixel, from the distance to what its center
+    // sees.  0 for a pinhole.
+    double circle_of_confusion(const World & w, int x, int y) const;
+    // Samples a pixel takes before the noise threshold can stop it.  Out of focus pixels take
+    // more, in proportion to the area of their blur, up to the world's aa_sample_max.
+    int min_samples(const World & w, int x, int y) const;
+
+	// Crop window
+	// Only the pixels inside the window are rendered, the rest of the frame is left black or
+	// empty, or as it was in the previous frame handed to a render.  Clipped to the frame, and
+	// throws when nothing of it is left.
+	void set_crop_window(int x, int y, int width, int height);
+	void clear_crop_window();
+	[[nodiscard]] bool has_crop_window() const;
+	// Clips a bucket to the crop window, false when the two do not overlap
+	bool clip_to_crop_window(int & x, int & y, int & width, int & height) const;
 
 	// Render
 	Canvas render(const World & w) const;
+	// Renders the crop window into a copy of previous, which has to be the size of the frame
+	Canvas render(const World & w, const Canvas & previous) const;
 	Canvas threaded_render(const World & w) const;
+	Canvas threaded_render(const World & w, const Canvas & previous) const;
 	Canvas render_scanline(const World & w, int line) const;
 
     SampleBuffer multi_sample_render_bucket(const World & w, int x, int y, int width, int height, int bucket_id) const;
     SampleBuffer multi_sample_threaded_render(const World & l_camera) const;
+    // Also fills stats with the counters and time of every bucket
+    SampleBuffer multi_sample_threaded_render(const World & w, RenderStats & stats) const;
+    // Only renders the buckets the checkpoint does not already have, and adds each one to it
+    // as it finishes
+    SampleBuffer multi_sample_threaded_render(const World & w, RenderStats & stats, RenderCheckpoint & checkpoint) const;
+    // Only renders the buckets that overlap the crop window, and writes them over a copy of
+    // previous, so a change to one part of a frame costs only that part.  previous has to be
+    // the size of the frame, and is not changed.
+    SampleBuffer multi_sample_threaded_render(const World & w, RenderStats & stats, const SampleBuffer & previous) const;
+
+    // Renders one sample in every pixel per pass and keeps refining the whole frame,
+    // so a usable image exists long before the render is done
+    SampleBuffer progressive_render(const World & w, const ProgressiveSettings & settings) const;
+
+    // Renders the buckets at whatever quality the scheduler can afford, to finish inside its
+    // frame budget.  Keep the scheduler between frames so its timings carry over.
+    SampleBuffer deadline_render(const World & w, DeadlineScheduler & scheduler) const;
+
+    // An empty buffer covering the whole frame, for buckets rendered elsewhere to be written into
+    SampleBuffer frame_buffer() const;
+
+	// Properties
+	// Every camera sample is cast at a random time between these, and moving objects and a
+	// keyframed camera are blurred over it.  Equal times render a still instant.
+	double shutter_open, shutter_close;
+
+	// Depth of field
+	// Diameter of the lens in world units, 0 is a pinhole with everything in focus
+	double aperture;
+	// Distance along the view direction that is in focus
+	double focal_distance;
+	// Straight sides of the aperture, 0 for a round one
+	int aperture_blades;
+	// Turns a polygonal aperture, in radians
+	double aperture_rotation;
 
 	// Accessors
 	int get_horizontal_size() const;
 	int get_vertical_size() const;
 	double get_fov() const;
 	double get_pixel_size() const;
+	// The whole frame without a crop window
+	PixelRect get_crop_window() const;
 
 private:
 	// Private Properties
@@ -47,8 +172,21 @@ private:
 
 	double c_fov_, c_pixel_size_, c_half_width_, c_half_height_;
 
+	// Empty without a crop window
+	PixelRect c_crop_;
+
 	void pixel_size_();
+    // Towards the point on the film, with the film at distance focus
+    Tuple c_direction_from_film_(const Matrix4 & inv_x_form, const Tuple & origin, double film_x, double film_y, double focus) const;
     AABB2D extent_from_bucket_(int x, int y, int w, int h) const;
+    Canvas c_render_(const World & w, const Canvas * previous) const;
+    Canvas c_threaded_render_(const World & w, const Canvas * previous) const;
+    // A black frame, or a copy of previous once it is checked to be the size of the frame
+    Canvas c_start_canvas_(const Canvas * previous) const;
+    SampleBuffer c_multi_sample_threaded_render_(const World & w, RenderStats & stats, RenderCheckpoint * checkpoint, const SampleBuffer * previous) const;
+    Sample c_trace_sample_(const World & w, int x, int y, const CameraSample & camera_sample, double differential_scale) const;
+    void c_progressive_pass_(const World & w, SampleBuffer & image, int x, int y, int width, int height, int bucket_id) const;
+    static bool c_write_preview_(SampleBuffer & image, const std::string & file_path);
 };
 
 #endif
@@ -200,3 +200,33 @@ void canvas_to_ppm(Canvas canvas, std::string file_path, bool convert_to_sRGB)
 
 	output_file.close();
 }
+
+// Writes linear floating point values, so HDR renders and textures survive the round trip
+// Portable Float Map: http://www.pauldebevec.com/Research/HDR/PFM/
+void canvas_to_pfm(Canvas canvas, const std::string & file_path)
+{
+	std::ofstream output_file;
+
+	output_file.open(file_path, std::ios::out | std::ios::binary);
+
+	// Header, the negative scale marks the data as little endian
+	output_file << "PF\n" << canvas.width() << " " << canvas.height() << "\n-1.0\n";
+
+	std::vector<float> row = std::vector<float>(size_t(canvas.width()) * 3);
+
+	// Rows are stored from the bottom of the image to the top
+	for (int y = canvas.height() - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < canvas.width(); x++)
+		{
+			Color c = canvas.pixel_at(x, y);
+			row[(x * 3)] = static_cast<float>(c.x);
+			row[(x * 3) + 1] = static_cast<float>(c.y);
+			row[(x * 3) + 2] = static_cast<float>(c.z);
+		}
+
+		output_file.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+	}
+
+	output_file.close();
+}
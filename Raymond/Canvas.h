@@ -48,5 +48,6 @@ private:
 // File Output
 void canvas_to_ppm(Canvas canvas, std::string file_path);
 void canvas_to_ppm(Canvas canvas, std::string file_path, bool convert_to_sRGB);
+void canvas_to_pfm(Canvas canvas, const std::string & file_path);
 
 #endif
@@ -0,0 +1,440 @@
+#include "pch.h"
+#include "Checkpoint.h"
+
+#include <cstring>
+#include <filesystem>
+
+static const char CHECKPOINT_MAGIC[8] = { 'R', 'C', 'H', 'E', 'C', 'K', '0', '1' };
+
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+RenderCheckpoint::RenderCheckpoint(const std::string & file_path, uint64_t render_hash)
+{
+	this->interval = 60.0;
+
+	this->ck_path_ = file_path;
+	this->ck_render_hash_ = render_hash;
+	this->ck_pass_count_ = 0;
+	this->ck_valid_size_ = 0;
+	this->ck_writing_ = false;
+	this->ck_stopping_ = false;
+	this->ck_last_save_ = std::chrono::steady_clock::now();
+
+	this->ck_read_();
+
+	std::error_code error;
+	const std::filesystem::path path = std::filesystem::path(file_path);
+	if (path.has_parent_path())
+	{
+		std::filesystem::create_directories(path.parent_path(), error);
+	}
+
+	if (this->ck_valid_size_ > 0)
+	{
+		// A record cut short is dropped, so the next one is appended where it started
+		std::filesystem::resize_file(path, this->ck_valid_size_, error);
+		this->ck_file_.open(path, std::ios::out | std::ios::binary | std::ios::app);
+	}
+	else
+	{
+		this->ck_file_.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		this->ck_write_header_(this->ck_file_);
+		this->ck_file_.flush();
+	}
+
+	if (!this->ck_file_)
+	{
+		throw std::runtime_error("Cannot write checkpoint: " + file_path);
+	}
+
+	this->ck_writer_ = std::thread(&RenderCheckpoint::ck_write_, this);
+}
+
+RenderCheckpoint::~RenderCheckpoint()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->ck_mutex_);
+		this->ck_stopping_ = true;
+	}
+	this->ck_changed_.notify_all();
+
+	this->ck_writer_.join();
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool RenderCheckpoint::has_bucket(int id) const
+{
+	return this->ck_buckets_.count(id) > 0;
+}
+
+uint64_t RenderCheckpoint::restore_buckets(SampleBuffer & image) const
+{
+	uint64_t pixels = 0;
+
+	for (const auto & bucket : this->ck_buckets_)
+	{
+		NodeBucketResult result = unpack_bucket(bucket.second, image);
+		pixels += uint64_t(result.bucket.width) * uint64_t(result.bucket.height);
+	}
+
+	return pixels;
+}
+
+void RenderCheckpoint::add_bucket(const NodeBucketResult & result, SampleBuffer & bucket)
+{
+	Record record = Record();
+	record.type = CheckpointBucket;
+	record.pass = 0;
+	record.payload = pack_bucket(result, bucket);
+
+	std::lock_guard<std::mutex> lock(this->ck_mutex_);
+	this->ck_queue_.push_back(std::move(record));
+	this->ck_changed_.notify_all();
+}
+
+int RenderCheckpoint::restore_passes(SampleBuffer & image) const
+{
+	if (this->ck_pass_count_ == 0 || this->ck_passes_.size() < 2 * sizeof(int32_t))
+	{
+		return 0;
+	}
+
+	int32_t size[2];
+	memcpy(size, this->ck_passes_.data(), sizeof(size));
+
+	if (size[0] != image.width() || size[1] != image.height() ||
+		this->ck_passes_.size() != sizeof(size) + size_t(size[0]) * size_t(size[1]) * sizeof(CheckpointPixel))
+	{
+		return 0;
+	}
+
+	const auto * pixels = reinterpret_cast<const CheckpointPixel *>(this->ck_passes_.data() + sizeof(size));
+
+	for (int y = 0; y < size[1]; y++)
+	{
+		for (int x = 0; x < size[0]; x++)
+		{
+			const CheckpointPixel & in = pixels[y * size[0] + x];
+			image.pixel_at(x, y)->set_accumulated(unpack_pixel(in.sum), in.sum.samples, in.mean, in.m2);
+		}
+	}
+
+	return this->ck_pass_count_;
+}
+
+void RenderCheckpoint::save_passes(SampleBuffer & image, int pass)
+{
+	const int32_t size[2] = { image.width(), image.height() };
+
+	Record record = Record();
+	record.type = CheckpointPasses;
+	record.pass = pass;
+	record.payload = std::string(sizeof(size) + size_t(size[0]) * size_t(size[1]) * sizeof(CheckpointPixel), '\0');
+	memcpy(record.payload.data(), size, sizeof(size));
+
+	auto * pixels = reinterpret_cast<CheckpointPixel *>(record.payload.data() + sizeof(size));
+
+	for (int y = 0; y < size[1]; y++)
+	{
+		for (int x = 0; x < size[0]; x++)
+		{
+			Sample sum;
+			int count;
+			CheckpointPixel & out = pixels[y * size[0] + x];
+
+			image.pixel_at(x, y)->get_accumulated(sum, count, out.mean, out.m2);
+			out.sum = pack_pixel(sum, count);
+		}
+	}
+
+	this->ck_last_save_ = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(this->ck_mutex_);
+	this->ck_queue_.push_back(std::move(record));
+	this->ck_changed_.notify_all();
+}
+
+bool RenderCheckpoint::is_save_due() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->ck_last_save_).count() >= this->interval;
+}
+
+void RenderCheckpoint::flush()
+{
+	std::unique_lock<std::mutex> lock(this->ck_mutex_);
+	this->ck_changed_.wait(lock, [this]() { return this->ck_queue_.empty() && !this->ck_writing_; });
+
+	if (!this->ck_error_.empty())
+	{
+		throw std::runtime_error(this->ck_error_);
+	}
+}
+
+void RenderCheckpoint::remove()
+{
+	std::unique_lock<std::mutex> lock(this->ck_mutex_);
+	this->ck_changed_.wait(lock, [this]() { return this->ck_queue_.empty() && !this->ck_writing_; });
+
+	this->ck_file_.close();
+
+	std::error_code error;
+	std::filesystem::remove(this->ck_path_, error);
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+std::string RenderCheckpoint::get_path() const
+{
+	return this->ck_path_;
+}
+
+size_t RenderCheckpoint::get_restored_buckets() const
+{
+	return this->ck_buckets_.size();
+}
+
+int RenderCheckpoint::get_restored_passes() const
+{
+	return this->ck_pass_count_;
+}
+
+uint64_t RenderCheckpoint::render_hash(const Camera & c, const World & w, uint64_t scene_hash, const std::vector<std::string> & asset_paths)
+{
+	const uint32_t version = RenderCheckpoint::VERSION;
+	uint64_t hash = hash_value(HASH_SEED, version);
+	hash = hash_value(hash, scene_hash);
+
+	for (const std::string & path : asset_paths)
+	{
+		std::error_code error;
+		const uintmax_t size = std::filesystem::file_size(path, error);
+		const auto modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+		hash = hash_value(hash, uint64_t(size));
+		hash = hash_value(hash, int64_t(modified));
+	}
+
+	hash = hash_value(hash, c.get_horizontal_size());
+	hash = hash_value(hash, c.get_vertical_size());
+	hash = hash_value(hash, c.get_fov());
+
+	for (int i = 0; i < 16; i++)
+	{
+		hash = hash_value(hash, c.get_transform().at(i));
+	}
+
+	hash = hash_value(hash, c.shutter_open);
+	hash = hash_value(hash, c.shutter_close);
+	hash = hash_value(hash, c.aperture);
+	hash = hash_value(hash, c.focal_distance);
+	hash = hash_value(hash, c.aperture_blades);
+	hash = hash_value(hash, c.aperture_rotation);
+
+	// A cropped render saves buckets cut down to the window, under the ids of the whole ones
+	const PixelRect crop = c.get_crop_window();
+	hash = hash_value(hash, crop.x);
+	hash = hash_value(hash, crop.y);
+	hash = hash_value(hash, crop.width);
+	hash = hash_value(hash, crop.height);
+
+	hash = hash_value(hash, w.aa_sample_min);
+	hash = hash_value(hash, w.aa_sample_max);
+	hash = hash_value(hash, w.bucket_size);
+	hash = hash_value(hash, w.shadow_subdivs);
+	hash = hash_value(hash, w.reflection_subdivs);
+	hash = hash_value(hash, w.refraction_subdivs);
+	hash = hash_value(hash, w.gi_subdivs);
+	hash = hash_value(hash, w.sample_size);
+	hash = hash_value(hash, w.noise_threshold);
+	hash = hash_value(hash, w.max_ray_depth);
+	hash = hash_value(hash, w.light_samples);
+	hash = hash_value(hash, w.environment_samples);
+
+	return hash;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void RenderCheckpoint::ck_read_()
+{
+	MappedFile file = MappedFile(this->ck_path_);
+
+	if (!file.is_open() || file.size() < sizeof(CheckpointHeader))
+	{
+		return;
+	}
+
+	CheckpointHeader header = CheckpointHeader();
+	memcpy(&header, file.data(), sizeof(CheckpointHeader));
+
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header.version != RenderCheckpoint::VERSION ||
+		header.pixel_size != sizeof(CheckpointPixel) || header.render_hash != this->ck_render_hash_)
+	{
+		return;
+	}
+
+	uint64_t offset = sizeof(CheckpointHeader);
+
+	while (offset + sizeof(CheckpointRecordHeader) <= file.size())
+	{
+		CheckpointRecordHeader record = CheckpointRecordHeader();
+		memcpy(&record, file.data() + offset, sizeof(CheckpointRecordHeader));
+
+		const uint64_t payload_offset = offset + sizeof(CheckpointRecordHeader);
+
+		if (record.size > file.size() - payload_offset || hash_bytes(HASH_SEED, file.data() + payload_offset, size_t(record.size)) != record.checksum)
+		{
+			break;
+		}
+
+		std::string payload = std::string(file.data() + payload_offset, size_t(record.size));
+
+		if (record.type == CheckpointBucket && payload.size() >= sizeof(NodeBucketResult))
+		{
+			NodeBucketResult result = NodeBucketResult();
+			memcpy(&result, payload.data(), sizeof(NodeBucketResult));
+			this->ck_buckets_[result.bucket.id] = std::move(payload);
+		}
+		else if (record.type == CheckpointPasses)
+		{
+			this->ck_passes_ = std::move(payload);
+			this->ck_pass_count_ = int(record.pass);
+		}
+
+		offset = payload_offset + record.size;
+	}
+
+	this->ck_valid_size_ = offset;
+}
+
+void RenderCheckpoint::ck_write_()
+{
+	std::unique_lock<std::mutex> lock(this->ck_mutex_);
+
+	while (true)
+	{
+		this->ck_changed_.wait(lock, [this]() { return this->ck_stopping_ || !this->ck_queue_.empty(); });
+
+		if (this->ck_queue_.empty())
+		{
+			return;
+		}
+
+		Record record = std::move(this->ck_queue_.front());
+		this->ck_queue_.pop_front();
+
+		// Only the last of several saves waiting to be written is worth writing
+		const bool superseded = record.type == CheckpointPasses && std::any_of(this->ck_queue_.begin(), this->ck_queue_.end(), [](const Record & r) { return r.type == CheckpointPasses; });
+
+		if (superseded)
+		{
+			continue;
+		}
+
+		this->ck_writing_ = true;
+		lock.unlock();
+
+		std::string error;
+
+		try
+		{
+			if (record.type == CheckpointBucket)
+			{
+				this->ck_append_(record);
+			}
+			else
+			{
+				this->ck_replace_(record);
+			}
+		}
+		catch (const std::exception & ex)
+		{
+			error = ex.what();
+		}
+
+		lock.lock();
+		this->ck_writing_ = false;
+
+		if (!error.empty() && this->ck_error_.empty())
+		{
+			this->ck_error_ = error;
+		}
+
+		this->ck_changed_.notify_all();
+	}
+}
+
+void RenderCheckpoint::ck_append_(const Record & record)
+{
+	CheckpointRecordHeader header = CheckpointRecordHeader();
+	header.type = record.type;
+	header.pass = uint32_t(record.pass);
+	header.size = record.payload.size();
+	header.checksum = hash_bytes(HASH_SEED, record.payload.data(), record.payload.size());
+
+	this->ck_file_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	this->ck_file_.write(record.payload.data(), static_cast<std::streamsize>(record.payload.size()));
+	// Handed to the system straight away, so it survives the render being killed
+	this->ck_file_.flush();
+
+	if (!this->ck_file_)
+	{
+		throw std::runtime_error("Cannot write checkpoint: " + this->ck_path_);
+	}
+}
+
+void RenderCheckpoint::ck_replace_(const Record & record)
+{
+	// Written next to the checkpoint and renamed, so there is always one whole save on disk
+	const std::string temp_path = this->ck_path_ + ".tmp";
+
+	{
+		std::ofstream output_file(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		this->ck_write_header_(output_file);
+
+		CheckpointRecordHeader header = CheckpointRecordHeader();
+		header.type = record.type;
+		header.pass = uint32_t(record.pass);
+		header.size = record.payload.size();
+		header.checksum = hash_bytes(HASH_SEED, record.payload.data(), record.payload.size());
+
+		output_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		output_file.write(record.payload.data(), static_cast<std::streamsize>(record.payload.size()));
+
+		if (!output_file)
+		{
+			throw std::runtime_error("Cannot write checkpoint: " + temp_path);
+		}
+	}
+
+	this->ck_file_.close();
+
+	std::error_code error;
+	std::filesystem::rename(temp_path, this->ck_path_, error);
+
+	this->ck_file_.open(this->ck_path_, std::ios::out | std::ios::binary | std::ios::app);
+
+	if (error || !this->ck_file_)
+	{
+		throw std::runtime_error("Cannot write checkpoint: " + this->ck_path_);
+	}
+}
+
+void RenderCheckpoint::ck_write_header_(std::ofstream & output) const
+{
+	CheckpointHeader header = CheckpointHeader();
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.version = RenderCheckpoint::VERSION;
+	header.pixel_size = sizeof(CheckpointPixel);
+	header.render_hash = this->ck_render_hash_;
+
+	output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
@@ -0,0 +1,151 @@
+#ifndef H_RAYMOND_CHECKPOINT
+#define H_RAYMOND_CHECKPOINT
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Camera.h"
+#include "World.h"
+#include "SampleBuffer.h"
+#include "Distributed.h"
+
+enum CheckpointRecordType : uint32_t
+{
+	// A finished bucket, packed the same as a render node sends it back
+	CheckpointBucket,
+	// The running sums of every pixel of a progressive render, after some number of passes
+	CheckpointPasses
+};
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	// Changes with the pixel layout, which also makes files from other compilers invalid
+	uint32_t pixel_size;
+	uint64_t render_hash;
+};
+
+// Every record says how long it is and what its bytes hash to, so a record cut short by the
+// render being killed is found and dropped
+struct CheckpointRecordHeader
+{
+	uint32_t type;
+	uint32_t pass;
+	uint64_t size;
+	uint64_t checksum;
+};
+
+// One pixel of a progressive render, its sum in samples with the mean and spread of its
+// luminosity as they were
+struct CheckpointPixel
+{
+	PackedPixel sum;
+	double mean, m2;
+};
+
+// The finished part of a render, saved as it goes, so a render that is stopped can carry on
+// from where it was instead of from the start.
+//
+// Buckets are appended to the file as they finish.  A progressive render saves the sums of
+// every pixel each interval seconds, and as each save replaces the one before, it is written
+// to a new file which is then renamed over the old one.  Writing happens on a thread of its
+// own, so render threads only pay for packing their pixels.
+//
+// The file starts with a hash of the camera, the settings and the scene.  A file for a
+// different render is discarded, and the render starts over.
+class RenderCheckpoint
+{
+public:
+	RenderCheckpoint(const std::string & file_path, uint64_t render_hash);
+	// Waits for everything queued to be written
+	~RenderCheckpoint();
+
+	RenderCheckpoint(const RenderCheckpoint &) = delete;
+	RenderCheckpoint & operator=(const RenderCheckpoint &) = delete;
+
+	// Properties
+	// Seconds between saves of a progressive render
+	double interval;
+
+	// Methods
+	// Buckets
+	[[nodiscard]] bool has_bucket(int id) const;
+	// Writes the buckets read back from the file into the frame, and returns their pixels
+	uint64_t restore_buckets(SampleBuffer & image) const;
+	// Packs the bucket on the calling thread, and queues it to be appended
+	void add_bucket(const NodeBucketResult & result, SampleBuffer & bucket);
+
+	// Passes
+	// Sets every pixel to its sums as they were saved, and returns the passes they hold.
+	// 0 when nothing was saved, and the image is left alone.
+	int restore_passes(SampleBuffer & image) const;
+	// Copies the sums of every pixel on the calling thread, and queues them to be written
+	void save_passes(SampleBuffer & image, int pass);
+	// True once interval seconds have passed since the last save
+	[[nodiscard]] bool is_save_due() const;
+
+	// Blocks until everything queued is written.  Throws if any of it could not be.
+	void flush();
+	// Deletes the file, once what it was for has been written out
+	void remove();
+
+	// Accessors
+	[[nodiscard]] std::string get_path() const;
+	// What the file held when it was opened
+	[[nodiscard]] size_t get_restored_buckets() const;
+	[[nodiscard]] int get_restored_passes() const;
+
+	// Everything that changes the pixels of a render, apart from the scene's objects, which
+	// are left to scene_hash.  Hashing the scene file, or its cache, is enough for those.
+	// Images and environments are only named by the scene, so the size and time of each
+	// file in asset_paths are hashed as well, as ImageMap::graph_hash does.
+	static uint64_t render_hash(const Camera & c, const World & w, uint64_t scene_hash, const std::vector<std::string> & asset_paths = {});
+
+	static const uint32_t VERSION = 1;
+
+private:
+	struct Record
+	{
+		CheckpointRecordType type;
+		int pass;
+		std::string payload;
+	};
+
+	void ck_read_();
+	void ck_write_();
+	void ck_append_(const Record & record);
+	void ck_replace_(const Record & record);
+	void ck_write_header_(std::ofstream & output) const;
+
+	std::string ck_path_;
+	uint64_t ck_render_hash_;
+
+	// Read back when opened
+	std::map<int, std::string> ck_buckets_;
+	std::string ck_passes_;
+	int ck_pass_count_;
+	// Bytes of the file that are whole records, anything after is cut off
+	uint64_t ck_valid_size_;
+
+	// Written by the writer thread, guarded by the mutex
+	std::mutex ck_mutex_;
+	std::condition_variable ck_changed_;
+	std::deque<Record> ck_queue_;
+	bool ck_writing_;
+	bool ck_stopping_;
+	std::string ck_error_;
+	std::ofstream ck_file_;
+	std::thread ck_writer_;
+
+	std::chrono::steady_clock::time_point ck_last_save_;
+};
+
+#endif
@@ -4,6 +4,11 @@
 const double EPSILON = 0.0001;
 
 const int RAY_DEPTH_LIMIT = 5;
+// Paths this deep are ended at random once their throughput gets low
+const int RUSSIAN_ROULETTE_DEPTH = 3;
+// Steps an animated transform is sampled in between each pair of keyframes.  Transforms
+// are blended linearly between steps.
+const int MOTION_STEPS = 16;
 
 const double SAFE_DIV_MIN = EPSILON;
 const double SAFE_DIV_MAX = (1.0f / SAFE_DIV_MIN);
@@ -0,0 +1,243 @@
+#include "pch.h"
+#include "DeadlineScheduler.h"
+
+// ------------------------------------------------------------------------
+//
+// Deadline Scheduler
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+DeadlineScheduler::DeadlineScheduler() : DeadlineScheduler(60.0)
+{
+}
+
+DeadlineScheduler::DeadlineScheduler(double frame_budget)
+{
+	this->frame_budget = frame_budget;
+	this->headroom = 0.05;
+
+	this->ds_full_ = RenderQuality();
+	this->ds_lowest_ = RenderQuality();
+	this->ds_ns_per_sample_ = 0.0;
+
+	this->ds_frame_start_ = std::chrono::steady_clock::now();
+	this->ds_pixels_left_ = 0;
+	this->ds_threads_ = 1;
+	this->ds_lowered_buckets_ = 0;
+	this->ds_frame_ = 0;
+}
+
+DeadlineScheduler::~DeadlineScheduler()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+void DeadlineScheduler::begin_frame(const World & w, int pixel_count, int threads)
+{
+	if (this->frame_budget <= 0.0)
+	{
+		throw std::invalid_argument("The frame budget must be greater than 0");
+	}
+
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	this->ds_full_ = DeadlineScheduler::quality_of(w);
+	this->ds_lowest_ = this->ds_full_;
+
+	this->ds_frame_start_ = std::chrono::steady_clock::now();
+	this->ds_pixels_left_ = pixel_count;
+	this->ds_threads_ = std::max(threads, 1);
+	this->ds_lowered_buckets_ = 0;
+	this->ds_frame_++;
+}
+
+RenderQuality DeadlineScheduler::next_bucket(int pixel_count, int bucket_id)
+{
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	// Nothing has been measured yet
+	if (this->ds_ns_per_sample_ <= 0.0)
+	{
+		return this->ds_full_;
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->ds_frame_start_).count();
+	double time_left = (this->frame_budget * (1.0 - this->headroom)) - elapsed;
+
+	// Pixels still rendering on other threads are counted, they are using up the time left as well
+	double pixels_left = double(std::max(this->ds_pixels_left_, (long long)pixel_count));
+	double ns_per_pixel = std::max(time_left, 0.0) * 1.0e9 * double(this->ds_threads_) / pixels_left;
+	double scale = ns_per_pixel / (this->ds_ns_per_sample_ * double(std::max(this->ds_full_.aa_sample_max, 1)));
+
+	RenderQuality quality = DeadlineScheduler::scale_quality(this->ds_full_, scale);
+
+	if (quality.aa_sample_max < this->ds_full_.aa_sample_max ||
+		quality.shadow_subdivs < this->ds_full_.shadow_subdivs ||
+		quality.max_ray_depth < this->ds_full_.max_ray_depth)
+	{
+		this->ds_lowered_buckets_++;
+
+		this->ds_lowest_.aa_sample_max = std::min(this->ds_lowest_.aa_sample_max, quality.aa_sample_max);
+		this->ds_lowest_.shadow_subdivs = std::min(this->ds_lowest_.shadow_subdivs, quality.shadow_subdivs);
+		this->ds_lowest_.max_ray_depth = std::min(this->ds_lowest_.max_ray_depth, quality.max_ray_depth);
+
+		std::ostringstream oss;
+		oss << "Bucket: " << bucket_id << " Lowered to meet the deadline - " << this->ds_describe_(quality) << std::endl;
+		std::cout << oss.str();
+	}
+
+	return quality;
+}
+
+void DeadlineScheduler::finish_bucket(const RenderQuality & quality, int pixel_count, double seconds)
+{
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	this->ds_pixels_left_ -= pixel_count;
+
+	double samples = double(pixel_count) * double(std::max(quality.aa_sample_max, 1));
+
+	if (samples <= 0.0 || seconds <= 0.0)
+	{
+		return;
+	}
+
+	// Brought back to what a sample would have cost at full quality
+	double measured = (seconds * 1.0e9 / samples) / DeadlineScheduler::relative_cost(quality, this->ds_full_);
+
+	// Buckets vary a lot with what they see, so the estimate follows them slowly
+	this->ds_ns_per_sample_ = (this->ds_ns_per_sample_ <= 0.0) ? measured : (0.75 * this->ds_ns_per_sample_) + (0.25 * measured);
+}
+
+void DeadlineScheduler::end_frame()
+{
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->ds_frame_start_).count();
+
+	std::ostringstream oss;
+	oss << "Frame " << this->ds_frame_ << " finished in " << elapsed << "s of a " << this->frame_budget << "s budget";
+
+	if (this->ds_lowered_buckets_ > 0)
+	{
+		oss << " - " << this->ds_lowered_buckets_ << " buckets lowered, at most " << this->ds_describe_(this->ds_lowest_);
+	}
+	else
+	{
+		oss << " - at full quality";
+	}
+
+	oss << std::endl;
+	std::cout << oss.str();
+}
+
+double DeadlineScheduler::ns_per_sample() const
+{
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	return this->ds_ns_per_sample_;
+}
+
+RenderQuality DeadlineScheduler::full_quality() const
+{
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	return this->ds_full_;
+}
+
+RenderQuality DeadlineScheduler::lowest_quality() const
+{
+	std::lock_guard<std::mutex> lock(this->ds_mutex_);
+
+	return this->ds_lowest_;
+}
+
+// Shadow rays and bounces are each taken as costing about as much as the camera ray
+double DeadlineScheduler::relative_cost(const RenderQuality & quality, const RenderQuality & full)
+{
+	double shadow = double(1 + std::max(quality.shadow_subdivs, 0)) / double(1 + std::max(full.shadow_subdivs, 0));
+	double depth = double(1 + std::max(quality.max_ray_depth, 0)) / double(1 + std::max(full.max_ray_depth, 0));
+
+	return shadow * depth;
+}
+
+RenderQuality DeadlineScheduler::scale_quality(const RenderQuality & full, double scale)
+{
+	RenderQuality quality = full;
+	scale = clip(scale, 0.0, 1.0);
+
+	if (scale >= 1.0)
+	{
+		return quality;
+	}
+
+	// Fewer antialiasing samples, down to one
+	quality.aa_sample_max = clip(int(floor(double(full.aa_sample_max) * scale)), 1, std::max(full.aa_sample_max, 1));
+
+	// What is left has to come out of the cost of each sample
+	double remaining = scale * double(std::max(full.aa_sample_max, 1)) / double(quality.aa_sample_max);
+
+	if (remaining < 1.0 && full.shadow_subdivs > 1)
+	{
+		quality.shadow_subdivs = clip(int(floor(double(1 + full.shadow_subdivs) * remaining)) - 1, 1, full.shadow_subdivs);
+		remaining /= double(1 + quality.shadow_subdivs) / double(1 + full.shadow_subdivs);
+	}
+
+	if (remaining < 1.0 && full.max_ray_depth > 1)
+	{
+		quality.max_ray_depth = clip(int(floor(double(1 + full.max_ray_depth) * remaining)) - 1, 1, full.max_ray_depth);
+	}
+
+	return quality;
+}
+
+RenderQuality DeadlineScheduler::quality_of(const World & w)
+{
+	RenderQuality quality = RenderQuality();
+	quality.aa_sample_max = w.aa_sample_max;
+	quality.shadow_subdivs = w.shadow_subdivs;
+	quality.max_ray_depth = w.max_ray_depth;
+
+	return quality;
+}
+
+void DeadlineScheduler::apply(const RenderQuality & quality, World & w)
+{
+	w.aa_sample_max = quality.aa_sample_max;
+	w.aa_sample_min = std::min(w.aa_sample_min, quality.aa_sample_max);
+	w.shadow_subdivs = quality.shadow_subdivs;
+	w.max_ray_depth = quality.max_ray_depth;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// Lists the settings lower than full, with how far they dropped
+std::string DeadlineScheduler::ds_describe_(const RenderQuality & quality) const
+{
+	std::ostringstream oss;
+	bool first = true;
+
+	auto knob = [&oss, &first](const char * name, int value, int full)
+	{
+		if (value >= full)
+		{
+			return;
+		}
+
+		oss << (first ? "" : ", ") << name << " " << full << " -> " << value
+			<< " (-" << int(std::round(100.0 * double(full - value) / double(full))) << "%)";
+		first = false;
+	};
+
+	knob("aa_sample_max", quality.aa_sample_max, this->ds_full_.aa_sample_max);
+	knob("shadow_subdivs", quality.shadow_subdivs, this->ds_full_.shadow_subdivs);
+	knob("max_ray_depth", quality.max_ray_depth, this->ds_full_.max_ray_depth);
+
+	return oss.str();
+}
@@ -0,0 +1,77 @@
+#ifndef H_RAYMOND_DEADLINESCHEDULER
+#define H_RAYMOND_DEADLINESCHEDULER
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "World.h"
+
+// The settings a deadline render trades away to stay on time
+struct RenderQuality
+{
+	int aa_sample_max;
+	int shadow_subdivs;
+	int max_ray_depth;
+};
+
+// Picks the quality of each bucket so a frame finishes within a wall clock budget.
+// The cost of a sample is measured as buckets finish and carried over from frame to frame,
+// and the time left is shared between the pixels left.  When they cannot all have the
+// scene's own settings, antialiasing samples are lowered first, then shadow subdivisions,
+// then the ray depth.
+class DeadlineScheduler
+{
+public:
+	DeadlineScheduler();
+	explicit DeadlineScheduler(double frame_budget);
+	~DeadlineScheduler();
+
+	// Properties
+	// Seconds per frame
+	double frame_budget;
+	// Fraction of the budget held back for stitching, and for buckets that run long
+	double headroom;
+
+	// Methods
+	// Starts the clock.  The quality in w is the best any bucket is given.
+	void begin_frame(const World & w, int pixel_count, int threads);
+	// Quality for a bucket that is about to start, logged when it is lower than the scene's
+	RenderQuality next_bucket(int pixel_count, int bucket_id);
+	// Folds the bucket's time into the cost of a sample
+	void finish_bucket(const RenderQuality & quality, int pixel_count, double seconds);
+	// Logs the frame time and the lowest quality used
+	void end_frame();
+
+	// Nanoseconds per camera sample at the scene's shadow subdivisions and ray depth,
+	// per thread.  0 until a bucket has finished.
+	double ns_per_sample() const;
+	RenderQuality full_quality() const;
+	RenderQuality lowest_quality() const;
+
+	// Cost of a sample at quality, relative to full.  A rough linear model, the measured
+	// cost corrects for whatever it misses.
+	static double relative_cost(const RenderQuality & quality, const RenderQuality & full);
+	// The best quality whose samples cost at most scale of full's, for a bucket taking
+	// full.aa_sample_max samples per pixel
+	static RenderQuality scale_quality(const RenderQuality & full, double scale);
+	static RenderQuality quality_of(const World & w);
+	static void apply(const RenderQuality & quality, World & w);
+
+private:
+	std::string ds_describe_(const RenderQuality & quality) const;
+
+	mutable std::mutex ds_mutex_;
+
+	RenderQuality ds_full_;
+	RenderQuality ds_lowest_;
+	double ds_ns_per_sample_;
+
+	std::chrono::steady_clock::time_point ds_frame_start_;
+	long long ds_pixels_left_;
+	int ds_threads_;
+	int ds_lowered_buckets_;
+	int ds_frame_;
+};
+
+#endif
@@ -0,0 +1,1146 @@
+#include "pch.h"
+#include "Distributed.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+static const uint32_t NODE_MESSAGE_MAGIC = 0x444F4E52;
+static const uint32_t NODE_PROTOCOL_VERSION = 1;
+static const std::string UNIX_ADDRESS_PREFIX = "unix:";
+
+// ------------------------------------------------------------------------
+//
+// Packed Buckets
+//
+// ------------------------------------------------------------------------
+
+static void pack_color(float * out, const Color & color)
+{
+	out[0] = float(color.x);
+	out[1] = float(color.y);
+	out[2] = float(color.z);
+}
+
+static Color unpack_color(const float * in)
+{
+	return Color(double(in[0]), double(in[1]), double(in[2]));
+}
+
+PackedPixel pack_pixel(const Sample & sample, int samples)
+{
+	PackedPixel out = PackedPixel();
+
+	pack_color(out.rgb, sample.get_current_rgb());
+	pack_color(out.background, sample.Background);
+	pack_color(out.normal, sample.Normal);
+	pack_color(out.position, sample.Position);
+	pack_color(out.diffuse, sample.Diffuse);
+	pack_color(out.specular, sample.Specular);
+	pack_color(out.lighting, sample.Lighting);
+	pack_color(out.global_illumination, sample.GlobalIllumination);
+	pack_color(out.reflection, sample.Reflection);
+	pack_color(out.refraction, sample.Refraction);
+
+	out.alpha = float(sample.Alpha);
+	out.depth = float(sample.Depth);
+	out.time = float(sample.Time);
+	out.rays = float(sample.Rays);
+	out.reflection_filter = float(sample.ReflectionFilter);
+	out.refraction_filter = float(sample.RefractionFilter);
+	out.bucket_id = sample.BucketID;
+	out.samples = samples;
+
+	return out;
+}
+
+Sample unpack_pixel(const PackedPixel & in)
+{
+	Sample sample = Sample();
+
+	sample.set_rgb(unpack_color(in.rgb));
+	sample.Background = unpack_color(in.background);
+	sample.Normal = unpack_color(in.normal);
+	sample.Position = unpack_color(in.position);
+	sample.Diffuse = unpack_color(in.diffuse);
+	sample.Specular = unpack_color(in.specular);
+	sample.Lighting = unpack_color(in.lighting);
+	sample.GlobalIllumination = unpack_color(in.global_illumination);
+	sample.Reflection = unpack_color(in.reflection);
+	sample.Refraction = unpack_color(in.refraction);
+
+	sample.Alpha = double(in.alpha);
+	sample.Depth = double(in.depth);
+	sample.Time = double(in.time);
+	sample.Rays = double(in.rays);
+	sample.ReflectionFilter = double(in.reflection_filter);
+	sample.RefractionFilter = double(in.refraction_filter);
+	sample.BucketID = in.bucket_id;
+
+	return sample;
+}
+
+std::string pack_bucket(const NodeBucketResult & result, SampleBuffer & bucket)
+{
+	const int width = result.bucket.width;
+	const int height = result.bucket.height;
+
+	std::string packed = std::string(sizeof(NodeBucketResult) + size_t(width) * size_t(height) * sizeof(PackedPixel), '\0');
+	memcpy(packed.data(), &result, sizeof(NodeBucketResult));
+
+	auto * pixels = reinterpret_cast<PackedPixel *>(packed.data() + sizeof(NodeBucketResult));
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const std::shared_ptr<SampledPixel> pixel = bucket.pixel_at(x, y);
+			pixels[y * width + x] = pack_pixel(pixel->get_calculated_average(), pixel->sample_count());
+		}
+	}
+
+	return packed;
+}
+
+NodeBucketResult unpack_bucket(const std::string & packed, SampleBuffer & image)
+{
+	NodeBucketResult result = NodeBucketResult();
+
+	if (packed.size() < sizeof(NodeBucketResult))
+	{
+		throw std::runtime_error("Packed bucket is too short");
+	}
+
+	memcpy(&result, packed.data(), sizeof(NodeBucketResult));
+
+	const NodeBucket & bucket = result.bucket;
+
+	if (bucket.width <= 0 || bucket.height <= 0 || bucket.x < 0 || bucket.y < 0 || bucket.x + bucket.width > image.width() || bucket.y + bucket.height > image.height())
+	{
+		throw std::runtime_error("Packed bucket " + std::to_string(bucket.id) + " is outside the frame");
+	}
+
+	if (packed.size() != sizeof(NodeBucketResult) + size_t(bucket.width) * size_t(bucket.height) * sizeof(PackedPixel))
+	{
+		throw std::runtime_error("Packed bucket " + std::to_string(bucket.id) + " is the wrong size");
+	}
+
+	const auto * pixels = reinterpret_cast<const PackedPixel *>(packed.data() + sizeof(NodeBucketResult));
+
+	for (int y = 0; y < bucket.height; y++)
+	{
+		for (int x = 0; x < bucket.width; x++)
+		{
+			const PackedPixel & in = pixels[y * bucket.width + x];
+
+			auto pixel = std::make_shared<SampledPixel>();
+			pixel->set_average(unpack_pixel(in), in.samples);
+			image.write_pixel(bucket.x + x, bucket.y + y, pixel);
+		}
+	}
+
+	return result;
+}
+
+// ------------------------------------------------------------------------
+//
+// Node Socket
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+NodeSocket::NodeSocket() : NodeSocket(-1)
+{
+}
+
+NodeSocket::NodeSocket(int descriptor)
+{
+	this->ns_descriptor_ = descriptor;
+}
+
+NodeSocket::NodeSocket(NodeSocket && src) noexcept
+{
+	this->ns_descriptor_ = src.ns_descriptor_;
+	this->ns_unix_path_ = std::move(src.ns_unix_path_);
+	this->ns_address_ = std::move(src.ns_address_);
+
+	src.ns_descriptor_ = -1;
+	src.ns_unix_path_.clear();
+}
+
+NodeSocket & NodeSocket::operator=(NodeSocket && src) noexcept
+{
+	if (this != &src)
+	{
+		this->close();
+
+		this->ns_descriptor_ = src.ns_descriptor_;
+		this->ns_unix_path_ = std::move(src.ns_unix_path_);
+		this->ns_address_ = std::move(src.ns_address_);
+
+		src.ns_descriptor_ = -1;
+		src.ns_unix_path_.clear();
+	}
+
+	return *this;
+}
+
+NodeSocket::~NodeSocket()
+{
+	this->close();
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+void NodeSocket::send_message(NodeMessage type, const std::string & payload)
+{
+	NodeMessageHeader header = NodeMessageHeader();
+	header.magic = NODE_MESSAGE_MAGIC;
+	header.type = type;
+	header.size = payload.size();
+
+	this->ns_send_(&header, sizeof(header));
+	this->ns_send_(payload.data(), payload.size());
+}
+
+NodeMessage NodeSocket::receive_message(std::string & payload, double timeout)
+{
+	NodeMessageHeader header = NodeMessageHeader();
+	this->ns_receive_(&header, sizeof(header), timeout);
+
+	if (header.magic != NODE_MESSAGE_MAGIC || header.type > NodeDoneMessage)
+	{
+		throw std::runtime_error("Not a render node message");
+	}
+
+	payload.resize(size_t(header.size));
+	this->ns_receive_(payload.data(), payload.size(), timeout);
+
+	return NodeMessage(header.type);
+}
+
+bool NodeSocket::is_open() const
+{
+	return this->ns_descriptor_ >= 0;
+}
+
+std::string NodeSocket::bound_address() const
+{
+	return this->ns_address_;
+}
+
+#ifndef _WIN32
+
+// Splits host:port at the last colon, so a bare port listens everywhere
+static void split_address(const std::string & address, std::string & host, std::string & port)
+{
+	const size_t colon = address.rfind(':');
+
+	if (colon == std::string::npos)
+	{
+		throw std::runtime_error("Render node addresses are host:port or unix:/path, not " + address);
+	}
+
+	host = address.substr(0, colon);
+	port = address.substr(colon + 1);
+}
+
+static sockaddr_un unix_socket_address(const std::string & path)
+{
+	sockaddr_un socket_address = sockaddr_un();
+	socket_address.sun_family = AF_UNIX;
+
+	if (path.empty() || path.size() >= sizeof(socket_address.sun_path))
+	{
+		throw std::runtime_error("Unix socket path is empty or too long: " + path);
+	}
+
+	memcpy(socket_address.sun_path, path.c_str(), path.size() + 1);
+	return socket_address;
+}
+
+static void configure_socket(int descriptor, bool tcp)
+{
+	int on = 1;
+
+	// Buckets are sent whole, there is nothing to gain from waiting to fill a packet
+	if (tcp)
+	{
+		setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+
+#ifdef SO_NOSIGPIPE
+	setsockopt(descriptor, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+NodeSocket NodeSocket::connect(const std::string & address)
+{
+	if (address.rfind(UNIX_ADDRESS_PREFIX, 0) == 0)
+	{
+		const sockaddr_un socket_address = unix_socket_address(address.substr(UNIX_ADDRESS_PREFIX.size()));
+		NodeSocket result = NodeSocket(::socket(AF_UNIX, SOCK_STREAM, 0));
+
+		if (!result.is_open() || ::connect(result.ns_descriptor_, reinterpret_cast<const sockaddr *>(&socket_address), sizeof(socket_address)) != 0)
+		{
+			throw std::runtime_error("Cannot connect to " + address + ": " + strerror(errno));
+		}
+
+		configure_socket(result.ns_descriptor_, false);
+		result.ns_address_ = address;
+		return result;
+	}
+
+	std::string host, port;
+	split_address(address, host, port);
+
+	addrinfo hints = addrinfo();
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo * found = nullptr;
+	if (getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &found) != 0)
+	{
+		throw std::runtime_error("Cannot resolve " + address);
+	}
+
+	NodeSocket result;
+
+	for (addrinfo * info = found; info != nullptr && !result.is_open(); info = info->ai_next)
+	{
+		NodeSocket attempt = NodeSocket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+
+		if (attempt.is_open() && ::connect(attempt.ns_descriptor_, info->ai_addr, info->ai_addrlen) == 0)
+		{
+			result = std::move(attempt);
+		}
+	}
+
+	freeaddrinfo(found);
+
+	if (!result.is_open())
+	{
+		throw std::runtime_error("Cannot connect to " + address + ": " + strerror(errno));
+	}
+
+	configure_socket(result.ns_descriptor_, true);
+	result.ns_address_ = address;
+	return result;
+}
+
+NodeSocket NodeSocket::listen(const std::string & address)
+{
+	if (address.rfind(UNIX_ADDRESS_PREFIX, 0) == 0)
+	{
+		const std::string path = address.substr(UNIX_ADDRESS_PREFIX.size());
+		const sockaddr_un socket_address = unix_socket_address(path);
+		NodeSocket result = NodeSocket(::socket(AF_UNIX, SOCK_STREAM, 0));
+
+		// A socket file left behind by a coordinator that did not shut down would stop the bind
+		::unlink(path.c_str());
+
+		if (!result.is_open() || ::bind(result.ns_descriptor_, reinterpret_cast<const sockaddr *>(&socket_address), sizeof(socket_address)) != 0 || ::listen(result.ns_descriptor_, SOMAXCONN) != 0)
+		{
+			throw std::runtime_error("Cannot listen on " + address + ": " + strerror(errno));
+		}
+
+		result.ns_unix_path_ = path;
+		result.ns_address_ = address;
+		return result;
+	}
+
+	std::string host, port;
+	split_address(address, host, port);
+
+	addrinfo hints = addrinfo();
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	addrinfo * found = nullptr;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0)
+	{
+		throw std::runtime_error("Cannot resolve " + address);
+	}
+
+	NodeSocket result;
+
+	for (addrinfo * info = found; info != nullptr && !result.is_open(); info = info->ai_next)
+	{
+		NodeSocket attempt = NodeSocket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+
+		int on = 1;
+		if (attempt.is_open() &&
+			setsockopt(attempt.ns_descriptor_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+			::bind(attempt.ns_descriptor_, info->ai_addr, info->ai_addrlen) == 0 &&
+			::listen(attempt.ns_descriptor_, SOMAXCONN) == 0)
+		{
+			result = std::move(attempt);
+		}
+	}
+
+	freeaddrinfo(found);
+
+	if (!result.is_open())
+	{
+		throw std::runtime_error("Cannot listen on " + address + ": " + strerror(errno));
+	}
+
+	// Port 0 was given one by the system
+	sockaddr_storage bound = sockaddr_storage();
+	socklen_t bound_size = sizeof(bound);
+	getsockname(result.ns_descriptor_, reinterpret_cast<sockaddr *>(&bound), &bound_size);
+
+	const uint16_t bound_port = (bound.ss_family == AF_INET6) ?
+		ntohs(reinterpret_cast<const sockaddr_in6 *>(&bound)->sin6_port) :
+		ntohs(reinterpret_cast<const sockaddr_in *>(&bound)->sin_port);
+
+	result.ns_address_ = host + ":" + std::to_string(bound_port);
+	return result;
+}
+
+NodeSocket NodeSocket::accept(double timeout) const
+{
+	pollfd waiting = { this->ns_descriptor_, POLLIN, 0 };
+
+	if (::poll(&waiting, 1, int(timeout * 1000.0)) <= 0)
+	{
+		return NodeSocket();
+	}
+
+	NodeSocket result = NodeSocket(::accept(this->ns_descriptor_, nullptr, nullptr));
+
+	if (result.is_open())
+	{
+		configure_socket(result.ns_descriptor_, this->ns_unix_path_.empty());
+		result.ns_address_ = this->ns_address_;
+	}
+
+	return result;
+}
+
+void NodeSocket::shutdown()
+{
+	if (this->is_open())
+	{
+		::shutdown(this->ns_descriptor_, SHUT_RDWR);
+	}
+}
+
+void NodeSocket::close()
+{
+	if (this->is_open())
+	{
+		::close(this->ns_descriptor_);
+		this->ns_descriptor_ = -1;
+	}
+
+	if (!this->ns_unix_path_.empty())
+	{
+		::unlink(this->ns_unix_path_.c_str());
+		this->ns_unix_path_.clear();
+	}
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void NodeSocket::ns_send_(const void * data, size_t size)
+{
+	const char * bytes = static_cast<const char *>(data);
+
+	while (size > 0)
+	{
+		const ssize_t sent = ::send(this->ns_descriptor_, bytes, size, MSG_NOSIGNAL);
+
+		if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (sent <= 0)
+		{
+			throw std::runtime_error("Lost connection to " + this->ns_address_);
+		}
+
+		bytes += sent;
+		size -= size_t(sent);
+	}
+}
+
+void NodeSocket::ns_receive_(void * data, size_t size, double timeout)
+{
+	char * bytes = static_cast<char *>(data);
+
+	while (size > 0)
+	{
+		pollfd waiting = { this->ns_descriptor_, POLLIN, 0 };
+		const int ready = ::poll(&waiting, 1, (timeout > 0.0) ? int(timeout * 1000.0) : -1);
+
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ready == 0)
+		{
+			throw std::runtime_error("Timed out waiting for " + this->ns_address_);
+		}
+
+		const ssize_t received = (ready > 0) ? ::recv(this->ns_descriptor_, bytes, size, 0) : -1;
+
+		if (received < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (received <= 0)
+		{
+			throw std::runtime_error("Lost connection to " + this->ns_address_);
+		}
+
+		bytes += received;
+		size -= size_t(received);
+	}
+}
+
+#else
+
+NodeSocket NodeSocket::connect(const std::string & address)
+{
+	throw std::runtime_error("Render nodes need POSIX sockets, cannot connect to " + address);
+}
+
+NodeSocket NodeSocket::listen(const std::string & address)
+{
+	throw std::runtime_error("Render nodes need POSIX sockets, cannot listen on " + address);
+}
+
+NodeSocket NodeSocket::accept(double timeout) const
+{
+	return NodeSocket();
+}
+
+void NodeSocket::shutdown()
+{
+}
+
+void NodeSocket::close()
+{
+	this->ns_descriptor_ = -1;
+}
+
+void NodeSocket::ns_send_(const void * data, size_t size)
+{
+	throw std::runtime_error("Render nodes need POSIX sockets");
+}
+
+void NodeSocket::ns_receive_(void * data, size_t size, double timeout)
+{
+	throw std::runtime_error("Render nodes need POSIX sockets");
+}
+
+#endif
+
+// ------------------------------------------------------------------------
+//
+// Render Coordinator
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+RenderCoordinator::RenderCoordinator(const std::string & address, std::ostream & output) : rc_output_(output)
+{
+	this->node_timeout = 300.0;
+	this->idle_timeout = 60.0;
+	this->max_attempts = 3;
+
+	this->rc_remaining_ = 0;
+	this->rc_active_nodes_ = 0;
+	this->rc_nodes_served_ = 0;
+	this->rc_nodes_lost_ = 0;
+	this->rc_buckets_retried_ = 0;
+
+	this->rc_scene_data_ = nullptr;
+	this->rc_image_ = nullptr;
+	this->rc_stats_ = nullptr;
+	this->rc_progress_ = nullptr;
+
+	this->rc_listener_ = NodeSocket::listen(address);
+}
+
+RenderCoordinator::~RenderCoordinator()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+SampleBuffer RenderCoordinator::render(const std::string & scene_path, RenderStats & stats)
+{
+	using clock = std::chrono::steady_clock;
+	auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+	const auto render_start = clock::now();
+
+	// The nodes are sent the compiled scene, so it has to be in a cache that is current
+	const Scene scene = SceneCache::load(scene_path);
+	const std::string cache_path = SceneCache::cache_path_for(scene_path);
+
+	{
+		SceneCache cache = SceneCache(cache_path);
+
+		if (!cache.is_valid())
+		{
+			throw std::runtime_error("Cannot write the scene cache the render nodes are sent: " + cache_path);
+		}
+
+		// Nodes are only sent the cache, so they would have to find images where they are here
+		const std::vector<std::string> assets = cache.asset_paths();
+
+		if (!assets.empty())
+		{
+			throw std::runtime_error("Render nodes cannot read the images the scene uses, such as " + assets[0]);
+		}
+	}
+
+	std::string scene_data;
+	{
+		MappedFile cache_file = MappedFile(cache_path);
+		scene_data.assign(cache_file.data(), cache_file.size());
+	}
+
+	const World & w = scene.world;
+	const Camera & c = scene.camera;
+	const int width = c.get_horizontal_size();
+	const int height = c.get_vertical_size();
+	const int bucket_size = std::max(w.bucket_size, 1);
+
+	SampleBuffer image = c.frame_buffer();
+	const PixelRect crop = c.get_crop_window();
+	ProgressReporter progress = ProgressReporter("Rendering on nodes", uint64_t(crop.width) * uint64_t(crop.height), this->rc_output_);
+
+	{
+		std::lock_guard<std::mutex> lock(this->rc_mutex_);
+
+		this->rc_queue_.clear();
+
+		for (int y = 0; y < height; y += bucket_size)
+		{
+			for (int x = 0; x < width; x += bucket_size)
+			{
+				Job job = Job();
+				job.bucket.id = int(this->rc_queue_.size()) + 1;
+				job.bucket.x = x;
+				job.bucket.y = y;
+				job.bucket.width = std::min(bucket_size, width - x);
+				job.bucket.height = std::min(bucket_size, height - y);
+				job.attempts = 0;
+
+				// Only what is inside the camera's crop window is sent out
+				if (!c.clip_to_crop_window(job.bucket.x, job.bucket.y, job.bucket.width, job.bucket.height))
+				{
+					continue;
+				}
+
+				this->rc_queue_.push_back(job);
+			}
+		}
+
+		this->rc_remaining_ = this->rc_queue_.size();
+		this->rc_failure_.clear();
+		this->rc_active_nodes_ = 0;
+		this->rc_nodes_served_ = 0;
+		this->rc_nodes_lost_ = 0;
+		this->rc_buckets_retried_ = 0;
+
+		this->rc_scene_data_ = &scene_data;
+		this->rc_image_ = &image;
+		this->rc_stats_ = &stats;
+		this->rc_progress_ = &progress;
+	}
+
+	progress.start();
+
+	std::vector<std::unique_ptr<NodeSocket>> nodes;
+	std::vector<std::thread> node_threads;
+	auto idle_since = clock::now();
+
+	// Nodes are taken on until the last bucket is in, each served by a thread of its own
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->rc_mutex_);
+
+			if (this->rc_remaining_ == 0 || !this->rc_failure_.empty())
+			{
+				break;
+			}
+
+			if (this->rc_active_nodes_ > 0)
+			{
+				idle_since = clock::now();
+			}
+			else if (seconds_since(idle_since) > this->idle_timeout)
+			{
+				this->rc_failure_ = "No render node connected to " + this->get_address() + " for " + std::to_string(int(this->idle_timeout)) + " seconds";
+				break;
+			}
+		}
+
+		NodeSocket node = this->rc_listener_.accept(0.1);
+
+		if (node.is_open())
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->rc_mutex_);
+				this->rc_active_nodes_++;
+				this->rc_nodes_served_++;
+			}
+
+			nodes.push_back(std::make_unique<NodeSocket>(std::move(node)));
+			node_threads.emplace_back(&RenderCoordinator::rc_serve_node_, this, nodes.back().get());
+		}
+	}
+
+	bool failed;
+	{
+		std::lock_guard<std::mutex> lock(this->rc_mutex_);
+		failed = !this->rc_failure_.empty();
+	}
+
+	// Idle nodes are told the frame is done.  After a failure, nodes still rendering are cut off.
+	this->rc_changed_.notify_all();
+
+	if (failed)
+	{
+		for (std::unique_ptr<NodeSocket> & node : nodes)
+		{
+			node->shutdown();
+		}
+	}
+
+	for (std::thread & thread : node_threads)
+	{
+		thread.join();
+	}
+
+	progress.finish();
+
+	this->rc_scene_data_ = nullptr;
+	this->rc_image_ = nullptr;
+	this->rc_stats_ = nullptr;
+	this->rc_progress_ = nullptr;
+
+	if (failed)
+	{
+		throw std::runtime_error(this->rc_failure_);
+	}
+
+	stats.wall_seconds = seconds_since(render_start);
+	stats.measure_image(image);
+
+	return image;
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+std::string RenderCoordinator::get_address() const
+{
+	return this->rc_listener_.bound_address();
+}
+
+int RenderCoordinator::get_nodes_served() const
+{
+	return this->rc_nodes_served_;
+}
+
+int RenderCoordinator::get_nodes_lost() const
+{
+	return this->rc_nodes_lost_;
+}
+
+int RenderCoordinator::get_buckets_retried() const
+{
+	return this->rc_buckets_retried_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void RenderCoordinator::rc_serve_node_(NodeSocket * socket)
+{
+	std::vector<Job> in_flight;
+	bool finished = false;
+
+	try
+	{
+		std::string payload;
+		NodeHello hello = NodeHello();
+
+		if (socket->receive_message(payload, this->node_timeout) != NodeHelloMessage || payload.size() != sizeof(NodeHello))
+		{
+			throw std::runtime_error("Render node did not say hello");
+		}
+
+		memcpy(&hello, payload.data(), sizeof(NodeHello));
+
+		if (hello.version != NODE_PROTOCOL_VERSION)
+		{
+			throw std::runtime_error("Render node speaks another version");
+		}
+
+		socket->send_message(NodeSceneMessage, *this->rc_scene_data_);
+
+		// Every thread of the node is kept in work, with a bucket each
+		const size_t slots = size_t(std::max(hello.threads, 1));
+
+		while (true)
+		{
+			Job job = Job();
+
+			while (in_flight.size() < slots && this->rc_take_job_(job, in_flight.empty()))
+			{
+				socket->send_message(NodeBucketMessage, std::string(reinterpret_cast<const char *>(&job.bucket), sizeof(NodeBucket)));
+				in_flight.push_back(job);
+			}
+
+			if (in_flight.empty())
+			{
+				finished = true;
+				socket->send_message(NodeDoneMessage, std::string());
+				break;
+			}
+
+			if (socket->receive_message(payload, this->node_timeout) != NodeResultMessage || payload.size() < sizeof(NodeBucketResult))
+			{
+				throw std::runtime_error("Render node sent something other than a bucket");
+			}
+
+			// Only buckets the node was given are written into the frame
+			NodeBucketResult result = NodeBucketResult();
+			memcpy(&result, payload.data(), sizeof(NodeBucketResult));
+
+			auto sent = std::find_if(in_flight.begin(), in_flight.end(), [&result](const Job & j)
+			{
+				return j.bucket.id == result.bucket.id && j.bucket.x == result.bucket.x && j.bucket.y == result.bucket.y &&
+					j.bucket.width == result.bucket.width && j.bucket.height == result.bucket.height;
+			});
+
+			if (sent == in_flight.end())
+			{
+				throw std::runtime_error("Render node sent a bucket it was not given");
+			}
+
+			// Buckets do not overlap, so they are written without the lock
+			unpack_bucket(payload, *this->rc_image_);
+			in_flight.erase(sent);
+
+			BucketStats bucket_stats = BucketStats();
+			bucket_stats.id = result.bucket.id;
+			bucket_stats.x = result.bucket.x;
+			bucket_stats.y = result.bucket.y;
+			bucket_stats.width = result.bucket.width;
+			bucket_stats.height = result.bucket.height;
+			bucket_stats.seconds = result.seconds;
+			bucket_stats.counters = result.counters;
+
+			this->rc_progress_->advance(uint64_t(result.bucket.width) * uint64_t(result.bucket.height));
+			this->rc_progress_->add_rays(result.counters.total_rays());
+
+			std::lock_guard<std::mutex> lock(this->rc_mutex_);
+			this->rc_stats_->add_bucket(bucket_stats);
+
+			if (--this->rc_remaining_ == 0)
+			{
+				this->rc_changed_.notify_all();
+			}
+		}
+	}
+	catch (const std::exception &)
+	{
+		// A node that goes after the frame is done has lost nothing
+		if (!finished)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->rc_mutex_);
+				this->rc_nodes_lost_++;
+			}
+
+			this->rc_return_jobs_(in_flight);
+		}
+	}
+
+	socket->close();
+
+	std::lock_guard<std::mutex> lock(this->rc_mutex_);
+	this->rc_active_nodes_--;
+	this->rc_changed_.notify_all();
+}
+
+bool RenderCoordinator::rc_take_job_(Job & job, bool wait)
+{
+	std::unique_lock<std::mutex> lock(this->rc_mutex_);
+
+	// Buckets still out on other nodes can come back to the queue, so a node without work waits
+	// for the frame to finish rather than leaving
+	if (wait)
+	{
+		this->rc_changed_.wait(lock, [this]() { return !this->rc_queue_.empty() || this->rc_remaining_ == 0 || !this->rc_failure_.empty(); });
+	}
+
+	if (this->rc_queue_.empty() || !this->rc_failure_.empty())
+	{
+		return false;
+	}
+
+	job = this->rc_queue_.front();
+	this->rc_queue_.pop_front();
+
+	return true;
+}
+
+void RenderCoordinator::rc_return_jobs_(const std::vector<Job> & jobs)
+{
+	std::lock_guard<std::mutex> lock(this->rc_mutex_);
+
+	for (Job job : jobs)
+	{
+		job.attempts++;
+
+		if (job.attempts >= this->max_attempts)
+		{
+			this->rc_failure_ = "Bucket " + std::to_string(job.bucket.id) + " was lost by " + std::to_string(job.attempts) + " render nodes";
+		}
+		else
+		{
+			// Lost buckets go first, they are holding the frame up
+			this->rc_queue_.push_front(job);
+			this->rc_buckets_retried_++;
+		}
+	}
+
+	this->rc_changed_.notify_all();
+}
+
+// ------------------------------------------------------------------------
+//
+// Render Node
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+RenderNode::RenderNode(int threads)
+{
+	this->connect_timeout = 10.0;
+	this->rn_threads_ = (threads > 0) ? threads : std::max(int(std::thread::hardware_concurrency()), 1);
+}
+
+RenderNode::~RenderNode()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+int RenderNode::run(const std::string & address)
+{
+	using clock = std::chrono::steady_clock;
+
+	// Nodes are often started alongside the coordinator, and may be up first
+	const auto connect_start = clock::now();
+	NodeSocket socket;
+
+	while (!socket.is_open())
+	{
+		try
+		{
+			socket = NodeSocket::connect(address);
+		}
+		catch (const std::runtime_error &)
+		{
+			if (std::chrono::duration<double>(clock::now() - connect_start).count() > this->connect_timeout)
+			{
+				throw;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+
+	NodeHello hello = NodeHello();
+	hello.version = NODE_PROTOCOL_VERSION;
+	hello.threads = this->rn_threads_;
+	socket.send_message(NodeHelloMessage, std::string(reinterpret_cast<const char *>(&hello), sizeof(NodeHello)));
+
+	std::string payload;
+	if (socket.receive_message(payload, 0.0) != NodeSceneMessage)
+	{
+		throw std::runtime_error("Coordinator at " + address + " did not send a scene");
+	}
+
+	// Built straight from the bytes, the files the scene was read from are on the coordinator
+	Scene scene;
+	{
+		SceneCache cache = SceneCache::from_bytes(payload, "scene from " + address);
+
+		if (!cache.is_valid())
+		{
+			throw std::runtime_error("The scene from " + address + " cannot be built here, it is from another build of Raymond");
+		}
+
+		scene = cache.build();
+	}
+
+	payload.clear();
+
+	const World & w = scene.world;
+	const Camera & c = scene.camera;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<NodeBucket> queue;
+	bool stopping = false;
+	int rendered = 0;
+	std::exception_ptr error;
+
+	// Results are sent from the render threads, one at a time
+	std::mutex send_mutex;
+
+	auto fail = [&](std::exception_ptr failure)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (!error)
+		{
+			error = failure;
+		}
+
+		stopping = true;
+		queue.clear();
+		changed.notify_all();
+	};
+
+	auto render_buckets = [&]()
+	{
+		while (true)
+		{
+			NodeBucket bucket = NodeBucket();
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]() { return stopping || !queue.empty(); });
+
+				if (queue.empty())
+				{
+					return;
+				}
+
+				bucket = queue.front();
+				queue.pop_front();
+			}
+
+			try
+			{
+				const RenderCounters counters_before = thread_counters();
+				auto bucket_start = clock::now();
+
+				SampleBuffer image = c.multi_sample_render_bucket(w, bucket.x, bucket.y, bucket.width, bucket.height, bucket.id);
+
+				NodeBucketResult result = NodeBucketResult();
+				result.bucket = bucket;
+				result.seconds = std::chrono::duration<double>(clock::now() - bucket_start).count();
+				result.counters = thread_counters() - counters_before;
+
+				const std::string packed = pack_bucket(result, image);
+				{
+					std::lock_guard<std::mutex> send_lock(send_mutex);
+					socket.send_message(NodeResultMessage, packed);
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				rendered++;
+			}
+			catch (...)
+			{
+				fail(std::current_exception());
+				// Wakes the receiving thread
+				socket.shutdown();
+				return;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < this->rn_threads_; i++)
+	{
+		threads.emplace_back(render_buckets);
+	}
+
+	try
+	{
+		while (true)
+		{
+			const NodeMessage type = socket.receive_message(payload, 0.0);
+
+			if (type == NodeDoneMessage)
+			{
+				break;
+			}
+
+			if (type != NodeBucketMessage || payload.size() != sizeof(NodeBucket))
+			{
+				throw std::runtime_error("Coordinator at " + address + " sent something other than a bucket");
+			}
+
+			NodeBucket bucket = NodeBucket();
+			memcpy(&bucket, payload.data(), sizeof(NodeBucket));
+
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(bucket);
+			changed.notify_one();
+		}
+	}
+	catch (...)
+	{
+		fail(std::current_exception());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+
+	for (std::thread & thread : threads)
+	{
+		thread.join();
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	return rendered;
+}
@@ -0,0 +1,230 @@
+#ifndef H_RAYMOND_DISTRIBUTED
+#define H_RAYMOND_DISTRIBUTED
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Camera.h"
+#include "World.h"
+#include "SampleBuffer.h"
+#include "RenderStats.h"
+#include "ProgressReporter.h"
+
+// Messages between a coordinator and its render nodes.  Every message is a header and then
+// size bytes of payload.  Payloads are plain structs in the byte order of the machine, the
+// same as a scene cache, so every node has to be the same build on the same kind of machine.
+enum NodeMessage : uint32_t
+{
+	// Node to coordinator, a NodeHello
+	NodeHelloMessage,
+	// Coordinator to node, the bytes of a scene cache
+	NodeSceneMessage,
+	// Coordinator to node, a NodeBucket to render
+	NodeBucketMessage,
+	// Node to coordinator, a NodeBucketResult and then the bucket's PackedPixels
+	NodeResultMessage,
+	// Coordinator to node, the frame is finished and the node can leave
+	NodeDoneMessage
+};
+
+struct NodeMessageHeader
+{
+	uint32_t magic;
+	uint32_t type;
+	uint64_t size;
+};
+
+struct NodeHello
+{
+	uint32_t version;
+	// Buckets the node renders at once, and so how many it is sent ahead
+	int32_t threads;
+};
+
+struct NodeBucket
+{
+	int32_t id;
+	int32_t x, y, width, height;
+	int32_t padding;
+};
+
+struct NodeBucketResult
+{
+	NodeBucket bucket;
+	double seconds;
+	RenderCounters counters;
+};
+
+// The average of one pixel's samples, in floats.  All a coordinator needs to stitch and
+// write every channel, at a fraction of the size of the samples it came from.
+struct PackedPixel
+{
+	float rgb[3];
+	float background[3];
+	float normal[3];
+	float position[3];
+	float diffuse[3];
+	float specular[3];
+	float lighting[3];
+	float global_illumination[3];
+	float reflection[3];
+	float refraction[3];
+	float alpha, depth, time, rays, reflection_filter, refraction_filter;
+	int32_t bucket_id;
+	int32_t samples;
+};
+
+// One pixel's average, or its running sum, and the samples behind it
+PackedPixel pack_pixel(const Sample & sample, int samples);
+Sample unpack_pixel(const PackedPixel & packed);
+
+// Packs the pixels of a rendered bucket behind its result
+std::string pack_bucket(const NodeBucketResult & result, SampleBuffer & bucket);
+// Writes the pixels of a packed bucket into the frame, where the bucket is, and returns its result
+NodeBucketResult unpack_bucket(const std::string & packed, SampleBuffer & image);
+
+// One end of a connection between a coordinator and a node, or a coordinator's listening
+// socket.  Addresses are "host:port" for TCP, or "unix:/path" for a Unix socket, which is
+// quicker for nodes on the same machine.  Errors throw a runtime_error.
+class NodeSocket
+{
+public:
+	NodeSocket();
+	explicit NodeSocket(int descriptor);
+	NodeSocket(NodeSocket && src) noexcept;
+	NodeSocket & operator=(NodeSocket && src) noexcept;
+	~NodeSocket();
+
+	NodeSocket(const NodeSocket &) = delete;
+	NodeSocket & operator=(const NodeSocket &) = delete;
+
+	// Methods
+	static NodeSocket connect(const std::string & address);
+	// Port 0 picks a free port, see bound_address
+	static NodeSocket listen(const std::string & address);
+	// Waits up to timeout seconds, and returns a closed socket when nobody connected
+	NodeSocket accept(double timeout) const;
+
+	// Throws when the connection is lost, or when timeout seconds pass without any data.
+	// A timeout of 0 waits for as long as it takes.
+	void send_message(NodeMessage type, const std::string & payload);
+	NodeMessage receive_message(std::string & payload, double timeout);
+
+	// Wakes a thread blocked on the socket, which then throws
+	void shutdown();
+	void close();
+
+	[[nodiscard]] bool is_open() const;
+	// Where a listening socket is, with the port it was given
+	[[nodiscard]] std::string bound_address() const;
+
+private:
+	void ns_send_(const void * data, size_t size);
+	void ns_receive_(void * data, size_t size, double timeout);
+
+	int ns_descriptor_;
+	// Removed when a listening Unix socket closes
+	std::string ns_unix_path_;
+	std::string ns_address_;
+};
+
+// Splits one frame between render nodes in other processes or on other machines.  The scene
+// is compiled into a scene cache once and the same bytes are sent to every node, which
+// builds it without parsing.  Images are not sent, so scenes that use image maps or an
+// environment are refused.  Nodes are then kept busy with buckets and send back each
+// bucket's pixels as PackedPixels, which are stitched into the frame as they arrive.
+//
+// A node that disconnects, or holds buckets for longer than node_timeout without sending
+// one back, is dropped and its buckets go back on the queue for the other nodes.  Nodes can
+// join at any point in the render.
+class RenderCoordinator
+{
+public:
+	// Starts listening straight away, so nodes can connect before render is called
+	explicit RenderCoordinator(const std::string & address, std::ostream & output = std::cout);
+	~RenderCoordinator();
+
+	RenderCoordinator(const RenderCoordinator &) = delete;
+	RenderCoordinator & operator=(const RenderCoordinator &) = delete;
+
+	// Properties
+	// Seconds a node can hold buckets without returning one before it is dropped
+	double node_timeout;
+	// Seconds to wait with buckets left and no node connected, before the render fails
+	double idle_timeout;
+	// Nodes a bucket is sent to before the render fails, so a bucket that brings down every
+	// node does not go round for ever
+	int max_attempts;
+
+	// Methods
+	// Renders the camera of the scene file on whichever nodes connect
+	SampleBuffer render(const std::string & scene_path, RenderStats & stats);
+
+	// Accessors
+	// Where nodes connect to, with the port that was picked
+	[[nodiscard]] std::string get_address() const;
+	// Of the last render
+	[[nodiscard]] int get_nodes_served() const;
+	[[nodiscard]] int get_nodes_lost() const;
+	[[nodiscard]] int get_buckets_retried() const;
+
+private:
+	struct Job
+	{
+		NodeBucket bucket;
+		int attempts;
+	};
+
+	void rc_serve_node_(NodeSocket * socket);
+	// Blocks until there is a bucket to send or the frame is done, false when it is done
+	bool rc_take_job_(Job & job, bool wait);
+	void rc_return_jobs_(const std::vector<Job> & jobs);
+
+	NodeSocket rc_listener_;
+	std::ostream & rc_output_;
+
+	// The render in progress, guarded by the mutex
+	std::mutex rc_mutex_;
+	std::condition_variable rc_changed_;
+	std::deque<Job> rc_queue_;
+	size_t rc_remaining_;
+	std::string rc_failure_;
+	int rc_active_nodes_;
+	int rc_nodes_served_;
+	int rc_nodes_lost_;
+	int rc_buckets_retried_;
+
+	const std::string * rc_scene_data_;
+	SampleBuffer * rc_image_;
+	RenderStats * rc_stats_;
+	ProgressReporter * rc_progress_;
+};
+
+// Renders buckets for a coordinator, as a process of its own
+class RenderNode
+{
+public:
+	// 0 threads is one per hardware thread
+	explicit RenderNode(int threads = 0);
+	~RenderNode();
+
+	// Properties
+	// Seconds to keep trying while the coordinator is not up yet
+	double connect_timeout;
+
+	// Methods
+	// Renders whatever the coordinator sends until it says the frame is done, and returns the
+	// buckets rendered.  Throws when the coordinator cannot be reached or goes away.
+	int run(const std::string & address);
+
+private:
+	int rn_threads_;
+};
+
+#endif
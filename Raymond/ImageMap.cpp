@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "ImageMap.h"
+
+#include <filesystem>
+
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+ImageMap::ImageMap() : TexMap()
+{
+	this->uv_mapping = PlanarUVMapping;
+	this->cache = TextureCache::global();
+	this->file = nullptr;
+}
+
+ImageMap::ImageMap(const std::string & file_path) : ImageMap(file_path, TextureCache::global())
+{
+}
+
+ImageMap::ImageMap(const std::string & file_path, std::shared_ptr<TextureCache> cache) : TexMap()
+{
+	this->uv_mapping = PlanarUVMapping;
+	this->cache = std::move(cache);
+	this->file = this->cache->open(file_path);
+}
+
+ImageMap::~ImageMap()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Color ImageMap::local_sample_at(const IxComps & comps) const
+{
+	if (this->file == nullptr)
+	{
+		return Color(0.0);
+	}
+
+	const Tuple uv = this->uv_at(comps.texmap_point);
+
+	// v runs from the bottom of the image to the top
+	return this->cache->bilinear(*this->file, 0, uv.x, 1.0 - uv.z);
+}
+
+Color ImageMap::local_filtered_sample_at(const IxComps & comps) const
+{
+	if (this->file == nullptr)
+	{
+		return Color(0.0);
+	}
+
+	const Tuple uv = this->uv_at(comps.texmap_point);
+
+	// The uv derivatives are taken over a short step along each footprint vector,
+	// so neither the seam nor a footprint wider than the image wraps back to zero
+	auto uv_derivative = [&](const Tuple & footprint_v)
+	{
+		const double step = 1.0 / std::max(footprint_v.magnitude() * 1024.0, 1.0);
+		const Tuple uv_step = this->uv_at(comps.texmap_point + (footprint_v * step));
+
+		const double du = uv_step.x - uv.x;
+		const double dv = uv_step.z - uv.z;
+
+		return Tuple::Vector((du - floor(du + 0.5)) / step, 0.0, (dv - floor(dv + 0.5)) / step);
+	};
+
+	const Tuple duv_dx = uv_derivative(comps.texmap_dpdx);
+	const Tuple duv_dy = uv_derivative(comps.texmap_dpdy);
+
+	const double width = double(this->file->width);
+	const double height = double(this->file->height);
+
+	// Footprint measured in level 0 texels
+	const double footprint = std::max(
+		std::max(fabs(duv_dx.x) * width, fabs(duv_dx.z) * height),
+		std::max(fabs(duv_dy.x) * width, fabs(duv_dy.z) * height)
+	);
+
+	return this->cache->trilinear(*this->file, uv.x, 1.0 - uv.z, footprint);
+}
+
+uint64_t ImageMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = hash_value(hash, this->uv_mapping);
+	hash = hash_string(hash, this->file ? this->file->path : std::string());
+
+	// Edits to the file on disk change its size or its time, so bakes of the old image are
+	// not used for the new one
+	if (this->file)
+	{
+		std::error_code error;
+		const uintmax_t size = std::filesystem::file_size(this->file->path, error);
+		const auto modified = std::filesystem::last_write_time(this->file->path, error).time_since_epoch().count();
+
+		hash = hash_value(hash, uint64_t(size));
+		hash = hash_value(hash, int64_t(modified));
+	}
+
+	return hash;
+}
+
+Tuple ImageMap::uv_at(const Tuple & texmap_point) const
+{
+	double u = 0.0;
+	double v = 0.0;
+
+	switch (this->uv_mapping)
+	{
+	case PlanarUVMapping:
+		u = texmap_point.x;
+		v = texmap_point.z;
+		break;
+
+	case SphericalUVMapping:
+	{
+		const double theta = atan2(texmap_point.x, texmap_point.z);
+		const double radius = Tuple::Vector(texmap_point.x, texmap_point.y, texmap_point.z).magnitude();
+		const double phi = (radius > 0.0) ? acos(clip(texmap_point.y / radius, -1.0, 1.0)) : 0.0;
+
+		u = 1.0 - ((theta / (2.0 * M_PI)) + 0.5);
+		v = 1.0 - (phi / M_PI);
+		break;
+	}
+
+	case CylindricalUVMapping:
+	{
+		const double theta = atan2(texmap_point.x, texmap_point.z);
+
+		u = 1.0 - ((theta / (2.0 * M_PI)) + 0.5);
+		v = texmap_point.y;
+		break;
+	}
+	}
+
+	return Tuple::Point(u - floor(u), 0.0, v - floor(v));
+}
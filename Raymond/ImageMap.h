@@ -0,0 +1,35 @@
+#ifndef H_RAYMOND_IMAGEMAP
+#define H_RAYMOND_IMAGEMAP
+
+#include "Texmap.h"
+#include "TextureCache.h"
+
+enum UVMapping { PlanarUVMapping, SphericalUVMapping, CylindricalUVMapping };
+
+// Bitmap texture read through the shared texture cache
+class ImageMap :
+	public TexMap
+{
+public:
+	ImageMap();
+	explicit ImageMap(const std::string & file_path);
+	ImageMap(const std::string & file_path, std::shared_ptr<TextureCache> cache);
+	~ImageMap();
+
+	// Methods
+	virtual Color local_sample_at(const IxComps & comps) const override;
+	// Picks the mip level from the ray footprint and blends the two nearest levels
+	virtual Color local_filtered_sample_at(const IxComps & comps) const override;
+	// Images are identified by path, and by the size and time of the file
+	virtual uint64_t graph_hash() const override;
+
+	// Texture coordinates of a point in texture space, u and v run from 0 to 1 and y is unused
+	Tuple uv_at(const Tuple & texmap_point) const;
+
+	// Properties
+	UVMapping uv_mapping;
+	std::shared_ptr<TextureCache> cache;
+	std::shared_ptr<TextureFile> file;
+};
+
+#endif
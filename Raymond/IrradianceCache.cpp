@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "IrradianceCache.h"
+
+// ------------------------------------------------------------------------
+//
+// Irradiance Cache
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+IrradianceCache::IrradianceCache()
+{
+	this->accuracy = 0.3;
+	this->min_spacing = 0.02;
+	this->max_spacing = 1.0;
+
+	this->irc_cell_size_ = 0.0;
+}
+
+IrradianceCache::~IrradianceCache()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool IrradianceCache::lookup(const Tuple & point, const Tuple & normal, Color & irradiance) const
+{
+	std::shared_lock<std::shared_mutex> lock(this->irc_mutex_);
+
+	if (this->irc_cell_size_ <= 0.0)
+	{
+		return false;
+	}
+
+	auto cell = this->irc_cells_.find(irc_key_(this->irc_cell_(point.x), this->irc_cell_(point.y), this->irc_cell_(point.z)));
+
+	if (cell == this->irc_cells_.end())
+	{
+		return false;
+	}
+
+	Color weighted_sum = Color(0.0);
+	double weight_total = 0.0;
+
+	for (size_t index : cell->second)
+	{
+		const IRCRecord & record = this->irc_records_[index];
+		const Tuple offset = point - record.point;
+
+		// Records in front of the point saw occluders the point cannot
+		if (Tuple::dot(offset, normal + record.normal) < -0.02 * record.radius)
+		{
+			continue;
+		}
+
+		// Ward's error estimate, from the distance and the change in the normal
+		double error = (offset.magnitude() / record.radius) +
+			sqrt(std::max(0.0, 1.0 - Tuple::dot(normal, record.normal)));
+
+		if (error < this->accuracy)
+		{
+			double weight = 1.0 / std::max(error, EPSILON);
+			weighted_sum = weighted_sum + (record.irradiance * weight);
+			weight_total += weight;
+		}
+	}
+
+	if (weight_total <= 0.0)
+	{
+		return false;
+	}
+
+	irradiance = weighted_sum / weight_total;
+	return true;
+}
+
+void IrradianceCache::insert(const Tuple & point, const Tuple & normal, const Color & irradiance, double mean_distance)
+{
+	std::unique_lock<std::shared_mutex> lock(this->irc_mutex_);
+
+	if (this->irc_cell_size_ <= 0.0)
+	{
+		// Big enough that a record overlaps at most two cells on each axis
+		this->irc_cell_size_ = std::max(this->accuracy * this->max_spacing, EPSILON);
+	}
+
+	IRCRecord record;
+	record.point = point;
+	record.normal = normal;
+	record.irradiance = irradiance;
+	record.radius = clip(mean_distance, this->min_spacing, this->max_spacing);
+
+	const size_t index = this->irc_records_.size();
+	this->irc_records_.push_back(record);
+
+	// The record is valid within accuracy * radius of its point
+	const double reach = this->accuracy * record.radius;
+
+	for (int z = this->irc_cell_(point.z - reach); z <= this->irc_cell_(point.z + reach); z++)
+	{
+		for (int y = this->irc_cell_(point.y - reach); y <= this->irc_cell_(point.y + reach); y++)
+		{
+			for (int x = this->irc_cell_(point.x - reach); x <= this->irc_cell_(point.x + reach); x++)
+			{
+				this->irc_cells_[irc_key_(x, y, z)].push_back(index);
+			}
+		}
+	}
+}
+
+size_t IrradianceCache::size() const
+{
+	std::shared_lock<std::shared_mutex> lock(this->irc_mutex_);
+
+	return this->irc_records_.size();
+}
+
+void IrradianceCache::clear()
+{
+	std::unique_lock<std::shared_mutex> lock(this->irc_mutex_);
+
+	this->irc_records_.clear();
+	this->irc_cells_.clear();
+	this->irc_cell_size_ = 0.0;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// 21 bits per axis, cells wrap around far from the origin
+uint64_t IrradianceCache::irc_key_(int x, int y, int z)
+{
+	const uint64_t mask = (uint64_t(1) << 21) - 1;
+
+	return (uint64_t(x) & mask) | ((uint64_t(y) & mask) << 21) | ((uint64_t(z) & mask) << 42);
+}
+
+int IrradianceCache::irc_cell_(double coordinate) const
+{
+	return static_cast<int>(floor(coordinate / this->irc_cell_size_));
+}
@@ -0,0 +1,60 @@
+#ifndef H_RAYMOND_IRRADIANCECACHE
+#define H_RAYMOND_IRRADIANCECACHE
+
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+
+#include "Tuple.h"
+#include "Color.h"
+
+// Ward's irradiance cache.  Indirect diffuse light changes slowly across a surface, so each
+// estimate is stored with the distance to the geometry around it, and reused by nearby points
+// facing the same way for as far as that distance says it stays valid.
+// Ward, Rubinstein and Clear, A Ray Tracing Solution for Diffuse Interreflection
+// Safe to use from the render threads.  Records are not keyed on ray time, so it holds one
+// frame: World::begin_frame clears it before each render.
+class IrradianceCache
+{
+public:
+	IrradianceCache();
+	~IrradianceCache();
+
+	// Methods
+	// Blends the records valid at a point, false when there are none
+	bool lookup(const Tuple & point, const Tuple & normal, Color & irradiance) const;
+	// mean_distance is the harmonic mean of the distances the estimate's rays travelled
+	void insert(const Tuple & point, const Tuple & normal, const Color & irradiance, double mean_distance);
+
+	size_t size() const;
+	// Call after the scene changes, World::begin_frame does at the start of every render
+	void clear();
+
+	// Properties
+	// Ward's a, lower values store more records and interpolate less
+	double accuracy;
+	// Limits on the mean distance a record is trusted over
+	double min_spacing, max_spacing;
+
+private:
+	struct IRCRecord
+	{
+		Tuple point;
+		Tuple normal;
+		Color irradiance;
+		double radius;
+	};
+
+	static uint64_t irc_key_(int x, int y, int z);
+	int irc_cell_(double coordinate) const;
+
+	mutable std::shared_mutex irc_mutex_;
+	std::vector<IRCRecord> irc_records_;
+	// Records listed in every cell their valid region overlaps
+	std::unordered_map<uint64_t, std::vector<size_t>> irc_cells_;
+	// Fixed by the first insert, so changing the properties later cannot strand records
+	double irc_cell_size_;
+};
+
+#endif
@@ -15,6 +15,7 @@ IxComps::IxComps()
 	this->t_value = 0.0;
 	this->object = nullptr;
 	this->ray_depth = 0;
+	this->time = 0.0;
 
 	this->point = Tuple::Point(0.0, 0.0, 0.0);
 	this->texmap_point = this->point;
@@ -31,6 +32,14 @@ IxComps::IxComps()
 
 	this->n1 = 1.0;
 	this->n2 = 1.0;
+
+	this->has_differentials = false;
+	this->dpdx = Tuple::Vector(0.0, 0.0, 0.0);
+	this->dpdy = Tuple::Vector(0.0, 0.0, 0.0);
+	this->texmap_dpdx = this->dpdx;
+	this->texmap_dpdy = this->dpdy;
+	this->rx_direction = this->dpdx;
+	this->ry_direction = this->dpdy;
 }
 
 IxComps::IxComps(const Intersection & ix, const Ray & ray)
@@ -38,11 +47,12 @@ IxComps::IxComps(const Intersection & ix, const Ray & ray)
 	this->t_value = ix.t_value;
 	this->object = ix.object;
 	this->ray_depth = ray.depth;
+	this->time = ray.time;
 
 	this->point = ray.position(this->t_value);
 	this->texmap_point = this->point;
 	this->eye_v = -(Tuple(ray.direction));
-	this->normal_v = this->object->normal_at(this->point);
+	this->normal_v = this->object->normal_at(this->point, this->time);
 	this->reflect_v = Tuple::reflect(ray.direction, this->normal_v);
 
 	this->shadow_multiplier = Color(1.0);
@@ -62,6 +72,8 @@ IxComps::IxComps(const Intersection & ix, const Ray & ray)
 
 	this->n1 = 1.0;
 	this->n2 = 1.0;
+
+	this->ic_compute_differentials_(ray);
 }
 
 IxComps::IxComps(const Intersection & ix, const Ray & ray, const Intersections & xs) : IxComps(ix, ray)
@@ -140,6 +152,7 @@ IxComps::IxComps(const IxComps & src)
 	this->t_value = src.t_value;
 	this->object = src.object;
 	this->ray_depth = src.ray_depth;
+	this->time = src.time;
 
 	this->point = src.point;
 	this->texmap_point = src.texmap_point;
@@ -155,11 +168,67 @@ IxComps::IxComps(const IxComps & src)
 
 	this->n1 = src.n1;
 	this->n2 = src.n2;
+
+	this->has_differentials = src.has_differentials;
+	this->dpdx = src.dpdx;
+	this->dpdy = src.dpdy;
+	this->texmap_dpdx = src.texmap_dpdx;
+	this->texmap_dpdy = src.texmap_dpdy;
+	this->rx_direction = src.rx_direction;
+	this->ry_direction = src.ry_direction;
 }
 
 IxComps::~IxComps()
 = default;
 
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// Intersects the differential rays with the tangent plane at the hit to estimate the
+// area of the surface covered by the pixel
+// From Physically Based Rendering, 3rd Edition by Pharr, Jakob, and Humphreys
+// https://www.pbr-book.org/3ed-2018/Texture/Sampling_and_Antialiasing#FindingtheTextureSamplingRate
+void IxComps::ic_compute_differentials_(const Ray & ray)
+{
+	this->has_differentials = false;
+	this->dpdx = Tuple::Vector(0.0, 0.0, 0.0);
+	this->dpdy = Tuple::Vector(0.0, 0.0, 0.0);
+	this->rx_direction = ray.direction;
+	this->ry_direction = ray.direction;
+
+	if (ray.has_differentials)
+	{
+		double d = Tuple::dot(this->normal_v, this->point);
+
+		double dx_den = Tuple::dot(this->normal_v, ray.rx_direction);
+		double dy_den = Tuple::dot(this->normal_v, ray.ry_direction);
+
+		// Differential rays parallel to the surface have no finite footprint
+		if (fabs(dx_den) > EPSILON && fabs(dy_den) > EPSILON)
+		{
+			double tx = (d - Tuple::dot(this->normal_v, ray.rx_origin)) / dx_den;
+			double ty = (d - Tuple::dot(this->normal_v, ray.ry_origin)) / dy_den;
+
+			Tuple px = ray.rx_origin + (ray.rx_direction * tx);
+			Tuple py = ray.ry_origin + (ray.ry_direction * ty);
+
+			this->dpdx = px - this->point;
+			this->dpdy = py - this->point;
+			this->dpdx.w = 0.0;
+			this->dpdy.w = 0.0;
+
+			this->rx_direction = ray.rx_direction;
+			this->ry_direction = ray.ry_direction;
+
+			this->has_differentials = true;
+		}
+	}
+
+	this->texmap_dpdx = this->dpdx;
+	this->texmap_dpdy = this->dpdy;
+}
+
 // ------------------------------------------------------------------------
 // Factories
 // ------------------------------------------------------------------------
@@ -170,6 +239,7 @@ IxComps IxComps::Background(const Ray & r)
 	comp.t_value = std::numeric_limits<double>::infinity();
 	comp.object = nullptr;
 	comp.ray_depth = r.depth;
+	comp.time = r.time;
 
 	comp.point = Tuple::Point(0.0, 0.0, 0.0);
 	comp.texmap_point = comp.point;
@@ -182,6 +252,9 @@ IxComps IxComps::Background(const Ray & r)
 	comp.n1 = 1.0;
 	comp.n2 = 1.0;
 
+	comp.rx_direction = r.rx_direction;
+	comp.ry_direction = r.ry_direction;
+
 	return comp;
 }
 
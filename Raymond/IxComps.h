@@ -35,10 +35,23 @@ public:
 	Tuple normal_v;
 	Tuple reflect_v;
 	int ray_depth;
+	// Time of the ray that hit, rays cast from here are cast at the same time
+	double time;
 	bool inside;
 	double t_value;
 	Color shadow_multiplier;
 	double n1, n2;
+
+	// Ray Differentials
+	// dpdx and dpdy are the world space footprint of a pixel on the surface,
+	// texmap_dpdx and texmap_dpdy are the same footprint in the space of the current TexMap
+	bool has_differentials;
+	Tuple dpdx, dpdy;
+	Tuple texmap_dpdx, texmap_dpdy;
+	Tuple rx_direction, ry_direction;
+
+private:
+	void ic_compute_differentials_(const Ray & ray);
 };
 
 #endif
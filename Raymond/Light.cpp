@@ -24,6 +24,8 @@ Light::Light(const Color& color, double multiplier) : ObjectBase()
 
 	this->falloff = false;
 	this->cutoff = 0.0001;
+
+	this->casts_shadows = true;
 }
 
 Light::~Light()
@@ -39,6 +41,26 @@ Tuple Light::area_position() const
     return this->position();
 }
 
+bool Light::has_area() const
+{
+	return false;
+}
+
+double Light::bounding_radius() const
+{
+	return 0.0;
+}
+
+bool Light::sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const
+{
+	return false;
+}
+
+bool Light::intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const
+{
+	return false;
+}
+
 // ------------------------------------------------------------------------
 //
 // PointLight
@@ -87,3 +109,498 @@ Tuple PointLight::area_position() const
     Tuple area_point = Tuple::RandomInUnitSphere() * this->radius;
     return (this->get_transform()).position() + area_point;
 }
+
+double PointLight::bounding_radius() const
+{
+	return this->radius;
+}
+
+// ------------------------------------------------------------------------
+//
+// Area Light Helpers
+//
+// ------------------------------------------------------------------------
+
+// Radiance that spreads a light's intensity over its area
+static Color area_light_radiance(const Light & light, double area)
+{
+	return light.color * (light.color.magnitude() * light.multiplier / std::max(area, EPSILON));
+}
+
+// Converts a density over the light's area to a density over solid angle at the shading point
+static double area_to_solid_angle(double area_pdf, double distance, double cos_light)
+{
+	return cos_light > 0.0 ? area_pdf * distance * distance / cos_light : 0.0;
+}
+
+// Shirley and Chiu, A Low Distortion Map Between Disk and Square
+static void concentric_disk(double u1, double u2, double & x, double & y)
+{
+	const double a = (2.0 * u1) - 1.0;
+	const double b = (2.0 * u2) - 1.0;
+
+	if (a == 0.0 && b == 0.0)
+	{
+		x = y = 0.0;
+		return;
+	}
+
+	double r, phi;
+	if (fabs(a) > fabs(b))
+	{
+		r = a;
+		phi = (M_PI / 4.0) * (b / a);
+	}
+	else
+	{
+		r = b;
+		phi = (M_PI / 2.0) - ((M_PI / 4.0) * (a / b));
+	}
+
+	x = r * cos(phi);
+	y = r * sin(phi);
+}
+
+// The rectangle as seen from a point, in a frame where it lies in the plane z = z0 < 0
+struct SphericalRect
+{
+	Tuple x, y, z;
+	double x0, y0, z0, x1, y1;
+	double b0, b1, k;
+	double solid_angle;
+};
+
+static SphericalRect spherical_rect(const Tuple & point, const Tuple & corner, const Tuple & edge_x, const Tuple & edge_y)
+{
+	SphericalRect rect;
+
+	const double width = edge_x.magnitude();
+	const double height = edge_y.magnitude();
+
+	rect.x = edge_x / width;
+	rect.y = edge_y / height;
+	rect.z = Tuple::cross(rect.x, rect.y);
+
+	const Tuple d = corner - point;
+	rect.x0 = Tuple::dot(d, rect.x);
+	rect.y0 = Tuple::dot(d, rect.y);
+	rect.z0 = Tuple::dot(d, rect.z);
+
+	if (rect.z0 > 0.0)
+	{
+		rect.z = rect.z * -1.0;
+		rect.z0 = -rect.z0;
+	}
+
+	rect.x1 = rect.x0 + width;
+	rect.y1 = rect.y0 + height;
+
+	// Normals of the planes through the point and each edge
+	const Tuple v00 = Tuple::Vector(rect.x0, rect.y0, rect.z0);
+	const Tuple v01 = Tuple::Vector(rect.x0, rect.y1, rect.z0);
+	const Tuple v10 = Tuple::Vector(rect.x1, rect.y0, rect.z0);
+	const Tuple v11 = Tuple::Vector(rect.x1, rect.y1, rect.z0);
+
+	const Tuple n0 = Tuple::cross(v00, v10).normalize();
+	const Tuple n1 = Tuple::cross(v10, v11).normalize();
+	const Tuple n2 = Tuple::cross(v11, v01).normalize();
+	const Tuple n3 = Tuple::cross(v01, v00).normalize();
+
+	// Interior angles of the spherical quad
+	const double g0 = acos(clip(-Tuple::dot(n0, n1), -1.0, 1.0));
+	const double g1 = acos(clip(-Tuple::dot(n1, n2), -1.0, 1.0));
+	const double g2 = acos(clip(-Tuple::dot(n2, n3), -1.0, 1.0));
+	const double g3 = acos(clip(-Tuple::dot(n3, n0), -1.0, 1.0));
+
+	rect.b0 = n0.z;
+	rect.b1 = n2.z;
+	rect.k = (2.0 * M_PI) - g2 - g3;
+	rect.solid_angle = g0 + g1 - rect.k;
+
+	return rect;
+}
+
+// Below this the rectangle is too small for its angles to be trusted, and is sampled by area
+static const double MIN_SPHERICAL_RECT = 1e-3;
+
+// ------------------------------------------------------------------------
+//
+// RectLight
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+RectLight::RectLight() : RectLight(Color(1.0), 1.0, 1.0, 1.0)
+{
+}
+
+RectLight::RectLight(const Color & color, double multiplier, double width, double height) : Light(color, multiplier)
+{
+	this->width = width;
+	this->height = height;
+
+	this->falloff = true;
+}
+
+RectLight::~RectLight()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool RectLight::has_area() const
+{
+	return true;
+}
+
+double RectLight::bounding_radius() const
+{
+	Tuple corner, edge_x, edge_y, normal;
+	this->rl_frame_(corner, edge_x, edge_y, normal);
+
+	return (edge_x + edge_y).magnitude() * 0.5;
+}
+
+bool RectLight::sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const
+{
+	Tuple corner, edge_x, edge_y, normal;
+	this->rl_frame_(corner, edge_x, edge_y, normal);
+
+	// Only the side facing along the normal emits
+	if (Tuple::dot(point - corner, normal) <= EPSILON)
+	{
+		return false;
+	}
+
+	const SphericalRect rect = spherical_rect(point, corner, edge_x, edge_y);
+	const double area = Tuple::cross(edge_x, edge_y).magnitude();
+
+	if (rect.solid_angle < MIN_SPHERICAL_RECT)
+	{
+		sample.point = corner + (edge_x * u1) + (edge_y * u2);
+		const Tuple offset = sample.point - point;
+		sample.distance = offset.magnitude();
+		sample.direction = offset / sample.distance;
+		sample.pdf = area_to_solid_angle(1.0 / area, sample.distance, -Tuple::dot(sample.direction, normal));
+	}
+	else
+	{
+		// Urena et al., section 3.2.  Pick the angle, then the height along the chosen line
+		const double au = (u1 * rect.solid_angle) + rect.k;
+		const double fu = ((cos(au) * rect.b0) - rect.b1) / sin(au);
+		double cu = copysign(1.0, fu) / sqrt((fu * fu) + (rect.b0 * rect.b0));
+		cu = clip(cu, -1.0, 1.0);
+
+		double xu = -(cu * rect.z0) / std::max(sqrt(1.0 - (cu * cu)), EPSILON);
+		xu = clip(xu, rect.x0, rect.x1);
+
+		const double d = sqrt((xu * xu) + (rect.z0 * rect.z0));
+		const double h0 = rect.y0 / sqrt((d * d) + (rect.y0 * rect.y0));
+		const double h1 = rect.y1 / sqrt((d * d) + (rect.y1 * rect.y1));
+		const double hv = h0 + (u2 * (h1 - h0));
+		const double hv2 = hv * hv;
+		const double yv = hv2 < 1.0 - EPSILON ? (hv * d) / sqrt(1.0 - hv2) : rect.y1;
+
+		sample.point = point + (rect.x * xu) + (rect.y * yv) + (rect.z * rect.z0);
+		const Tuple offset = sample.point - point;
+		sample.distance = offset.magnitude();
+		sample.direction = offset / sample.distance;
+		sample.pdf = 1.0 / rect.solid_angle;
+	}
+
+	sample.radiance = area_light_radiance(*this, area);
+	return sample.pdf > 0.0;
+}
+
+bool RectLight::intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const
+{
+	Tuple corner, edge_x, edge_y, normal;
+	this->rl_frame_(corner, edge_x, edge_y, normal);
+
+	// The ray has to arrive at the emitting side
+	const double cos_light = -Tuple::dot(direction, normal);
+	if (cos_light <= 0.0 || Tuple::dot(point - corner, normal) <= EPSILON)
+	{
+		return false;
+	}
+
+	const double t = Tuple::dot(point - corner, normal) / cos_light;
+	const Tuple hit = point + (direction * t);
+	const Tuple offset = hit - corner;
+
+	const double s = Tuple::dot(offset, edge_x) / edge_x.magnitude_squared();
+	const double r = Tuple::dot(offset, edge_y) / edge_y.magnitude_squared();
+	if (s < 0.0 || s > 1.0 || r < 0.0 || r > 1.0)
+	{
+		return false;
+	}
+
+	const SphericalRect rect = spherical_rect(point, corner, edge_x, edge_y);
+	const double area = Tuple::cross(edge_x, edge_y).magnitude();
+
+	sample.point = hit;
+	sample.direction = direction;
+	sample.distance = t;
+	sample.pdf = rect.solid_angle < MIN_SPHERICAL_RECT ?
+		area_to_solid_angle(1.0 / area, t, cos_light) :
+		1.0 / rect.solid_angle;
+	sample.radiance = area_light_radiance(*this, area);
+
+	return sample.pdf > 0.0;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// The transform should only rotate, scale and move the light, so the edges stay square
+void RectLight::rl_frame_(Tuple & corner, Tuple & edge_x, Tuple & edge_y, Tuple & normal) const
+{
+	const Matrix4 transform = this->get_transform();
+
+	corner = transform * Tuple::Point(this->width * -0.5, 0.0, this->height * -0.5);
+	edge_x = transform * Tuple::Vector(this->width, 0.0, 0.0);
+	edge_y = transform * Tuple::Vector(0.0, 0.0, this->height);
+	// x cross z points down -y
+	normal = Tuple::cross(edge_x, edge_y).normalize();
+}
+
+// ------------------------------------------------------------------------
+//
+// DiskLight
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+DiskLight::DiskLight() : DiskLight(Color(1.0), 1.0, 0.5)
+{
+}
+
+DiskLight::DiskLight(const Color & color, double multiplier, double radius) : Light(color, multiplier)
+{
+	this->radius = radius;
+
+	this->falloff = true;
+}
+
+DiskLight::~DiskLight()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool DiskLight::has_area() const
+{
+	return true;
+}
+
+double DiskLight::bounding_radius() const
+{
+	Tuple center, axis_u, axis_v, normal;
+	this->dl_frame_(center, axis_u, axis_v, normal);
+
+	return std::max(axis_u.magnitude(), axis_v.magnitude());
+}
+
+bool DiskLight::sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const
+{
+	Tuple center, axis_u, axis_v, normal;
+	this->dl_frame_(center, axis_u, axis_v, normal);
+
+	if (Tuple::dot(point - center, normal) <= EPSILON)
+	{
+		return false;
+	}
+
+	double x, y;
+	concentric_disk(u1, u2, x, y);
+
+	const double area = Tuple::cross(axis_u, axis_v).magnitude() * M_PI;
+
+	sample.point = center + (axis_u * x) + (axis_v * y);
+	const Tuple offset = sample.point - point;
+	sample.distance = offset.magnitude();
+	sample.direction = offset / sample.distance;
+	sample.pdf = area_to_solid_angle(1.0 / area, sample.distance, -Tuple::dot(sample.direction, normal));
+	sample.radiance = area_light_radiance(*this, area);
+
+	return sample.pdf > 0.0;
+}
+
+bool DiskLight::intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const
+{
+	Tuple center, axis_u, axis_v, normal;
+	this->dl_frame_(center, axis_u, axis_v, normal);
+
+	const double cos_light = -Tuple::dot(direction, normal);
+	if (cos_light <= 0.0 || Tuple::dot(point - center, normal) <= EPSILON)
+	{
+		return false;
+	}
+
+	const double t = Tuple::dot(point - center, normal) / cos_light;
+	const Tuple hit = point + (direction * t);
+	const Tuple offset = hit - center;
+
+	const double x = Tuple::dot(offset, axis_u) / axis_u.magnitude_squared();
+	const double y = Tuple::dot(offset, axis_v) / axis_v.magnitude_squared();
+	if ((x * x) + (y * y) > 1.0)
+	{
+		return false;
+	}
+
+	const double area = Tuple::cross(axis_u, axis_v).magnitude() * M_PI;
+
+	sample.point = hit;
+	sample.direction = direction;
+	sample.distance = t;
+	sample.pdf = area_to_solid_angle(1.0 / area, t, cos_light);
+	sample.radiance = area_light_radiance(*this, area);
+
+	return sample.pdf > 0.0;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void DiskLight::dl_frame_(Tuple & center, Tuple & axis_u, Tuple & axis_v, Tuple & normal) const
+{
+	const Matrix4 transform = this->get_transform();
+
+	center = transform.position();
+	axis_u = transform * Tuple::Vector(this->radius, 0.0, 0.0);
+	axis_v = transform * Tuple::Vector(0.0, 0.0, this->radius);
+	normal = Tuple::cross(axis_u, axis_v).normalize();
+}
+
+// ------------------------------------------------------------------------
+//
+// SphereLight
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+SphereLight::SphereLight() : SphereLight(Tuple::Point(0.0, 0.0, 0.0), Color(1.0), 1.0, 0.5)
+{
+}
+
+SphereLight::SphereLight(const Tuple & position, const Color & color, double multiplier, double radius) : Light(color, multiplier)
+{
+	this->radius = radius;
+	this->set_transform(Matrix4::Translation(position));
+
+	this->falloff = true;
+}
+
+SphereLight::~SphereLight()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool SphereLight::has_area() const
+{
+	return true;
+}
+
+double SphereLight::bounding_radius() const
+{
+	return this->radius;
+}
+
+bool SphereLight::sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const
+{
+	const Tuple to_center = this->position() - point;
+	const double distance_squared = to_center.magnitude_squared();
+	const double radius_squared = this->radius * this->radius;
+
+	if (distance_squared <= radius_squared)
+	{
+		return false;
+	}
+
+	// 1 - cos(theta max), written to stay accurate for small, distant spheres
+	const double sin2_max = radius_squared / distance_squared;
+	const double cos_max = sqrt(std::max(0.0, 1.0 - sin2_max));
+	const double one_minus_cos_max = sin2_max / (1.0 + cos_max);
+
+	const double cos_theta = 1.0 - (u1 * one_minus_cos_max);
+	const double sin_theta = sqrt(std::max(0.0, 1.0 - (cos_theta * cos_theta)));
+	const double phi = 2.0 * M_PI * u2;
+
+	const Tuple axis = to_center / sqrt(distance_squared);
+	Tuple tangent, bitangent;
+	Tuple::OrthonormalBasis(axis, tangent, bitangent);
+
+	sample.direction = (tangent * (sin_theta * cos(phi))) + (bitangent * (sin_theta * sin(phi))) + (axis * cos_theta);
+
+	// Nearest hit along the direction, which grazes the sphere at the edge of the cone
+	const double b = Tuple::dot(sample.direction, to_center);
+	const double discriminant = std::max(0.0, radius_squared - (distance_squared - (b * b)));
+	sample.distance = b - sqrt(discriminant);
+	sample.point = point + (sample.direction * sample.distance);
+	sample.pdf = 1.0 / (2.0 * M_PI * one_minus_cos_max);
+	sample.radiance = area_light_radiance(*this, M_PI * radius_squared);
+
+	return true;
+}
+
+bool SphereLight::intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const
+{
+	const Tuple to_center = this->position() - point;
+	const double distance_squared = to_center.magnitude_squared();
+	const double radius_squared = this->radius * this->radius;
+
+	if (distance_squared <= radius_squared)
+	{
+		return false;
+	}
+
+	const double b = Tuple::dot(direction, to_center);
+	const double discriminant = radius_squared - (distance_squared - (b * b));
+	if (b <= 0.0 || discriminant < 0.0)
+	{
+		return false;
+	}
+
+	sample.direction = direction;
+	sample.distance = b - sqrt(discriminant);
+	sample.point = point + (direction * sample.distance);
+	sample.pdf = this->sl_cone_pdf_(point);
+	sample.radiance = area_light_radiance(*this, M_PI * radius_squared);
+
+	return true;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+double SphereLight::sl_cone_pdf_(const Tuple & point) const
+{
+	const double sin2_max = (this->radius * this->radius) / (this->position() - point).magnitude_squared();
+	const double cos_max = sqrt(std::max(0.0, 1.0 - sin2_max));
+
+	return 1.0 / (2.0 * M_PI * (sin2_max / (1.0 + cos_max)));
+}
+
+// ------------------------------------------------------------------------
+//
+// Functions
+//
+// ------------------------------------------------------------------------
+
+double power_heuristic(double pdf_a, double pdf_b)
+{
+	const double a = pdf_a * pdf_a;
+	const double b = pdf_b * pdf_b;
+
+	return a + b > 0.0 ? a / (a + b) : 0.0;
+}
@@ -7,6 +7,18 @@
 #include "Matrix.h"
 #include "Ray.h"
 
+// A point on a light as seen from a shading point
+struct LightSample
+{
+	Tuple point;
+	// Unit vector from the shading point to the light
+	Tuple direction;
+	double distance;
+	// Probability density per unit solid angle at the shading point
+	double pdf;
+	Color radiance;
+};
+
 class Light :
 	public ObjectBase
 {
@@ -23,9 +35,22 @@ public:
 	bool falloff;
 	double cutoff;
 
+	// Lights that do not cast shadows are lit without tracing shadow rays
+	bool casts_shadows;
+
      // Methods
      Tuple position() const;
      virtual Tuple area_position() const;
+
+     // Area Lights
+     // Area lights are integrated over their surface instead of being treated as a point
+     virtual bool has_area() const;
+     // Radius of a sphere around position() that holds all of the light
+     virtual double bounding_radius() const;
+     // Picks a point on the light seen from point.  False when no part of it is visible from there.
+     virtual bool sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const;
+     // Finds where a ray from point meets the light, with the density sample_light would have picked it with
+     virtual bool intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const;
 };
 
 class PointLight :
@@ -40,11 +65,90 @@ public:
 
     // Methods
     Tuple area_position() const override;
+    double bounding_radius() const override;
 
     // properties
     double radius;
 };
 
+// Area lights emit from one side, along -y of their local space, like a lamp hanging
+// from a ceiling.  Their power is spread over their area, so that seen from far away
+// they match a PointLight with the same color and multiplier.  Falloff is always on.
+
+// A width by height rectangle in the xz plane, centered on the origin of its transform.
+// Sampled uniformly by solid angle, using Urena, Fajardo and King,
+// An Area-Preserving Parametrization for Spherical Rectangles
+class RectLight :
+	public Light
+{
+public:
+	RectLight();
+	RectLight(const Color & color, double multiplier, double width, double height);
+	~RectLight();
+
+	// Methods
+	bool has_area() const override;
+	double bounding_radius() const override;
+	bool sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const override;
+	bool intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const override;
+
+	// properties
+	double width, height;
+
+private:
+	// Corner and edges in world space
+	void rl_frame_(Tuple & corner, Tuple & edge_x, Tuple & edge_y, Tuple & normal) const;
+};
+
+// A disk in the xz plane.  There is no closed form for sampling a disk by solid angle,
+// so points are spread evenly over its area and the density converted to solid angle.
+class DiskLight :
+	public Light
+{
+public:
+	DiskLight();
+	DiskLight(const Color & color, double multiplier, double radius);
+	~DiskLight();
+
+	// Methods
+	bool has_area() const override;
+	double bounding_radius() const override;
+	bool sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const override;
+	bool intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const override;
+
+	// properties
+	double radius;
+
+private:
+	void dl_frame_(Tuple & center, Tuple & axis_u, Tuple & axis_v, Tuple & normal) const;
+};
+
+// A sphere that emits from its whole surface.  Sampled uniformly within the cone it covers.
+class SphereLight :
+	public Light
+{
+public:
+	SphereLight();
+	SphereLight(const Tuple & position, const Color & color, double multiplier, double radius);
+	~SphereLight();
+
+	// Methods
+	bool has_area() const override;
+	double bounding_radius() const override;
+	bool sample_light(const Tuple & point, double u1, double u2, LightSample & sample) const override;
+	bool intersect_light(const Tuple & point, const Tuple & direction, LightSample & sample) const override;
+
+	// properties
+	double radius;
+
+private:
+	double sl_cone_pdf_(const Tuple & point) const;
+};
+
+// Multiple importance sampling weight for a sample taken with density pdf_a,
+// when it could also have come from a strategy with density pdf_b
+double power_heuristic(double pdf_a, double pdf_b);
+
 //Overloaded Operators
 bool operator==(const PointLight & left_light, const PointLight & right_light);
 bool operator!=(const PointLight & left_light, const PointLight & right_light);
@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "LightTree.h"
+
+// ------------------------------------------------------------------------
+//
+// Light Tree
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+LightTree::LightTree()
+= default;
+
+LightTree::LightTree(const std::vector<std::shared_ptr<Light>> & lights)
+{
+	for (const std::shared_ptr<Light> & lgt : lights)
+	{
+		if (LightTree::accepts(*lgt))
+		{
+			this->lt_lights_.push_back(lgt);
+		}
+	}
+
+	if (this->lt_lights_.empty())
+	{
+		return;
+	}
+
+	std::vector<int> indices = std::vector<int>(this->lt_lights_.size());
+	for (int i = 0; i < static_cast<int>(indices.size()); i++)
+	{
+		indices[i] = i;
+	}
+
+	this->lt_nodes_.reserve((this->lt_lights_.size() * 2) - 1);
+	this->lt_build_(indices, 0, static_cast<int>(indices.size()));
+}
+
+LightTree::~LightTree()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool LightTree::sample(const Tuple & point, double u, std::shared_ptr<Light> & light, double & pdf) const
+{
+	if (this->lt_nodes_.empty())
+	{
+		return false;
+	}
+
+	pdf = 1.0;
+	int index = 0;
+
+	while (this->lt_nodes_[index].left >= 0)
+	{
+		const LTNode & node = this->lt_nodes_[index];
+
+		double left_importance = this->lt_importance_(this->lt_nodes_[node.left], point);
+		double right_importance = this->lt_importance_(this->lt_nodes_[node.right], point);
+		double total = left_importance + right_importance;
+		double left_probability = total > 0.0 ? left_importance / total : 0.5;
+
+		// Reuse u for the next level by stretching the chosen part back over [0,1)
+		if (u < left_probability)
+		{
+			u = u / left_probability;
+			pdf *= left_probability;
+			index = node.left;
+		}
+		else
+		{
+			u = (u - left_probability) / (1.0 - left_probability);
+			pdf *= 1.0 - left_probability;
+			index = node.right;
+		}
+
+		u = std::min(u, 1.0 - std::numeric_limits<double>::epsilon());
+	}
+
+	light = this->lt_lights_[this->lt_nodes_[index].light];
+	return pdf > 0.0;
+}
+
+size_t LightTree::size() const
+{
+	return this->lt_lights_.size();
+}
+
+bool LightTree::accepts(const Light & light)
+{
+	return light.falloff;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// Splits at the median of the widest axis.  Returns the index of the node
+int LightTree::lt_build_(std::vector<int> & indices, int begin, int end)
+{
+	const int node_index = static_cast<int>(this->lt_nodes_.size());
+	this->lt_nodes_.push_back(LTNode());
+
+	LTNode node = LTNode();
+	node.minimum = Tuple::Point(INFINITY, INFINITY, INFINITY);
+	node.maximum = Tuple::Point(-INFINITY, -INFINITY, -INFINITY);
+	node.power = 0.0;
+	node.left = node.right = node.light = -1;
+
+	for (int i = begin; i < end; i++)
+	{
+		const Light & lgt = *this->lt_lights_[indices[i]];
+		const Tuple p = lgt.position();
+
+		node.minimum = Tuple::Point(std::min(node.minimum.x, p.x), std::min(node.minimum.y, p.y), std::min(node.minimum.z, p.z));
+		node.maximum = Tuple::Point(std::max(node.maximum.x, p.x), std::max(node.maximum.y, p.y), std::max(node.maximum.z, p.z));
+		// The same measure World uses for the intensity of a light with falloff
+		node.power += lgt.color.magnitude() * lgt.multiplier;
+	}
+
+	if (end - begin == 1)
+	{
+		node.light = indices[begin];
+		this->lt_nodes_[node_index] = node;
+		return node_index;
+	}
+
+	const Tuple extent = node.maximum - node.minimum;
+	int axis = 0;
+	if (extent.y > extent.x && extent.y >= extent.z)
+	{
+		axis = 1;
+	}
+	else if (extent.z > extent.x && extent.z > extent.y)
+	{
+		axis = 2;
+	}
+
+	const int middle = begin + ((end - begin) / 2);
+	std::nth_element(
+		indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+		[this, axis](int a, int b)
+		{
+			const Tuple pa = this->lt_lights_[a]->position();
+			const Tuple pb = this->lt_lights_[b]->position();
+			return axis == 0 ? pa.x < pb.x : (axis == 1 ? pa.y < pb.y : pa.z < pb.z);
+		}
+	);
+
+	node.left = this->lt_build_(indices, begin, middle);
+	node.right = this->lt_build_(indices, middle, end);
+
+	this->lt_nodes_[node_index] = node;
+	return node_index;
+}
+
+// Power over the squared distance to the node's bounds.  A fraction of the node's own size
+// is added to the distance, so points inside a cluster do not pick one side of it outright.
+double LightTree::lt_importance_(const LTNode & node, const Tuple & point) const
+{
+	const double dx = std::max(std::max(node.minimum.x - point.x, point.x - node.maximum.x), 0.0);
+	const double dy = std::max(std::max(node.minimum.y - point.y, point.y - node.maximum.y), 0.0);
+	const double dz = std::max(std::max(node.minimum.z - point.z, point.z - node.maximum.z), 0.0);
+
+	const double distance_squared = (dx * dx) + (dy * dy) + (dz * dz);
+	const double size_squared = (node.maximum - node.minimum).magnitude_squared();
+
+	return node.power / std::max(distance_squared + (size_squared * 0.0125), EPSILON);
+}
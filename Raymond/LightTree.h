@@ -0,0 +1,50 @@
+#ifndef H_RAYMOND_LIGHTTREE
+#define H_RAYMOND_LIGHTTREE
+
+#include <vector>
+#include <memory>
+
+#include "Tuple.h"
+#include "Light.h"
+
+// Bounding volume hierarchy over lights with falloff, for picking the lights that matter at a
+// shading point without looking at all of them.  Each level is walked by choosing a child in
+// proportion to its power over its squared distance, so a pick costs log n.
+// A simplified form of Conty Estevez and Kulla, Importance Sampling of Many Lights with
+// Adaptive Tree Splitting.
+class LightTree
+{
+public:
+	LightTree();
+	explicit LightTree(const std::vector<std::shared_ptr<Light>> & lights);
+	~LightTree();
+
+	// Methods
+	// Picks a light for a point using u in [0,1), with the probability of having picked it.
+	// Every light has a chance of being picked, so estimates divided by pdf are unbiased,
+	// even if the lights have moved since the tree was built.
+	bool sample(const Tuple & point, double u, std::shared_ptr<Light> & light, double & pdf) const;
+
+	size_t size() const;
+
+	// Lights without falloff are not stored, their distance does not change their contribution
+	static bool accepts(const Light & light);
+
+private:
+	struct LTNode
+	{
+		Tuple minimum, maximum;
+		double power;
+		// Children, or -1 and the index of the light for leaves
+		int left, right;
+		int light;
+	};
+
+	int lt_build_(std::vector<int> & indices, int begin, int end);
+	double lt_importance_(const LTNode & node, const Tuple & point) const;
+
+	std::vector<LTNode> lt_nodes_;
+	std::vector<std::shared_ptr<Light>> lt_lights_;
+};
+
+#endif
@@ -26,21 +26,78 @@ Color BaseMaterial::lighting(const std::shared_ptr<Light>, const IxComps &) cons
 	return Color(0.0);
 }
 
+// Traces a single ray, the path beyond it is followed iteratively by World::color_at
 Color BaseMaterial::reflect(const World & world, const IxComps & comps) const
 {
+	Ray reflect_ray;
+	Color weight;
+
+	if (this->reflected_ray(comps, reflect_ray, weight))
+	{
+		return world.color_at(reflect_ray) * weight;
+	}
+
 	return Color(0.0);
 }
 
 Color BaseMaterial::refract(const World & world, const IxComps & comps) const
+{
+	Ray refract_ray;
+	Color weight;
+
+	if (this->refracted_ray(comps, refract_ray, weight))
+	{
+		return world.color_at(refract_ray) * weight;
+	}
+
+	return Color(0.0);
+}
+
+bool BaseMaterial::reflected_ray(const IxComps & comps, Ray & ray, Color & weight) const
+{
+	return false;
+}
+
+bool BaseMaterial::refracted_ray(const IxComps & comps, Ray & ray, Color & weight) const
+{
+	return false;
+}
+
+Color BaseMaterial::diffuse_albedo(const IxComps & comps) const
+{
+	return Color(0.0);
+}
+
+Color BaseMaterial::light_response(const IxComps & comps, const Tuple & light_v) const
 {
 	return Color(0.0);
 }
 
+bool BaseMaterial::sample_light_response(const IxComps & comps, double u1, double u2, Tuple & light_v, double & pdf) const
+{
+	return false;
+}
+
+double BaseMaterial::light_response_pdf(const IxComps & comps, const Tuple & light_v) const
+{
+	return 0.0;
+}
+
+double BaseMaterial::glossy_fraction(const IxComps & comps) const
+{
+	return 0.0;
+}
+
 Color BaseMaterial::transmit(const std::shared_ptr<Light> lgt, const World & world, const IxComps & comps, const Intersections & ix) const
 {
 	return Color(0.0);
 }
 
+void BaseMaterial::compile_maps()
+{
+	this->ior.compile();
+}
+
 // ------------------------------------------------------------------------
 //
 // Normal Material
@@ -193,7 +250,7 @@ Color PhongMaterial::lighting(
 	return this->lighting(lgt, comps);
 }
 
-Color PhongMaterial::reflect(const World & world, const IxComps & comps) const
+bool PhongMaterial::reflected_ray(const IxComps & comps, Ray & ray, Color & weight) const
 {
 	Color blk = Color(0.0);
 	Color slt_reflection = this->reflection.sample_at(comps);
@@ -204,18 +261,34 @@ Color PhongMaterial::reflect(const World & world, const IxComps & comps) const
 		// Roughness code from Ray Tracing in One Weekend by Peter Shirley
 		// https://raytracing.github.io/books/RayTracingInOneWeekend.html#metal/fuzzyreflection
 		double slt_refl_rough = this->reflection_roughness.sample_at(comps);
-		Ray reflect_ray = Ray(
+		Tuple fuzz = slt_refl_rough * Tuple::RandomInUnitSphere();
+		ray = Ray(
 			comps.over_point, 
-			comps.reflect_v + (slt_refl_rough * Tuple::RandomInUnitSphere()), 
-			comps.ray_depth + 1
+			comps.reflect_v + fuzz, 
+			comps.ray_depth + 1,
+			comps.time
 		);
-		return world.color_at(reflect_ray) * slt_reflection;
+
+		// Mirror the differentials about the normal as well, so textures seen in 
+		// reflections are filtered. Curvature of the surface is ignored.
+		if (comps.has_differentials)
+		{
+			ray.set_differentials(
+				comps.over_point + comps.dpdx,
+				Tuple::reflect(comps.rx_direction, comps.normal_v) + fuzz,
+				comps.over_point + comps.dpdy,
+				Tuple::reflect(comps.ry_direction, comps.normal_v) + fuzz
+			);
+		}
+
+		weight = slt_reflection;
+		return true;
 	}
 
-	return blk;
+	return false;
 }
 
-Color PhongMaterial::refract(const World & world, const IxComps & comps) const
+bool PhongMaterial::refracted_ray(const IxComps & comps, Ray & ray, Color & weight) const
 {
 	Color blk = Color(0.0);
 	Color slt_refraction = this->refraction.sample_at(comps);
@@ -229,38 +302,139 @@ Color PhongMaterial::refract(const World & world, const IxComps & comps) const
 		// Inverted from the definition of Snell's Law
 		double n_ratio = comps.n1 / comps.n2;
 
-		// cos(theta_i) is the same as the dot product of the two vectors
-		double cos_i = Tuple::dot(comps.eye_v, comps.normal_v);
-
-		// Find sin(theta_t)^2 via trigonometric identity
-		double sin2_t = (n_ratio * n_ratio) * (1 - (cos_i * cos_i));
+		Tuple direction;
 
 		// False if Total Internal Reflection applies
-		if (sin2_t < 1.0)
+		if (refract_vector(comps.eye_v, comps.normal_v, n_ratio, direction))
 		{
 			// Refraction
 
-			// Find cos(theta_t) via trigonometric identity
-			double cos_t = sqrt(1.0 - sin2_t);
-
-			// Compute the direction of the refracted ray
-			Tuple direction = comps.normal_v * (n_ratio * cos_i - cos_t) - comps.eye_v * n_ratio;
-
 			// Create the refracted Ray
 			// Roughness code from Ray Tracing in One Weekend by Peter Shirley
 			// https://raytracing.github.io/books/RayTracingInOneWeekend.html#metal/fuzzyreflection
 			double slt_rafr_rough = this->refraction_roughness.sample_at(comps);
-			Ray refract_ray = Ray(
+			Tuple fuzz = slt_rafr_rough * Tuple::RandomInUnitSphere();
+			ray = Ray(
 				comps.under_point,
-				direction + (slt_rafr_rough * Tuple::RandomInUnitSphere()),
-				comps.ray_depth + 1
+				direction + fuzz,
+				comps.ray_depth + 1,
+				comps.time
 			);
-			// Find the color of the refracted ray
-			return world.color_at(refract_ray) * slt_refraction;
+
+			// Bend the differentials through the surface as well
+			// If either of them is totally internally reflected the refracted ray goes without
+			Tuple dx_direction, dy_direction;
+			if (
+				comps.has_differentials &&
+				refract_vector(-Tuple(comps.rx_direction), comps.normal_v, n_ratio, dx_direction) &&
+				refract_vector(-Tuple(comps.ry_direction), comps.normal_v, n_ratio, dy_direction)
+			)
+			{
+				ray.set_differentials(
+					comps.under_point + comps.dpdx,
+					dx_direction + fuzz,
+					comps.under_point + comps.dpdy,
+					dy_direction + fuzz
+				);
+			}
+
+			weight = slt_refraction;
+			return true;
 		}
 	}
 
-	return blk;
+	return false;
+}
+
+// Matches the diffuse term of lighting(), with the light's color replaced by the incoming light
+Color PhongMaterial::diffuse_albedo(const IxComps & comps) const
+{
+	return this->color.sample_at(comps) * this->diffuse.sample_at(comps);
+}
+
+// The diffuse and specular terms of lighting(), with the light's color left to the caller
+Color PhongMaterial::light_response(const IxComps & comps, const Tuple & light_v) const
+{
+	double light_dot_normal = Tuple::dot(light_v, comps.normal_v);
+
+	if (light_dot_normal <= 0.0)
+	{
+		return Color(0.0);
+	}
+
+	Color response = this->color.sample_at(comps) * this->diffuse.sample_at(comps) * light_dot_normal;
+
+	double reflect_dot_eye = Tuple::dot(Tuple::reflect(light_v * -1.0, comps.normal_v), comps.eye_v);
+
+	if (reflect_dot_eye > 0.0)
+	{
+		response = response + Color(this->specular.sample_at(comps) * pow(reflect_dot_eye, this->shininess.sample_at(comps)));
+	}
+
+	return response;
+}
+
+// A cosine lobe around the normal for the diffuse term, and a cos^n lobe around the mirror
+// direction for the specular one.  (reflect(-l, n) . eye) is the same as (l . reflect(-eye, n))
+bool PhongMaterial::sample_light_response(const IxComps & comps, double u1, double u2, Tuple & light_v, double & pdf) const
+{
+	double diffuse_probability = this->pm_diffuse_probability_(comps);
+
+	if (u1 < diffuse_probability)
+	{
+		light_v = Tuple::CosineHemisphere(comps.normal_v, u1 / diffuse_probability, u2);
+	}
+	else
+	{
+		u1 = std::min((u1 - diffuse_probability) / (1.0 - diffuse_probability), 1.0 - std::numeric_limits<double>::epsilon());
+
+		double cos_alpha = pow(1.0 - u1, 1.0 / (this->shininess.sample_at(comps) + 1.0));
+		double sin_alpha = sqrt(std::max(0.0, 1.0 - (cos_alpha * cos_alpha)));
+		double phi = 2.0 * M_PI * u2;
+
+		const Tuple mirror_v = comps.reflect_v.normalize();
+		Tuple tangent, bitangent;
+		Tuple::OrthonormalBasis(mirror_v, tangent, bitangent);
+
+		light_v = (tangent * (sin_alpha * cos(phi))) + (bitangent * (sin_alpha * sin(phi))) + (mirror_v * cos_alpha);
+	}
+
+	if (Tuple::dot(light_v, comps.normal_v) <= 0.0)
+	{
+		return false;
+	}
+
+	pdf = this->light_response_pdf(comps, light_v);
+	return pdf > 0.0;
+}
+
+double PhongMaterial::light_response_pdf(const IxComps & comps, const Tuple & light_v) const
+{
+	double light_dot_normal = Tuple::dot(light_v, comps.normal_v);
+
+	if (light_dot_normal <= 0.0)
+	{
+		return 0.0;
+	}
+
+	double diffuse_probability = this->pm_diffuse_probability_(comps);
+	double pdf = diffuse_probability * light_dot_normal / M_PI;
+
+	double mirror_dot_light = Tuple::dot(comps.reflect_v.normalize(), light_v);
+
+	if (mirror_dot_light > 0.0)
+	{
+		double slt_shininess = this->shininess.sample_at(comps);
+		pdf += (1.0 - diffuse_probability) * (slt_shininess + 1.0) / (2.0 * M_PI) * pow(mirror_dot_light, slt_shininess);
+	}
+
+	return pdf;
+}
+
+// The specular lobe's share of the energy, as sample_light_response picks it
+double PhongMaterial::glossy_fraction(const IxComps & comps) const
+{
+	return 1.0 - this->pm_diffuse_probability_(comps);
 }
 
 Color PhongMaterial::transmit(const std::shared_ptr<Light> lgt, const World & world, const IxComps & comps, const Intersections & ix) const
@@ -289,7 +463,7 @@ Color PhongMaterial::transmit(const std::shared_ptr<Light> lgt, const World & wo
 
 				if (light_distance > distance)
 				{
-					result = result * world.shadowed(lgt, comps.under_point, comps.ray_depth);
+					result = result * world.shadowed(lgt, comps.under_point, comps.ray_depth, comps.time);
 				}
 
 				if (comps.n2 > 1.0 + EPSILON)
@@ -307,6 +481,40 @@ Color PhongMaterial::transmit(const std::shared_ptr<Light> lgt, const World & wo
 	return Color(0.0);
 }
 
+void PhongMaterial::compile_maps()
+{
+	BaseMaterial::compile_maps();
+
+	this->color.compile();
+	this->reflection.compile();
+	this->refraction.compile();
+	this->ambient.compile();
+
+	this->diffuse.compile();
+	this->specular.compile();
+	this->shininess.compile();
+	this->reflection_roughness.compile();
+	this->refraction_roughness.compile();
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+// In proportion to how much light each lobe reflects over the hemisphere
+double PhongMaterial::pm_diffuse_probability_(const IxComps & comps) const
+{
+	double diffuse_energy = M_PI * this->diffuse.sample_at(comps) * this->color.sample_at(comps).luminosity();
+	double specular_energy = 2.0 * M_PI * this->specular.sample_at(comps) / (this->shininess.sample_at(comps) + 1.0);
+
+	if (diffuse_energy + specular_energy <= 0.0)
+	{
+		return 1.0;
+	}
+
+	return diffuse_energy / (diffuse_energy + specular_energy);
+}
+
 // ------------------------------------------------------------------------
 // Comparison Operators
 // ------------------------------------------------------------------------
@@ -367,3 +575,29 @@ double schlick(const IxComps & comps)
 
 	return r0 + (1.0 - r0) * (y * y * y * y * y);
 }
+
+// Snell's Law
+// Returns false if there is total internal reflection, otherwise places the refracted 
+// direction into refracted_v
+bool refract_vector(const Tuple & eye_v, const Tuple & normal_v, double n_ratio, Tuple & refracted_v)
+{
+	// cos(theta_i) is the same as the dot product of the two vectors
+	double cos_i = Tuple::dot(eye_v, normal_v);
+
+	// Find sin(theta_t)^2 via trigonometric identity
+	double sin2_t = (n_ratio * n_ratio) * (1 - (cos_i * cos_i));
+
+	if (sin2_t >= 1.0)
+	{
+		return false;
+	}
+
+	// Find cos(theta_t) via trigonometric identity
+	double cos_t = sqrt(1.0 - sin2_t);
+
+	// Compute the direction of the refracted ray
+	refracted_v = normal_v * (n_ratio * cos_i - cos_t) - eye_v * n_ratio;
+
+	return true;
+}
+
@@ -28,6 +28,29 @@ public:
 	virtual Color reflect(const World & world, const IxComps & comps) const;
 	virtual Color refract(const World & world, const IxComps & comps) const;
 	virtual Color transmit(const std::shared_ptr<Light> lgt, const World & world, const IxComps & comps, const Intersections & ix) const;
+
+	// Rays that continue a path through the surface, used by the integrator in World.
+	// Return false when the material does not reflect or refract at this point.
+	// The color the traced ray carries is multiplied by weight.
+	virtual bool reflected_ray(const IxComps & comps, Ray & ray, Color & weight) const;
+	virtual bool refracted_ray(const IxComps & comps, Ray & ray, Color & weight) const;
+
+	// Fraction of indirect light the surface scatters diffusely, used for global illumination
+	virtual Color diffuse_albedo(const IxComps & comps) const;
+
+	// Area lights are integrated by World one direction at a time.
+	// light_response is the light reflected toward the eye for unit light arriving along light_v,
+	// including the cosine term, so that lighting() for a point light is light_response times its intensity.
+	virtual Color light_response(const IxComps & comps, const Tuple & light_v) const;
+	// Picks a direction roughly in proportion to light_response, with its density per unit solid angle
+	virtual bool sample_light_response(const IxComps & comps, double u1, double u2, Tuple & light_v, double & pdf) const;
+	virtual double light_response_pdf(const IxComps & comps, const Tuple & light_v) const;
+	// Share of light_response in lobes narrow enough that sampling the material finds them
+	// better than sampling the light.  0 for a purely diffuse surface.
+	virtual double glossy_fraction(const IxComps & comps) const;
+
+	// Compiles the map graphs connected to the slots again where they have been edited
+	virtual void compile_maps();
 	
 	// Properties
 	std::string name;
@@ -57,10 +80,18 @@ public:
 	Color lighting(const std::shared_ptr<Light> lgt, const Tuple & point, const Tuple & eye_v, const Tuple & normal_v) const;
 	Color lighting(const std::shared_ptr<Light> lgt, const Tuple & point, const Tuple & eye_v, const Tuple & normal_v, bool shadowed) const;
 
-	virtual Color reflect(const World & world, const IxComps & comps) const override;
-	virtual Color refract(const World & world, const IxComps & comps) const override;
 	virtual Color transmit(const std::shared_ptr<Light> lgt, const World & world, const IxComps & comps, const Intersections & ix) const override;
 
+	virtual bool reflected_ray(const IxComps & comps, Ray & ray, Color & weight) const override;
+	virtual bool refracted_ray(const IxComps & comps, Ray & ray, Color & weight) const override;
+	virtual Color diffuse_albedo(const IxComps & comps) const override;
+
+	virtual Color light_response(const IxComps & comps, const Tuple & light_v) const override;
+	virtual bool sample_light_response(const IxComps & comps, double u1, double u2, Tuple & light_v, double & pdf) const override;
+	virtual double light_response_pdf(const IxComps & comps, const Tuple & light_v) const override;
+	virtual double glossy_fraction(const IxComps & comps) const override;
+
+	virtual void compile_maps() override;
 
 	// Properties
 	ColorMapSlot color;
@@ -76,6 +107,10 @@ public:
 
 	bool transparent_shadows;
 
+private:
+	// Chance of sample_light_response picking the diffuse lobe over the specular one
+	double pm_diffuse_probability_(const IxComps & comps) const;
+
 };
 
 // Overloaded Operators
@@ -84,5 +119,6 @@ bool operator!=(const PhongMaterial & left_mat, const PhongMaterial & right_mat)
 
 // Shading Functions
 double schlick(const IxComps & comps);
+bool refract_vector(const Tuple & eye_v, const Tuple & normal_v, double n_ratio, Tuple & refracted_v);
 
 #endif
@@ -874,7 +874,56 @@ double Matrix4::determinant() const
 
 Matrix4 Matrix4::inverse() const
 {
-	return Matrix4(this->inverse_vector());
+	// The cofactor expansion written out, sharing the 2x2 determinants of the top and
+	// bottom row pairs.  Every set_transform inverts, so this runs once per object loaded.
+	const double a00 = this->get(0), a01 = this->get(1), a02 = this->get(2), a03 = this->get(3);
+	const double a10 = this->get(4), a11 = this->get(5), a12 = this->get(6), a13 = this->get(7);
+	const double a20 = this->get(8), a21 = this->get(9), a22 = this->get(10), a23 = this->get(11);
+	const double a30 = this->get(12), a31 = this->get(13), a32 = this->get(14), a33 = this->get(15);
+
+	const double s0 = a00 * a11 - a10 * a01;
+	const double s1 = a00 * a12 - a10 * a02;
+	const double s2 = a00 * a13 - a10 * a03;
+	const double s3 = a01 * a12 - a11 * a02;
+	const double s4 = a01 * a13 - a11 * a03;
+	const double s5 = a02 * a13 - a12 * a03;
+
+	const double c0 = a20 * a31 - a30 * a21;
+	const double c1 = a20 * a32 - a30 * a22;
+	const double c2 = a20 * a33 - a30 * a23;
+	const double c3 = a21 * a32 - a31 * a22;
+	const double c4 = a21 * a33 - a31 * a23;
+	const double c5 = a22 * a33 - a32 * a23;
+
+	const double det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if (abs(det) < std::numeric_limits<double>::epsilon())
+	{
+		throw NoninvertableMatrix(*this);
+	}
+
+	const double inv_det = 1.0 / det;
+
+	return Matrix4(std::vector<double>{
+		( a11 * c5 - a12 * c4 + a13 * c3) * inv_det,
+		(-a01 * c5 + a02 * c4 - a03 * c3) * inv_det,
+		( a31 * s5 - a32 * s4 + a33 * s3) * inv_det,
+		(-a21 * s5 + a22 * s4 - a23 * s3) * inv_det,
+
+		(-a10 * c5 + a12 * c2 - a13 * c1) * inv_det,
+		( a00 * c5 - a02 * c2 + a03 * c1) * inv_det,
+		(-a30 * s5 + a32 * s2 - a33 * s1) * inv_det,
+		( a20 * s5 - a22 * s2 + a23 * s1) * inv_det,
+
+		( a10 * c4 - a11 * c2 + a13 * c0) * inv_det,
+		(-a00 * c4 + a01 * c2 - a03 * c0) * inv_det,
+		( a30 * s4 - a31 * s2 + a33 * s0) * inv_det,
+		(-a20 * s4 + a21 * s2 - a23 * s0) * inv_det,
+
+		(-a10 * c3 + a11 * c1 - a12 * c0) * inv_det,
+		( a00 * c3 - a01 * c1 + a02 * c0) * inv_det,
+		(-a30 * s3 + a31 * s1 - a32 * s0) * inv_det,
+		( a20 * s3 - a21 * s1 + a22 * s0) * inv_det
+	});
 }
 
 Matrix4 Matrix4::transpose() const
@@ -882,16 +931,16 @@ Matrix4 Matrix4::transpose() const
 	return Matrix4(this->transpose_vector());
 }
 
-Tuple Matrix4::position()
+Tuple Matrix4::position() const
 {
 	return Tuple::Point(
-		this->operator[](3),
-		this->operator[](7),
-		this->operator[](11)
+		this->get(3),
+		this->get(7),
+		this->get(11)
 	);
 }
 
-Tuple Matrix4::scale()
+Tuple Matrix4::scale() const
 {
 	Tuple s0 = (this->get_row_tuple(0));
 	s0.w = 0;
@@ -934,14 +983,16 @@ Matrix4 Matrix4::operator*(const Matrix4 & right_matrix) const
 // External Overloaded Operators
 Tuple Matrix4::operator*(const Tuple & tuple) const
 {
-	double x, y, z, w;
+	// Reads the rows straight from the underlying data rather than building a Tuple per row,
+	// this is called for every point, normal and ray transformation
+	const double * m = this->begin();
 
-	x = Tuple::dot(tuple, this->get_row_tuple(0));
-	y = Tuple::dot(tuple, this->get_row_tuple(1));
-	z = Tuple::dot(tuple, this->get_row_tuple(2));
-	w = Tuple::dot(tuple, this->get_row_tuple(3));
-
-	return Tuple(x, y, z, w);
+	return Tuple(
+		(tuple.x * m[0]) + (tuple.y * m[1]) + (tuple.z * m[2]) + (tuple.w * m[3]),
+		(tuple.x * m[4]) + (tuple.y * m[5]) + (tuple.z * m[6]) + (tuple.w * m[7]),
+		(tuple.x * m[8]) + (tuple.y * m[9]) + (tuple.z * m[10]) + (tuple.w * m[11]),
+		(tuple.x * m[12]) + (tuple.y * m[13]) + (tuple.z * m[14]) + (tuple.w * m[15])
+	);
 }
 
 // ------------------------------------------------------------------------
@@ -158,8 +158,8 @@ public:
 	Matrix4 transpose() const;
 
 	// Transformation Matrix Getters
-	Tuple position();
-	Tuple scale();
+	Tuple position() const;
+	Tuple scale() const;
 
 	// Overloaded Operators
 	Matrix4 operator*(const Matrix4 & right_matrix) const;
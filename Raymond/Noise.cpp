@@ -30,7 +30,7 @@
 PerlinMap::PerlinMap()
 {
 	// Initialize with the reference values
-	this->p = { 151, 160, 137, 91, 90, 15,131, 13, 201, 95, 96, 53, 194, 233, 7, 225,
+	this->p_table_ = { 151, 160, 137, 91, 90, 15,131, 13, 201, 95, 96, 53, 194, 233, 7, 225,
 		140, 36, 103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23, 190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62,
 		94, 252, 219, 203, 117, 35, 11, 32, 57, 177, 33, 88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168,
 		68, 175, 74, 165, 71, 134, 139, 48, 27, 166, 77, 146, 158, 231, 83, 111, 229, 122, 60, 211, 133, 230,
@@ -44,31 +44,27 @@ PerlinMap::PerlinMap()
 		205, 93, 222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180,
 	};
 
-	// Duplicate the vector
-	this->p.insert(this->p.end(), this->p.begin(), this->p.end());
-
 	this->octaves = 3;
 	this->persistence = 1.0;
+	this->basis = PerlinNoiseBasis;
+	this->compatibility_mode = false;
 }
 
 // Generate a new permutation vector based on the value of seed
 PerlinMap::PerlinMap(int seed) {
-	this->p.resize(256);
-
 	// Fill p with values from 0 to 255
-	std::iota(this->p.begin(), this->p.end(), 0);
+	std::iota(this->p_table_.begin(), this->p_table_.end(), 0);
 
 	// Initialize a random engine with seed
 	std::default_random_engine engine(seed);
 
 	// Shuffle using the above random engine
-	std::shuffle(this->p.begin(), this->p.end(), engine);
-
-	// Duplicate the permutation vector
-	this->p.insert(this->p.end(), this->p.begin(), this->p.end());
+	std::shuffle(this->p_table_.begin(), this->p_table_.end(), engine);
 
 	this->octaves = 3;
 	this->persistence = 1.0;
+	this->basis = PerlinNoiseBasis;
+	this->compatibility_mode = false;
 }
 
 PerlinMap::~PerlinMap()
@@ -77,7 +73,27 @@ PerlinMap::~PerlinMap()
 
 Color PerlinMap::local_sample_at(const IxComps & comps) const
 {
-	return Color(this->p_octave_perlin_(comps.texmap_point.x, comps.texmap_point.y, comps.texmap_point.z));
+	return Color(this->p_octave_noise_(comps.texmap_point.x, comps.texmap_point.y, comps.texmap_point.z, 0.0, this->basis));
+}
+
+Color PerlinMap::local_filtered_sample_at(const IxComps & comps) const
+{
+	Tuple width = TexMap::filter_width_(comps);
+	double filter_width = std::max(width.x, std::max(width.y, width.z));
+
+	return Color(this->p_octave_noise_(comps.texmap_point.x, comps.texmap_point.y, comps.texmap_point.z, filter_width, this->basis));
+}
+
+uint64_t PerlinMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = hash_value(hash, this->octaves);
+	hash = hash_value(hash, this->persistence);
+	hash = hash_value(hash, this->basis);
+	hash = hash_value(hash, this->compatibility_mode);
+	hash = hash_bytes(hash, this->p_table_.data(), this->p_table_.size());
+
+	return hash;
 }
 
 
@@ -129,12 +145,13 @@ double PerlinMap::p_perlin_(double x, double y, double z) const
 	double w = p_fade_(z);
 
 	// Hash coordinates of the 8 cube corners
-	int A = this->p[X] + Y;
-	int AA = this->p[A] + Z;
-	int AB = this->p[A + 1] + Z;
-	int B = this->p[X + 1] + Y;
-	int BA = this->p[B] + Z;
-	int BB = this->p[B + 1] + Z;
+	const uint8_t * p = this->p_table_.data();
+	int A = p[X] + Y;
+	int AA = p[A & 255] + Z;
+	int AB = p[(A + 1) & 255] + Z;
+	int B = p[(X + 1) & 255] + Y;
+	int BA = p[B & 255] + Z;
+	int BB = p[(B + 1) & 255] + Z;
 
 	// Add blended results from 8 corners of cube
 	double res = PerlinMap::p_lerp_(
@@ -143,25 +160,25 @@ double PerlinMap::p_perlin_(double x, double y, double z) const
 			v, 
 			PerlinMap::p_lerp_(
 				u, 
-				p_grad_(this->p[AA], x, y, z),
-				p_grad_(this->p[BA], x - 1, y, z)
+				p_grad_(p[AA & 255], x, y, z),
+				p_grad_(p[BA & 255], x - 1, y, z)
 			), 
 			PerlinMap::p_lerp_(
-				u, p_grad_(this->p[AB], x, y - 1, z),
-				p_grad_(this->p[BB], x - 1, y - 1, z)
+				u, p_grad_(p[AB & 255], x, y - 1, z),
+				p_grad_(p[BB & 255], x - 1, y - 1, z)
 			)
 		), 
 		PerlinMap::p_lerp_(
 			v, 
 			PerlinMap::p_lerp_(
 				u, 
-				p_grad_(this->p[AA + 1], x, y, z - 1),
-				p_grad_(this->p[BA + 1], x - 1, y, z - 1)
+				p_grad_(p[(AA + 1) & 255], x, y, z - 1),
+				p_grad_(p[(BA + 1) & 255], x - 1, y, z - 1)
 			), 
 			PerlinMap::p_lerp_(
 				u, 
-				p_grad_(this->p[AB + 1], x, y - 1, z - 1),
-				p_grad_(this->p[BB + 1], x - 1, y - 1, z - 1)
+				p_grad_(p[(AB + 1) & 255], x, y - 1, z - 1),
+				p_grad_(p[(BB + 1) & 255], x - 1, y - 1, z - 1)
 			)
 		)
 	);
@@ -171,12 +188,32 @@ double PerlinMap::p_perlin_(double x, double y, double z) const
 // Sourced from Adrian Biagioli
 // https://adrianb.io/2014/08/09/perlinnoise.html
 double PerlinMap::p_octave_perlin_(double x, double y, double z) const {
+	return this->p_octave_perlin_(x, y, z, 0.0);
+}
+
+// Octaves whose features are smaller than the filter footprint cannot be resolved and would alias.
+// They fade to the average value of the noise instead, and are not evaluated once fully faded.
+double PerlinMap::p_octave_perlin_(double x, double y, double z, double filter_width) const {
 	double total = 0;
 	double frequency = 1;
 	double amplitude = 1;
 	double maxValue = 0;  // Used for normalizing result to 0.0 - 1.0
 	for (int i = 0; i < this->octaves; i++) {
-		total += this->p_perlin_(x * frequency, y * frequency, z * frequency) * amplitude;
+		// 1.0 while the footprint is under half a lattice cell, 0.0 once it covers a whole cell
+		double visibility = clip(2.0 - (2.0 * filter_width * frequency), 0.0, 1.0);
+
+		if (visibility >= 1.0)
+		{
+			total += this->p_perlin_(x * frequency, y * frequency, z * frequency) * amplitude;
+		}
+		else if (visibility > 0.0)
+		{
+			total += lerp(visibility, 0.5, this->p_perlin_(x * frequency, y * frequency, z * frequency)) * amplitude;
+		}
+		else
+		{
+			total += 0.5 * amplitude;
+		}
 
 		maxValue += amplitude;
 
@@ -192,6 +229,102 @@ double PerlinMap::p_lerp_(double t, double a, double b)
 	return a + t * (b - a);
 }
 
+// ------------------------------------------------------------------------
+// Batched Octaves
+// ------------------------------------------------------------------------
+
+// Matches the fade in p_octave_perlin_ exactly
+static double octave_visibility(const double filter_width, const double frequency)
+{
+	return clip(2.0 - (2.0 * filter_width * frequency), 0.0, 1.0);
+}
+
+double PerlinMap::p_octave_noise_(double x, double y, double z, double filter_width, NoiseBasis noise_basis) const
+{
+	if (this->compatibility_mode && noise_basis == PerlinNoiseBasis)
+	{
+		return this->p_octave_perlin_(x, y, z, filter_width);
+	}
+
+	double total = 0.0;
+	double max_value = 0.0;
+
+	NoiseBatch batch = NoiseBatch();
+
+	for (int first_octave = 0; first_octave < this->octaves; first_octave += NoiseBatch::MAX_LANES)
+	{
+		const int num_octaves = std::min(NoiseBatch::MAX_LANES, this->octaves - first_octave);
+
+		batch.clear();
+		this->p_add_octaves_(batch, x, y, z, filter_width, first_octave, num_octaves);
+		batch.evaluate(noise_basis);
+		this->p_sum_octaves_(batch, 0, filter_width, first_octave, num_octaves, total, max_value);
+	}
+
+	return total / max_value;
+}
+
+// Adds a lane for every octave that is not fully faded by the filter
+void PerlinMap::p_add_octaves_(NoiseBatch & batch, double x, double y, double z, double filter_width, int first_octave, int num_octaves) const
+{
+	double frequency = 1;
+
+	for (int i = 0; i < first_octave; i++)
+	{
+		frequency *= 2;
+	}
+
+	for (int i = first_octave; i < first_octave + num_octaves; i++)
+	{
+		if (filter_width <= 0.0 || octave_visibility(filter_width, frequency) > 0.0)
+		{
+			batch.add(this->p_table_.data(), x * frequency, y * frequency, z * frequency);
+		}
+
+		frequency *= 2;
+	}
+}
+
+// Accumulates in the same order as p_octave_perlin_, so the two only differ by the float
+// rounding of the Perlin kernel.  Returns the lane after the last one used.
+int PerlinMap::p_sum_octaves_(const NoiseBatch & batch, int lane, double filter_width, int first_octave, int num_octaves, double & total, double & max_value) const
+{
+	double frequency = 1;
+	double amplitude = 1;
+
+	for (int i = 0; i < first_octave; i++)
+	{
+		frequency *= 2;
+		amplitude *= this->persistence;
+	}
+
+	for (int i = first_octave; i < first_octave + num_octaves; i++)
+	{
+		// Without a footprint every octave is fully visible
+		double visibility = (filter_width <= 0.0) ? 1.0 : octave_visibility(filter_width, frequency);
+
+		if (visibility >= 1.0)
+		{
+			total += batch.result(lane++) * amplitude;
+		}
+		else if (visibility > 0.0)
+		{
+			total += lerp(visibility, 0.5, batch.result(lane++)) * amplitude;
+		}
+		else
+		{
+			total += 0.5 * amplitude;
+		}
+
+		max_value += amplitude;
+
+		amplitude *= this->persistence;
+		frequency *= 2;
+	}
+
+	return lane;
+}
+
 // ------------------------------------------------------------------------
 //
 // Colored Perlin Map
@@ -210,6 +343,8 @@ ColoredPerlin::ColoredPerlin(int seed)
 	this->g_ = std::make_shared<PerlinMap>(seed + 1);
 	this->b_ = std::make_shared<PerlinMap>(seed + 2);
 
+	this->basis = PerlinNoiseBasis;
+	this->compatibility_mode = false;
 }
 
 ColoredPerlin::~ColoredPerlin()
@@ -218,9 +353,339 @@ ColoredPerlin::~ColoredPerlin()
 
 Color ColoredPerlin::local_sample_at(const IxComps & comps) const
 {
+	return this->cp_sample_(comps, 0.0);
+}
+
+Color ColoredPerlin::local_filtered_sample_at(const IxComps & comps) const
+{
+	Tuple width = TexMap::filter_width_(comps);
+
+	return this->cp_sample_(comps, std::max(width.x, std::max(width.y, width.z)));
+}
+
+// Octaves and persistence are left out, the channels use their own
+uint64_t ColoredPerlin::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = hash_value(hash, this->basis);
+	hash = hash_value(hash, this->compatibility_mode);
+	hash = hash_value(hash, this->r_->graph_hash());
+	hash = hash_value(hash, this->g_->graph_hash());
+	hash = hash_value(hash, this->b_->graph_hash());
+
+	return hash;
+}
+
+// Evaluates the octaves of all three channels in one batch
+Color ColoredPerlin::cp_sample_(const IxComps & comps, const double filter_width) const
+{
+	const Tuple & p = comps.texmap_point;
+	const PerlinMap * channels[3] = { this->r_.get(), this->g_.get(), this->b_.get() };
+	double values[3];
+
+	const int num_lanes = this->r_->octaves + this->g_->octaves + this->b_->octaves;
+
+	if ((this->compatibility_mode && this->basis == PerlinNoiseBasis) || num_lanes > NoiseBatch::MAX_LANES)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			values[c] = (this->compatibility_mode && this->basis == PerlinNoiseBasis) ?
+				channels[c]->p_octave_perlin_(p.x, p.y, p.z, filter_width) :
+				channels[c]->p_octave_noise_(p.x, p.y, p.z, filter_width, this->basis);
+		}
+	}
+	else
+	{
+		NoiseBatch batch = NoiseBatch();
+
+		for (const PerlinMap * channel : channels)
+		{
+			channel->p_add_octaves_(batch, p.x, p.y, p.z, filter_width, 0, channel->octaves);
+		}
+
+		batch.evaluate(this->basis);
+
+		int lane = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			double total = 0.0;
+			double max_value = 0.0;
+
+			lane = channels[c]->p_sum_octaves_(batch, lane, filter_width, 0, channels[c]->octaves, total, max_value);
+			values[c] = total / max_value;
+		}
+	}
+
+	// Each channel is a gray color reduced back to one value, as the channel maps used to be sampled
 	return Color(
-		this->r_->local_sample_at(comps).luminosity(),
-		this->g_->local_sample_at(comps).luminosity(),
-		this->b_->local_sample_at(comps).luminosity()
+		Color(values[0]).luminosity(),
+		Color(values[1]).luminosity(),
+		Color(values[2]).luminosity()
 	);
 }
+
+// ------------------------------------------------------------------------
+//
+// Noise Batch
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+// The lane arrays are left uninitialized, only lanes below nb_size_ are ever read
+NoiseBatch::NoiseBatch()
+{
+	this->nb_size_ = 0;
+}
+
+NoiseBatch::~NoiseBatch()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+int NoiseBatch::add(const uint8_t * table, double x, double y, double z)
+{
+	if (this->nb_size_ >= MAX_LANES)
+	{
+		throw std::out_of_range("NoiseBatch is full");
+	}
+
+	const int lane = this->nb_size_++;
+
+	this->nb_tables_[lane] = table;
+	this->nb_x_[lane] = x;
+	this->nb_y_[lane] = y;
+	this->nb_z_[lane] = z;
+
+	return lane;
+}
+
+void NoiseBatch::evaluate(NoiseBasis basis)
+{
+	switch (basis)
+	{
+	case PerlinNoiseBasis:
+		this->nb_evaluate_perlin_();
+		break;
+	case SimplexNoiseBasis:
+		this->nb_evaluate_simplex_();
+		break;
+	}
+}
+
+double NoiseBatch::result(const int lane) const
+{
+	return this->nb_results_[lane];
+}
+
+int NoiseBatch::size() const
+{
+	return this->nb_size_;
+}
+
+void NoiseBatch::clear()
+{
+	this->nb_size_ = 0;
+}
+
+// ------------------------------------------------------------------------
+// Kernels
+// ------------------------------------------------------------------------
+
+// Ken Perlin's reference gradient, written with selects instead of a switch so the
+// lane loop has no branches.  Gives the same values as PerlinMap::p_grad_.
+static inline float lane_grad(const int32_t hash, const float x, const float y, const float z)
+{
+	const int32_t h = hash & 15;
+	const float u = (h < 8) ? x : y;
+	const float v = (h < 4) ? y : (((h == 12) || (h == 14)) ? x : z);
+	return (((h & 1) == 0) ? u : -u) + (((h & 2) == 0) ? v : -v);
+}
+
+// floor() is a library call without SSE4.1, this is exact for anything that fits an int
+static inline int lane_floor(const double x)
+{
+	const int i = static_cast<int>(x);
+	return (x < i) ? i - 1 : i;
+}
+
+static inline float lane_lerp(const float t, const float a, const float b)
+{
+	return a + t * (b - a);
+}
+
+static inline float lane_fade(const float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+// The cells and the positions in them are found in double, so points far from the origin
+// keep their precision.  Everything after is in float, with the corner hashes widened to
+// 32 bits, so four lanes of the same width fit each SSE2 vector.
+void NoiseBatch::nb_evaluate_perlin_()
+{
+	const int n = this->nb_size_;
+	// Padded to whole vectors, so the arithmetic loop has no remainder
+	const int padded = (n + 3) & ~3;
+
+	// The table lookups are gathers, so they are done up front one lane at a time
+	alignas(16) int32_t corners[8][MAX_LANES];
+	alignas(16) float fx[MAX_LANES], fy[MAX_LANES], fz[MAX_LANES];
+	alignas(16) float results[MAX_LANES];
+
+	for (int l = 0; l < n; l++)
+	{
+		const uint8_t * p = this->nb_tables_[l];
+
+		const int cell_x = lane_floor(this->nb_x_[l]);
+		const int cell_y = lane_floor(this->nb_y_[l]);
+		const int cell_z = lane_floor(this->nb_z_[l]);
+
+		const int X = cell_x & 255;
+		const int Y = cell_y & 255;
+		const int Z = cell_z & 255;
+
+		fx[l] = static_cast<float>(this->nb_x_[l] - cell_x);
+		fy[l] = static_cast<float>(this->nb_y_[l] - cell_y);
+		fz[l] = static_cast<float>(this->nb_z_[l] - cell_z);
+
+		const int A = p[X] + Y;
+		const int AA = p[A & 255] + Z;
+		const int AB = p[(A + 1) & 255] + Z;
+		const int B = p[(X + 1) & 255] + Y;
+		const int BA = p[B & 255] + Z;
+		const int BB = p[(B + 1) & 255] + Z;
+
+		corners[0][l] = p[AA & 255];
+		corners[1][l] = p[BA & 255];
+		corners[2][l] = p[AB & 255];
+		corners[3][l] = p[BB & 255];
+		corners[4][l] = p[(AA + 1) & 255];
+		corners[5][l] = p[(BA + 1) & 255];
+		corners[6][l] = p[(AB + 1) & 255];
+		corners[7][l] = p[(BB + 1) & 255];
+	}
+
+	for (int l = n; l < padded; l++)
+	{
+		fx[l] = fy[l] = fz[l] = 0.0f;
+		for (int32_t * corner : corners)
+		{
+			corner[l] = 0;
+		}
+	}
+
+	// Pure arithmetic across the lanes
+	for (int l = 0; l < padded; l++)
+	{
+		const float x = fx[l];
+		const float y = fy[l];
+		const float z = fz[l];
+
+		const float u = lane_fade(x);
+		const float v = lane_fade(y);
+		const float w = lane_fade(z);
+
+		const float res = lane_lerp(
+			w,
+			lane_lerp(
+				v,
+				lane_lerp(u, lane_grad(corners[0][l], x, y, z), lane_grad(corners[1][l], x - 1.0f, y, z)),
+				lane_lerp(u, lane_grad(corners[2][l], x, y - 1.0f, z), lane_grad(corners[3][l], x - 1.0f, y - 1.0f, z))
+			),
+			lane_lerp(
+				v,
+				lane_lerp(u, lane_grad(corners[4][l], x, y, z - 1.0f), lane_grad(corners[5][l], x - 1.0f, y, z - 1.0f)),
+				lane_lerp(u, lane_grad(corners[6][l], x, y - 1.0f, z - 1.0f), lane_grad(corners[7][l], x - 1.0f, y - 1.0f, z - 1.0f))
+			)
+		);
+
+		results[l] = (res + 1.0f) * 0.5f;
+	}
+
+	for (int l = 0; l < n; l++)
+	{
+		this->nb_results_[l] = results[l];
+	}
+}
+
+// 3D simplex noise after Stefan Gustavson's "Simplex noise demystified"
+// https://weber.itn.liu.se/~stegu/simplexnoise/simplexnoise.pdf
+// Touches 4 corners instead of 8 and has no axis aligned artifacts, but does not match Perlin noise.
+void NoiseBatch::nb_evaluate_simplex_()
+{
+	static const double grad3[12][3] = {
+		{ 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+		{ 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+		{ 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 }
+	};
+
+	// Skewing and unskewing factors for 3 dimensions
+	const double F3 = 1.0 / 3.0;
+	const double G3 = 1.0 / 6.0;
+
+	for (int l = 0; l < this->nb_size_; l++)
+	{
+		const uint8_t * p = this->nb_tables_[l];
+		const double x = this->nb_x_[l];
+		const double y = this->nb_y_[l];
+		const double z = this->nb_z_[l];
+
+		// Skew the input space to find the simplex cell
+		const double s = (x + y + z) * F3;
+		const int i = lane_floor(x + s);
+		const int j = lane_floor(y + s);
+		const int k = lane_floor(z + s);
+
+		const double t = (i + j + k) * G3;
+		const double x0 = x - (i - t);
+		const double y0 = y - (j - t);
+		const double z0 = z - (k - t);
+
+		// Which of the six tetrahedra the point is in
+		int i1, j1, k1, i2, j2, k2;
+		if (x0 >= y0)
+		{
+			if (y0 >= z0) { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+			else if (x0 >= z0) { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; }
+			else { i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; }
+		}
+		else
+		{
+			if (y0 < z0) { i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; }
+			else if (x0 < z0) { i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; }
+			else { i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+		}
+
+		const double offsets[4][3] = {
+			{ x0, y0, z0 },
+			{ x0 - i1 + G3, y0 - j1 + G3, z0 - k1 + G3 },
+			{ x0 - i2 + 2.0 * G3, y0 - j2 + 2.0 * G3, z0 - k2 + 2.0 * G3 },
+			{ x0 - 1.0 + 3.0 * G3, y0 - 1.0 + 3.0 * G3, z0 - 1.0 + 3.0 * G3 }
+		};
+
+		const int corner_i[4] = { 0, i1, i2, 1 };
+		const int corner_j[4] = { 0, j1, j2, 1 };
+		const int corner_k[4] = { 0, k1, k2, 1 };
+
+		double n = 0.0;
+
+		for (int c = 0; c < 4; c++)
+		{
+			const double * o = offsets[c];
+			double falloff = 0.6 - (o[0] * o[0]) - (o[1] * o[1]) - (o[2] * o[2]);
+
+			if (falloff > 0.0)
+			{
+				const int gi = p[(i + corner_i[c] + p[(j + corner_j[c] + p[(k + corner_k[c]) & 255]) & 255]) & 255] % 12;
+				falloff *= falloff;
+				n += falloff * falloff * ((grad3[gi][0] * o[0]) + (grad3[gi][1] * o[1]) + (grad3[gi][2] * o[2]));
+			}
+		}
+
+		// Scaled to roughly -1.0 to 1.0, then into the same range as the Perlin kernel
+		this->nb_results_[l] = clip((32.0 * n + 1.0) / 2.0, 0.0, 1.0);
+	}
+}
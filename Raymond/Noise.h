@@ -4,16 +4,49 @@
 #include <algorithm>
 #include <numeric>
 #include <random>
+#include <array>
+#include <cstdint>
 
 #include "Utilities.h"
 #include "Tuple.h"
 #include "Object.h"
 #include "Texmap.h"
 
+enum NoiseBasis { PerlinNoiseBasis, SimplexNoiseBasis };
+
+// Noise lookups gathered from one or more maps and evaluated in a single pass.
+// Every lane has its own point and permutation table, so all the octaves of all
+// the channels of a sample are laid out side by side for the compiler to vectorize.
+// The Perlin kernel works in float after finding each lane's cell, which is what lets
+// four lanes share a vector, and is within 1e-6 of compatibility mode.
+class NoiseBatch
+{
+public:
+	NoiseBatch();
+	~NoiseBatch();
+
+	// Methods
+	int add(const uint8_t * table, double x, double y, double z);
+	void evaluate(NoiseBasis basis);
+	void clear();
+	double result(int lane) const;
+	int size() const;
+
+	static const int MAX_LANES = 64;
+
+private:
+	void nb_evaluate_perlin_();
+	void nb_evaluate_simplex_();
+
+	int nb_size_;
+	const uint8_t * nb_tables_[MAX_LANES];
+	double nb_x_[MAX_LANES], nb_y_[MAX_LANES], nb_z_[MAX_LANES];
+	double nb_results_[MAX_LANES];
+};
+
 class PerlinMap :
 	public TexMap
 {
-	std::vector<int> p;
 public:
 	PerlinMap();
 	PerlinMap(int seed);
@@ -21,12 +54,20 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual Color local_filtered_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	int octaves;
 	double persistence;
+	NoiseBasis basis;
+	// Evaluates one octave at a time in double exactly as before the batched kernel,
+	// for matching renders of existing scenes bit for bit
+	bool compatibility_mode;
 
 private:
+	friend class ColoredPerlin;
+
 	// Perlin Noise 
 	// static
 	static double p_fade_(const double & t);
@@ -34,8 +75,17 @@ private:
 
 	double p_perlin_(double x, double y, double z) const;
 	double p_octave_perlin_(double x, double y, double z) const;
+	double p_octave_perlin_(double x, double y, double z, double filter_width) const;
+
+	// Batched octaves
+	double p_octave_noise_(double x, double y, double z, double filter_width, NoiseBasis noise_basis) const;
+	void p_add_octaves_(NoiseBatch & batch, double x, double y, double z, double filter_width, int first_octave, int num_octaves) const;
+	int p_sum_octaves_(const NoiseBatch & batch, int lane, double filter_width, int first_octave, int num_octaves, double & total, double & max_value) const;
 
 	static double p_lerp_(double t, double a, double b);
+
+	// Ken Perlin's permutation, indices wrap at 256
+	std::array<uint8_t, 256> p_table_;
 };
 
 class ColoredPerlin :
@@ -48,11 +98,18 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual Color local_filtered_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	int octaves;
 	double persistence;
+	NoiseBasis basis;
+	bool compatibility_mode;
+
 private:
+	Color cp_sample_(const IxComps & comps, double filter_width) const;
+
 	std::shared_ptr<PerlinMap> r_, g_, b_;
 };
 
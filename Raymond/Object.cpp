@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "Object.h"
 #include "Primitive.h"
+#include "RenderStats.h"
 
 // ------------------------------------------------------------------------
 //
@@ -14,24 +15,45 @@ TransformController::TransformController()
 {
 	this->x_transform_ = Matrix4::Identity();
 	this->x_inverse_transform_ = Matrix4::Identity();
+	this->x_inverse_transpose_transform_ = Matrix4::Identity();
+	this->x_version_ = 0;
 }
 
 TransformController::TransformController(const Matrix4 & m)
 {
-	this->x_transform_ = m;
-	this->x_inverse_transform_ = m.inverse();
+	this->x_version_ = 0;
+	this->set_transform(m);
 }
 
 TransformController::TransformController(const TransformController & src)
 {
 	this->x_transform_ = src.get_transform();
-	this->x_inverse_transform_ = src.get_transform().inverse();
+	this->x_inverse_transform_ = src.get_inverse_transform();
+	this->x_inverse_transpose_transform_ = src.get_inverse_transpose_transform();
+	this->x_keyframes_ = src.x_keyframes_;
+	this->x_steps_ = src.x_steps_;
+	this->x_version_ = 0;
 }
 
 TransformController::~TransformController()
 {
 }
 
+TransformController & TransformController::operator=(const TransformController & src)
+{
+	if (this != &src)
+	{
+		this->x_transform_ = src.get_transform();
+		this->x_inverse_transform_ = src.get_inverse_transform();
+		this->x_inverse_transpose_transform_ = src.get_inverse_transpose_transform();
+		this->x_keyframes_ = src.x_keyframes_;
+		this->x_steps_ = src.x_steps_;
+		this->x_version_++;
+	}
+
+	return *this;
+}
+
 // ------------------------------------------------------------------------
 // Methods
 // ------------------------------------------------------------------------
@@ -40,25 +62,313 @@ void TransformController::set_transform(const Matrix4 & m)
 {
 	this->x_transform_ = m;
 	this->x_inverse_transform_ = m.inverse();
+	this->x_inverse_transpose_transform_ = this->x_inverse_transform_.transpose();
+
+	this->x_keyframes_.clear();
+	this->x_steps_.clear();
+	this->x_version_++;
 }
 
-Matrix4 TransformController::get_transform() const
+void TransformController::set_transform(const Matrix4 & m, const Matrix4 & inverse)
+{
+	this->x_transform_ = m;
+	this->x_inverse_transform_ = inverse;
+	this->x_inverse_transpose_transform_ = inverse.transpose();
+
+	this->x_keyframes_.clear();
+	this->x_steps_.clear();
+	this->x_version_++;
+}
+
+const Matrix4 & TransformController::get_transform() const
 {
 	return this->x_transform_;
 }
 
-Matrix4 TransformController::get_inverse_transform() const
+const Matrix4 & TransformController::get_inverse_transform() const
 {
 	return this->x_inverse_transform_;
 }
 
+const Matrix4 & TransformController::get_inverse_transpose_transform() const
+{
+	return this->x_inverse_transpose_transform_;
+}
+
+// ------------------------------------------------------------------------
+// Keyframes
+// ------------------------------------------------------------------------
+
+namespace
+{
+	// Quaternions are kept in Tuples as x, y, z and w
+	double quaternion_dot(const Tuple & a, const Tuple & b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	}
+
+	Tuple quaternion_from_rotation(const Matrix4 & m)
+	{
+		const double trace = m.get(0, 0) + m.get(1, 1) + m.get(2, 2);
+
+		if (trace > 0.0)
+		{
+			double s = 0.5 / sqrt(trace + 1.0);
+			return {(m.get(2, 1) - m.get(1, 2)) * s, (m.get(0, 2) - m.get(2, 0)) * s, (m.get(1, 0) - m.get(0, 1)) * s, 0.25 / s};
+		}
+		if (m.get(0, 0) > m.get(1, 1) && m.get(0, 0) > m.get(2, 2))
+		{
+			double s = 2.0 * sqrt(1.0 + m.get(0, 0) - m.get(1, 1) - m.get(2, 2));
+			return {0.25 * s, (m.get(0, 1) + m.get(1, 0)) / s, (m.get(0, 2) + m.get(2, 0)) / s, (m.get(2, 1) - m.get(1, 2)) / s};
+		}
+		if (m.get(1, 1) > m.get(2, 2))
+		{
+			double s = 2.0 * sqrt(1.0 + m.get(1, 1) - m.get(0, 0) - m.get(2, 2));
+			return {(m.get(0, 1) + m.get(1, 0)) / s, 0.25 * s, (m.get(1, 2) + m.get(2, 1)) / s, (m.get(0, 2) - m.get(2, 0)) / s};
+		}
+
+		double s = 2.0 * sqrt(1.0 + m.get(2, 2) - m.get(0, 0) - m.get(1, 1));
+		return {(m.get(0, 2) + m.get(2, 0)) / s, (m.get(1, 2) + m.get(2, 1)) / s, 0.25 * s, (m.get(1, 0) - m.get(0, 1)) / s};
+	}
+
+	Matrix4 rotation_from_quaternion(const Tuple & q)
+	{
+		const double xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		const double xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		const double xw = q.x * q.w, yw = q.y * q.w, zw = q.z * q.w;
+
+		return Matrix4({
+			1.0 - 2.0 * (yy + zz), 2.0 * (xy - zw), 2.0 * (xz + yw), 0.0,
+			2.0 * (xy + zw), 1.0 - 2.0 * (xx + zz), 2.0 * (yz - xw), 0.0,
+			2.0 * (xz - yw), 2.0 * (yz + xw), 1.0 - 2.0 * (xx + yy), 0.0,
+			0.0, 0.0, 0.0, 1.0
+		});
+	}
+
+	Tuple quaternion_slerp(const Tuple & a, Tuple b, double t)
+	{
+		double cosine = quaternion_dot(a, b);
+
+		// The short way round
+		if (cosine < 0.0)
+		{
+			b = b * -1.0;
+			cosine = -cosine;
+		}
+
+		// Nearly the same rotation, where slerp divides by almost 0
+		if (cosine > 0.9995)
+		{
+			Tuple q = a * (1.0 - t) + b * t;
+			return q / sqrt(quaternion_dot(q, q));
+		}
+
+		const double theta = acos(cosine);
+		const double sine = sin(theta);
+
+		return a * (sin((1.0 - t) * theta) / sine) + b * (sin(t * theta) / sine);
+	}
+
+	// Splits m into translation * rotation * stretch.  The rotation is found by polar
+	// decomposition, averaging the matrix with its inverse transpose until it stops changing.
+	void decompose_transform(const Matrix4 & m, Tuple & translation, Tuple & rotation, Matrix4 & stretch)
+	{
+		translation = Tuple::Vector(m.get(0, 3), m.get(1, 3), m.get(2, 3));
+
+		Matrix4 linear = m;
+		for (int row = 0; row < 3; row++)
+		{
+			linear.set(row, 3, 0.0);
+		}
+
+		Matrix4 r = linear;
+		for (int i = 0; i < 100; i++)
+		{
+			const Matrix4 inverse_transpose = r.inverse().transpose();
+			double change = 0.0;
+
+			for (int k = 0; k < 16; k++)
+			{
+				const double next = 0.5 * (r.at(k) + inverse_transpose.at(k));
+				change = std::max(change, std::abs(next - r.at(k)));
+				r.at(k) = next;
+			}
+
+			if (change < 1.0e-12)
+			{
+				break;
+			}
+		}
+
+		// A mirroring is not a rotation, so it is left in the stretch
+		if (r.determinant() < 0.0)
+		{
+			for (int row = 0; row < 3; row++)
+			{
+				for (int col = 0; col < 3; col++)
+				{
+					r.set(row, col, -r.get(row, col));
+				}
+			}
+		}
+
+		stretch = r.inverse() * linear;
+		rotation = quaternion_from_rotation(r);
+	}
+}
+
+void TransformController::add_keyframe(double time, const Matrix4 & m)
+{
+	Keyframe key = Keyframe();
+	key.time = time;
+	key.transform = m;
+	decompose_transform(m, key.translation, key.rotation, key.stretch);
+
+	auto position = std::lower_bound(this->x_keyframes_.begin(), this->x_keyframes_.end(), time, [](const Keyframe & k, double t) { return k.time < t; });
+
+	// A second keyframe at the same time replaces the first
+	if (position != this->x_keyframes_.end() && position->time == time)
+	{
+		*position = key;
+	}
+	else
+	{
+		this->x_keyframes_.insert(position, key);
+	}
+
+	const Matrix4 & first = this->x_keyframes_.front().transform;
+	this->x_transform_ = first;
+	this->x_inverse_transform_ = first.inverse();
+	this->x_inverse_transpose_transform_ = this->x_inverse_transform_.transpose();
+
+	this->x_build_steps_();
+	this->x_version_++;
+}
+
+bool TransformController::is_animated() const
+{
+	return this->x_keyframes_.size() > 1;
+}
+
+size_t TransformController::keyframe_count() const
+{
+	return this->x_keyframes_.size();
+}
+
+Matrix4 TransformController::get_transform_at(double time) const
+{
+	if (!this->is_animated())
+	{
+		return this->x_transform_;
+	}
+
+	size_t step;
+	double fraction;
+	this->x_find_step_(time, step, fraction);
+
+	return TransformController::x_blend_(this->x_steps_[step].transform, this->x_steps_[step + 1].transform, fraction);
+}
+
+Matrix4 TransformController::get_inverse_transform_at(double time) const
+{
+	if (!this->is_animated())
+	{
+		return this->x_inverse_transform_;
+	}
+
+	size_t step;
+	double fraction;
+	this->x_find_step_(time, step, fraction);
+
+	return TransformController::x_blend_(this->x_steps_[step].inverse, this->x_steps_[step + 1].inverse, fraction);
+}
+
+BoundingBox TransformController::motion_bounds(const BoundingBox & local_bounds) const
+{
+	const double infinity = std::numeric_limits<double>::infinity();
+
+	// Boxes that go on forever, like a plane's, would only turn into NaNs
+	for (int i = 0; i < 3; i++)
+	{
+		if (!std::isfinite(local_bounds.minimum[i]) || !std::isfinite(local_bounds.maximum[i]))
+		{
+			return {Tuple::Point(-infinity, -infinity, -infinity), Tuple::Point(infinity, infinity, infinity)};
+		}
+	}
+
+	BoundingBox result = BoundingBox(Tuple::Point(infinity, infinity, infinity), Tuple::Point(-infinity, -infinity, -infinity));
+
+	auto add_box = [&](const Matrix4 & m)
+	{
+		for (int corner = 0; corner < 8; corner++)
+		{
+			Tuple p = m * Tuple::Point(
+				(corner & 1) ? local_bounds.maximum.x : local_bounds.minimum.x,
+				(corner & 2) ? local_bounds.maximum.y : local_bounds.minimum.y,
+				(corner & 4) ? local_bounds.maximum.z : local_bounds.minimum.z
+			);
+
+			for (int i = 0; i < 3; i++)
+			{
+				result.minimum[i] = std::min(result.minimum[i], p[i]);
+				result.maximum[i] = std::max(result.maximum[i], p[i]);
+			}
+		}
+	};
+
+	// Between steps every point moves in a straight line, so the steps' boxes cover it
+	if (this->is_animated())
+	{
+		for (const MotionStep & step : this->x_steps_)
+		{
+			add_box(step.transform);
+		}
+	}
+	else
+	{
+		add_box(this->x_transform_);
+	}
+
+	return result;
+}
+
+uint64_t TransformController::get_version() const
+{
+	return this->x_version_;
+}
+
 // ------------------------------------------------------------------------
 // Transformers
 // ------------------------------------------------------------------------
 
 Ray TransformController::ray_to_object_space(const Ray & r) const
 {
-	return Ray(r).transform(this->x_inverse_transform_);
+	if (!this->is_animated())
+	{
+		return r.transform(this->x_inverse_transform_);
+	}
+
+	size_t step;
+	double fraction;
+	this->x_find_step_(r.time, step, fraction);
+
+	const Matrix4 & first = this->x_steps_[step].inverse;
+	const Matrix4 & second = this->x_steps_[step + 1].inverse;
+
+	Ray result = Ray(TransformController::x_blend_(first, second, fraction, r.origin), TransformController::x_blend_(first, second, fraction, r.direction));
+	result.time = r.time;
+
+	if (r.has_differentials)
+	{
+		result.set_differentials(
+			TransformController::x_blend_(first, second, fraction, r.rx_origin),
+			TransformController::x_blend_(first, second, fraction, r.rx_direction),
+			TransformController::x_blend_(first, second, fraction, r.ry_origin),
+			TransformController::x_blend_(first, second, fraction, r.ry_direction)
+		);
+	}
+
+	return result;
 }
 
 Tuple TransformController::point_to_object_space(const Tuple & p) const
@@ -73,12 +383,147 @@ Tuple TransformController::point_to_world_space(const Tuple & p) const
 
 Tuple TransformController::normal_vector_to_world_space(const Tuple & v) const
 {
-	Tuple nor = this->x_inverse_transform_.transpose() * v;
+	Tuple nor = this->x_inverse_transpose_transform_ * v;
 	nor.w = 0;
 	nor = nor.normalize();
 	return nor;
 }
 
+Tuple TransformController::point_to_object_space(const Tuple & p, double time) const
+{
+	if (!this->is_animated())
+	{
+		return this->x_inverse_transform_ * p;
+	}
+
+	size_t step;
+	double fraction;
+	this->x_find_step_(time, step, fraction);
+
+	return TransformController::x_blend_(this->x_steps_[step].inverse, this->x_steps_[step + 1].inverse, fraction, p);
+}
+
+Tuple TransformController::point_to_world_space(const Tuple & p, double time) const
+{
+	if (!this->is_animated())
+	{
+		return this->x_transform_ * p;
+	}
+
+	size_t step;
+	double fraction;
+	this->x_find_step_(time, step, fraction);
+
+	return TransformController::x_blend_(this->x_steps_[step].transform, this->x_steps_[step + 1].transform, fraction, p);
+}
+
+Tuple TransformController::normal_vector_to_world_space(const Tuple & v, double time) const
+{
+	if (!this->is_animated())
+	{
+		return this->normal_vector_to_world_space(v);
+	}
+
+	size_t step;
+	double fraction;
+	this->x_find_step_(time, step, fraction);
+
+	Tuple nor = TransformController::x_blend_(this->x_steps_[step].inverse_transpose, this->x_steps_[step + 1].inverse_transpose, fraction, v);
+	nor.w = 0;
+	return nor.normalize();
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void TransformController::x_build_steps_()
+{
+	this->x_steps_.clear();
+
+	if (!this->is_animated())
+	{
+		return;
+	}
+
+	this->x_steps_.reserve((this->x_keyframes_.size() - 1) * MOTION_STEPS + 1);
+
+	auto add_step = [this](const Tuple & translation, const Tuple & rotation, const Matrix4 & stretch)
+	{
+		MotionStep step = MotionStep();
+		step.transform = Matrix4::Translation(translation.x, translation.y, translation.z) * rotation_from_quaternion(rotation) * stretch;
+		step.inverse = step.transform.inverse();
+		step.inverse_transpose = step.inverse.transpose();
+		this->x_steps_.push_back(step);
+	};
+
+	for (size_t k = 0; k + 1 < this->x_keyframes_.size(); k++)
+	{
+		const Keyframe & from = this->x_keyframes_[k];
+		const Keyframe & to = this->x_keyframes_[k + 1];
+
+		for (int i = 0; i < MOTION_STEPS; i++)
+		{
+			const double t = double(i) / double(MOTION_STEPS);
+			add_step(from.translation * (1.0 - t) + to.translation * t, quaternion_slerp(from.rotation, to.rotation, t), TransformController::x_blend_(from.stretch, to.stretch, t));
+		}
+	}
+
+	const Keyframe & last = this->x_keyframes_.back();
+	add_step(last.translation, last.rotation, last.stretch);
+}
+
+void TransformController::x_find_step_(double time, size_t & step, double & fraction) const
+{
+	const std::vector<Keyframe> & keys = this->x_keyframes_;
+
+	if (time <= keys.front().time)
+	{
+		step = 0;
+		fraction = 0.0;
+		return;
+	}
+
+	if (time >= keys.back().time)
+	{
+		step = this->x_steps_.size() - 2;
+		fraction = 1.0;
+		return;
+	}
+
+	// The keyframe span time is in
+	auto next = std::upper_bound(keys.begin(), keys.end(), time, [](double t, const Keyframe & k) { return t < k.time; });
+	const size_t span = size_t(next - keys.begin()) - 1;
+
+	const double position = (time - keys[span].time) / (next->time - keys[span].time) * double(MOTION_STEPS);
+	const int index = std::min(int(position), MOTION_STEPS - 1);
+
+	step = span * MOTION_STEPS + size_t(index);
+	fraction = position - double(index);
+}
+
+Tuple TransformController::x_blend_(const Matrix4 & first, const Matrix4 & second, double fraction, const Tuple & t)
+{
+	if (fraction <= 0.0)
+	{
+		return first * t;
+	}
+
+	return (first * t) * (1.0 - fraction) + (second * t) * fraction;
+}
+
+Matrix4 TransformController::x_blend_(const Matrix4 & first, const Matrix4 & second, double fraction)
+{
+	Matrix4 result = first;
+
+	for (int k = 0; k < 16; k++)
+	{
+		result.at(k) = first.at(k) * (1.0 - fraction) + second.at(k) * fraction;
+	}
+
+	return result;
+}
+
 // ------------------------------------------------------------------------
 // Operators
 // ------------------------------------------------------------------------
@@ -103,13 +548,56 @@ ObjectBase::ObjectBase()
 	this->o_definition_ = std::make_shared<NullShapeDefinition>();
 	this->o_parent_ = nullptr;
 	this->o_bounds_as_group_ = false;
+
+	this->o_world_transform_ = Matrix4::Identity();
+	this->o_world_inverse_transform_ = Matrix4::Identity();
+	this->o_world_normal_transform_ = Matrix4::Identity();
+	this->o_world_dirty_ = false;
+	this->o_motion_bounds_dirty_ = true;
 }
 
+// The transform controller is duplicated rather than shared, so that a copy can be 
+// transformed without invalidating the original's world transform cache
+ObjectBase::ObjectBase(const ObjectBase & src) : std::enable_shared_from_this<ObjectBase>(src)
+{
+	this->object_type = src.object_type;
+	this->o_name_ = src.o_name_;
+	this->o_transform_ = std::make_shared<TransformController>(*src.o_transform_);
+	this->o_definition_ = src.o_definition_;
+	this->o_parent_ = src.o_parent_;
+	this->o_children_ = src.o_children_;
+	this->o_bounds_as_group_ = src.o_bounds_as_group_;
+
+	this->o_world_transform_ = Matrix4::Identity();
+	this->o_world_inverse_transform_ = Matrix4::Identity();
+	this->o_world_normal_transform_ = Matrix4::Identity();
+	this->o_world_dirty_ = true;
+	this->o_motion_bounds_dirty_ = true;
+}
 
 ObjectBase::~ObjectBase()
 {
 }
 
+ObjectBase & ObjectBase::operator=(const ObjectBase & src)
+{
+	if (this != &src)
+	{
+		this->object_type = src.object_type;
+		this->o_name_ = src.o_name_;
+		this->o_transform_ = std::make_shared<TransformController>(*src.o_transform_);
+		this->o_definition_ = src.o_definition_;
+		this->o_parent_ = src.o_parent_;
+		this->o_children_ = src.o_children_;
+		this->o_bounds_as_group_ = src.o_bounds_as_group_;
+
+		this->o_invalidate_world_transform_();
+		this->o_motion_bounds_dirty_ = true;
+	}
+
+	return *this;
+}
+
 std::shared_ptr<ObjectBase> ObjectBase::get_ptr()
 {
 	return shared_from_this();
@@ -128,13 +616,8 @@ Tuple ObjectBase::normal_at(const Tuple & world_space_point) const
 	Tuple object_normal_vector = this->o_definition_->local_normal_at(object_space_point);
 
 	// Multiply object space normal by transpose of the inverted x form matrix
-	Tuple world_normal_vector = this->normal_vector_to_world_space(object_normal_vector);
-
-	// Enforce behavior as a vector by setting w to 0
-	world_normal_vector.w = 0.0;
-
-	// Normalize vector
-	return world_normal_vector.normalize();
+	// The result is already a normalized vector
+	return this->normal_vector_to_world_space(object_normal_vector);
 }
 
 std::vector<double> ObjectBase::intersect_t(const Ray & r) const
@@ -146,14 +629,26 @@ std::vector<double> ObjectBase::intersect_t(const Ray & r) const
 
 Intersections ObjectBase::intersect_i(const Ray & r)
 {
+    thread_counters().bounds_tests++;
+
+    // The box around the shape over its whole motion is in the ray's space, so rays that miss
+    // it are culled before paying for the transform, blended or not
+    if (!this->o_motion_bounds_().intersect(r))
+    {
+        return {};
+    }
+
 	// Transform ray to object space
 	Ray transformed_ray = this->ray_to_object_space(r);
 
-    if (! this->o_definition_->bounding_box().intersect(r))
+    // The definition's own box is tighter around rotated shapes
+    if (! this->o_definition_->bounding_box().intersect(transformed_ray))
     {
         return {};
     }
 
+    thread_counters().primitive_tests++;
+
 	// Calculate intersections for the parent object (this)
 	Intersections result = Intersections(this->o_definition_->local_intersect_t(transformed_ray), this->get_ptr());
 
@@ -194,6 +689,7 @@ void ObjectBase::parent_children(std::vector<std::shared_ptr<ObjectBase>> childr
 	for (size_t i = 0; i < children.size(); i++)
 	{
 		children[i]->o_set_parent_(ptr);
+		children[i]->o_invalidate_world_transform_();
 	}
 }
 
@@ -204,11 +700,13 @@ void ObjectBase::parent_child(std::shared_ptr<ObjectBase> child) // NOLINT(perfo
 	auto ptr = this->get_ptr();
 
 	child->o_set_parent_(ptr);
+	child->o_invalidate_world_transform_();
 }
 
 void ObjectBase::o_unparent_()
 {
 	this->o_parent_ = nullptr;
+	this->o_invalidate_world_transform_();
 }
 
 void ObjectBase::freeze_children()
@@ -266,6 +764,7 @@ std::string ObjectBase::get_name() const
 void ObjectBase::set_definition(std::shared_ptr<PrimitiveDefinition> def)
 {
 	this->o_definition_ = def;
+	this->o_motion_bounds_dirty_.store(true, std::memory_order_release);
 }
 
 std::shared_ptr<PrimitiveDefinition> ObjectBase::get_definition()
@@ -281,35 +780,71 @@ std::shared_ptr<PrimitiveDefinition> ObjectBase::get_definition() const
 void ObjectBase::set_transform(Matrix4 m )
 {
 	this->o_transform_->set_transform(m);
+	this->o_invalidate_world_transform_();
+	this->o_motion_bounds_dirty_.store(true, std::memory_order_release);
+}
+
+void ObjectBase::set_transform(const Matrix4 & m, const Matrix4 & inverse)
+{
+	this->o_transform_->set_transform(m, inverse);
+	this->o_invalidate_world_transform_();
+	this->o_motion_bounds_dirty_.store(true, std::memory_order_release);
+}
+
+void ObjectBase::add_keyframe(double time, const Matrix4 & m)
+{
+	this->o_transform_->add_keyframe(time, m);
+	this->o_invalidate_world_transform_();
+	this->o_motion_bounds_dirty_.store(true, std::memory_order_release);
+}
+
+bool ObjectBase::is_moving() const
+{
+	return this->o_transform_->is_animated() || (this->has_parent() && this->o_parent_->is_moving());
+}
+
+Matrix4 ObjectBase::get_transform_at(double time) const
+{
+	return this->o_transform_->get_transform_at(time);
 }
 
-Matrix4 ObjectBase::get_transform() const
+Matrix4 ObjectBase::get_inverse_transform_at(double time) const
+{
+	return this->o_transform_->get_inverse_transform_at(time);
+}
+
+const Matrix4 & ObjectBase::get_transform() const
 {
 	return this->o_transform_->get_transform();
 }
 
 Matrix4 ObjectBase::get_world_transform() const
 {
-	if (this->has_parent())
-	{
-		return this->o_transform_->get_transform() * this->o_parent_->get_world_transform();
-	}
-	else
-	{
-		return this->o_transform_->get_transform();
-	}
+	this->o_update_world_transform_();
+	return this->o_world_transform_;
 }
 
-Matrix4 ObjectBase::get_inverse_transform() const
+const Matrix4 & ObjectBase::get_inverse_transform() const
 {
 	return this->o_transform_->get_inverse_transform();
 }
 
+Matrix4 ObjectBase::get_world_inverse_transform() const
+{
+	this->o_update_world_transform_();
+	return this->o_world_inverse_transform_;
+}
+
 bool ObjectBase::bounds_as_group() const
 {
 	return this->o_bounds_as_group_;
 }
 
+void ObjectBase::invalidate_bounds()
+{
+	this->o_motion_bounds_dirty_.store(true, std::memory_order_release);
+}
+
 void ObjectBase::set_bounds_as_group(bool bound_as_group)
 {
 	this->o_bounds_as_group_ = bound_as_group;
@@ -326,40 +861,129 @@ Ray ObjectBase::ray_to_object_space(const Ray & r) const
 
 Tuple ObjectBase::point_to_object_space(const Tuple & p) const
 {
-	if (this->has_parent())
+	this->o_update_world_transform_();
+	return this->o_world_inverse_transform_ * p;
+}
+
+Tuple ObjectBase::point_to_world_space(const Tuple & p) const
+{
+	this->o_update_world_transform_();
+	return this->o_world_transform_ * p;
+}
+
+Tuple ObjectBase::normal_vector_to_world_space(const Tuple & v) const
+{
+	this->o_update_world_transform_();
+
+	Tuple nor = this->o_world_normal_transform_ * v;
+	nor.w = 0.0;
+	return nor.normalize();
+}
+
+// Moving objects are transformed one parent at a time, in the same order the world
+// transform cache composes them in
+Tuple ObjectBase::normal_at(const Tuple & world_space_point, double time) const
+{
+	if (!this->is_moving())
 	{
-		return this->o_transform_->point_to_object_space(this->o_parent_->point_to_object_space(p));
+		return this->normal_at(world_space_point);
 	}
-	else
+
+	Tuple object_space_point = this->point_to_object_space(world_space_point, time);
+	Tuple object_normal_vector = this->o_definition_->local_normal_at(object_space_point);
+
+	return this->normal_vector_to_world_space(object_normal_vector, time);
+}
+
+Tuple ObjectBase::point_to_object_space(const Tuple & p, double time) const
+{
+	if (!this->is_moving())
 	{
-		return this->o_transform_->point_to_object_space(p);
+		return this->point_to_object_space(p);
 	}
+
+	const Tuple parent_space_point = this->has_parent() ? this->o_parent_->point_to_object_space(p, time) : p;
+	return this->o_transform_->point_to_object_space(parent_space_point, time);
 }
 
-Tuple ObjectBase::point_to_world_space(const Tuple & p) const
+Tuple ObjectBase::normal_vector_to_world_space(const Tuple & v, double time) const
 {
-	if (this->has_parent())
+	if (!this->is_moving())
 	{
-		return this->o_transform_->point_to_world_space(this->o_parent_->point_to_world_space(p));
+		return this->normal_vector_to_world_space(v);
 	}
-	else
+
+	const Tuple parent_space_normal = this->o_transform_->normal_vector_to_world_space(v, time);
+	return this->has_parent() ? this->o_parent_->normal_vector_to_world_space(parent_space_normal, time) : parent_space_normal;
+}
+
+// ------------------------------------------------------------------------
+// World Transform Cache
+// ------------------------------------------------------------------------
+
+void ObjectBase::o_invalidate_world_transform_()
+{
+	this->o_world_dirty_.store(true, std::memory_order_release);
+
+	// Children inherit this object's world transform
+	for (const std::shared_ptr<ObjectBase>& child : this->o_children_)
 	{
-		return this->o_transform_->point_to_world_space(p);
+		child->o_invalidate_world_transform_();
 	}
 }
 
-Tuple ObjectBase::normal_vector_to_world_space(const Tuple & v) const
+void ObjectBase::o_update_world_transform_() const
 {
-	Tuple nor = this->o_transform_->normal_vector_to_world_space(v);
+	// Fast path, the cache is valid
+	if (!this->o_world_dirty_.load(std::memory_order_acquire))
+	{
+		return;
+	}
+
+	// Several render threads may hit a dirty object at once, only one rebuilds it
+	std::lock_guard<std::mutex> lock(this->o_world_mutex_);
+
+	if (!this->o_world_dirty_.load(std::memory_order_relaxed))
+	{
+		return;
+	}
 
+	// These are composed in the same order that the transformers were 
+	// previously applied while walking up the parent chain
 	if (this->has_parent())
 	{
-		return this->o_parent_->normal_vector_to_world_space(nor);
+		this->o_parent_->o_update_world_transform_();
+
+		this->o_world_transform_ = this->o_transform_->get_transform() * this->o_parent_->o_world_transform_;
+		this->o_world_inverse_transform_ = this->o_transform_->get_inverse_transform() * this->o_parent_->o_world_inverse_transform_;
+		this->o_world_normal_transform_ = this->o_parent_->o_world_normal_transform_ * this->o_transform_->get_inverse_transpose_transform();
 	}
 	else
 	{
-		return nor;
+		this->o_world_transform_ = this->o_transform_->get_transform();
+		this->o_world_inverse_transform_ = this->o_transform_->get_inverse_transform();
+		this->o_world_normal_transform_ = this->o_transform_->get_inverse_transpose_transform();
 	}
+
+	this->o_world_dirty_.store(false, std::memory_order_release);
+}
+
+const BoundingBox & ObjectBase::o_motion_bounds_() const
+{
+	if (!this->o_motion_bounds_dirty_.load(std::memory_order_acquire))
+	{
+		return this->o_motion_bounds_cache_;
+	}
+
+	std::lock_guard<std::mutex> lock(this->o_world_mutex_);
+
+	if (this->o_motion_bounds_dirty_.load(std::memory_order_relaxed))
+	{
+		this->o_motion_bounds_cache_ = this->o_transform_->motion_bounds(this->o_definition_->bounding_box());
+		this->o_motion_bounds_dirty_.store(false, std::memory_order_release);
+	}
+
+	return this->o_motion_bounds_cache_;
 }
 
 // ------------------------------------------------------------------------
@@ -5,6 +5,8 @@
 #include <algorithm> 
 #include <string>
 #include <memory> // Shared Pointers
+#include <atomic>
+#include <mutex>
 
 #include "Ray.h"
 #include "Tuple.h"
@@ -72,12 +74,36 @@ public:
 	TransformController(const TransformController & src);
 	~TransformController();
 
+	TransformController & operator=(const TransformController & src);
+
 	// Methods
+	// Also removes any keyframes
 	void set_transform(const Matrix4 & m);
-	Matrix4 get_transform() const;
-	Matrix4 get_inverse_transform() const;
+	// For transforms whose inverse is already known, such as ones read from a scene cache
+	void set_transform(const Matrix4 & m, const Matrix4 & inverse);
+	const Matrix4 & get_transform() const;
+	const Matrix4 & get_inverse_transform() const;
+	const Matrix4 & get_inverse_transpose_transform() const;
+
+	// Keyframes
+	// Moves the transform over time.  Between keyframes the translation and the scale are
+	// interpolated linearly and the rotation spherically.  Before the first keyframe and
+	// after the last the transform holds still.  The static transform is the first keyframe's.
+	void add_keyframe(double time, const Matrix4 & m);
+	// True with two or more keyframes
+	bool is_animated() const;
+	size_t keyframe_count() const;
+	Matrix4 get_transform_at(double time) const;
+	Matrix4 get_inverse_transform_at(double time) const;
+	// Box around local_bounds over the whole motion, in the space the transform moves it in
+	BoundingBox motion_bounds(const BoundingBox & local_bounds) const;
+
+	// Goes up every time the transform or its keyframes change, so anything built from them
+	// can tell it is out of date
+	uint64_t get_version() const;
 
 	// Self Transformers
+	// Uses the ray's time when the transform is animated
 	Ray ray_to_object_space(const Ray & r) const;
 
 	Tuple point_to_object_space(const Tuple & p) const;
@@ -85,21 +111,64 @@ public:
 
 	Tuple normal_vector_to_world_space(const Tuple & v) const;
 
+	// At a time, for animated transforms
+	Tuple point_to_object_space(const Tuple & p, double time) const;
+	Tuple point_to_world_space(const Tuple & p, double time) const;
+	Tuple normal_vector_to_world_space(const Tuple & v, double time) const;
+
 	// Overloaded Operators
 	friend std::ostream & operator<<(std::ostream & os, const TransformController & ctrl);
 
 private:
+	// A keyframe, split into the parts that are interpolated.  The rotation is a quaternion
+	// in x, y, z and w, and the stretch is the scale and shear left over.
+	struct Keyframe
+	{
+		double time;
+		Matrix4 transform;
+		Tuple translation;
+		Tuple rotation;
+		Matrix4 stretch;
+	};
+
+	struct MotionStep
+	{
+		Matrix4 transform;
+		Matrix4 inverse;
+		Matrix4 inverse_transpose;
+	};
+
+	void x_build_steps_();
+	// The step at or before time, and how far time is towards the next one
+	void x_find_step_(double time, size_t & step, double & fraction) const;
+	// Blends what the matrices of two neighbouring steps do to t, which is the same as
+	// blending the matrices and applying that
+	static Tuple x_blend_(const Matrix4 & first, const Matrix4 & second, double fraction, const Tuple & t);
+	static Matrix4 x_blend_(const Matrix4 & first, const Matrix4 & second, double fraction);
+
 	//properties
 	Matrix4 x_transform_;
 	Matrix4 x_inverse_transform_;
+	// Used to transform normals, cached so it is not rebuilt for every normal
+	Matrix4 x_inverse_transpose_transform_;
+
+	std::vector<Keyframe> x_keyframes_;
+	// The motion sampled MOTION_STEPS times between each pair of keyframes, with the inverses
+	// already taken, so a transformer only blends two results instead of building a matrix
+	std::vector<MotionStep> x_steps_;
+
+	uint64_t x_version_;
 };
 
 class ObjectBase : public std::enable_shared_from_this<ObjectBase>
 {
 public:
 	ObjectBase();
+	ObjectBase(const ObjectBase & src);
 	virtual ~ObjectBase();
 
+	ObjectBase & operator=(const ObjectBase & src);
+
 	std::shared_ptr<ObjectBase> get_ptr();
 
 	// Methods
@@ -128,9 +197,19 @@ public:
 	std::shared_ptr<PrimitiveDefinition> get_definition() const;
 
 	void set_transform(Matrix4 m);
-	Matrix4 get_transform() const;
+	void set_transform(const Matrix4 & m, const Matrix4 & inverse);
+	const Matrix4 & get_transform() const;
 	Matrix4 get_world_transform() const;
-	Matrix4 get_inverse_transform() const;
+	const Matrix4 & get_inverse_transform() const;
+	Matrix4 get_world_inverse_transform() const;
+
+	// Keyframes, see TransformController.  Setting a transform removes them.
+	void add_keyframe(double time, const Matrix4 & m);
+	// True when this object or any of its parents has an animated transform
+	bool is_moving() const;
+	// This object's own transform, without its parents'
+	Matrix4 get_transform_at(double time) const;
+	Matrix4 get_inverse_transform_at(double time) const;
 
 	bool bounds_as_group() const;
 
@@ -142,6 +221,11 @@ public:
 
 	Tuple normal_vector_to_world_space(const Tuple & v) const;
 
+	// At a time, the same as the ones above for objects that are not moving
+	Tuple normal_at(const Tuple & world_space_point, double time) const;
+	Tuple point_to_object_space(const Tuple & p, double time) const;
+	Tuple normal_vector_to_world_space(const Tuple & v, double time) const;
+
 	// Overloaded Operators
 	friend std::ostream & operator<<(std::ostream & os, const ObjectBase & obj);
 
@@ -152,6 +236,8 @@ public:
 	// Should only be set from derived class
 	void set_definition(std::shared_ptr<PrimitiveDefinition> def);
 	void set_bounds_as_group(bool bound_as_group);
+	// Call after changing the size of the definition
+	void invalidate_bounds();
 
 private:
 	// Methods
@@ -159,6 +245,17 @@ private:
 	// Unparents this but does not remove it from Parent vector
 	void o_unparent_();
 
+	// World transform cache
+	// Marks this object and all of its children as needing their world matrices rebuilt
+	void o_invalidate_world_transform_();
+	// Rebuilds the world matrices from the parent chain if they have been invalidated
+	void o_update_world_transform_() const;
+
+	// Box around the shape over its whole motion, in its parent's space, which for a shape
+	// that does not move is just its transformed box.  Built on first use after the
+	// transform or the definition change.
+	const BoundingBox & o_motion_bounds_() const;
+
 	// Properties
 	std::string o_name_;
 	std::shared_ptr<TransformController> o_transform_;
@@ -166,6 +263,18 @@ private:
 	std::shared_ptr<ObjectBase> o_parent_;
 	std::vector<std::shared_ptr<ObjectBase>> o_children_;
 	bool o_bounds_as_group_;
+
+	// World transform cache
+	// Composed from the parent chain on first use after a transform or parenting change,
+	// so the transformers only need a single matrix multiply
+	mutable Matrix4 o_world_transform_;
+	mutable Matrix4 o_world_inverse_transform_;
+	mutable Matrix4 o_world_normal_transform_;
+	mutable std::atomic<bool> o_world_dirty_;
+	mutable std::mutex o_world_mutex_;
+
+	mutable BoundingBox o_motion_bounds_cache_;
+	mutable std::atomic<bool> o_motion_bounds_dirty_;
 };
 
 #endif
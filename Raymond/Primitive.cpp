@@ -164,6 +164,7 @@ void Cylinder::set_minimum(const double & min)
 {
 	auto def = std::static_pointer_cast<CylinderDefinition>(this->get_definition());
 	def->minimum = min;
+	this->invalidate_bounds();
 }
 
 double Cylinder::get_maximum() const
@@ -175,7 +176,8 @@ double Cylinder::get_maximum() const
 void Cylinder::set_maximum(const double & max)
 {
 	auto def = std::static_pointer_cast<CylinderDefinition>(this->get_definition());
-	def->minimum = max;
+	def->maximum = max;
+	this->invalidate_bounds();
 }
 
 // ------------------------------------------------------------------------
@@ -242,6 +244,7 @@ void DoubleNappedCone::set_minimum(const double & min)
 {
 	auto def = std::static_pointer_cast<DoubleNappedConeDefinition>(this->get_definition());
 	def->minimum = min;
+	this->invalidate_bounds();
 }
 
 double DoubleNappedCone::get_maximum() const
@@ -253,7 +256,8 @@ double DoubleNappedCone::get_maximum() const
 void DoubleNappedCone::set_maximum(const double & max)
 {
 	auto def = std::static_pointer_cast<DoubleNappedConeDefinition>(this->get_definition());
-	def->minimum = max;
+	def->maximum = max;
+	this->invalidate_bounds();
 }
 
 // ------------------------------------------------------------------------
@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "ProgressReporter.h"
+
+// ------------------------------------------------------------------------
+//
+// Progress Reporter
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+ProgressReporter::ProgressReporter(const std::string & label, uint64_t total, std::ostream & output) : pr_output_(output)
+{
+	this->interval = 1.0;
+
+	this->pr_label_ = label;
+	this->pr_total_ = total;
+
+	this->pr_completed_ = 0;
+	this->pr_rays_ = 0;
+
+	this->pr_start_ = std::chrono::steady_clock::now();
+	this->pr_stopping_ = false;
+	this->pr_started_ = false;
+}
+
+ProgressReporter::~ProgressReporter()
+{
+	this->finish();
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+void ProgressReporter::start()
+{
+	if (this->pr_started_)
+	{
+		return;
+	}
+
+	this->pr_started_ = true;
+	this->pr_stopping_ = false;
+	this->pr_start_ = std::chrono::steady_clock::now();
+	this->pr_thread_ = std::thread(&ProgressReporter::pr_run_, this);
+}
+
+void ProgressReporter::finish()
+{
+	if (!this->pr_started_)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->pr_mutex_);
+		this->pr_stopping_ = true;
+	}
+	this->pr_wake_.notify_all();
+
+	if (this->pr_thread_.joinable())
+	{
+		this->pr_thread_.join();
+	}
+
+	this->pr_started_ = false;
+	this->pr_print_();
+}
+
+void ProgressReporter::advance(uint64_t units)
+{
+	this->pr_completed_.fetch_add(units, std::memory_order_relaxed);
+}
+
+void ProgressReporter::add_rays(uint64_t rays)
+{
+	this->pr_rays_.fetch_add(rays, std::memory_order_relaxed);
+}
+
+uint64_t ProgressReporter::completed() const
+{
+	return this->pr_completed_.load(std::memory_order_relaxed);
+}
+
+uint64_t ProgressReporter::rays() const
+{
+	return this->pr_rays_.load(std::memory_order_relaxed);
+}
+
+std::string ProgressReporter::format_line(const std::string & label, uint64_t completed, uint64_t total, double elapsed_seconds, uint64_t rays)
+{
+	const double fraction = (total > 0) ? std::min(double(completed) / double(total), 1.0) : 1.0;
+
+	std::ostringstream oss;
+	oss << std::fixed;
+	oss.precision(1);
+
+	oss << label << ": " << fraction * 100.0 << "% - " << elapsed_seconds << "s elapsed";
+
+	// The rate so far is the best guess for the rest
+	if (fraction > 0.0 && fraction < 1.0)
+	{
+		oss << ", " << elapsed_seconds * (1.0 - fraction) / fraction << "s left";
+	}
+
+	if (rays > 0 && elapsed_seconds > 0.0)
+	{
+		oss.precision(2);
+		oss << " - " << double(rays) / elapsed_seconds / 1.0e6 << "M rays/s";
+	}
+
+	return oss.str();
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void ProgressReporter::pr_run_()
+{
+	std::unique_lock<std::mutex> lock(this->pr_mutex_);
+	const auto wait = std::chrono::duration<double>(std::max(this->interval, 0.01));
+
+	while (!this->pr_wake_.wait_for(lock, wait, [this]() { return this->pr_stopping_; }))
+	{
+		this->pr_print_();
+	}
+}
+
+void ProgressReporter::pr_print_()
+{
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->pr_start_).count();
+	const std::string line = ProgressReporter::format_line(this->pr_label_, this->completed(), this->pr_total_, elapsed, this->rays());
+
+	this->pr_output_ << line << std::endl;
+}
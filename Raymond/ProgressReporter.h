@@ -0,0 +1,64 @@
+#ifndef H_RAYMOND_PROGRESSREPORTER
+#define H_RAYMOND_PROGRESSREPORTER
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Prints the progress of a render from a thread of its own.  Workers only add to atomic
+// counters, so they never wait on the console, and the reporter prints at most one line
+// per interval, with the time left and the rays traced per second.
+class ProgressReporter
+{
+public:
+	ProgressReporter(const std::string & label, uint64_t total, std::ostream & output = std::cout);
+	// Finishes, if finish has not been called
+	~ProgressReporter();
+
+	ProgressReporter(const ProgressReporter &) = delete;
+	ProgressReporter & operator=(const ProgressReporter &) = delete;
+
+	// Properties
+	// Seconds between lines, set before start
+	double interval;
+
+	// Methods
+	void start();
+	// Stops the reporter and prints the final line
+	void finish();
+
+	// Called by the workers.  Units are whatever total was counted in, pixels or lines.
+	void advance(uint64_t units);
+	void add_rays(uint64_t rays);
+
+	[[nodiscard]] uint64_t completed() const;
+	[[nodiscard]] uint64_t rays() const;
+
+	// A line of the report, exposed for testing
+	static std::string format_line(const std::string & label, uint64_t completed, uint64_t total, double elapsed_seconds, uint64_t rays);
+
+private:
+	void pr_run_();
+	void pr_print_();
+
+	std::string pr_label_;
+	uint64_t pr_total_;
+	std::ostream & pr_output_;
+
+	std::atomic<uint64_t> pr_completed_;
+	std::atomic<uint64_t> pr_rays_;
+
+	std::chrono::steady_clock::time_point pr_start_;
+	std::thread pr_thread_;
+	std::mutex pr_mutex_;
+	std::condition_variable pr_wake_;
+	bool pr_stopping_;
+	bool pr_started_;
+};
+
+#endif
@@ -15,6 +15,12 @@ Ray::Ray():Ray(Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), 0)
 
 Ray::Ray(const Ray & src) : Ray(src.origin, src.direction, src.depth)
 {
+	this->time = src.time;
+	this->has_differentials = src.has_differentials;
+	this->rx_origin = src.rx_origin;
+	this->rx_direction = src.rx_direction;
+	this->ry_origin = src.ry_origin;
+	this->ry_direction = src.ry_direction;
 }
 
 Ray::Ray(Tuple origin, Tuple direction) : Ray(origin, direction, 0)
@@ -27,6 +33,14 @@ Ray::Ray(Tuple origin, Tuple direction, int depth)
 	this->direction = direction;
 	this->depth = depth;
 	this->dir_mult_inv = direction.multiplicative_inverse();
+	this->time = 0.0;
+
+	this->has_differentials = false;
+}
+
+Ray::Ray(Tuple origin, Tuple direction, int depth, double time) : Ray(origin, direction, depth)
+{
+	this->time = time;
 }
 
 Ray::~Ray()
@@ -42,9 +56,41 @@ Tuple Ray::position(double t) const
 	return this->origin + (this->direction * t);
 }
 
-Ray Ray::transform(Matrix4 m) const
+Ray Ray::transform(const Matrix4 & m) const
+{
+	Ray result = Ray(m * this->origin, m * this->direction);
+	result.time = this->time;
+
+	if (this->has_differentials)
+	{
+		result.set_differentials(
+			m * this->rx_origin, 
+			m * this->rx_direction, 
+			m * this->ry_origin, 
+			m * this->ry_direction
+		);
+	}
+
+	return result;
+}
+
+void Ray::set_differentials(const Tuple & dx_origin, const Tuple & dx_direction, const Tuple & dy_origin, const Tuple & dy_direction)
+{
+	this->has_differentials = true;
+	this->rx_origin = dx_origin;
+	this->rx_direction = dx_direction;
+	this->ry_origin = dy_origin;
+	this->ry_direction = dy_direction;
+}
+
+// Shrinks the differentials towards the main ray
+// When a pixel takes many samples, each one only needs to cover a fraction of the pixel
+void Ray::scale_differentials(double s)
 {
-	return Ray(m * this->origin, m * this->direction);
+	this->rx_origin = this->origin + (this->rx_origin - this->origin) * s;
+	this->ry_origin = this->origin + (this->ry_origin - this->origin) * s;
+	this->rx_direction = this->direction + (this->rx_direction - this->direction) * s;
+	this->ry_direction = this->direction + (this->ry_direction - this->direction) * s;
 }
 
 std::ostream & operator<<(std::ostream & os, const Ray & r)
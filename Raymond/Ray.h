@@ -11,18 +11,30 @@ public:
 	Ray(const Ray & src);
 	Ray(Tuple origin, Tuple direction);
 	Ray(Tuple origin, Tuple direction, int depth);
+	Ray(Tuple origin, Tuple direction, int depth, double time);
 	~Ray();
 
 	// Methods
 	Tuple position(double) const;
 
-	Ray transform(Matrix4) const;
+	Ray transform(const Matrix4 &) const;
+
+	// Ray Differentials
+	// Rays offset by one pixel in x and y, used to find the footprint of a hit for texture filtering
+	void set_differentials(const Tuple & dx_origin, const Tuple & dx_direction, const Tuple & dy_origin, const Tuple & dy_direction);
+	void scale_differentials(double s);
 
 	// Properties
 	Tuple origin;
 	Tuple direction;
 	Tuple dir_mult_inv;
 	int depth;
+	// When in the shutter the ray was cast, animated transforms are evaluated at it
+	double time;
+
+	bool has_differentials;
+	Tuple rx_origin, rx_direction;
+	Tuple ry_origin, ry_direction;
 
 	// Overloaded Operators
 	friend std::ostream & operator<<(std::ostream &, const Ray &);
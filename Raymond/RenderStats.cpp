@@ -0,0 +1,215 @@
+#include "pch.h"
+#include "RenderStats.h"
+
+// ------------------------------------------------------------------------
+//
+// Render Counters
+//
+// ------------------------------------------------------------------------
+
+uint64_t RenderCounters::total_rays() const
+{
+	return this->camera_rays + this->shadow_rays + this->reflection_rays + this->refraction_rays + this->indirect_rays;
+}
+
+RenderCounters & RenderCounters::operator+=(const RenderCounters & right)
+{
+	this->camera_rays += right.camera_rays;
+	this->shadow_rays += right.shadow_rays;
+	this->reflection_rays += right.reflection_rays;
+	this->refraction_rays += right.refraction_rays;
+	this->indirect_rays += right.indirect_rays;
+
+	this->bounds_tests += right.bounds_tests;
+	this->primitive_tests += right.primitive_tests;
+	this->shading_calls += right.shading_calls;
+	this->texmap_evaluations += right.texmap_evaluations;
+	this->samples += right.samples;
+
+	return *this;
+}
+
+RenderCounters RenderCounters::operator-(const RenderCounters & right) const
+{
+	RenderCounters result = RenderCounters();
+
+	result.camera_rays = this->camera_rays - right.camera_rays;
+	result.shadow_rays = this->shadow_rays - right.shadow_rays;
+	result.reflection_rays = this->reflection_rays - right.reflection_rays;
+	result.refraction_rays = this->refraction_rays - right.refraction_rays;
+	result.indirect_rays = this->indirect_rays - right.indirect_rays;
+
+	result.bounds_tests = this->bounds_tests - right.bounds_tests;
+	result.primitive_tests = this->primitive_tests - right.primitive_tests;
+	result.shading_calls = this->shading_calls - right.shading_calls;
+	result.texmap_evaluations = this->texmap_evaluations - right.texmap_evaluations;
+	result.samples = this->samples - right.samples;
+
+	return result;
+}
+
+// ------------------------------------------------------------------------
+//
+// Render Stats
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+RenderStats::RenderStats()
+{
+	this->wall_seconds = 0.0;
+
+	this->rs_width_ = 0;
+	this->rs_height_ = 0;
+	this->rs_min_spp_ = 0;
+	this->rs_max_spp_ = 0;
+	this->rs_mean_spp_ = 0.0;
+}
+
+RenderStats::~RenderStats()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+void RenderStats::add_bucket(const BucketStats & bucket)
+{
+	this->rs_totals_ += bucket.counters;
+	this->rs_buckets_.push_back(bucket);
+}
+
+void RenderStats::measure_image(const SampleBuffer & image)
+{
+	this->rs_width_ = image.width();
+	this->rs_height_ = image.height();
+
+	long long total = 0;
+	this->rs_min_spp_ = std::numeric_limits<int>::max();
+	this->rs_max_spp_ = 0;
+
+	for (const std::shared_ptr<SampledPixel> & pixel : image.get_pixels())
+	{
+		int count = pixel->sample_count();
+
+		total += count;
+		this->rs_min_spp_ = std::min(this->rs_min_spp_, count);
+		this->rs_max_spp_ = std::max(this->rs_max_spp_, count);
+	}
+
+	const double pixel_count = double(this->rs_width_) * double(this->rs_height_);
+
+	if (pixel_count <= 0.0)
+	{
+		this->rs_min_spp_ = 0;
+	}
+
+	this->rs_mean_spp_ = pixel_count > 0.0 ? double(total) / pixel_count : 0.0;
+}
+
+std::string RenderStats::to_json() const
+{
+	auto counters_json = [](std::ostream & os, const RenderCounters & c)
+	{
+		os << "{ \"rays\": { \"camera\": " << c.camera_rays
+			<< ", \"shadow\": " << c.shadow_rays
+			<< ", \"reflection\": " << c.reflection_rays
+			<< ", \"refraction\": " << c.refraction_rays
+			<< ", \"indirect\": " << c.indirect_rays
+			<< ", \"total\": " << c.total_rays()
+			<< " }, \"bounds_tests\": " << c.bounds_tests
+			<< ", \"primitive_tests\": " << c.primitive_tests
+			<< ", \"shading_calls\": " << c.shading_calls
+			<< ", \"texmap_evaluations\": " << c.texmap_evaluations
+			<< ", \"samples\": " << c.samples << " }";
+	};
+
+	std::ostringstream oss;
+	oss.precision(9);
+
+	oss << "{\n";
+	oss << "\t\"width\": " << this->rs_width_ << ",\n";
+	oss << "\t\"height\": " << this->rs_height_ << ",\n";
+	oss << "\t\"wall_seconds\": " << this->wall_seconds << ",\n";
+	oss << "\t\"samples_per_pixel\": { \"min\": " << this->rs_min_spp_
+		<< ", \"mean\": " << this->rs_mean_spp_
+		<< ", \"max\": " << this->rs_max_spp_ << " },\n";
+
+	oss << "\t\"totals\": ";
+	counters_json(oss, this->rs_totals_);
+	oss << ",\n";
+
+	oss << "\t\"buckets\": [";
+	for (size_t i = 0; i < this->rs_buckets_.size(); i++)
+	{
+		const BucketStats & bucket = this->rs_buckets_[i];
+
+		oss << (i == 0 ? "\n" : ",\n")
+			<< "\t\t{ \"id\": " << bucket.id
+			<< ", \"x\": " << bucket.x << ", \"y\": " << bucket.y
+			<< ", \"width\": " << bucket.width << ", \"height\": " << bucket.height
+			<< ", \"seconds\": " << bucket.seconds
+			<< ", \"counters\": ";
+		counters_json(oss, bucket.counters);
+		oss << " }";
+	}
+	oss << (this->rs_buckets_.empty() ? "]\n" : "\n\t]\n");
+
+	oss << "}\n";
+
+	return oss.str();
+}
+
+bool RenderStats::write_json(const std::string & file_path) const
+{
+	std::ofstream output_file(file_path, std::ios::out);
+
+	if (!output_file.is_open())
+	{
+		return false;
+	}
+
+	output_file << this->to_json();
+
+	return bool(output_file);
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+const RenderCounters & RenderStats::totals() const
+{
+	return this->rs_totals_;
+}
+
+const std::vector<BucketStats> & RenderStats::get_buckets() const
+{
+	return this->rs_buckets_;
+}
+
+int RenderStats::get_width() const
+{
+	return this->rs_width_;
+}
+
+int RenderStats::get_height() const
+{
+	return this->rs_height_;
+}
+
+int RenderStats::min_samples_per_pixel() const
+{
+	return this->rs_min_spp_;
+}
+
+int RenderStats::max_samples_per_pixel() const
+{
+	return this->rs_max_spp_;
+}
+
+double RenderStats::mean_samples_per_pixel() const
+{
+	return this->rs_mean_spp_;
+}
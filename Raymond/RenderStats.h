@@ -0,0 +1,90 @@
+#ifndef H_RAYMOND_RENDERSTATS
+#define H_RAYMOND_RENDERSTATS
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class SampleBuffer;
+
+// Work done while rendering.  Every thread counts into its own copy, so counting is a plain
+// increment, and the copies are only added together once the buckets are done.
+struct RenderCounters
+{
+	// Rays by what they were traced for.  Indirect rays gather global illumination and
+	// background light.
+	uint64_t camera_rays = 0;
+	uint64_t shadow_rays = 0;
+	uint64_t reflection_rays = 0;
+	uint64_t refraction_rays = 0;
+	uint64_t indirect_rays = 0;
+
+	// Bounding boxes of objects and their children tested against rays.  There is no
+	// BVH, so this is the closest there is to nodes visited.
+	uint64_t bounds_tests = 0;
+	// Rays tested against a primitive's surface, after its bounding box was hit
+	uint64_t primitive_tests = 0;
+	uint64_t shading_calls = 0;
+	// Texture slots evaluated through a connected TexMap
+	uint64_t texmap_evaluations = 0;
+	uint64_t samples = 0;
+
+	[[nodiscard]] uint64_t total_rays() const;
+
+	RenderCounters & operator+=(const RenderCounters & right);
+	RenderCounters operator-(const RenderCounters & right) const;
+};
+
+// The calling thread's counters
+inline RenderCounters & thread_counters()
+{
+	thread_local RenderCounters counters;
+	return counters;
+}
+
+// Time and work of a single bucket
+struct BucketStats
+{
+	int id;
+	int x, y, width, height;
+	double seconds;
+	RenderCounters counters;
+};
+
+// Everything counted in a render, written out as JSON
+class RenderStats
+{
+public:
+	RenderStats();
+	~RenderStats();
+
+	// Properties
+	double wall_seconds;
+
+	// Methods
+	void add_bucket(const BucketStats & bucket);
+	// Reads samples per pixel from the finished image
+	void measure_image(const SampleBuffer & image);
+
+	[[nodiscard]] std::string to_json() const;
+	bool write_json(const std::string & file_path) const;
+
+	// Accessors
+	[[nodiscard]] const RenderCounters & totals() const;
+	[[nodiscard]] const std::vector<BucketStats> & get_buckets() const;
+	[[nodiscard]] int get_width() const;
+	[[nodiscard]] int get_height() const;
+	[[nodiscard]] int min_samples_per_pixel() const;
+	[[nodiscard]] int max_samples_per_pixel() const;
+	[[nodiscard]] double mean_samples_per_pixel() const;
+
+private:
+	RenderCounters rs_totals_;
+	std::vector<BucketStats> rs_buckets_;
+
+	int rs_width_, rs_height_;
+	int rs_min_spp_, rs_max_spp_;
+	double rs_mean_spp_;
+};
+
+#endif
@@ -24,6 +24,8 @@ Sample::Sample(const Tuple & canvas_origin)
 	this->Background = Color(0.0);
 
 	this->Depth = 0.0;
+	this->Time = 0.0;
+	this->Rays = 0.0;
 	this->Normal = Color(0.0);
 	this->Position = Color(0.0);
     this->BucketID = 0;
@@ -52,6 +54,8 @@ Sample::Sample(const Sample & src)
 	this->Background = src.Background;
 
 	this->Depth = src.Depth;
+	this->Time = src.Time;
+	this->Rays = src.Rays;
 	this->Normal = src.Normal;
 	this->Position = src.Position;
     this->BucketID = src.BucketID;
@@ -110,6 +114,10 @@ Color Sample::get_channel(RE channel) const
 		return Color(this->RefractionFilter);
     case bucketid:
         return Sample::id_to_color(this->BucketID);
+    case sampletime:
+        return Color(this->Time);
+    case raycount:
+        return Color(this->Rays);
 	default:
 		return this->s_rgb_;
 	}
@@ -166,6 +174,8 @@ Sample Sample::operator*(const Sample & right_sample) const
 	result.Background = this->Background * right_sample.Background;
 
 	result.Depth = this->Depth * right_sample.Depth;
+	result.Time = this->Time * right_sample.Time;
+	result.Rays = this->Rays * right_sample.Rays;
 	result.Normal = this->Normal * right_sample.Normal;
 	result.Position = this->Position * right_sample.Position;
 
@@ -193,6 +203,8 @@ Sample Sample::operator/(const Sample & right_sample) const
 	result.Background = this->Background / right_sample.Background;
 
 	result.Depth = safe_comp_divide(this->Depth, right_sample.Depth);
+	result.Time = safe_comp_divide(this->Time, right_sample.Time);
+	result.Rays = safe_comp_divide(this->Rays, right_sample.Rays);
 	result.Normal = this->Normal / right_sample.Normal;
 	result.Position = this->Position / right_sample.Position;
 
@@ -220,6 +232,8 @@ Sample Sample::operator+(const Sample & right_sample) const
 	result.Background = this->Background + right_sample.Background;
 
 	result.Depth = this->Depth + right_sample.Depth;
+	result.Time = this->Time + right_sample.Time;
+	result.Rays = this->Rays + right_sample.Rays;
 	result.Normal = this->Normal + right_sample.Normal;
 	result.Position = this->Position + right_sample.Position;
 
@@ -247,6 +261,8 @@ Sample Sample::operator-(const Sample & right_sample) const
 	result.Background = this->Background - right_sample.Background;
 
 	result.Depth = this->Depth - right_sample.Depth;
+	result.Time = this->Time - right_sample.Time;
+	result.Rays = this->Rays - right_sample.Rays;
 	result.Normal = this->Normal - right_sample.Normal;
 	result.Position = this->Position - right_sample.Position;
 
@@ -274,6 +290,8 @@ Sample Sample::operator*(const double & scalar) const
 	result.Background = this->Background * scalar;
 
 	result.Depth = this->Depth * scalar;
+	result.Time = this->Time * scalar;
+	result.Rays = this->Rays * scalar;
 	result.Normal = this->Normal * scalar;
 	result.Position = this->Position * scalar;
 
@@ -301,6 +319,8 @@ Sample Sample::operator/(const double & scalar) const
 	result.Background = this->Background / scalar;
 
 	result.Depth = safe_comp_divide(this->Depth, scalar);
+	result.Time = safe_comp_divide(this->Time, scalar);
+	result.Rays = safe_comp_divide(this->Rays, scalar);
 	result.Normal = this->Normal / scalar;
 	result.Position = this->Position / scalar;
 
@@ -328,6 +348,8 @@ Sample Sample::operator+(const double & scalar) const
 	result.Background = this->Background + scalar;
 
 	result.Depth = this->Depth + scalar;
+	result.Time = this->Time + scalar;
+	result.Rays = this->Rays + scalar;
 	result.Normal = this->Normal + scalar;
 	result.Position = this->Position + scalar;
 
@@ -355,6 +377,8 @@ Sample Sample::operator-(const double & scalar) const
 	result.Background = this->Background - scalar;
 
 	result.Depth = this->Depth - scalar;
+	result.Time = this->Time - scalar;
+	result.Rays = this->Rays - scalar;
 	result.Normal = this->Normal - scalar;
 	result.Position = this->Position - scalar;
 
@@ -389,6 +413,8 @@ std::ostream & operator<<(std::ostream & os, const Sample & s)
 		<< ", Alpha: " << s.Alpha
 		<< ", Background: " << s.Background
 		<< ", Depth: " << s.Depth
+		<< ", Time: " << s.Time
+		<< ", Rays: " << s.Rays
 		<< ", Normal: " << s.Normal
 		<< ", Position: " << s.Position
 		<< ", Diffuse: " << s.Diffuse
@@ -7,7 +7,7 @@
 enum RE { 
 	rgb, alpha, background, depth, normal, position, diffuse, specular, lighting, 
 	globalillumination, reflection, reflectionfilter, refraction, refractionfilter,
-    bucketid
+    bucketid, sampletime, raycount
 };
 
 class Sample
@@ -48,6 +48,10 @@ public:
     Color Background;
 
     double Depth;
+    // Heat maps, in microseconds spent and rays traced for the sample.
+    // Pixels report them summed over their samples.
+    double Time;
+    double Rays;
     Color Normal;
     Color Position;
 
@@ -12,6 +12,11 @@
 SampledPixel::SampledPixel()
 {
 	this->sp_average_ = Sample();
+
+	this->sp_sum_ = Sample();
+	this->sp_count_ = 0;
+	this->sp_mean_ = 0.0;
+	this->sp_m2_ = 0.0;
 }
 
 SampledPixel::~SampledPixel()
@@ -33,6 +38,12 @@ void SampledPixel::add_sample(const Sample& sample)
 
 Color SampledPixel::get_channel(RE channel) const
 {
+	// Heat maps are the pixel's total, not the average of its samples
+	if (channel == sampletime || channel == raycount)
+	{
+		return this->sp_average_.get_channel(channel) * double(this->sample_count());
+	}
+
 	return this->sp_average_.get_channel(channel);
 }
 
@@ -88,6 +99,69 @@ void SampledPixel::full_average()
     }
 }
 
+void SampledPixel::accumulate_sample(const Sample& sample)
+{
+	this->sp_sum_ = (this->sp_count_ == 0) ? sample : this->sp_sum_ + sample;
+	this->sp_count_++;
+
+	const double value = sample.get_current_rgb().luminosity();
+	const double delta = value - this->sp_mean_;
+	this->sp_mean_ += delta / double(this->sp_count_);
+	this->sp_m2_ += delta * (value - this->sp_mean_);
+
+	this->sp_average_ = this->sp_sum_ / double(this->sp_count_);
+}
+
+void SampledPixel::get_accumulated(Sample& sum, int& count, double& mean, double& m2) const
+{
+	sum = this->sp_sum_;
+	count = this->sp_count_;
+	mean = this->sp_mean_;
+	m2 = this->sp_m2_;
+}
+
+void SampledPixel::set_accumulated(const Sample& sum, int count, double mean, double m2)
+{
+	this->sp_samples_vec_.clear();
+	this->sp_sum_ = sum;
+	this->sp_count_ = count;
+	this->sp_mean_ = mean;
+	this->sp_m2_ = m2;
+
+	this->sp_average_ = (count > 0) ? sum / double(count) : sum;
+}
+
+void SampledPixel::set_average(const Sample& average, int count)
+{
+	this->sp_samples_vec_.clear();
+	this->sp_average_ = average;
+	this->sp_count_ = count;
+	this->sp_sum_ = average * double(count);
+
+	// The spread of the samples is not sent, so the pixel reads as converged
+	this->sp_mean_ = average.get_current_rgb().luminosity();
+	this->sp_m2_ = 0.0;
+}
+
+int SampledPixel::sample_count() const
+{
+	return (this->sp_count_ > 0) ? this->sp_count_ : int(this->sp_samples_vec_.size());
+}
+
+double SampledPixel::relative_error() const
+{
+	if (this->sp_count_ < 2)
+	{
+		return 0.0;
+	}
+
+	const double variance = this->sp_m2_ / double(this->sp_count_ - 1);
+	const double standard_error = sqrt(variance / double(this->sp_count_));
+
+	// Dark pixels are judged against a floor, or noise in the shadows would never converge
+	return standard_error / std::max(std::abs(this->sp_mean_), 0.01);
+}
+
 bool SampledPixel::test_noise_threshold(const double &noise_threshold) const
 {
     Color average = this->quick_average();
@@ -339,6 +413,22 @@ bool SampleBuffer::test_noise_threshold(const int & x, const int & y, const doub
     return this->sb_get_element_(x, y)->test_noise_threshold(noise_threshold);
 }
 
+void SampleBuffer::debug_dump(std::ostream & os) const
+{
+    os << *this << "\n";
+
+    for (int y = 0; y < this->sb_height_; y++)
+    {
+        for (int x = 0; x < this->sb_width_; x++)
+        {
+            std::shared_ptr<SampledPixel> pixel = this->sb_get_element_(x, y);
+
+            os << "(" << x << ", " << y << ") " << pixel->sample_count() << " samples: "
+               << pixel->get_calculated_average() << "\n";
+        }
+    }
+}
+
 // ------------------------------------------------------------------------
 // Accessors
 // ------------------------------------------------------------------------
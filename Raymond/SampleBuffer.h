@@ -30,6 +30,19 @@ public:
 	[[nodiscard]] Color quick_average() const;
     void full_average();
 
+	// Progressive rendering keeps a running sum instead of every sample, so a pixel
+	// costs the same after a thousand passes as after one
+	void accumulate_sample(const Sample& sample);
+	// The running sums of accumulate_sample, to carry on with in a later render
+	void get_accumulated(Sample& sum, int& count, double& mean, double& m2) const;
+	void set_accumulated(const Sample& sum, int count, double mean, double m2);
+	// A pixel rendered elsewhere, from its average and the number of samples behind it
+	void set_average(const Sample& average, int count);
+	// Samples taken, whether they were added or accumulated
+	[[nodiscard]] int sample_count() const;
+	// Standard error of the mean luminosity, relative to the mean.  Zero until there are two samples.
+	[[nodiscard]] double relative_error() const;
+
 	// Accessors
 	[[nodiscard]] Color get_channel(RE channel) const;
 	[[nodiscard]] Sample get_calculated_average() const;
@@ -43,6 +56,10 @@ private:
 	Sample sp_average_;
     std::vector<Sample> sp_samples_vec_;
 
+	Sample sp_sum_;
+	int sp_count_;
+	// Welford's running mean and sum of squared differences, of the luminosity
+	double sp_mean_, sp_m2_;
 };
 
 class SampleBuffer
@@ -74,6 +91,9 @@ public:
 
     [[nodiscard]] bool test_noise_threshold(const int & x, const int & y, const double & noise_threshold) const;
 
+    // Writes every pixel's sample count and average, for debugging.  Slow on large images.
+    void debug_dump(std::ostream & os) const;
+
 	// Accessors
 	[[nodiscard]] int width() const;
 	[[nodiscard]] int height() const;
@@ -0,0 +1,538 @@
+#include "pch.h"
+#include "SceneCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char SCENE_CACHE_MAGIC[8] = { 'R', 'S', 'C', 'E', 'N', 'E', '0', '1' };
+
+// Sections start on 8 byte boundaries, so the records can be read in place
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + 7) & ~uint64_t(7);
+}
+
+// ------------------------------------------------------------------------
+//
+// Mapped File
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+MappedFile::MappedFile(const std::string & file_path)
+{
+	this->mf_data_ = nullptr;
+	this->mf_size_ = 0;
+	this->mf_mapped_ = false;
+
+#ifndef _WIN32
+	const int descriptor = open(file_path.c_str(), O_RDONLY);
+
+	if (descriptor >= 0)
+	{
+		struct stat status = {};
+
+		if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+		{
+			void * mapping = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+			if (mapping != MAP_FAILED)
+			{
+				this->mf_data_ = static_cast<const char *>(mapping);
+				this->mf_size_ = size_t(status.st_size);
+				this->mf_mapped_ = true;
+			}
+		}
+
+		// The mapping stays valid once the file is closed
+		close(descriptor);
+		return;
+	}
+#endif
+
+	std::ifstream input_file(file_path, std::ios::in | std::ios::binary);
+
+	if (input_file.is_open())
+	{
+		this->mf_buffer_.assign(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>());
+		this->mf_data_ = this->mf_buffer_.data();
+		this->mf_size_ = this->mf_buffer_.size();
+	}
+}
+
+MappedFile::MappedFile(std::vector<char> bytes)
+{
+	this->mf_buffer_ = std::move(bytes);
+	this->mf_data_ = this->mf_buffer_.empty() ? nullptr : this->mf_buffer_.data();
+	this->mf_size_ = this->mf_buffer_.size();
+	this->mf_mapped_ = false;
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+	if (this->mf_mapped_)
+	{
+		munmap(const_cast<char *>(this->mf_data_), this->mf_size_);
+	}
+#endif
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool MappedFile::is_open() const
+{
+	return this->mf_data_ != nullptr;
+}
+
+const char * MappedFile::data() const
+{
+	return this->mf_data_;
+}
+
+size_t MappedFile::size() const
+{
+	return this->mf_size_;
+}
+
+// ------------------------------------------------------------------------
+//
+// Scene Cache
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+SceneCache::SceneCache(const std::string & cache_path) : sc_file_(cache_path)
+{
+	this->sc_path_ = cache_path;
+	this->sc_intact_ = this->sc_check_layout_();
+	this->sc_valid_ = this->sc_intact_;
+
+	if (!this->sc_valid_)
+	{
+		return;
+	}
+
+	// Stale once any source has changed or gone
+	const SceneCacheHeader & header = this->sc_header_();
+	const auto * sources = reinterpret_cast<const SceneCacheSource *>(this->sc_file_.data() + header.sources_offset);
+
+	for (uint64_t i = 0; i < header.source_count && this->sc_valid_; i++)
+	{
+		const std::string path = this->sc_string_(sources[i].path_offset, sources[i].path_size);
+
+		std::error_code error;
+		this->sc_valid_ = std::filesystem::is_regular_file(path, error) && SceneCache::hash_file(path) == sources[i].content_hash;
+	}
+}
+
+SceneCache::SceneCache(std::vector<char> bytes, const std::string & name) : sc_file_(std::move(bytes))
+{
+	this->sc_path_ = name;
+	this->sc_intact_ = this->sc_check_layout_();
+	this->sc_valid_ = this->sc_intact_;
+}
+
+SceneCache::~SceneCache()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool SceneCache::is_valid() const
+{
+	return this->sc_valid_;
+}
+
+Scene SceneCache::build() const
+{
+	if (!this->sc_valid_)
+	{
+		throw std::runtime_error("Scene cache is missing or out of date: " + this->sc_path_);
+	}
+
+	const SceneCacheHeader & header = this->sc_header_();
+	const char * data = this->sc_file_.data();
+
+	// Maps, materials, lights, the camera and settings
+	std::istringstream definitions(std::string(data + header.definitions_offset, header.definitions_size));
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(definitions, this->sc_path_);
+
+	// Primitives, straight from the records
+	const auto * records = reinterpret_cast<const SceneCacheRecord *>(data + header.records_offset);
+	std::vector<std::shared_ptr<PrimitiveBase>> primitives = std::vector<std::shared_ptr<PrimitiveBase>>(header.record_count);
+
+	for (uint64_t i = 0; i < header.record_count; i++)
+	{
+		const SceneCacheRecord & record = records[i];
+		std::shared_ptr<PrimitiveBase> primitive;
+
+		switch (record.type)
+		{
+		case CacheSphere:
+			primitive = std::make_shared<Sphere>();
+			break;
+		case CacheGlassSphere:
+			primitive = Sphere::GlassSphere();
+			break;
+		case CachePlane:
+			primitive = std::make_shared<InfinitePlane>();
+			break;
+		case CacheCube:
+			primitive = std::make_shared<Cube>();
+			break;
+		case CacheCylinder:
+		{
+			auto cylinder = std::make_shared<Cylinder>(record.minimum, record.maximum);
+			cylinder->set_closed(record.closed != 0);
+			primitive = cylinder;
+			break;
+		}
+		case CacheCone:
+		case CacheDoubleCone:
+		{
+			std::shared_ptr<DoubleNappedCone> cone;
+			if (record.type == CacheCone)
+			{
+				cone = std::make_shared<Cone>();
+			}
+			else
+			{
+				cone = std::make_shared<DoubleNappedCone>();
+			}
+
+			cone->set_minimum(record.minimum);
+			cone->set_maximum(record.maximum);
+			cone->set_closed(record.closed != 0);
+			primitive = cone;
+			break;
+		}
+		case CacheGroup:
+			primitive = std::make_shared<Group>();
+			break;
+		default:
+			throw std::runtime_error("Scene cache has an unknown primitive type: " + this->sc_path_);
+		}
+
+		primitive->set_name(this->sc_string_(header.strings_offset + record.name_offset, record.name_size));
+
+		if (record.material_size > 0)
+		{
+			auto material = parser.get_material(this->sc_string_(header.strings_offset + record.material_offset, record.material_size));
+
+			if (material == nullptr)
+			{
+				throw std::runtime_error("Scene cache uses a material it does not define: " + this->sc_path_);
+			}
+
+			primitive->material = material;
+		}
+
+		primitive->set_transform(
+			Matrix4(std::vector<double>(record.transform, record.transform + 16)),
+			Matrix4(std::vector<double>(record.inverse, record.inverse + 16))
+		);
+
+		primitives[i] = primitive;
+	}
+
+	// Records are in the order their blocks were opened, which keeps every world and group in
+	// the order the file lists them
+	for (uint64_t i = 0; i < header.record_count; i++)
+	{
+		const int32_t parent = records[i].parent;
+
+		if (parent >= 0 && uint64_t(parent) < header.record_count)
+		{
+			primitives[parent]->parent_child(primitives[i]);
+		}
+		else
+		{
+			scene.world.add_object(primitives[i]);
+		}
+	}
+
+	return scene;
+}
+
+std::vector<std::string> SceneCache::source_paths() const
+{
+	if (!this->sc_intact_)
+	{
+		return std::vector<std::string>();
+	}
+
+	return this->sc_paths_(0, this->sc_header_().source_count);
+}
+
+std::vector<std::string> SceneCache::asset_paths() const
+{
+	if (!this->sc_intact_)
+	{
+		return std::vector<std::string>();
+	}
+
+	const SceneCacheHeader & header = this->sc_header_();
+	return this->sc_paths_(header.source_count, header.asset_count);
+}
+
+bool SceneCache::write(const std::string & cache_path, const SceneParser & parser)
+{
+	const std::vector<SceneCacheRecord> & records = parser.records();
+	const std::vector<std::string> & source_files = parser.source_files();
+
+	// Without its files, a cache could never be checked
+	if (!parser.record_primitives || source_files.empty())
+	{
+		return false;
+	}
+
+	std::string strings = parser.record_strings();
+	std::vector<SceneCacheSource> sources;
+
+	for (const std::string & path : source_files)
+	{
+		SceneCacheSource source = SceneCacheSource();
+		source.path_offset = strings.size();
+		source.path_size = path.size();
+		source.content_hash = SceneCache::hash_file(path);
+
+		strings += path;
+		sources.push_back(source);
+	}
+
+	for (const std::string & path : parser.asset_files())
+	{
+		SceneCacheSource asset = SceneCacheSource();
+		asset.path_offset = strings.size();
+		asset.path_size = path.size();
+
+		strings += path;
+		sources.push_back(asset);
+	}
+
+	const std::string & definitions = parser.definitions();
+
+	SceneCacheHeader header = SceneCacheHeader();
+	memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(SCENE_CACHE_MAGIC));
+	header.version = SceneCache::VERSION;
+	header.record_size = sizeof(SceneCacheRecord);
+
+	header.source_count = source_files.size();
+	header.asset_count = parser.asset_files().size();
+	header.sources_offset = align_offset(sizeof(SceneCacheHeader));
+	header.strings_offset = align_offset(header.sources_offset + sources.size() * sizeof(SceneCacheSource));
+	header.strings_size = strings.size();
+	header.definitions_offset = align_offset(header.strings_offset + header.strings_size);
+	header.definitions_size = definitions.size();
+	header.record_count = records.size();
+	header.records_offset = align_offset(header.definitions_offset + header.definitions_size);
+
+	// Source paths are found through the string table, so offsets are absolute in the file
+	for (SceneCacheSource & source : sources)
+	{
+		source.path_offset += header.strings_offset;
+	}
+
+	std::error_code error;
+	const std::filesystem::path path = std::filesystem::path(cache_path);
+	if (path.has_parent_path())
+	{
+		std::filesystem::create_directories(path.parent_path(), error);
+	}
+
+	// The file is put together in memory so the hash can cover all of it
+	std::string bytes = std::string(header.records_offset + records.size() * sizeof(SceneCacheRecord), '\0');
+	memcpy(&bytes[header.sources_offset], sources.data(), sources.size() * sizeof(SceneCacheSource));
+	memcpy(&bytes[header.strings_offset], strings.data(), strings.size());
+	memcpy(&bytes[header.definitions_offset], definitions.data(), definitions.size());
+	memcpy(&bytes[header.records_offset], records.data(), records.size() * sizeof(SceneCacheRecord));
+
+	header.file_hash = 0;
+	memcpy(&bytes[0], &header, sizeof(header));
+	header.file_hash = hash_bytes(HASH_SEED, bytes.data(), bytes.size());
+	memcpy(&bytes[0], &header, sizeof(header));
+
+	// Written next to the destination and renamed, so a render never maps half a file
+	const std::filesystem::path temp_path = temp_file_path(path.string());
+
+	{
+		std::ofstream output_file(temp_path, std::ios::out | std::ios::binary);
+
+		if (!output_file.is_open())
+		{
+			return false;
+		}
+
+		output_file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+
+		if (!output_file)
+		{
+			output_file.close();
+			std::filesystem::remove(temp_path, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temp_path, path, error);
+
+	if (error)
+	{
+		std::filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	return true;
+}
+
+Scene SceneCache::load(const std::string & scene_path)
+{
+	const std::string cache_path = SceneCache::cache_path_for(scene_path);
+
+	{
+		SceneCache cache = SceneCache(cache_path);
+		const std::vector<std::string> sources = cache.source_paths();
+
+		// A cache copied in from another scene is not used
+		if (cache.is_valid() && !sources.empty() && sources[0] == std::filesystem::absolute(scene_path).string())
+		{
+			return cache.build();
+		}
+	}
+
+	SceneParser parser = SceneParser();
+	parser.record_primitives = true;
+	Scene scene = parser.load(scene_path);
+
+	// Failing to write only means the next load parses again
+	SceneCache::write(cache_path, parser);
+
+	return scene;
+}
+
+SceneCache SceneCache::from_bytes(const std::string & bytes, const std::string & name)
+{
+	return SceneCache(std::vector<char>(bytes.begin(), bytes.end()), name);
+}
+
+std::string SceneCache::cache_path_for(const std::string & scene_path)
+{
+	return scene_path + ".cache";
+}
+
+uint64_t SceneCache::hash_file(const std::string & file_path)
+{
+	MappedFile file = MappedFile(file_path);
+	return hash_bytes(HASH_SEED, file.data(), file.size());
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+const SceneCacheHeader & SceneCache::sc_header_() const
+{
+	return *reinterpret_cast<const SceneCacheHeader *>(this->sc_file_.data());
+}
+
+std::string SceneCache::sc_string_(uint64_t offset, uint64_t size) const
+{
+	return std::string(this->sc_file_.data() + offset, size);
+}
+
+std::vector<std::string> SceneCache::sc_paths_(uint64_t first, uint64_t count) const
+{
+	const auto * sources = reinterpret_cast<const SceneCacheSource *>(this->sc_file_.data() + this->sc_header_().sources_offset);
+	std::vector<std::string> paths;
+
+	for (uint64_t i = first; i < first + count; i++)
+	{
+		paths.push_back(this->sc_string_(sources[i].path_offset, sources[i].path_size));
+	}
+
+	return paths;
+}
+
+// Every section has to lie inside the file before anything in it is read
+bool SceneCache::sc_check_layout_() const
+{
+	const uint64_t file_size = this->sc_file_.size();
+
+	if (!this->sc_file_.is_open() || file_size < sizeof(SceneCacheHeader))
+	{
+		return false;
+	}
+
+	const SceneCacheHeader & header = this->sc_header_();
+
+	if (memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(SCENE_CACHE_MAGIC)) != 0 ||
+		header.version != SceneCache::VERSION ||
+		header.record_size != sizeof(SceneCacheRecord))
+	{
+		return false;
+	}
+
+	// Catches files pieced together from two writes, or damaged after they were written
+	SceneCacheHeader unhashed = header;
+	unhashed.file_hash = 0;
+	uint64_t file_hash = hash_bytes(HASH_SEED, &unhashed, sizeof(unhashed));
+	file_hash = hash_bytes(file_hash, this->sc_file_.data() + sizeof(SceneCacheHeader), file_size - sizeof(SceneCacheHeader));
+
+	if (file_hash != header.file_hash)
+	{
+		return false;
+	}
+
+	auto fits = [file_size](uint64_t offset, uint64_t count, uint64_t size)
+	{
+		return offset <= file_size && (size == 0 || count <= (file_size - offset) / size);
+	};
+
+	// Assets are in the same array as the sources, after them
+	if (header.source_count > file_size || header.asset_count > file_size ||
+		!fits(header.sources_offset, header.source_count + header.asset_count, sizeof(SceneCacheSource)) ||
+		!fits(header.strings_offset, header.strings_size, 1) ||
+		!fits(header.definitions_offset, header.definitions_size, 1) ||
+		!fits(header.records_offset, header.record_count, sizeof(SceneCacheRecord)) ||
+		header.records_offset % alignof(SceneCacheRecord) != 0 ||
+		header.sources_offset % alignof(SceneCacheSource) != 0)
+	{
+		return false;
+	}
+
+	const auto * sources = reinterpret_cast<const SceneCacheSource *>(this->sc_file_.data() + header.sources_offset);
+	for (uint64_t i = 0; i < header.source_count + header.asset_count; i++)
+	{
+		if (!fits(sources[i].path_offset, sources[i].path_size, 1))
+		{
+			return false;
+		}
+	}
+
+	const auto * records = reinterpret_cast<const SceneCacheRecord *>(this->sc_file_.data() + header.records_offset);
+	for (uint64_t i = 0; i < header.record_count; i++)
+	{
+		if (uint64_t(records[i].name_offset) + records[i].name_size > header.strings_size ||
+			uint64_t(records[i].material_offset) + records[i].material_size > header.strings_size)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,152 @@
+#ifndef H_RAYMOND_SCENECACHE
+#define H_RAYMOND_SCENECACHE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Scene;
+class SceneParser;
+
+// Primitive types as they are stored in a scene cache
+enum SceneCachePrimitive : uint32_t
+{
+	CacheSphere, CacheGlassSphere, CachePlane, CacheCube, CacheCylinder, CacheCone, CacheDoubleCone, CacheGroup
+};
+
+// One primitive, laid out so an array of them can be used straight from the mapped file.
+// Strings are offsets into the cache's string table and parents are record indices, so
+// nothing in a record depends on where the file is mapped.
+struct SceneCacheRecord
+{
+	uint32_t type;
+	// Index of the group this is in, -1 for primitives added to the world
+	int32_t parent;
+
+	uint32_t name_offset, name_size;
+	// Empty for the primitive's own default material
+	uint32_t material_offset, material_size;
+
+	uint32_t closed;
+	uint32_t padding;
+	double minimum, maximum;
+
+	double transform[16];
+	double inverse[16];
+};
+
+struct SceneCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	// Changes with the record layout, which also makes caches from other compilers invalid
+	uint32_t record_size;
+
+	uint64_t source_count, sources_offset;
+	// Images and environments, listed after the sources.  They are read when the scene
+	// renders, not compiled into it, so they are not hashed.
+	uint64_t asset_count;
+	uint64_t strings_offset, strings_size;
+	uint64_t definitions_offset, definitions_size;
+	uint64_t record_count, records_offset;
+
+	// Hash of the whole file, taken with this field zero
+	uint64_t file_hash;
+};
+
+// A file the scene was read from, and the hash of what it held
+struct SceneCacheSource
+{
+	uint64_t path_offset, path_size;
+	uint64_t content_hash;
+};
+
+// Read only view of a whole file, memory mapped where the platform allows it
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string & file_path);
+	// Holds bytes that are already in memory, such as a file sent over a socket
+	explicit MappedFile(std::vector<char> bytes);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	// Methods
+	bool is_open() const;
+	const char * data() const;
+	size_t size() const;
+
+private:
+	const char * mf_data_;
+	size_t mf_size_;
+	// Holds the file where it cannot be mapped
+	std::vector<char> mf_buffer_;
+	bool mf_mapped_;
+};
+
+// Compiled form of a scene file.  The primitives are a flat array of fixed size records with
+// their transforms already inverted, so a cached scene is built without parsing the
+// geometry or inverting a matrix.  Maps, materials, lights, the camera and settings are
+// small, and are kept as the scene file lines that made them.
+//
+// The records are read in place from the mapped file, but build() still parses the
+// definitions and makes a new object for every primitive, so a cached scene is not used
+// without building it.  That roughly halves the time to load a scene with many primitives
+// rather than making it instant; the time left is spent in the objects, not the file.
+//
+// Every file the scene was read from is stored with a hash of its contents, and the cache
+// is only used while all of them still hash the same.  The cache also holds a hash of itself,
+// so a file that is damaged or pieced together from two writes is never used.  A cache sent
+// from another machine is built from its bytes instead, without looking for its sources.
+class SceneCache
+{
+public:
+	explicit SceneCache(const std::string & cache_path);
+	~SceneCache();
+
+	// Methods
+	// True for a cache of this version whose sources have not changed
+	bool is_valid() const;
+	// Throws a runtime_error when the cache is not valid
+	Scene build() const;
+
+	// Paths of the files the scene came from, the scene file itself first
+	std::vector<std::string> source_paths() const;
+	// Paths of the images and environments the scene reads
+	std::vector<std::string> asset_paths() const;
+
+	// Writes the scene the parser last loaded, which needs record_primitives set
+	static bool write(const std::string & cache_path, const SceneParser & parser);
+
+	// Builds the scene from its cache when the cache is current, otherwise loads the scene
+	// file and writes a new cache for next time
+	static Scene load(const std::string & scene_path);
+	static std::string cache_path_for(const std::string & scene_path);
+
+	static uint64_t hash_file(const std::string & file_path);
+
+	// A cache written somewhere else, whose sources are files on that machine.  Only its
+	// layout is checked, name is used in error messages.
+	static SceneCache from_bytes(const std::string & bytes, const std::string & name);
+
+	static const uint32_t VERSION = 3;
+
+private:
+	SceneCache(std::vector<char> bytes, const std::string & name);
+
+	std::vector<std::string> sc_paths_(uint64_t first, uint64_t count) const;
+	const SceneCacheHeader & sc_header_() const;
+	std::string sc_string_(uint64_t offset, uint64_t size) const;
+	bool sc_check_layout_() const;
+
+	// Properties
+	std::string sc_path_;
+	MappedFile sc_file_;
+	// The layout and the file's own hash check out, whether or not the sources have changed
+	bool sc_intact_;
+	bool sc_valid_;
+};
+
+#endif
@@ -0,0 +1,1410 @@
+#include "pch.h"
+#include "SceneFile.h"
+
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+// ------------------------------------------------------------------------
+//
+// Scene Parser
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+SceneParser::SceneParser()
+{
+	this->max_include_depth = 16;
+	this->record_primitives = false;
+
+	this->sp_lines_read_ = 0;
+
+	this->sp_width_ = 256;
+	this->sp_height_ = 256;
+	this->sp_fov_ = 45.0;
+	this->sp_from_ = Tuple::Point(0.0, 0.0, -5.0);
+	this->sp_to_ = Tuple::Point(0.0, 0.0, 0.0);
+	this->sp_up_ = Tuple::Vector(0.0, 1.0, 0.0);
+	this->sp_aperture_ = 0.0;
+	this->sp_focal_distance_ = 0.0;
+	this->sp_blades_ = 0;
+	this->sp_blade_rotation_ = 0.0;
+	this->sp_crop_ = PixelRect();
+}
+
+SceneParser::~SceneParser()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Scene SceneParser::load(const std::string & file_path)
+{
+	std::ifstream input_file(file_path, std::ios::in);
+
+	if (!input_file.is_open())
+	{
+		throw std::runtime_error("Cannot open scene file: " + file_path);
+	}
+
+	Scene scene = this->parse(input_file, file_path, std::filesystem::path(file_path).parent_path().string());
+	this->sp_source_files_.insert(this->sp_source_files_.begin(), std::filesystem::absolute(file_path).string());
+
+	return scene;
+}
+
+Scene SceneParser::parse(std::istream & input, const std::string & source_name, const std::string & directory)
+{
+	this->sp_scene_ = Scene();
+	this->sp_scene_.camera = Camera(this->sp_width_, this->sp_height_, deg_to_rad(this->sp_fov_));
+	this->sp_scene_.camera.set_transform(Matrix4::ViewTransform(this->sp_from_, this->sp_to_, this->sp_up_));
+
+	this->sp_blocks_.clear();
+	this->sp_sources_.clear();
+	this->sp_texmaps_.clear();
+	this->sp_materials_.clear();
+	this->sp_lines_read_ = 0;
+
+	this->sp_definitions_.clear();
+	this->sp_records_.clear();
+	this->sp_record_strings_.clear();
+	this->sp_source_files_.clear();
+	this->sp_asset_files_.clear();
+
+	this->sp_parse_stream_(input, source_name, directory);
+
+	return std::move(this->sp_scene_);
+}
+
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+std::shared_ptr<TexMap> SceneParser::get_texmap(const std::string & name) const
+{
+	auto found = this->sp_texmaps_.find(name);
+	return found == this->sp_texmaps_.end() ? nullptr : found->second;
+}
+
+std::shared_ptr<BaseMaterial> SceneParser::get_material(const std::string & name) const
+{
+	auto found = this->sp_materials_.find(name);
+	return found == this->sp_materials_.end() ? nullptr : found->second;
+}
+
+size_t SceneParser::lines_read() const
+{
+	return this->sp_lines_read_;
+}
+
+const std::string & SceneParser::definitions() const
+{
+	return this->sp_definitions_;
+}
+
+const std::vector<SceneCacheRecord> & SceneParser::records() const
+{
+	return this->sp_records_;
+}
+
+const std::string & SceneParser::record_strings() const
+{
+	return this->sp_record_strings_;
+}
+
+const std::vector<std::string> & SceneParser::source_files() const
+{
+	return this->sp_source_files_;
+}
+
+const std::vector<std::string> & SceneParser::asset_files() const
+{
+	return this->sp_asset_files_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void SceneParser::sp_parse_stream_(std::istream & input, const std::string & source_name, const std::string & directory)
+{
+	if (int(this->sp_sources_.size()) >= this->max_include_depth)
+	{
+		this->sp_error_("includes are nested more than " + std::to_string(this->max_include_depth) + " deep at " + source_name);
+	}
+
+	// Blocks have to be closed in the file that opened them
+	const size_t open_blocks = this->sp_blocks_.size();
+	this->sp_sources_.push_back({source_name, directory, 0});
+
+	while (std::getline(input, this->sp_line_))
+	{
+		this->sp_sources_.back().line++;
+		this->sp_lines_read_++;
+
+		this->sp_tokenize_(this->sp_line_);
+
+		if (!this->sp_tokens_.empty())
+		{
+			this->sp_parse_line_();
+		}
+	}
+
+	if (this->sp_blocks_.size() != open_blocks)
+	{
+		this->sp_error_("missing end for " + this->sp_blocks_.back().kind);
+	}
+
+	this->sp_sources_.pop_back();
+}
+
+void SceneParser::sp_tokenize_(const std::string & line)
+{
+	this->sp_tokens_.clear();
+
+	const char * data = line.data();
+	const size_t size = line.size();
+	size_t i = 0;
+
+	while (i < size)
+	{
+		const char c = data[i];
+
+		if (c == ' ' || c == '\t' || c == '\r' || c == ',')
+		{
+			i++;
+		}
+		else if (c == '#')
+		{
+			break;
+		}
+		else if (c == '"')
+		{
+			const size_t start = ++i;
+
+			while (i < size && data[i] != '"')
+			{
+				i++;
+			}
+
+			if (i == size)
+			{
+				this->sp_error_("missing closing quote");
+			}
+
+			this->sp_tokens_.emplace_back(data + start, i - start);
+			i++;
+		}
+		else
+		{
+			const size_t start = i;
+
+			while (i < size && data[i] != ' ' && data[i] != '\t' && data[i] != '\r' && data[i] != ',' && data[i] != '#')
+			{
+				i++;
+			}
+
+			this->sp_tokens_.emplace_back(data + start, i - start);
+		}
+	}
+}
+
+void SceneParser::sp_parse_line_()
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+
+	// Lines of blocks that are not primitives are kept for scene caches
+	const bool was_top_level = this->sp_blocks_.empty();
+	const bool in_definition = !was_top_level && this->sp_blocks_.front().type != PrimitiveBlock;
+
+	if (keyword == "end")
+	{
+		this->sp_expect_count_(0, 0);
+		this->sp_close_block_();
+	}
+	else if (keyword == "include")
+	{
+		this->sp_include_();
+	}
+	else if (this->sp_blocks_.empty() || (this->sp_blocks_.back().type == PrimitiveBlock && this->sp_blocks_.back().kind == "group" && !SceneParser::sp_is_transform_(keyword)))
+	{
+		this->sp_open_block_();
+	}
+	else
+	{
+		this->sp_block_property_();
+	}
+
+	if (this->record_primitives)
+	{
+		const bool opened_definition = was_top_level && !this->sp_blocks_.empty() && this->sp_blocks_.back().type != PrimitiveBlock;
+
+		if (in_definition || opened_definition)
+		{
+			this->sp_record_definition_(opened_definition);
+		}
+	}
+}
+
+void SceneParser::sp_open_block_()
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+	const bool top_level = this->sp_blocks_.empty();
+
+	// Groups only hold primitives, everything else is global
+	if (!top_level && (keyword == "settings" || keyword == "camera" || keyword == "background" ||
+		keyword == "texmap" || keyword == "material" || keyword == "light"))
+	{
+		this->sp_error_(std::string(keyword) + " cannot be inside a group");
+	}
+
+	Block block = Block();
+	block.kind = std::string(keyword);
+	block.transform = Matrix4::Identity();
+
+	if (keyword == "settings")
+	{
+		this->sp_expect_count_(0, 0);
+		block.type = SettingsBlock;
+		this->sp_blocks_.push_back(std::move(block));
+	}
+	else if (keyword == "camera")
+	{
+		this->sp_expect_count_(0, 0);
+		block.type = CameraBlock;
+		this->sp_blocks_.push_back(std::move(block));
+	}
+	else if (keyword == "background")
+	{
+		this->sp_expect_count_(1, 2);
+		block.type = BackgroundBlock;
+		block.kind = this->sp_name_(1);
+
+		if (block.kind == "environment" || block.kind == "hosek_wilkie")
+		{
+			this->sp_expect_count_(2, 2);
+			block.path = (std::filesystem::path(this->sp_sources_.back().directory) / this->sp_name_(2)).string();
+			this->sp_asset_files_.push_back(std::filesystem::absolute(block.path).string());
+		}
+		else if (block.kind != "none" && block.kind != "normal_gradient" && block.kind != "sky")
+		{
+			this->sp_error_("unknown background " + block.kind);
+		}
+
+		this->sp_blocks_.push_back(std::move(block));
+	}
+	else if (keyword == "texmap")
+	{
+		this->sp_open_texmap_();
+	}
+	else if (keyword == "material")
+	{
+		this->sp_open_material_();
+	}
+	else if (keyword == "light")
+	{
+		this->sp_open_light_();
+	}
+	else
+	{
+		this->sp_open_primitive_();
+	}
+}
+
+bool SceneParser::sp_is_transform_(std::string_view keyword)
+{
+	return keyword == "translate" || keyword == "scale" || keyword == "rotate_x" || keyword == "rotate_y" ||
+		keyword == "rotate_z" || keyword == "shear" || keyword == "matrix";
+}
+
+void SceneParser::sp_close_block_()
+{
+	if (this->sp_blocks_.empty())
+	{
+		this->sp_error_("end without a block");
+	}
+
+	Block block = std::move(this->sp_blocks_.back());
+	this->sp_blocks_.pop_back();
+
+	switch (block.type)
+	{
+	case SettingsBlock:
+		break;
+
+	case CameraBlock:
+		this->sp_scene_.camera = Camera(this->sp_width_, this->sp_height_, deg_to_rad(this->sp_fov_));
+		this->sp_scene_.camera.set_transform(Matrix4::ViewTransform(this->sp_from_, this->sp_to_, this->sp_up_));
+		this->sp_scene_.camera.aperture = this->sp_aperture_;
+		// Without a focal distance, the point the camera looks at is in focus
+		this->sp_scene_.camera.focal_distance = (this->sp_focal_distance_ > 0.0) ? this->sp_focal_distance_ : (this->sp_to_ - this->sp_from_).magnitude();
+		this->sp_scene_.camera.aperture_blades = this->sp_blades_;
+		this->sp_scene_.camera.aperture_rotation = deg_to_rad(this->sp_blade_rotation_);
+
+		if (this->sp_crop_.width > 0)
+		{
+			if (this->sp_crop_.x >= this->sp_width_ || this->sp_crop_.y >= this->sp_height_)
+			{
+				this->sp_error_("camera crop is outside the frame");
+			}
+
+			this->sp_scene_.camera.set_crop_window(this->sp_crop_.x, this->sp_crop_.y, this->sp_crop_.width, this->sp_crop_.height);
+		}
+		break;
+
+	case BackgroundBlock:
+		if (block.kind == "none")
+		{
+			this->sp_scene_.world.background = std::make_shared<Background>();
+		}
+		else if (block.kind == "normal_gradient")
+		{
+			this->sp_scene_.world.background = std::make_shared<NormalGradientBackground>();
+		}
+		else if (block.kind == "sky" || block.kind == "hosek_wilkie")
+		{
+			std::shared_ptr<SkyBackground> sky;
+			if (block.kind == "sky")
+			{
+				sky = std::make_shared<PreethamSkyBackground>(block.sun, block.turbidity);
+			}
+			else
+			{
+				sky = std::make_shared<HosekWilkieBackground>(block.path, block.sun, block.turbidity, block.albedo);
+			}
+
+			if (block.has_multiplier)
+			{
+				sky->multiplier = block.multiplier;
+			}
+			this->sp_scene_.world.background = sky;
+		}
+		else
+		{
+			this->sp_scene_.world.background = std::make_shared<EnvironmentMapBackground>(block.path);
+		}
+		break;
+
+	case TexMapBlock:
+		if (block.has_transform)
+		{
+			block.texmap->transform->set_transform(block.transform);
+		}
+
+		// Baked before anything can use it, so every frame rendered from the scene shares the
+		// one bake, and a later load of an unchanged scene reads it from the bake cache
+		if (block.bake_resolution > 0)
+		{
+			if (block.texmap->get_mapping_space() == ObjectSpace)
+			{
+				this->sp_error_("texmap " + block.path + " is in object space and cannot be baked");
+			}
+
+			auto baked = std::make_shared<BakedMap>(block.texmap, BoundingBox(block.bake_minimum, block.bake_maximum), block.bake_resolution);
+			baked->bake();
+			block.texmap = baked;
+		}
+
+		// Registered once complete, so a map cannot use itself
+		this->sp_texmaps_[block.path] = block.texmap;
+		break;
+
+	case MaterialBlock:
+		this->sp_materials_[block.path] = block.material;
+		break;
+
+	case LightBlock:
+		if (block.has_transform)
+		{
+			block.light->set_transform(block.transform);
+		}
+		this->sp_scene_.world.add_object(block.light);
+		break;
+
+	case PrimitiveBlock:
+		if (block.has_transform)
+		{
+			block.primitive->set_transform(block.transform);
+		}
+
+		if (block.record >= 0)
+		{
+			this->sp_record_primitive_(block);
+		}
+
+		if (!this->sp_blocks_.empty())
+		{
+			this->sp_blocks_.back().primitive->parent_child(block.primitive);
+		}
+		else
+		{
+			this->sp_scene_.world.add_object(block.primitive);
+		}
+		break;
+	}
+}
+
+void SceneParser::sp_block_property_()
+{
+	Block & block = this->sp_blocks_.back();
+
+	switch (block.type)
+	{
+	case SettingsBlock:
+		this->sp_settings_property_();
+		break;
+	case CameraBlock:
+		this->sp_camera_property_();
+		break;
+	case BackgroundBlock:
+		this->sp_background_property_(block);
+		break;
+	case TexMapBlock:
+		this->sp_texmap_property_(block);
+		break;
+	case MaterialBlock:
+		this->sp_material_property_(block);
+		break;
+	case LightBlock:
+		this->sp_light_property_(block);
+		break;
+	case PrimitiveBlock:
+		this->sp_primitive_property_(block);
+		break;
+	}
+}
+
+bool SceneParser::sp_transform_property_(Block & block)
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+	Matrix4 m;
+
+	if (keyword == "translate")
+	{
+		this->sp_expect_count_(3, 3);
+		m = Matrix4::Translation(this->sp_number_(1), this->sp_number_(2), this->sp_number_(3));
+	}
+	else if (keyword == "scale")
+	{
+		this->sp_expect_count_(1, 3);
+
+		if (this->sp_tokens_.size() == 2)
+		{
+			const double s = this->sp_number_(1);
+			m = Matrix4::Scaling(s, s, s);
+		}
+		else
+		{
+			this->sp_expect_count_(3, 3);
+			m = Matrix4::Scaling(this->sp_number_(1), this->sp_number_(2), this->sp_number_(3));
+		}
+	}
+	else if (keyword == "rotate_x")
+	{
+		this->sp_expect_count_(1, 1);
+		m = Matrix4::Rotation_X(deg_to_rad(this->sp_number_(1)));
+	}
+	else if (keyword == "rotate_y")
+	{
+		this->sp_expect_count_(1, 1);
+		m = Matrix4::Rotation_Y(deg_to_rad(this->sp_number_(1)));
+	}
+	else if (keyword == "rotate_z")
+	{
+		this->sp_expect_count_(1, 1);
+		m = Matrix4::Rotation_Z(deg_to_rad(this->sp_number_(1)));
+	}
+	else if (keyword == "shear")
+	{
+		this->sp_expect_count_(6, 6);
+		m = Matrix4::Shear(this->sp_number_(1), this->sp_number_(2), this->sp_number_(3), this->sp_number_(4), this->sp_number_(5), this->sp_number_(6));
+	}
+	else if (keyword == "matrix")
+	{
+		this->sp_expect_count_(16, 16);
+
+		std::vector<double> values(16);
+		for (size_t i = 0; i < 16; i++)
+		{
+			values[i] = this->sp_number_(i + 1);
+		}
+
+		m = Matrix4(values);
+	}
+	else
+	{
+		return false;
+	}
+
+	block.transform = block.has_transform ? block.transform * m : m;
+	block.has_transform = true;
+
+	return true;
+}
+
+void SceneParser::sp_settings_property_()
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+	World & w = this->sp_scene_.world;
+
+	this->sp_expect_count_(1, 1);
+
+	if (keyword == "aa_sample_min") w.aa_sample_min = this->sp_integer_(1);
+	else if (keyword == "aa_sample_max") w.aa_sample_max = this->sp_integer_(1);
+	else if (keyword == "bucket_size") w.bucket_size = this->sp_integer_(1);
+	else if (keyword == "shadow_subdivs") w.shadow_subdivs = this->sp_integer_(1);
+	else if (keyword == "reflection_subdivs") w.reflection_subdivs = this->sp_integer_(1);
+	else if (keyword == "refraction_subdivs") w.refraction_subdivs = this->sp_integer_(1);
+	else if (keyword == "gi_subdivs") w.gi_subdivs = this->sp_integer_(1);
+	else if (keyword == "sample_size") w.sample_size = this->sp_number_(1);
+	else if (keyword == "noise_threshold") w.noise_threshold = this->sp_number_(1);
+	else if (keyword == "max_ray_depth") w.max_ray_depth = this->sp_integer_(1);
+	else if (keyword == "light_samples") w.light_samples = this->sp_integer_(1);
+	else if (keyword == "environment_samples") w.environment_samples = this->sp_integer_(1);
+	else this->sp_error_("unknown setting " + std::string(keyword));
+}
+
+void SceneParser::sp_camera_property_()
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+
+	if (keyword == "size")
+	{
+		this->sp_expect_count_(2, 2);
+		this->sp_width_ = this->sp_integer_(1);
+		this->sp_height_ = this->sp_integer_(2);
+
+		if (this->sp_width_ <= 0 || this->sp_height_ <= 0)
+		{
+			this->sp_error_("camera size must be positive");
+		}
+	}
+	else if (keyword == "fov")
+	{
+		this->sp_expect_count_(1, 1);
+		this->sp_fov_ = this->sp_number_(1);
+	}
+	else if (keyword == "from")
+	{
+		this->sp_expect_count_(3, 3);
+		this->sp_from_ = Tuple::Point(this->sp_number_(1), this->sp_number_(2), this->sp_number_(3));
+	}
+	else if (keyword == "to")
+	{
+		this->sp_expect_count_(3, 3);
+		this->sp_to_ = Tuple::Point(this->sp_number_(1), this->sp_number_(2), this->sp_number_(3));
+	}
+	else if (keyword == "up")
+	{
+		this->sp_expect_count_(3, 3);
+		this->sp_up_ = this->sp_triple_(1);
+	}
+	else if (keyword == "aperture")
+	{
+		this->sp_expect_count_(1, 1);
+		this->sp_aperture_ = this->sp_number_(1);
+
+		if (this->sp_aperture_ < 0.0)
+		{
+			this->sp_error_("camera aperture cannot be negative");
+		}
+	}
+	else if (keyword == "focal_distance")
+	{
+		this->sp_expect_count_(1, 1);
+		this->sp_focal_distance_ = this->sp_number_(1);
+
+		if (this->sp_focal_distance_ <= 0.0)
+		{
+			this->sp_error_("camera focal_distance must be positive");
+		}
+	}
+	else if (keyword == "blades")
+	{
+		this->sp_expect_count_(1, 2);
+		this->sp_blades_ = this->sp_integer_(1);
+		this->sp_blade_rotation_ = (this->sp_tokens_.size() > 2) ? this->sp_number_(2) : 0.0;
+
+		if (this->sp_blades_ != 0 && this->sp_blades_ < 3)
+		{
+			this->sp_error_("camera blades must be 0 for a round aperture, or at least 3");
+		}
+	}
+	else if (keyword == "crop")
+	{
+		this->sp_expect_count_(4, 4);
+		this->sp_crop_ = { this->sp_integer_(1), this->sp_integer_(2), this->sp_integer_(3), this->sp_integer_(4) };
+
+		if (this->sp_crop_.x < 0 || this->sp_crop_.y < 0 || this->sp_crop_.width <= 0 || this->sp_crop_.height <= 0)
+		{
+			this->sp_error_("camera crop needs a corner inside the frame and a positive size");
+		}
+	}
+	else
+	{
+		this->sp_error_("unknown camera property " + std::string(keyword));
+	}
+}
+
+void SceneParser::sp_background_property_(Block & block)
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+
+	const bool is_sky = block.kind == "sky" || block.kind == "hosek_wilkie";
+
+	if (is_sky && keyword == "sun")
+	{
+		this->sp_expect_count_(3, 3);
+		block.sun = this->sp_triple_(1);
+	}
+	else if (is_sky && keyword == "turbidity")
+	{
+		this->sp_expect_count_(1, 1);
+		block.turbidity = this->sp_number_(1);
+
+		if (block.kind == "hosek_wilkie" && (block.turbidity < 1.0 || block.turbidity > 10.0))
+		{
+			this->sp_error_("hosek_wilkie turbidity must be between 1 and 10");
+		}
+	}
+	else if (block.kind == "hosek_wilkie" && keyword == "albedo")
+	{
+		this->sp_expect_count_(1, 1);
+		block.albedo = this->sp_number_(1);
+
+		if (block.albedo < 0.0 || block.albedo > 1.0)
+		{
+			this->sp_error_("hosek_wilkie albedo must be between 0 and 1");
+		}
+	}
+	else if (is_sky && keyword == "multiplier")
+	{
+		this->sp_expect_count_(1, 1);
+		block.multiplier = this->sp_number_(1);
+		block.has_multiplier = true;
+	}
+	else
+	{
+		this->sp_error_("unknown " + block.kind + " background property " + std::string(keyword));
+	}
+}
+
+void SceneParser::sp_open_texmap_()
+{
+	this->sp_expect_count_(2, 5);
+
+	Block block = Block();
+	block.type = TexMapBlock;
+	block.transform = Matrix4::Identity();
+	block.path = this->sp_name_(1);
+	block.kind = this->sp_name_(2);
+
+	if (this->sp_texmaps_.count(block.path) > 0)
+	{
+		this->sp_error_("texmap " + block.path + " is already defined");
+	}
+
+	const std::string & type = block.kind;
+	const bool has_arguments = this->sp_tokens_.size() > 3;
+
+	if (type == "stripe") block.texmap = std::make_shared<StripeMap>();
+	else if (type == "gradient") block.texmap = std::make_shared<GradientMap>();
+	else if (type == "ring") block.texmap = std::make_shared<RingMap>();
+	else if (type == "checker") block.texmap = std::make_shared<CheckerMap>();
+	else if (type == "composite") block.texmap = std::make_shared<CompositeMap>();
+	else if (type == "perturb") block.texmap = std::make_shared<PerturbMap>();
+	else if (type == "channel") block.texmap = std::make_shared<ChannelMap>();
+	else if (type == "solid")
+	{
+		block.texmap = std::make_shared<SolidColorMap>(has_arguments ? this->sp_color_(3) : Color(0.0));
+	}
+	else if (type == "perlin")
+	{
+		block.texmap = has_arguments ? std::make_shared<PerlinMap>(this->sp_integer_(3)) : std::make_shared<PerlinMap>();
+	}
+	else if (type == "colored_perlin")
+	{
+		block.texmap = has_arguments ? std::make_shared<ColoredPerlin>(this->sp_integer_(3)) : std::make_shared<ColoredPerlin>();
+	}
+	else if (type == "image")
+	{
+		this->sp_expect_count_(3, 3);
+		const std::filesystem::path path = std::filesystem::path(this->sp_sources_.back().directory) / this->sp_name_(3);
+		block.texmap = std::make_shared<ImageMap>(path.string());
+		this->sp_asset_files_.push_back(std::filesystem::absolute(path).string());
+	}
+	else
+	{
+		this->sp_error_("unknown texmap type " + type);
+	}
+
+	this->sp_blocks_.push_back(std::move(block));
+}
+
+void SceneParser::sp_texmap_property_(Block & block)
+{
+	if (this->sp_transform_property_(block))
+	{
+		return;
+	}
+
+	const std::string_view keyword = this->sp_tokens_[0];
+	const std::string & type = block.kind;
+
+	if (keyword == "space")
+	{
+		this->sp_expect_count_(1, 1);
+		const std::string space = this->sp_name_(1);
+
+		if (space == "world") block.texmap->set_mapping_space(WorldSpace);
+		else if (space == "object") block.texmap->set_mapping_space(ObjectSpace);
+		else this->sp_error_("unknown mapping space " + space);
+
+		return;
+	}
+
+	if (keyword == "bake")
+	{
+		this->sp_expect_count_(7, 7);
+		block.bake_resolution = this->sp_integer_(1);
+		block.bake_minimum = Tuple::Point(this->sp_number_(2), this->sp_number_(3), this->sp_number_(4));
+		block.bake_maximum = Tuple::Point(this->sp_number_(5), this->sp_number_(6), this->sp_number_(7));
+
+		if (block.bake_resolution < 2)
+		{
+			this->sp_error_("bake resolution must be at least 2");
+		}
+
+		if (!(block.bake_maximum.x > block.bake_minimum.x || block.bake_maximum.y > block.bake_minimum.y || block.bake_maximum.z > block.bake_minimum.z))
+		{
+			this->sp_error_("bake box is empty");
+		}
+
+		return;
+	}
+
+	// Two input maps
+	if ((keyword == "a" || keyword == "b") && (type == "stripe" || type == "gradient" || type == "ring" || type == "checker" || type == "composite"))
+	{
+		std::shared_ptr<TexMap> input = this->sp_map_(1);
+		std::shared_ptr<TexMap> * target = nullptr;
+
+		if (type == "stripe") target = keyword == "a" ? &std::static_pointer_cast<StripeMap>(block.texmap)->a : &std::static_pointer_cast<StripeMap>(block.texmap)->b;
+		else if (type == "gradient") target = keyword == "a" ? &std::static_pointer_cast<GradientMap>(block.texmap)->a : &std::static_pointer_cast<GradientMap>(block.texmap)->b;
+		else if (type == "ring") target = keyword == "a" ? &std::static_pointer_cast<RingMap>(block.texmap)->a : &std::static_pointer_cast<RingMap>(block.texmap)->b;
+		else if (type == "checker") target = keyword == "a" ? &std::static_pointer_cast<CheckerMap>(block.texmap)->a : &std::static_pointer_cast<CheckerMap>(block.texmap)->b;
+		else target = keyword == "a" ? &std::static_pointer_cast<CompositeMap>(block.texmap)->a : &std::static_pointer_cast<CompositeMap>(block.texmap)->b;
+
+		*target = input;
+	}
+	else if (type == "gradient" && keyword == "clamp")
+	{
+		this->sp_expect_count_(1, 1);
+		std::static_pointer_cast<GradientMap>(block.texmap)->clamp_fraction = this->sp_bool_(1);
+	}
+	else if (type == "solid" && keyword == "color")
+	{
+		std::static_pointer_cast<SolidColorMap>(block.texmap)->col = this->sp_color_(1);
+	}
+	else if (type == "composite" && keyword == "factor")
+	{
+		std::static_pointer_cast<CompositeMap>(block.texmap)->factor = this->sp_map_(1);
+	}
+	else if (type == "composite" && keyword == "mode")
+	{
+		this->sp_expect_count_(1, 1);
+		const std::string mode = this->sp_name_(1);
+		auto composite = std::static_pointer_cast<CompositeMap>(block.texmap);
+
+		if (mode == "blend") composite->composite_mode = CompBlend;
+		else if (mode == "add") composite->composite_mode = CompAdd;
+		else if (mode == "multiply") composite->composite_mode = CompMultiply;
+		else if (mode == "divide") composite->composite_mode = CompDivide;
+		else if (mode == "subtract") composite->composite_mode = CompSubtract;
+		else if (mode == "overlay") composite->composite_mode = CompOverlay;
+		else if (mode == "screen") composite->composite_mode = CompScreen;
+		else this->sp_error_("unknown composite mode " + mode);
+	}
+	else if (type == "perturb" && (keyword == "main" || keyword == "displacement"))
+	{
+		auto perturb = std::static_pointer_cast<PerturbMap>(block.texmap);
+		(keyword == "main" ? perturb->main : perturb->displacement) = this->sp_map_(1);
+	}
+	else if (type == "perturb" && keyword == "scale")
+	{
+		this->sp_expect_count_(1, 1);
+		std::static_pointer_cast<PerturbMap>(block.texmap)->scale = this->sp_number_(1);
+	}
+	else if (type == "perturb" && keyword == "remap")
+	{
+		this->sp_expect_count_(1, 1);
+		std::static_pointer_cast<PerturbMap>(block.texmap)->displacement_remap = this->sp_bool_(1);
+	}
+	else if (type == "channel" && (keyword == "r" || keyword == "g" || keyword == "b"))
+	{
+		auto channel = std::static_pointer_cast<ChannelMap>(block.texmap);
+		(keyword == "r" ? channel->r : keyword == "g" ? channel->g : channel->b) = this->sp_map_(1);
+	}
+	else if (type == "channel" && keyword == "scale")
+	{
+		this->sp_expect_count_(1, 1);
+		std::static_pointer_cast<ChannelMap>(block.texmap)->scale = this->sp_number_(1);
+	}
+	else if (type == "perlin" && (keyword == "octaves" || keyword == "persistence"))
+	{
+		this->sp_expect_count_(1, 1);
+		auto perlin = std::static_pointer_cast<PerlinMap>(block.texmap);
+		if (keyword == "octaves") perlin->octaves = this->sp_integer_(1);
+		else perlin->persistence = this->sp_number_(1);
+	}
+	else if (type == "colored_perlin" && (keyword == "octaves" || keyword == "persistence"))
+	{
+		this->sp_expect_count_(1, 1);
+		auto perlin = std::static_pointer_cast<ColoredPerlin>(block.texmap);
+		if (keyword == "octaves") perlin->octaves = this->sp_integer_(1);
+		else perlin->persistence = this->sp_number_(1);
+	}
+	else if (type == "image" && keyword == "uv")
+	{
+		this->sp_expect_count_(1, 1);
+		const std::string mapping = this->sp_name_(1);
+		auto image = std::static_pointer_cast<ImageMap>(block.texmap);
+
+		if (mapping == "planar") image->uv_mapping = PlanarUVMapping;
+		else if (mapping == "spherical") image->uv_mapping = SphericalUVMapping;
+		else if (mapping == "cylindrical") image->uv_mapping = CylindricalUVMapping;
+		else this->sp_error_("unknown uv mapping " + mapping);
+	}
+	else
+	{
+		this->sp_error_("unknown " + type + " texmap property " + std::string(keyword));
+	}
+}
+
+void SceneParser::sp_open_material_()
+{
+	this->sp_expect_count_(2, 2);
+
+	Block block = Block();
+	block.type = MaterialBlock;
+	block.path = this->sp_name_(1);
+	block.kind = this->sp_name_(2);
+
+	if (this->sp_materials_.count(block.path) > 0)
+	{
+		this->sp_error_("material " + block.path + " is already defined");
+	}
+
+	if (block.kind == "phong") block.material = std::make_shared<PhongMaterial>();
+	else if (block.kind == "normals") block.material = std::make_shared<NormalsMaterial>();
+	else this->sp_error_("unknown material type " + block.kind);
+
+	block.material->name = block.path;
+
+	this->sp_blocks_.push_back(std::move(block));
+}
+
+void SceneParser::sp_material_property_(Block & block)
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+
+	if (keyword == "ior")
+	{
+		this->sp_set_slot_(block.material->ior);
+		return;
+	}
+	else if (keyword == "use_schlick")
+	{
+		this->sp_expect_count_(1, 1);
+		block.material->use_schlick = this->sp_bool_(1);
+		return;
+	}
+
+	if (block.kind != "phong")
+	{
+		this->sp_error_("unknown " + block.kind + " material property " + std::string(keyword));
+	}
+
+	auto phong = std::static_pointer_cast<PhongMaterial>(block.material);
+
+	if (keyword == "color") this->sp_set_slot_(phong->color);
+	else if (keyword == "reflection") this->sp_set_slot_(phong->reflection);
+	else if (keyword == "refraction") this->sp_set_slot_(phong->refraction);
+	else if (keyword == "ambient") this->sp_set_slot_(phong->ambient);
+	else if (keyword == "diffuse") this->sp_set_slot_(phong->diffuse);
+	else if (keyword == "specular") this->sp_set_slot_(phong->specular);
+	else if (keyword == "shininess") this->sp_set_slot_(phong->shininess);
+	else if (keyword == "reflection_roughness") this->sp_set_slot_(phong->reflection_roughness);
+	else if (keyword == "refraction_roughness") this->sp_set_slot_(phong->refraction_roughness);
+	else if (keyword == "transparent_shadows")
+	{
+		this->sp_expect_count_(1, 1);
+		phong->transparent_shadows = this->sp_bool_(1);
+	}
+	else
+	{
+		this->sp_error_("unknown phong material property " + std::string(keyword));
+	}
+}
+
+void SceneParser::sp_open_light_()
+{
+	this->sp_expect_count_(1, 2);
+
+	Block block = Block();
+	block.type = LightBlock;
+	block.transform = Matrix4::Identity();
+	block.kind = this->sp_name_(1);
+
+	if (block.kind == "point") block.light = std::make_shared<PointLight>();
+	else if (block.kind == "rect") block.light = std::make_shared<RectLight>();
+	else if (block.kind == "disk") block.light = std::make_shared<DiskLight>();
+	else if (block.kind == "sphere") block.light = std::make_shared<SphereLight>();
+	else this->sp_error_("unknown light type " + block.kind);
+
+	if (this->sp_tokens_.size() > 2)
+	{
+		block.light->set_name(this->sp_name_(2));
+	}
+
+	this->sp_blocks_.push_back(std::move(block));
+}
+
+void SceneParser::sp_light_property_(Block & block)
+{
+	if (this->sp_transform_property_(block))
+	{
+		return;
+	}
+
+	const std::string_view keyword = this->sp_tokens_[0];
+	Light & light = *block.light;
+
+	if (keyword == "position")
+	{
+		// Same as a translate, for lights that are only placed
+		this->sp_expect_count_(3, 3);
+		Matrix4 m = Matrix4::Translation(this->sp_number_(1), this->sp_number_(2), this->sp_number_(3));
+		block.transform = block.has_transform ? block.transform * m : m;
+		block.has_transform = true;
+	}
+	else if (keyword == "color") light.color = this->sp_color_(1);
+	else if (keyword == "multiplier")
+	{
+		this->sp_expect_count_(1, 1);
+		light.multiplier = this->sp_number_(1);
+	}
+	else if (keyword == "falloff")
+	{
+		this->sp_expect_count_(1, 1);
+		light.falloff = this->sp_bool_(1);
+	}
+	else if (keyword == "cutoff")
+	{
+		this->sp_expect_count_(1, 1);
+		light.cutoff = this->sp_number_(1);
+	}
+	else if (keyword == "casts_shadows")
+	{
+		this->sp_expect_count_(1, 1);
+		light.casts_shadows = this->sp_bool_(1);
+	}
+	else if (keyword == "radius" && block.kind != "rect")
+	{
+		this->sp_expect_count_(1, 1);
+		const double radius = this->sp_number_(1);
+
+		if (block.kind == "point") std::static_pointer_cast<PointLight>(block.light)->radius = radius;
+		else if (block.kind == "disk") std::static_pointer_cast<DiskLight>(block.light)->radius = radius;
+		else std::static_pointer_cast<SphereLight>(block.light)->radius = radius;
+	}
+	else if ((keyword == "width" || keyword == "height") && block.kind == "rect")
+	{
+		this->sp_expect_count_(1, 1);
+		auto rect = std::static_pointer_cast<RectLight>(block.light);
+		(keyword == "width" ? rect->width : rect->height) = this->sp_number_(1);
+	}
+	else
+	{
+		this->sp_error_("unknown " + block.kind + " light property " + std::string(keyword));
+	}
+}
+
+void SceneParser::sp_open_primitive_()
+{
+	this->sp_expect_count_(0, 1);
+
+	Block block = Block();
+	block.type = PrimitiveBlock;
+	block.transform = Matrix4::Identity();
+	block.kind = std::string(this->sp_tokens_[0]);
+
+	const std::string & type = block.kind;
+
+	if (type == "sphere") block.primitive = std::make_shared<Sphere>();
+	else if (type == "glass_sphere") block.primitive = Sphere::GlassSphere();
+	else if (type == "plane") block.primitive = std::make_shared<InfinitePlane>();
+	else if (type == "cube") block.primitive = std::make_shared<Cube>();
+	else if (type == "cylinder") block.primitive = std::make_shared<Cylinder>();
+	else if (type == "cone") block.primitive = std::make_shared<Cone>();
+	else if (type == "double_cone") block.primitive = std::make_shared<DoubleNappedCone>();
+	else if (type == "group") block.primitive = std::make_shared<Group>();
+	else this->sp_error_("unknown keyword " + type);
+
+	if (this->sp_tokens_.size() > 1)
+	{
+		block.primitive->set_name(this->sp_name_(1));
+	}
+
+	// Reserved now, so groups come after what they hold and children can point to them
+	if (this->record_primitives)
+	{
+		block.record = int(this->sp_records_.size());
+		this->sp_records_.emplace_back();
+	}
+
+	this->sp_blocks_.push_back(std::move(block));
+}
+
+void SceneParser::sp_primitive_property_(Block & block)
+{
+	if (this->sp_transform_property_(block))
+	{
+		return;
+	}
+
+	const std::string_view keyword = this->sp_tokens_[0];
+	const std::string & type = block.kind;
+	const bool is_cylinder = type == "cylinder";
+	const bool is_cone = type == "cone" || type == "double_cone";
+
+	if (keyword == "material")
+	{
+		this->sp_expect_count_(1, 1);
+		const std::string name = this->sp_name_(1);
+
+		auto found = this->sp_materials_.find(name);
+		if (found == this->sp_materials_.end())
+		{
+			this->sp_error_("material " + name + " is not defined");
+		}
+
+		block.primitive->material = found->second;
+	}
+	else if ((keyword == "minimum" || keyword == "maximum") && (is_cylinder || is_cone))
+	{
+		this->sp_expect_count_(1, 1);
+		const double value = this->sp_number_(1);
+
+		if (is_cylinder)
+		{
+			auto cylinder = std::static_pointer_cast<Cylinder>(block.primitive);
+			keyword == "minimum" ? cylinder->set_minimum(value) : cylinder->set_maximum(value);
+		}
+		else
+		{
+			auto cone = std::static_pointer_cast<DoubleNappedCone>(block.primitive);
+			keyword == "minimum" ? cone->set_minimum(value) : cone->set_maximum(value);
+		}
+	}
+	else if (keyword == "closed" && (is_cylinder || is_cone))
+	{
+		this->sp_expect_count_(1, 1);
+
+		if (is_cylinder) std::static_pointer_cast<Cylinder>(block.primitive)->set_closed(this->sp_bool_(1));
+		else std::static_pointer_cast<DoubleNappedCone>(block.primitive)->set_closed(this->sp_bool_(1));
+	}
+	else
+	{
+		this->sp_error_("unknown " + type + " property " + std::string(keyword));
+	}
+}
+
+void SceneParser::sp_include_()
+{
+	this->sp_expect_count_(1, 1);
+
+	const std::filesystem::path path = std::filesystem::path(this->sp_sources_.back().directory) / this->sp_name_(1);
+	std::ifstream input_file(path, std::ios::in);
+
+	if (!input_file.is_open())
+	{
+		this->sp_error_("cannot open included file " + path.string());
+	}
+
+	this->sp_source_files_.push_back(std::filesystem::absolute(path).string());
+
+	this->sp_parse_stream_(input_file, path.string(), path.parent_path().string());
+}
+
+void SceneParser::sp_record_definition_(bool opened_block)
+{
+	const std::string_view keyword = this->sp_tokens_[0];
+	const bool has_path = opened_block && this->sp_tokens_.size() > 2 && (
+		(keyword == "texmap" && this->sp_tokens_[2] == "image") ||
+		(keyword == "background" && (this->sp_tokens_[1] == "environment" || this->sp_tokens_[1] == "hosek_wilkie")));
+
+	if (!has_path)
+	{
+		this->sp_definitions_ += this->sp_line_;
+		this->sp_definitions_ += '\n';
+		return;
+	}
+
+	// The cache is read from somewhere else, so the path is written out in full
+	for (size_t i = 0; i + 1 < this->sp_tokens_.size(); i++)
+	{
+		this->sp_definitions_ += '"';
+		this->sp_definitions_ += this->sp_tokens_[i];
+		this->sp_definitions_ += "\" ";
+	}
+
+	const std::filesystem::path path = std::filesystem::path(this->sp_sources_.back().directory) / this->sp_tokens_.back();
+	this->sp_definitions_ += '"' + std::filesystem::absolute(path).string() + "\"\n";
+}
+
+void SceneParser::sp_record_primitive_(const Block & block)
+{
+	SceneCacheRecord record = SceneCacheRecord();
+	const std::string & type = block.kind;
+
+	if (type == "sphere") record.type = CacheSphere;
+	else if (type == "glass_sphere") record.type = CacheGlassSphere;
+	else if (type == "plane") record.type = CachePlane;
+	else if (type == "cube") record.type = CacheCube;
+	else if (type == "cylinder") record.type = CacheCylinder;
+	else if (type == "cone") record.type = CacheCone;
+	else if (type == "double_cone") record.type = CacheDoubleCone;
+	else record.type = CacheGroup;
+
+	// Still on the stack when this closes
+	record.parent = this->sp_blocks_.empty() ? -1 : this->sp_blocks_.back().record;
+
+	const std::string name = block.primitive->get_name();
+	record.name_offset = this->sp_record_string_(name);
+	record.name_size = uint32_t(name.size());
+
+	// Only named materials can be found again, the rest are the primitive's default
+	const std::shared_ptr<BaseMaterial> & material = block.primitive->material;
+	auto found = this->sp_materials_.find(material->name);
+	if (found != this->sp_materials_.end() && found->second == material)
+	{
+		record.material_offset = this->sp_record_string_(material->name);
+		record.material_size = uint32_t(material->name.size());
+	}
+
+	if (record.type == CacheCylinder)
+	{
+		auto cylinder = std::static_pointer_cast<Cylinder>(block.primitive);
+		record.closed = cylinder->get_closed();
+		record.minimum = cylinder->get_minimum();
+		record.maximum = cylinder->get_maximum();
+	}
+	else if (record.type == CacheCone || record.type == CacheDoubleCone)
+	{
+		auto cone = std::static_pointer_cast<DoubleNappedCone>(block.primitive);
+		record.closed = cone->get_closed();
+		record.minimum = cone->get_minimum();
+		record.maximum = cone->get_maximum();
+	}
+
+	const Matrix4 & transform = block.primitive->get_transform();
+	const Matrix4 & inverse = block.primitive->get_inverse_transform();
+
+	for (int i = 0; i < 16; i++)
+	{
+		record.transform[i] = transform.get(i);
+		record.inverse[i] = inverse.get(i);
+	}
+
+	this->sp_records_[block.record] = record;
+}
+
+uint32_t SceneParser::sp_record_string_(const std::string & str)
+{
+	const auto offset = uint32_t(this->sp_record_strings_.size());
+	this->sp_record_strings_ += str;
+	return offset;
+}
+
+// ------------------------------------------------------------------------
+// Argument Readers
+// ------------------------------------------------------------------------
+
+void SceneParser::sp_expect_count_(size_t minimum, size_t maximum) const
+{
+	const size_t count = this->sp_tokens_.size() - 1;
+
+	if (count < minimum || count > maximum)
+	{
+		std::string expected = std::to_string(minimum);
+		if (maximum != minimum)
+		{
+			expected += " to " + std::to_string(maximum);
+		}
+
+		this->sp_error_(std::string(this->sp_tokens_[0]) + " takes " + expected + " arguments, not " + std::to_string(count));
+	}
+}
+
+std::string SceneParser::sp_name_(size_t index) const
+{
+	if (index >= this->sp_tokens_.size())
+	{
+		this->sp_error_(std::string(this->sp_tokens_[0]) + " is missing an argument");
+	}
+
+	return std::string(this->sp_tokens_[index]);
+}
+
+double SceneParser::sp_number_(size_t index) const
+{
+	if (index >= this->sp_tokens_.size())
+	{
+		this->sp_error_(std::string(this->sp_tokens_[0]) + " is missing a number");
+	}
+
+	const std::string_view token = this->sp_tokens_[index];
+	const char * first = token.data();
+	const char * last = token.data() + token.size();
+
+	// from_chars does not take a leading +
+	if (first != last && *first == '+')
+	{
+		first++;
+	}
+
+	double value = 0.0;
+	auto result = std::from_chars(first, last, value);
+
+	if (result.ec != std::errc() || result.ptr != last)
+	{
+		this->sp_error_("expected a number, not " + std::string(token));
+	}
+
+	return value;
+}
+
+int SceneParser::sp_integer_(size_t index) const
+{
+	const double value = this->sp_number_(index);
+
+	if (value != std::floor(value))
+	{
+		this->sp_error_("expected a whole number, not " + std::string(this->sp_tokens_[index]));
+	}
+
+	return int(value);
+}
+
+bool SceneParser::sp_bool_(size_t index) const
+{
+	const std::string value = this->sp_name_(index);
+
+	if (value == "true" || value == "on" || value == "yes" || value == "1")
+	{
+		return true;
+	}
+	else if (value == "false" || value == "off" || value == "no" || value == "0")
+	{
+		return false;
+	}
+
+	this->sp_error_("expected true or false, not " + value);
+}
+
+Tuple SceneParser::sp_triple_(size_t index) const
+{
+	return Tuple::Vector(this->sp_number_(index), this->sp_number_(index + 1), this->sp_number_(index + 2));
+}
+
+Color SceneParser::sp_color_(size_t index) const
+{
+	const size_t count = this->sp_tokens_.size() - index;
+
+	if (count == 4 && this->sp_tokens_[index] == "srgb")
+	{
+		return Color(Color8Bit(this->sp_integer_(index + 1), this->sp_integer_(index + 2), this->sp_integer_(index + 3))).convert_srgb_to_linear();
+	}
+	else if (count == 1)
+	{
+		return Color(this->sp_number_(index));
+	}
+	else if (count == 3)
+	{
+		return Color(this->sp_number_(index), this->sp_number_(index + 1), this->sp_number_(index + 2));
+	}
+
+	this->sp_error_(std::string(this->sp_tokens_[0]) + " takes a luminosity, three values or srgb and three 8 bit values");
+}
+
+std::shared_ptr<TexMap> SceneParser::sp_map_(size_t index) const
+{
+	const std::string name = this->sp_name_(index);
+
+	auto found = this->sp_texmaps_.find(name);
+	if (found != this->sp_texmaps_.end())
+	{
+		this->sp_expect_count_(index, index);
+		return found->second;
+	}
+
+	const char c = name[0];
+	if (name == "srgb" || c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9'))
+	{
+		return std::make_shared<SolidColorMap>(this->sp_color_(index));
+	}
+
+	this->sp_error_("texmap " + name + " is not defined");
+}
+
+void SceneParser::sp_set_slot_(ColorMapSlot & slot) const
+{
+	const std::string name = this->sp_name_(1);
+
+	auto found = this->sp_texmaps_.find(name);
+	if (found != this->sp_texmaps_.end())
+	{
+		this->sp_expect_count_(1, 1);
+		slot.connect(found->second);
+		return;
+	}
+
+	const char c = name[0];
+	if (name != "srgb" && c != '-' && c != '+' && c != '.' && (c < '0' || c > '9'))
+	{
+		this->sp_error_("texmap " + name + " is not defined");
+	}
+
+	slot.set_value(this->sp_color_(1));
+}
+
+void SceneParser::sp_set_slot_(FloatMapSlot & slot) const
+{
+	this->sp_expect_count_(1, 1);
+	const std::string name = this->sp_name_(1);
+
+	auto found = this->sp_texmaps_.find(name);
+	if (found != this->sp_texmaps_.end())
+	{
+		slot.connect(found->second);
+		return;
+	}
+
+	slot.set_value(this->sp_number_(1));
+}
+
+void SceneParser::sp_error_(const std::string & message) const
+{
+	std::string location = "scene";
+
+	if (!this->sp_sources_.empty())
+	{
+		location = this->sp_sources_.back().name + ":" + std::to_string(this->sp_sources_.back().line);
+	}
+
+	throw std::runtime_error(location + ": " + message);
+}
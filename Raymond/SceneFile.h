@@ -0,0 +1,206 @@
+#ifndef H_RAYMOND_SCENEFILE
+#define H_RAYMOND_SCENEFILE
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "World.h"
+#include "Camera.h"
+#include "Texmap.h"
+#include "Material.h"
+#include "SceneCache.h"
+
+// A world and the camera looking at it, as read from a scene file
+struct Scene
+{
+	World world;
+	Camera camera;
+};
+
+// Reads the text scene format.  The file is read once, top to bottom, and every object is
+// added to the world as soon as its block ends, so nothing but the named maps and materials
+// is held on to while parsing.
+//
+// Every line is a keyword and its arguments.  # starts a comment, commas count as spaces and
+// names with spaces are quoted.  Blocks open with a header line and close with end:
+//
+//     settings                          aa_sample_min 4 and the other World settings
+//     camera                            size 256 256, fov 45 and from, to and up points,
+//                                       aperture 0.1, focal_distance 5, blades 6 [degrees]
+//                                       and crop x y width height
+//     background sky                    normal_gradient, sky, hosek_wilkie "dataset.h",
+//                                       environment "file.pfm" or none.  sky is Preetham's
+//                                       daylight model and hosek_wilkie is Hosek and Wilkie's,
+//                                       read from ArHosekSkyModelData_RGB.h.  Both take sun,
+//                                       turbidity and multiplier, hosek_wilkie also albedo,
+//                                       and neither draws the sun's disk.  Environments are
+//                                       only read from PFM files
+//     texmap <name> <type> [args]       stripe, gradient, ring, checker, solid, composite,
+//                                       perturb, channel, perlin <seed>, colored_perlin <seed>
+//                                       and image "file.ppm".  bake <resolution> <min> <max>
+//                                       bakes the map over a box when its block ends
+//     material <name> phong|normals     color 0.18, reflection stripes, ior 1.5 and so on
+//     light <type> [name]               point, rect, disk and sphere
+//     <primitive> [name]                sphere, glass_sphere, plane, cube, cylinder, cone,
+//                                       double_cone and group, which holds more primitives
+//     include "file.scene"              reads another file in place, paths are relative to
+//                                       the including file
+//
+// Maps and materials are named and can only be used after they are defined.  Colors are one
+// luminosity, three linear values, srgb and three 8 bit values, or the name of a map.
+// Transforms are lines of translate, scale, rotate_x, rotate_y, rotate_z (in degrees),
+// shear and matrix, and are multiplied in the order they are written, so
+//
+//     translate 0 1 0
+//     scale 0.5
+//
+// is Translation * Scaling, the same as it would be in code.  Errors throw a runtime_error
+// with the file and line.
+class SceneParser
+{
+public:
+	SceneParser();
+	~SceneParser();
+
+	// Methods
+	Scene load(const std::string & file_path);
+	// Includes are looked up in directory
+	Scene parse(std::istream & input, const std::string & source_name = "scene", const std::string & directory = "");
+
+	// Accessors, valid after a load, for looking into what was built
+	std::shared_ptr<TexMap> get_texmap(const std::string & name) const;
+	std::shared_ptr<BaseMaterial> get_material(const std::string & name) const;
+	size_t lines_read() const;
+
+	// What a scene cache is written from, kept while record_primitives is set
+	// Lines of every block that is not a primitive, with file paths made absolute
+	const std::string & definitions() const;
+	const std::vector<SceneCacheRecord> & records() const;
+	// Names the records point into
+	const std::string & record_strings() const;
+	// Every file read, the loaded file first
+	const std::vector<std::string> & source_files() const;
+	// Images and environments the scene reads as it renders, with absolute paths
+	const std::vector<std::string> & asset_files() const;
+
+	// Properties
+	// Deepest chain of includes allowed, which also stops files that include themselves
+	int max_include_depth;
+	bool record_primitives;
+
+private:
+	enum BlockType { SettingsBlock, CameraBlock, BackgroundBlock, TexMapBlock, MaterialBlock, LightBlock, PrimitiveBlock };
+
+	// The block being read, there is more than one while inside groups
+	struct Block
+	{
+		BlockType type;
+		std::string kind;
+		Matrix4 transform;
+		bool has_transform = false;
+		// Index into the records, when recording
+		int record = -1;
+
+		std::shared_ptr<TexMap> texmap;
+		std::shared_ptr<BaseMaterial> material;
+		std::shared_ptr<Light> light;
+		std::shared_ptr<PrimitiveBase> primitive;
+
+		// Used by blocks whose object is built at the end
+		std::string path;
+		Tuple sun = Tuple::Vector(0.0, 1.0, 0.0);
+		double turbidity = 3.0;
+		double albedo = 0.0;
+		double multiplier = 0.0;
+		bool has_multiplier = false;
+		// Samples along the longest side of a baked map's box, 0 when it is not baked
+		int bake_resolution = 0;
+		Tuple bake_minimum, bake_maximum;
+	};
+
+	// Where the parser is in which file, for error messages
+	struct Source
+	{
+		std::string name;
+		std::string directory;
+		int line;
+	};
+
+	void sp_parse_stream_(std::istream & input, const std::string & source_name, const std::string & directory);
+	void sp_parse_line_();
+	void sp_tokenize_(const std::string & line);
+
+	void sp_open_block_();
+	// Groups take transforms, every other line in a group is a primitive
+	static bool sp_is_transform_(std::string_view keyword);
+	void sp_close_block_();
+	void sp_block_property_();
+
+	bool sp_transform_property_(Block & block);
+	void sp_settings_property_();
+	void sp_camera_property_();
+	void sp_background_property_(Block & block);
+	void sp_texmap_property_(Block & block);
+	void sp_material_property_(Block & block);
+	void sp_light_property_(Block & block);
+	void sp_primitive_property_(Block & block);
+
+	void sp_open_texmap_();
+	void sp_open_material_();
+	void sp_open_light_();
+	void sp_open_primitive_();
+	void sp_include_();
+
+	void sp_record_definition_(bool opened_block);
+	void sp_record_primitive_(const Block & block);
+	uint32_t sp_record_string_(const std::string & str);
+
+	// Argument readers, index is the token after the keyword
+	void sp_expect_count_(size_t minimum, size_t maximum) const;
+	std::string sp_name_(size_t index) const;
+	double sp_number_(size_t index) const;
+	int sp_integer_(size_t index) const;
+	bool sp_bool_(size_t index) const;
+	Tuple sp_triple_(size_t index) const;
+	Color sp_color_(size_t index) const;
+	// A map by name or a solid color
+	std::shared_ptr<TexMap> sp_map_(size_t index) const;
+	void sp_set_slot_(ColorMapSlot & slot) const;
+	void sp_set_slot_(FloatMapSlot & slot) const;
+
+	[[noreturn]] void sp_error_(const std::string & message) const;
+
+	// Properties
+	Scene sp_scene_;
+	std::vector<Block> sp_blocks_;
+	std::vector<Source> sp_sources_;
+	std::vector<std::string_view> sp_tokens_;
+	std::string sp_line_;
+	size_t sp_lines_read_;
+
+	// Camera, built when its block ends
+	int sp_width_, sp_height_;
+	double sp_fov_;
+	Tuple sp_from_, sp_to_, sp_up_;
+	// 0 focal distance is the distance from from to to
+	double sp_aperture_, sp_focal_distance_;
+	int sp_blades_;
+	double sp_blade_rotation_;
+	// Empty renders the whole frame
+	PixelRect sp_crop_;
+
+	std::unordered_map<std::string, std::shared_ptr<TexMap>> sp_texmaps_;
+	std::unordered_map<std::string, std::shared_ptr<BaseMaterial>> sp_materials_;
+
+	std::string sp_definitions_;
+	std::vector<SceneCacheRecord> sp_records_;
+	std::string sp_record_strings_;
+	std::vector<std::string> sp_source_files_;
+	std::vector<std::string> sp_asset_files_;
+};
+
+#endif
@@ -0,0 +1,770 @@
+#include "pch.h"
+#include "TexMapProgram.h"
+
+#include <optional>
+#include <typeinfo>
+
+// ------------------------------------------------------------------------
+//
+// TexMapCompiler
+//
+// ------------------------------------------------------------------------
+// Walks a TexMap graph once and writes its instructions into a program
+// ------------------------------------------------------------------------
+
+class TexMapCompiler
+{
+public:
+	explicit TexMapCompiler(TexMapProgram & program);
+	~TexMapCompiler();
+
+	// Methods
+	bool compile(const std::shared_ptr<TexMap> & node, int base_frame);
+
+private:
+	// A frame already computed, so later nodes with the same transform can reuse it
+	struct TMCFrame
+	{
+		TexMapOp op;
+		int src;
+		int matrix;
+		int frame;
+	};
+
+	bool tmc_constant_(const std::shared_ptr<TexMap> & node, Color & col) const;
+	bool tmc_select_(TexMapOp op, const std::shared_ptr<TexMap> & node, const std::shared_ptr<TexMap> & a, const std::shared_ptr<TexMap> & b, int base_frame);
+
+	int tmc_texmap_frame_(const std::shared_ptr<TexMap> & node, int base_frame);
+	int tmc_frame_(TexMapOp op, int src, int matrix);
+	int tmc_matrix_(const Matrix4 & m);
+
+	int tmc_emit_(TexMapOp op, int dst, int src, int arg, int stack_change);
+	void tmc_push_scope_();
+	void tmc_pop_scope_();
+
+	TexMapProgram & tmc_program_;
+	// Frames computed in an enclosing scope are always valid, ones inside a skipped branch are not
+	std::vector<std::vector<TMCFrame>> tmc_scopes_;
+	int tmc_depth_;
+	bool tmc_failed_;
+};
+
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+TexMapCompiler::TexMapCompiler(TexMapProgram & program) : tmc_program_(program)
+{
+	this->tmc_scopes_ = std::vector<std::vector<TMCFrame>>(1);
+	this->tmc_depth_ = 0;
+	this->tmc_failed_ = false;
+}
+
+TexMapCompiler::~TexMapCompiler()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+bool TexMapCompiler::compile(const std::shared_ptr<TexMap> & node, const int base_frame)
+{
+	if (node == nullptr || this->tmc_failed_)
+	{
+		return false;
+	}
+
+	Color col;
+
+	if (this->tmc_constant_(node, col))
+	{
+		this->tmc_program_.tp_constants_.push_back(col);
+		this->tmc_emit_(TexOpConstant, 0, 0, static_cast<int>(this->tmc_program_.tp_constants_.size()) - 1, 1);
+		return !this->tmc_failed_;
+	}
+
+	// Exact types only, a subclass may sample differently
+	const std::type_info & type = typeid(*node);
+
+	if (type == typeid(StripeMap))
+	{
+		auto map = std::static_pointer_cast<StripeMap>(node);
+		return this->tmc_select_(TexOpStripe, node, map->a, map->b, base_frame);
+	}
+	else if (type == typeid(RingMap))
+	{
+		auto map = std::static_pointer_cast<RingMap>(node);
+		return this->tmc_select_(TexOpRing, node, map->a, map->b, base_frame);
+	}
+	else if (type == typeid(CheckerMap))
+	{
+		auto map = std::static_pointer_cast<CheckerMap>(node);
+		return this->tmc_select_(TexOpChecker, node, map->a, map->b, base_frame);
+	}
+	else if (type == typeid(GradientMap))
+	{
+		auto map = std::static_pointer_cast<GradientMap>(node);
+		const int frame = this->tmc_texmap_frame_(node, base_frame);
+
+		if (!this->compile(map->a, base_frame) || !this->compile(map->b, base_frame))
+		{
+			return false;
+		}
+
+		const int index = this->tmc_emit_(TexOpGradient, 0, frame, 0, -1);
+		this->tmc_program_.tp_instructions_[index].flag = map->clamp_fraction;
+	}
+	else if (type == typeid(CompositeMap))
+	{
+		auto map = std::static_pointer_cast<CompositeMap>(node);
+
+		if (!this->compile(map->a, base_frame) || !this->compile(map->b, base_frame) || !this->compile(map->factor, base_frame))
+		{
+			return false;
+		}
+
+		this->tmc_emit_(TexOpComposite, 0, 0, map->composite_mode, -2);
+	}
+	else if (type == typeid(ChannelMap))
+	{
+		auto map = std::static_pointer_cast<ChannelMap>(node);
+
+		if (!this->compile(map->r, base_frame) || !this->compile(map->g, base_frame) || !this->compile(map->b, base_frame))
+		{
+			return false;
+		}
+
+		this->tmc_emit_(TexOpChannel, 0, 0, 0, -2);
+	}
+	else if (type == typeid(PerturbMap))
+	{
+		// The perturbed point replaces the shading point for the main map, the perturb map's own transform is unused
+		auto map = std::static_pointer_cast<PerturbMap>(node);
+
+		if (!this->compile(map->displacement, base_frame))
+		{
+			return false;
+		}
+
+		const int frame = this->tmc_program_.tp_num_frames_++;
+		const int index = this->tmc_emit_(TexOpDisplace, frame, base_frame, 0, -1);
+		this->tmc_program_.tp_instructions_[index].value = map->scale;
+		this->tmc_program_.tp_instructions_[index].flag = map->displacement_remap;
+
+		return this->compile(map->main, frame);
+	}
+	else
+	{
+		// Leaf maps such as noise and images are sampled directly
+		const int frame = this->tmc_texmap_frame_(node, base_frame);
+
+		this->tmc_program_.tp_nodes_.push_back(node);
+		this->tmc_emit_(TexOpCall, frame, base_frame, static_cast<int>(this->tmc_program_.tp_nodes_.size()) - 1, 1);
+	}
+
+	return !this->tmc_failed_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+bool TexMapCompiler::tmc_constant_(const std::shared_ptr<TexMap> & node, Color & col) const
+{
+	if (node == nullptr)
+	{
+		return false;
+	}
+
+	const std::type_info & type = typeid(*node);
+	Color a, b, c;
+
+	if (type == typeid(SolidColorMap))
+	{
+		col = std::static_pointer_cast<SolidColorMap>(node)->col;
+		return true;
+	}
+	else if (type == typeid(StripeMap) || type == typeid(RingMap) || type == typeid(CheckerMap) || type == typeid(GradientMap))
+	{
+		// A pattern choosing between two equal colors is that color
+		std::shared_ptr<TexMap> map_a, map_b;
+
+		if (type == typeid(StripeMap))
+		{
+			map_a = std::static_pointer_cast<StripeMap>(node)->a;
+			map_b = std::static_pointer_cast<StripeMap>(node)->b;
+		}
+		else if (type == typeid(RingMap))
+		{
+			map_a = std::static_pointer_cast<RingMap>(node)->a;
+			map_b = std::static_pointer_cast<RingMap>(node)->b;
+		}
+		else if (type == typeid(CheckerMap))
+		{
+			map_a = std::static_pointer_cast<CheckerMap>(node)->a;
+			map_b = std::static_pointer_cast<CheckerMap>(node)->b;
+		}
+		else
+		{
+			map_a = std::static_pointer_cast<GradientMap>(node)->a;
+			map_b = std::static_pointer_cast<GradientMap>(node)->b;
+		}
+
+		if (this->tmc_constant_(map_a, a) && this->tmc_constant_(map_b, b) && a == b)
+		{
+			col = a;
+			return true;
+		}
+	}
+	else if (type == typeid(CompositeMap))
+	{
+		auto map = std::static_pointer_cast<CompositeMap>(node);
+
+		if (this->tmc_constant_(map->a, a) && this->tmc_constant_(map->b, b) && this->tmc_constant_(map->factor, c))
+		{
+			col = composite_colors(map->composite_mode, a, b, c.luminosity());
+			return true;
+		}
+	}
+	else if (type == typeid(ChannelMap))
+	{
+		auto map = std::static_pointer_cast<ChannelMap>(node);
+
+		if (this->tmc_constant_(map->r, a) && this->tmc_constant_(map->g, b) && this->tmc_constant_(map->b, c))
+		{
+			col = Color(a.luminosity(), b.luminosity(), c.luminosity());
+			return true;
+		}
+	}
+	else if (type == typeid(PerturbMap))
+	{
+		// Moving the point does nothing to a constant
+		return this->tmc_constant_(std::static_pointer_cast<PerturbMap>(node)->main, col);
+	}
+
+	return false;
+}
+
+bool TexMapCompiler::tmc_select_(const TexMapOp op, const std::shared_ptr<TexMap> & node, const std::shared_ptr<TexMap> & a, const std::shared_ptr<TexMap> & b, const int base_frame)
+{
+	const int frame = this->tmc_texmap_frame_(node, base_frame);
+	const int fraction = this->tmc_program_.tp_num_fractions_++;
+
+	this->tmc_emit_(op, fraction, frame, 0, 0);
+
+	// Only the side of the pattern the fraction covers is evaluated
+	const int jump_to_b = this->tmc_emit_(TexOpJumpIfOne, 0, 0, fraction, 0);
+
+	this->tmc_push_scope_();
+	const bool a_compiled = this->compile(a, base_frame);
+	this->tmc_pop_scope_();
+
+	const int jump_to_end = this->tmc_emit_(TexOpJumpIfZero, 0, 0, fraction, 0);
+	this->tmc_program_.tp_instructions_[jump_to_b].target = static_cast<int>(this->tmc_program_.tp_instructions_.size());
+
+	this->tmc_push_scope_();
+	const bool b_compiled = this->compile(b, base_frame);
+	this->tmc_pop_scope_();
+
+	// When color a was skipped only b is on the stack and the mix leaves it there
+	this->tmc_emit_(TexOpMix, 0, 0, fraction, -1);
+	this->tmc_program_.tp_instructions_[jump_to_end].target = static_cast<int>(this->tmc_program_.tp_instructions_.size());
+
+	return a_compiled && b_compiled && !this->tmc_failed_;
+}
+
+int TexMapCompiler::tmc_texmap_frame_(const std::shared_ptr<TexMap> & node, const int base_frame)
+{
+	int frame = base_frame;
+
+	if (node->get_mapping_space() == ObjectSpace)
+	{
+		frame = this->tmc_frame_(TexOpObjectSpace, frame, -1);
+	}
+
+	const Matrix4 & inverse = node->transform->get_inverse_transform();
+
+	// Untransformed maps sample the frame they are given
+	if (!std::equal(inverse.begin(), inverse.end(), Matrix4::Identity().begin()))
+	{
+		frame = this->tmc_frame_(TexOpTransform, frame, this->tmc_matrix_(inverse));
+	}
+
+	return frame;
+}
+
+int TexMapCompiler::tmc_frame_(const TexMapOp op, const int src, const int matrix)
+{
+	for (const std::vector<TMCFrame> & scope : this->tmc_scopes_)
+	{
+		for (const TMCFrame & existing : scope)
+		{
+			if (existing.op == op && existing.src == src && existing.matrix == matrix)
+			{
+				return existing.frame;
+			}
+		}
+	}
+
+	const int frame = this->tmc_program_.tp_num_frames_++;
+	this->tmc_emit_(op, frame, src, matrix, 0);
+	this->tmc_scopes_.back().push_back(TMCFrame{ op, src, matrix, frame });
+
+	return frame;
+}
+
+int TexMapCompiler::tmc_matrix_(const Matrix4 & m)
+{
+	std::vector<Matrix4> & matrices = this->tmc_program_.tp_matrices_;
+
+	for (size_t i = 0; i < matrices.size(); i++)
+	{
+		if (std::equal(m.begin(), m.end(), matrices[i].begin()))
+		{
+			return static_cast<int>(i);
+		}
+	}
+
+	matrices.push_back(m);
+	return static_cast<int>(matrices.size()) - 1;
+}
+
+int TexMapCompiler::tmc_emit_(const TexMapOp op, const int dst, const int src, const int arg, const int stack_change)
+{
+	this->tmc_program_.tp_instructions_.push_back(TexMapInstruction{ op, dst, src, arg, 0, 0.0, false });
+
+	this->tmc_depth_ += stack_change;
+
+	// Gives up on graphs too large for the interpreter's fixed registers
+	if (this->tmc_depth_ > TexMapProgram::MAX_STACK ||
+		this->tmc_program_.tp_num_frames_ > TexMapProgram::MAX_FRAMES ||
+		this->tmc_program_.tp_num_fractions_ > TexMapProgram::MAX_FRACTIONS)
+	{
+		this->tmc_failed_ = true;
+	}
+
+	return static_cast<int>(this->tmc_program_.tp_instructions_.size()) - 1;
+}
+
+void TexMapCompiler::tmc_push_scope_()
+{
+	this->tmc_scopes_.emplace_back();
+}
+
+void TexMapCompiler::tmc_pop_scope_()
+{
+	this->tmc_scopes_.pop_back();
+}
+
+// ------------------------------------------------------------------------
+//
+// TexMapProgram
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+TexMapProgram::TexMapProgram()
+{
+	// Frame 0 is the shading point
+	this->tp_num_frames_ = 1;
+	this->tp_num_fractions_ = 0;
+}
+
+TexMapProgram::~TexMapProgram()
+= default;
+
+std::shared_ptr<TexMapProgram> TexMapProgram::compile(const std::shared_ptr<TexMap> & root)
+{
+	std::shared_ptr<TexMapProgram> program = std::make_shared<TexMapProgram>();
+	TexMapCompiler compiler = TexMapCompiler(*program);
+
+	if (!compiler.compile(root, 0))
+	{
+		return nullptr;
+	}
+
+	program->tp_watch_graph_(root);
+
+	return program;
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+namespace
+{
+	// A point and its footprint
+	struct TPFrame
+	{
+		Tuple point, dpdx, dpdy;
+	};
+}
+
+Color TexMapProgram::evaluate(const IxComps & comps) const
+{
+	if (this->is_constant())
+	{
+		return this->tp_constants_[0];
+	}
+
+	const bool filtered = comps.has_differentials;
+
+	TPFrame frames[MAX_FRAMES];
+	double fractions[MAX_FRACTIONS];
+	Color stack[MAX_STACK];
+	int top = 0;
+
+	frames[0].point = comps.point;
+	frames[0].dpdx = comps.dpdx;
+	frames[0].dpdy = comps.dpdy;
+
+	// Only copied when the program samples a leaf map
+	std::optional<IxComps> leaf_comps;
+
+	const TexMapInstruction * instructions = this->tp_instructions_.data();
+	const int num_instructions = static_cast<int>(this->tp_instructions_.size());
+
+	int pc = 0;
+
+	while (pc < num_instructions)
+	{
+		const TexMapInstruction & ins = instructions[pc];
+		pc++;
+
+		switch (ins.op)
+		{
+		case TexOpConstant:
+			stack[top++] = this->tp_constants_[ins.arg];
+			break;
+
+		case TexOpObjectSpace:
+		{
+			TPFrame & dst = frames[ins.dst];
+			const TPFrame & src = frames[ins.src];
+
+			if (comps.object == nullptr)
+			{
+				dst = src;
+				break;
+			}
+
+			dst.point = comps.object->point_to_object_space(src.point, comps.time);
+			if (filtered)
+			{
+				dst.dpdx = comps.object->point_to_object_space(src.dpdx, comps.time);
+				dst.dpdy = comps.object->point_to_object_space(src.dpdy, comps.time);
+			}
+			break;
+		}
+
+		case TexOpTransform:
+		{
+			TPFrame & dst = frames[ins.dst];
+			const TPFrame & src = frames[ins.src];
+			const Matrix4 & m = this->tp_matrices_[ins.arg];
+
+			dst.point = m * src.point;
+			if (filtered)
+			{
+				dst.dpdx = m * src.dpdx;
+				dst.dpdy = m * src.dpdy;
+			}
+			break;
+		}
+
+		case TexOpDisplace:
+		{
+			Color disp = stack[--top];
+			if (ins.flag)
+			{
+				disp = remap(disp, Color(0.0), Color(1.0), Color(-1.0), Color(1.0));
+			}
+
+			TPFrame & dst = frames[ins.dst];
+			const TPFrame & src = frames[ins.src];
+
+			dst.point = src.point + (disp * ins.value);
+			dst.dpdx = src.dpdx;
+			dst.dpdy = src.dpdy;
+			break;
+		}
+
+		case TexOpStripe:
+		{
+			const TPFrame & src = frames[ins.src];
+			const double width = filtered ? std::max(fabs(src.dpdx.x), fabs(src.dpdy.x)) : 0.0;
+
+			fractions[ins.dst] = filtered_odd_fraction(src.point.x, width);
+			break;
+		}
+
+		case TexOpRing:
+		{
+			const Tuple & p = frames[ins.src].point;
+
+			fractions[ins.dst] = ((int(floor(sqrt((p.x * p.x) + (p.z * p.z)))) % 2) == 0) ? 0.0 : 1.0;
+			break;
+		}
+
+		case TexOpChecker:
+		{
+			const TPFrame & src = frames[ins.src];
+			const Tuple p = src.point + (comps.normal_v * EPSILON);
+
+			if (!filtered)
+			{
+				fractions[ins.dst] = (((int(floor(p.x)) + int(floor(p.y)) + int(floor(p.z))) % 2) == 0) ? 0.0 : 1.0;
+				break;
+			}
+
+			const double fx = filtered_odd_fraction(p.x, std::max(fabs(src.dpdx.x), fabs(src.dpdy.x)));
+			const double fy = filtered_odd_fraction(p.y, std::max(fabs(src.dpdx.y), fabs(src.dpdy.y)));
+			const double fz = filtered_odd_fraction(p.z, std::max(fabs(src.dpdx.z), fabs(src.dpdy.z)));
+
+			fractions[ins.dst] = 0.5 * (1.0 - ((1.0 - 2.0 * fx) * (1.0 - 2.0 * fy) * (1.0 - 2.0 * fz)));
+			break;
+		}
+
+		case TexOpJumpIfOne:
+			if (fractions[ins.arg] >= 1.0)
+			{
+				pc = ins.target;
+			}
+			break;
+
+		case TexOpJumpIfZero:
+			if (fractions[ins.arg] <= 0.0)
+			{
+				pc = ins.target;
+			}
+			break;
+
+		case TexOpMix:
+		{
+			const double fraction = fractions[ins.arg];
+
+			if (fraction > 0.0 && fraction < 1.0)
+			{
+				const Color b = stack[--top];
+				stack[top - 1] = lerp(fraction, stack[top - 1], b);
+			}
+			break;
+		}
+
+		case TexOpGradient:
+		{
+			double fraction = frames[ins.src].point.x;
+			if (ins.flag)
+			{
+				fraction = clip(fraction, 0.0, 0.999999);
+			}
+
+			const Color b = stack[--top];
+			stack[top - 1] = lerp(fraction, stack[top - 1], b);
+			break;
+		}
+
+		case TexOpComposite:
+		{
+			const double factor = stack[--top].luminosity();
+			const Color b = stack[--top];
+			stack[top - 1] = composite_colors(static_cast<CompositeMode>(ins.arg), stack[top - 1], b, factor);
+			break;
+		}
+
+		case TexOpChannel:
+		{
+			const Color b = stack[--top];
+			const Color g = stack[--top];
+			stack[top - 1] = Color(stack[top - 1].luminosity(), g.luminosity(), b.luminosity());
+			break;
+		}
+
+		case TexOpCall:
+		{
+			if (!leaf_comps.has_value())
+			{
+				leaf_comps.emplace(comps);
+			}
+
+			IxComps & leaf = *leaf_comps;
+			const TPFrame & frame = frames[ins.dst];
+
+			leaf.point = frames[ins.src].point;
+			leaf.texmap_point = frame.point;
+
+			if (filtered)
+			{
+				leaf.texmap_dpdx = frame.dpdx;
+				leaf.texmap_dpdy = frame.dpdy;
+				stack[top++] = this->tp_nodes_[ins.arg]->local_filtered_sample_at(leaf);
+			}
+			else
+			{
+				stack[top++] = this->tp_nodes_[ins.arg]->local_sample_at(leaf);
+			}
+			break;
+		}
+		}
+	}
+
+	return stack[0];
+}
+
+bool TexMapProgram::is_current(const std::shared_ptr<TexMap> & root) const
+{
+	if (this->tp_watches_.empty() || this->tp_watches_[0].node != root)
+	{
+		return false;
+	}
+
+	for (const TexMapWatch & watched : this->tp_watches_)
+	{
+		const TexMapWatch now = TexMapProgram::tp_watch_(watched.node, watched.kind);
+
+		if (now.transform != watched.transform || now.transform_version != watched.transform_version ||
+			now.mapping_space != watched.mapping_space ||
+			now.children[0] != watched.children[0] || now.children[1] != watched.children[1] || now.children[2] != watched.children[2] ||
+			now.col.x != watched.col.x || now.col.y != watched.col.y || now.col.z != watched.col.z || now.value != watched.value || now.mode != watched.mode || now.flag != watched.flag)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool TexMapProgram::is_constant() const
+{
+	return (this->tp_instructions_.size() == 1 && this->tp_instructions_[0].op == TexOpConstant);
+}
+
+size_t TexMapProgram::size() const
+{
+	return this->tp_instructions_.size();
+}
+
+const std::vector<TexMapInstruction> & TexMapProgram::get_instructions() const
+{
+	return this->tp_instructions_;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+namespace
+{
+	// The types a compiled program copies anything out of, in the order they are looked up
+	enum TexMapWatchKind { WatchSolid, WatchStripe, WatchRing, WatchChecker, WatchGradient, WatchComposite, WatchChannel, WatchPerturb, WatchKindCount };
+}
+
+TexMapWatch TexMapProgram::tp_watch_(const std::shared_ptr<const TexMap> & node, int kind)
+{
+	TexMapWatch watch = TexMapWatch{ node, kind, node->transform, 0, node->get_mapping_space(), { nullptr, nullptr, nullptr }, Color(0.0), 0.0, 0, false };
+
+	if (node->transform != nullptr)
+	{
+		watch.transform_version = node->transform->get_version();
+	}
+
+	// Only the parts of the types the compiler reads
+	if (kind < 0)
+	{
+		const std::type_info & type = typeid(*node);
+		const std::type_info * kinds[] = { &typeid(SolidColorMap), &typeid(StripeMap), &typeid(RingMap), &typeid(CheckerMap),
+			&typeid(GradientMap), &typeid(CompositeMap), &typeid(ChannelMap), &typeid(PerturbMap) };
+
+		for (int i = 0; i < WatchKindCount; i++)
+		{
+			if (type == *kinds[i])
+			{
+				watch.kind = i;
+			}
+		}
+	}
+
+	switch (watch.kind)
+	{
+	case WatchSolid:
+		watch.col = static_cast<const SolidColorMap *>(node.get())->col;
+		break;
+	case WatchStripe:
+		watch.children[0] = static_cast<const StripeMap *>(node.get())->a;
+		watch.children[1] = static_cast<const StripeMap *>(node.get())->b;
+		break;
+	case WatchRing:
+		watch.children[0] = static_cast<const RingMap *>(node.get())->a;
+		watch.children[1] = static_cast<const RingMap *>(node.get())->b;
+		break;
+	case WatchChecker:
+		watch.children[0] = static_cast<const CheckerMap *>(node.get())->a;
+		watch.children[1] = static_cast<const CheckerMap *>(node.get())->b;
+		break;
+	case WatchGradient:
+	{
+		auto map = static_cast<const GradientMap *>(node.get());
+		watch.children[0] = map->a;
+		watch.children[1] = map->b;
+		watch.flag = map->clamp_fraction;
+		break;
+	}
+	case WatchComposite:
+	{
+		auto map = static_cast<const CompositeMap *>(node.get());
+		watch.children[0] = map->a;
+		watch.children[1] = map->b;
+		watch.children[2] = map->factor;
+		watch.mode = map->composite_mode;
+		break;
+	}
+	case WatchChannel:
+	{
+		auto map = static_cast<const ChannelMap *>(node.get());
+		watch.children[0] = map->r;
+		watch.children[1] = map->g;
+		watch.children[2] = map->b;
+		break;
+	}
+	case WatchPerturb:
+	{
+		auto map = static_cast<const PerturbMap *>(node.get());
+		watch.children[0] = map->main;
+		watch.children[1] = map->displacement;
+		watch.value = map->scale;
+		watch.flag = map->displacement_remap;
+		break;
+	}
+	default:
+		break;
+	}
+
+	return watch;
+}
+
+void TexMapProgram::tp_watch_graph_(const std::shared_ptr<const TexMap> & node)
+{
+	if (node == nullptr)
+	{
+		return;
+	}
+
+	// Shared branches are watched once
+	for (const TexMapWatch & watched : this->tp_watches_)
+	{
+		if (watched.node == node)
+		{
+			return;
+		}
+	}
+
+	this->tp_watches_.push_back(TexMapProgram::tp_watch_(node, -1));
+	const TexMapWatch watch = this->tp_watches_.back();
+
+	for (const std::shared_ptr<const TexMap> & child : watch.children)
+	{
+		this->tp_watch_graph_(child);
+	}
+}
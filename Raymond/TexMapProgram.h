@@ -0,0 +1,112 @@
+#ifndef H_RAYMOND_TEXMAPPROGRAM
+#define H_RAYMOND_TEXMAPPROGRAM
+
+#include <vector>
+#include <memory>
+
+#include "Matrix.h"
+#include "Color.h"
+#include "IxComps.h"
+#include "Texmap.h"
+
+enum TexMapOp
+{
+	TexOpConstant,		// Pushes a constant color
+	TexOpObjectSpace,	// Moves a frame into the space of the shaded object
+	TexOpTransform,		// Moves a frame by a TexMap's inverse transform
+	TexOpDisplace,		// Pops a color and offsets a frame by it
+	TexOpStripe,		// Fraction of color b covered by the pattern at a frame
+	TexOpRing,
+	TexOpChecker,
+	TexOpJumpIfOne,		// Skips color a when the fraction is all b
+	TexOpJumpIfZero,	// Skips color b when the fraction is all a
+	TexOpMix,			// Blends the two colors on top of the stack by a fraction
+	TexOpGradient,		// Pops b and a, pushes the gradient between them
+	TexOpComposite,		// Pops factor, b and a, pushes the composite
+	TexOpChannel,		// Pops b, g and r, pushes their luminosities
+	TexOpCall			// Samples a TexMap the compiler has no instruction for
+};
+
+struct TexMapInstruction
+{
+	TexMapOp op;
+	// Frame or fraction register written
+	int dst;
+	// Frame register read
+	int src;
+	// Index into the constant, matrix or node tables, or a mode
+	int arg;
+	// Instruction to jump to
+	int target;
+	double value;
+	bool flag;
+};
+
+// What a program copied out of one node of its graph when it was compiled.  The nodes and
+// transforms are held, so none of them is freed and its address reused while it is watched.
+struct TexMapWatch
+{
+	std::shared_ptr<const TexMap> node;
+	// Which of the types the compiler knows, -1 for a leaf map
+	int kind;
+	std::shared_ptr<const TransformController> transform;
+	uint64_t transform_version;
+	MappingSpace mapping_space;
+	// The children the compiler reads, by type
+	std::shared_ptr<const TexMap> children[3];
+	Color col;
+	double value;
+	int mode;
+	bool flag;
+};
+
+// A TexMap graph flattened into a list of instructions.
+// Transforms shared by several nodes are only applied once, and branches built
+// entirely from SolidColorMaps are folded into a single constant.
+// Frames are points with their ray differentials, fractions are pattern selections.
+// Transforms, constants and parameters are copied in, so a program also keeps what it
+// copied, to tell when the graph has been edited since.
+class TexMapProgram
+{
+public:
+	TexMapProgram();
+	~TexMapProgram();
+
+	// Returns nullptr when the graph needs more registers than the interpreter has
+	static std::shared_ptr<TexMapProgram> compile(const std::shared_ptr<TexMap> & root);
+
+	// Methods
+	Color evaluate(const IxComps & comps) const;
+
+	// False once a node's transform, children or parameters have changed, or the slot has
+	// been pointed at another graph.  Leaf maps are sampled directly and always current.
+	// Visits every node, so it is checked before a render rather than while sampling.
+	bool is_current(const std::shared_ptr<TexMap> & root) const;
+
+	bool is_constant() const;
+	size_t size() const;
+	const std::vector<TexMapInstruction> & get_instructions() const;
+
+	static const int MAX_FRAMES = 16;
+	static const int MAX_FRACTIONS = 16;
+	static const int MAX_STACK = 16;
+
+private:
+	friend class TexMapCompiler;
+
+	// Finds the node's kind when it is -1
+	static TexMapWatch tp_watch_(const std::shared_ptr<const TexMap> & node, int kind);
+	void tp_watch_graph_(const std::shared_ptr<const TexMap> & node);
+
+	std::vector<TexMapInstruction> tp_instructions_;
+	std::vector<Color> tp_constants_;
+	std::vector<Matrix4> tp_matrices_;
+	std::vector<std::shared_ptr<TexMap>> tp_nodes_;
+	// Every node of the graph once, the root first
+	std::vector<TexMapWatch> tp_watches_;
+
+	int tp_num_frames_;
+	int tp_num_fractions_;
+};
+
+#endif
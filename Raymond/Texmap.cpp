@@ -1,5 +1,7 @@
 #include "pch.h"
 #include "Texmap.h"
+#include "TexMapProgram.h"
+#include "RenderStats.h"
 
 // ------------------------------------------------------------------------
 //
@@ -12,12 +14,19 @@
 TexMapSlot::TexMapSlot()
 {
 	this->connection = nullptr;
+	this->ts_program_ = nullptr;
 }
 
+TexMapSlot::TexMapSlot(const TexMapSlot & src)
+= default;
+
 TexMapSlot::~TexMapSlot()
 {
 }
 
+TexMapSlot & TexMapSlot::operator=(const TexMapSlot & src)
+= default;
+
 // ------------------------------------------------------------------------
 // Methods
 // ------------------------------------------------------------------------
@@ -25,11 +34,26 @@ TexMapSlot::~TexMapSlot()
 void TexMapSlot::connect(std::shared_ptr<TexMap> slot)
 {
 	this->connection = slot;
+	this->compile();
 }
 
 void TexMapSlot::disconnect()
 {
 	this->connection = nullptr;
+	this->ts_program_ = nullptr;
+}
+
+void TexMapSlot::compile()
+{
+	if (this->connection == nullptr)
+	{
+		this->ts_program_ = nullptr;
+	}
+	else if (this->ts_program_ == nullptr || !this->ts_program_->is_current(this->connection))
+	{
+		// Falls back to sampling the graph directly when it cannot be compiled
+		this->ts_program_ = TexMapProgram::compile(this->connection);
+	}
 }
 
 bool TexMapSlot::is_connected() const
@@ -37,6 +61,15 @@ bool TexMapSlot::is_connected() const
 	return (this->connection != nullptr);
 }
 
+// ------------------------------------------------------------------------
+// Accessors
+// ------------------------------------------------------------------------
+
+std::shared_ptr<const TexMapProgram> TexMapSlot::get_program() const
+{
+	return this->ts_program_;
+}
+
 // ------------------------------------------------------------------------
 //
 // ColorMapSlot
@@ -82,8 +115,16 @@ void ColorMapSlot::set_value(const double & lum)
 
 Color ColorMapSlot::sample_at(const IxComps & comps) const
 {
-	if (this->is_connected())
+	const TexMapProgram * compiled = this->ts_program_.get();
+
+	if (compiled != nullptr)
+	{
+		thread_counters().texmap_evaluations++;
+		return compiled->evaluate(comps);
+	}
+	else if (this->is_connected())
 	{
+		thread_counters().texmap_evaluations++;
 		return this->connection->sample_at(comps);
 	}
 	else
@@ -152,8 +193,16 @@ void FloatMapSlot::set_value(const double & val)
 
 double FloatMapSlot::sample_at(const IxComps & comps) const
 {
-	if (this->is_connected())
+	const TexMapProgram * compiled = this->ts_program_.get();
+
+	if (compiled != nullptr)
+	{
+		thread_counters().texmap_evaluations++;
+		return compiled->evaluate(comps).luminosity();
+	}
+	else if (this->is_connected())
 	{
+		thread_counters().texmap_evaluations++;
 		return this->connection->sample_at(comps).luminosity();
 	}
 	else
@@ -214,6 +263,11 @@ void TexMap::set_mapping_space(MappingSpace space)
 	this->mapping_space_ = space;
 }
 
+MappingSpace TexMap::get_mapping_space() const
+{
+	return this->mapping_space_;
+}
+
 // ------------------------------------------------------------------------
 // Shade
 // ------------------------------------------------------------------------
@@ -233,11 +287,118 @@ Color TexMap::sample_at(const IxComps & comps) const
 
 	// Also transforms by the object's transformation matrix
 	case ObjectSpace:
-		transformed_comps.texmap_point = this->transform->get_inverse_transform() * comps.object->point_to_object_space(comps.point);
+		transformed_comps.texmap_point = this->transform->get_inverse_transform() * comps.object->point_to_object_space(comps.point, comps.time);
+		break;
+	}
+
+	// Without differentials there is no footprint to filter
+	if (!comps.has_differentials)
+	{
+		return this->local_sample_at(transformed_comps);
+	}
+
+	// The footprint vectors have a w of 0.0, so only the linear part of the matrices applies
+	switch (this->mapping_space_)
+	{
+	case WorldSpace:
+		transformed_comps.texmap_dpdx = this->transform->get_inverse_transform() * comps.dpdx;
+		transformed_comps.texmap_dpdy = this->transform->get_inverse_transform() * comps.dpdy;
+		break;
+
+	case ObjectSpace:
+		transformed_comps.texmap_dpdx = this->transform->get_inverse_transform() * comps.object->point_to_object_space(comps.dpdx, comps.time);
+		transformed_comps.texmap_dpdy = this->transform->get_inverse_transform() * comps.object->point_to_object_space(comps.dpdy, comps.time);
 		break;
 	}
 
-	return this->local_sample_at(transformed_comps);
+	return this->local_filtered_sample_at(transformed_comps);
+}
+
+Color TexMap::local_filtered_sample_at(const IxComps & comps) const
+{
+	return this->local_sample_at(comps);
+}
+
+Tuple TexMap::filter_width_(const IxComps & comps)
+{
+	return Tuple::Vector(
+		std::max(fabs(comps.texmap_dpdx.x), fabs(comps.texmap_dpdy.x)),
+		std::max(fabs(comps.texmap_dpdx.y), fabs(comps.texmap_dpdy.y)),
+		std::max(fabs(comps.texmap_dpdx.z), fabs(comps.texmap_dpdy.z))
+	);
+}
+
+// ------------------------------------------------------------------------
+// Hashing
+// ------------------------------------------------------------------------
+
+uint64_t TexMap::graph_hash() const
+{
+	return this->base_hash_();
+}
+
+uint64_t TexMap::base_hash_() const
+{
+	uint64_t hash = hash_string(HASH_SEED, typeid(*this).name());
+	hash = hash_value(hash, this->mapping_space_);
+
+	const Matrix4 & m = this->transform->get_transform();
+	for (int row = 0; row < 4; row++)
+	{
+		for (double element : m.get_row(row))
+		{
+			hash = hash_value(hash, element);
+		}
+	}
+
+	return hash;
+}
+
+uint64_t TexMap::child_hash_(uint64_t hash, const std::shared_ptr<TexMap> & child)
+{
+	return hash_value(hash, child ? child->graph_hash() : uint64_t(0));
+}
+
+// ------------------------------------------------------------------------
+// Filtering Helpers
+// ------------------------------------------------------------------------
+
+// Integral of a square wave that is 0.0 on even unit intervals and 1.0 on odd ones
+// From Texturing and Modeling: A Procedural Approach by Ebert et al.
+static double odd_interval_integral(double x)
+{
+	double half_floor = floor(x / 2.0);
+	return half_floor + std::max(0.0, x - (2.0 * half_floor) - 1.0);
+}
+
+// Box filters the square wave over [x - width / 2, x + width / 2], giving the 
+// fraction of the filter that falls on odd intervals
+double filtered_odd_fraction(double x, double width)
+{
+	if (width < EPSILON)
+	{
+		return (int(floor(x)) % 2 == 0) ? 0.0 : 1.0;
+	}
+
+	double x0 = x - (width / 2.0);
+	double x1 = x + (width / 2.0);
+
+	return clip((odd_interval_integral(x1) - odd_interval_integral(x0)) / width, 0.0, 1.0);
+}
+
+// Only samples the child maps that the filter actually covers
+static Color blend_filtered(double fraction, const std::shared_ptr<TexMap> & a, const std::shared_ptr<TexMap> & b, const IxComps & comps)
+{
+	if (fraction <= 0.0)
+	{
+		return a->sample_at(comps);
+	}
+	else if (fraction >= 1.0)
+	{
+		return b->sample_at(comps);
+	}
+
+	return lerp(fraction, a->sample_at(comps), b->sample_at(comps));
 }
 
 // Constructs an IxComps to execute shading function.
@@ -321,6 +482,21 @@ Color StripeMap::local_sample_at(const IxComps & comps) const
 	}
 }
 
+Color StripeMap::local_filtered_sample_at(const IxComps & comps) const
+{
+	double width = TexMap::filter_width_(comps).x;
+
+	return blend_filtered(filtered_odd_fraction(comps.texmap_point.x, width), this->a, this->b, comps);
+}
+
+uint64_t StripeMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->a);
+	hash = child_hash_(hash, this->b);
+	return hash;
+}
+
 // ------------------------------------------------------------------------
 //
 // Solid Color Map
@@ -351,6 +527,15 @@ Color SolidColorMap::local_sample_at(const IxComps & comps) const
 	return this->col;
 }
 
+uint64_t SolidColorMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = hash_value(hash, this->col.x);
+	hash = hash_value(hash, this->col.y);
+	hash = hash_value(hash, this->col.z);
+	return hash;
+}
+
 // ------------------------------------------------------------------------
 //
 // Blend Map
@@ -398,6 +583,15 @@ Color GradientMap::local_sample_at(const IxComps & comps) const
 	return lerp(fraction, a->sample_at(comps), b->sample_at(comps));
 }
 
+uint64_t GradientMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->a);
+	hash = child_hash_(hash, this->b);
+	hash = hash_value(hash, this->clamp_fraction);
+	return hash;
+}
+
 // ------------------------------------------------------------------------
 //
 // Ring Map
@@ -446,6 +640,14 @@ Color RingMap::local_sample_at(const IxComps & comps) const
 	}
 }
 
+uint64_t RingMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->a);
+	hash = child_hash_(hash, this->b);
+	return hash;
+}
+
 // ------------------------------------------------------------------------
 //
 // Checker Map
@@ -496,6 +698,30 @@ Color CheckerMap::local_sample_at(const IxComps & comps) const
 	}
 }
 
+Color CheckerMap::local_filtered_sample_at(const IxComps & comps) const
+{
+	Tuple offset_point = comps.texmap_point + (comps.normal_v * EPSILON);
+	Tuple width = TexMap::filter_width_(comps);
+
+	// The checker is the parity of three stripe patterns. Treating each axis as independent,
+	// the chance of an odd sum is (1 - (1 - 2fx)(1 - 2fy)(1 - 2fz)) / 2
+	double fx = filtered_odd_fraction(offset_point.x, width.x);
+	double fy = filtered_odd_fraction(offset_point.y, width.y);
+	double fz = filtered_odd_fraction(offset_point.z, width.z);
+
+	double odd = 0.5 * (1.0 - ((1.0 - 2.0 * fx) * (1.0 - 2.0 * fy) * (1.0 - 2.0 * fz)));
+
+	return blend_filtered(odd, this->a, this->b, comps);
+}
+
+uint64_t CheckerMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->a);
+	hash = child_hash_(hash, this->b);
+	return hash;
+}
+
 // ------------------------------------------------------------------------
 //
 // Composite Map
@@ -557,12 +783,32 @@ CompositeMap::~CompositeMap()
 
 Color CompositeMap::local_sample_at(const IxComps & comps) const
 {
-	Color result;
 	Color a = this->a->sample_at(comps);
 	Color b = this->b->sample_at(comps);
 	double factor = this->factor->sample_at(comps).luminosity();
 
-	switch (this->composite_mode)
+	return composite_colors(this->composite_mode, a, b, factor);
+}
+
+uint64_t CompositeMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = hash_value(hash, this->composite_mode);
+	hash = child_hash_(hash, this->a);
+	hash = child_hash_(hash, this->b);
+	hash = child_hash_(hash, this->factor);
+	return hash;
+}
+
+// ------------------------------------------------------------------------
+// Blend Helpers
+// ------------------------------------------------------------------------
+
+Color composite_colors(CompositeMode mode, Color a, const Color & b, double factor)
+{
+	Color result;
+
+	switch (mode)
 	{
 	case CompBlend:
 		result = lerp(factor, a, b);
@@ -636,6 +882,16 @@ Color PerturbMap::local_sample_at(const IxComps & comps) const
 	return main->sample_at(transformed_comps);
 }
 
+uint64_t PerturbMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->main);
+	hash = child_hash_(hash, this->displacement);
+	hash = hash_value(hash, this->scale);
+	hash = hash_value(hash, this->displacement_remap);
+	return hash;
+}
+
 // ------------------------------------------------------------------------
 //
 // Channel Map
@@ -671,3 +927,12 @@ Color ChannelMap::local_sample_at(const IxComps & comps) const
 		this->b->sample_at(comps).luminosity()
 	);
 }
+
+uint64_t ChannelMap::graph_hash() const
+{
+	uint64_t hash = this->base_hash_();
+	hash = child_hash_(hash, this->r);
+	hash = child_hash_(hash, this->g);
+	hash = child_hash_(hash, this->b);
+	return hash;
+}
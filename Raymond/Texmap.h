@@ -11,19 +11,34 @@ enum CompositeMode { CompBlend, CompAdd, CompMultiply, CompDivide, CompSubtract,
 enum SlotType { ColorMapSlotType, FloatMapSlotType, BaseMapSlotType };
 
 class TexMap;
+class TexMapProgram;
 
 class TexMapSlot
 {
 public:
 	TexMapSlot();
+	TexMapSlot(const TexMapSlot & src);
 	~TexMapSlot();
 
+	TexMapSlot & operator=(const TexMapSlot & src);
+
 	virtual void connect(std::shared_ptr<TexMap> slot);
 	virtual void disconnect();
 	bool is_connected() const;
 
+	// Flattens the connected graph again if it has been edited since it was last compiled,
+	// connect() already compiles it.  World::begin_frame calls this for every material before
+	// a render, so it is never called while the slot is being sampled.
+	void compile();
+
+	// nullptr when the graph could not be compiled, and it is sampled directly
+	std::shared_ptr<const TexMapProgram> get_program() const;
+
 	// property
 	std::shared_ptr<TexMap> connection;
+
+protected:
+	std::shared_ptr<const TexMapProgram> ts_program_;
 };
 
 class ColorMapSlot :
@@ -83,15 +98,32 @@ public:
 	~TexMap();
 
 	void set_mapping_space(MappingSpace space);
+	MappingSpace get_mapping_space() const;
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const = 0;
+	// Samples the area of the texture covered by the ray differentials
+	// Maps that cannot filter themselves fall back to local_sample_at
+	virtual Color local_filtered_sample_at(const IxComps & comps) const;
 	Color sample_at(const IxComps & comps) const;
 	Color sample_at_point(const Tuple & point) const;
 
+	// Identifies the graph below this map by its types, parameters and transforms.
+	// Graphs with the same hash sample the same colors.
+	virtual uint64_t graph_hash() const;
+
 	//properties
 	std::shared_ptr<TransformController> transform;
 
+protected:
+	// Hash of the parts every map has, the type, mapping space and transform
+	uint64_t base_hash_() const;
+	// Hashes a child, missing children hash to a fixed value
+	static uint64_t child_hash_(uint64_t hash, const std::shared_ptr<TexMap> & child);
+
+	// Width of the filter footprint on each axis of texture space
+	static Tuple filter_width_(const IxComps & comps);
+
 private:
 	//properties
 	MappingSpace mapping_space_;
@@ -119,6 +151,8 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual Color local_filtered_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	std::shared_ptr<TexMap> a, b;
@@ -134,6 +168,7 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	Color col;
@@ -150,6 +185,7 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	std::shared_ptr<TexMap> a, b;
@@ -167,6 +203,7 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	std::shared_ptr<TexMap> a, b;
@@ -183,6 +220,8 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual Color local_filtered_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	std::shared_ptr<TexMap> a, b;
@@ -202,6 +241,7 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	CompositeMode composite_mode;
@@ -218,6 +258,7 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	std::shared_ptr<TexMap> main, displacement;
@@ -235,10 +276,18 @@ public:
 
 	// Methods
 	virtual Color local_sample_at(const IxComps & comps) const override;
+	virtual uint64_t graph_hash() const override;
 
 	// Properties
 	std::shared_ptr<TexMap> r, g, b;
 	double scale;
 };
 
+// Filtering Helpers
+// Fraction of a box filter centered on x that falls on odd unit intervals
+double filtered_odd_fraction(double x, double width);
+
+// Blend Helpers
+Color composite_colors(CompositeMode mode, Color a, const Color & b, double factor);
+
 #endif
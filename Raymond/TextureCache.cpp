@@ -0,0 +1,680 @@
+#include "pch.h"
+#include "TextureCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+// ------------------------------------------------------------------------
+//
+// TextureFile
+//
+// ------------------------------------------------------------------------
+// Header parsing
+// ------------------------------------------------------------------------
+
+// Reads the next whitespace separated token, skipping comments
+static std::string next_header_token(std::istream & stream)
+{
+	std::string token;
+	char c;
+
+	while (stream.get(c))
+	{
+		if (c == '#' && token.empty())
+		{
+			std::string comment;
+			std::getline(stream, comment);
+		}
+		else if (isspace(static_cast<unsigned char>(c)))
+		{
+			if (!token.empty())
+			{
+				break;
+			}
+		}
+		else
+		{
+			token += c;
+		}
+	}
+
+	return token;
+}
+
+static int parse_header_int(std::istream & stream, const std::string & path)
+{
+	const std::string token = next_header_token(stream);
+
+	try
+	{
+		return std::stoi(token);
+	}
+	catch (const std::exception &)
+	{
+		throw std::runtime_error("Malformed image header in " + path);
+	}
+}
+
+static bool host_is_little_endian()
+{
+	const uint16_t one = 1;
+	unsigned char first;
+	memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+TextureFile::TextureFile(const std::string & file_path)
+{
+	this->path = file_path;
+	this->id = 0;
+	this->tf_data_path_ = file_path;
+	this->tf_channels_ = 3;
+	this->tf_bytes_per_sample_ = 1;
+	this->tf_max_value_ = 255.0;
+	this->tf_little_endian_ = false;
+
+	std::ifstream stream(file_path, std::ios::in | std::ios::binary);
+
+	if (!stream.is_open())
+	{
+		throw std::runtime_error("Unable to open image " + file_path);
+	}
+
+	const std::string magic = next_header_token(stream);
+
+	if (magic == "P3")
+	{
+		this->format = PPMAsciiFormat;
+	}
+	else if (magic == "P6")
+	{
+		this->format = PPMBinaryFormat;
+	}
+	else if (magic == "PF" || magic == "Pf")
+	{
+		this->format = PFMFormat;
+		this->tf_channels_ = (magic == "PF") ? 3 : 1;
+		this->tf_bytes_per_sample_ = 4;
+	}
+	else
+	{
+		throw std::runtime_error("Unsupported image format in " + file_path);
+	}
+
+	this->width = parse_header_int(stream, file_path);
+	this->height = parse_header_int(stream, file_path);
+
+	if (this->width <= 0 || this->height <= 0)
+	{
+		throw std::runtime_error("Invalid image size in " + file_path);
+	}
+
+	if (this->format == PFMFormat)
+	{
+		// The sign of the scale gives the byte order, its magnitude is unused
+		const std::string scale = next_header_token(stream);
+		this->tf_little_endian_ = (!scale.empty() && scale[0] == '-');
+	}
+	else
+	{
+		this->tf_max_value_ = parse_header_int(stream, file_path);
+		this->tf_bytes_per_sample_ = (this->tf_max_value_ < 256.0) ? 1 : 2;
+	}
+
+	// next_header_token consumed the single whitespace character ending the header
+	this->tf_data_offset_ = stream.tellg();
+
+	if (this->format == PPMAsciiFormat)
+	{
+		this->tf_convert_ascii_(stream);
+	}
+
+	// Each level halves the one above it, rounding up so edge texels are never dropped
+	int level_w = this->width;
+	int level_h = this->height;
+
+	this->tf_level_widths_.push_back(level_w);
+	this->tf_level_heights_.push_back(level_h);
+
+	while (level_w > 1 || level_h > 1)
+	{
+		level_w = std::max(1, (level_w + 1) / 2);
+		level_h = std::max(1, (level_h + 1) / 2);
+		this->tf_level_widths_.push_back(level_w);
+		this->tf_level_heights_.push_back(level_h);
+	}
+
+	this->num_levels = static_cast<int>(this->tf_level_widths_.size());
+}
+
+TextureFile::~TextureFile()
+{
+	if (this->tf_data_path_ != this->path)
+	{
+		std::error_code error;
+		std::filesystem::remove(this->tf_data_path_, error);
+	}
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+int TextureFile::level_width(const int level) const
+{
+	return this->tf_level_widths_[clip(level, 0, this->num_levels - 1)];
+}
+
+int TextureFile::level_height(const int level) const
+{
+	return this->tf_level_heights_[clip(level, 0, this->num_levels - 1)];
+}
+
+void TextureFile::read_block(const int x, const int y, const int block_width, const int block_height, std::vector<float> & texels) const
+{
+	texels.assign(size_t(block_width) * size_t(block_height) * 3, 0.0f);
+
+	// Every tile opens its own stream, so tiles can be read from several threads at once
+	std::ifstream stream(this->tf_data_path_, std::ios::in | std::ios::binary);
+
+	if (!stream.is_open())
+	{
+		throw std::runtime_error("Unable to open image " + this->path);
+	}
+
+	const size_t pixel_bytes = size_t(this->tf_channels_) * size_t(this->tf_bytes_per_sample_);
+	std::vector<unsigned char> row_data = std::vector<unsigned char>(pixel_bytes * size_t(block_width));
+
+	for (int row = 0; row < block_height; row++)
+	{
+		// PFM stores its rows from the bottom of the image up
+		const int file_row = (this->format == PFMFormat) ? (this->height - 1 - (y + row)) : (y + row);
+		const std::streamoff offset = this->tf_data_offset_ +
+			static_cast<std::streamoff>((size_t(file_row) * size_t(this->width) + size_t(x)) * pixel_bytes);
+
+		stream.seekg(offset);
+		stream.read(reinterpret_cast<char *>(row_data.data()), static_cast<std::streamsize>(row_data.size()));
+
+		if (!stream)
+		{
+			throw std::runtime_error("Unexpected end of image data in " + this->path);
+		}
+
+		for (int col = 0; col < block_width; col++)
+		{
+			const Color col_value = this->tf_decode_(row_data.data() + size_t(col) * pixel_bytes);
+			const size_t texel_index = (size_t(row) * size_t(block_width) + size_t(col)) * 3;
+			texels[texel_index] = static_cast<float>(col_value.x);
+			texels[texel_index + 1] = static_cast<float>(col_value.y);
+			texels[texel_index + 2] = static_cast<float>(col_value.z);
+		}
+	}
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+void TextureFile::tf_convert_ascii_(std::istream & stream)
+{
+	std::error_code error;
+	const std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+
+	if (error)
+	{
+		throw std::runtime_error("No temporary directory to convert " + this->path + " into");
+	}
+
+	const std::string data_path = temp_file_path((directory / ("raymond_texture_" + std::to_string(hash_string(HASH_SEED, this->path)))).string());
+	std::ofstream output_file(data_path, std::ios::out | std::ios::binary);
+
+	if (!output_file.is_open())
+	{
+		throw std::runtime_error("Unable to write the converted pixels of " + this->path);
+	}
+
+	this->tf_data_path_ = data_path;
+	this->tf_data_offset_ = 0;
+
+	// A row at a time, so the whole image is never held in memory.  Missing samples are black.
+	const size_t row_samples = size_t(this->width) * 3;
+	std::vector<unsigned char> row_data = std::vector<unsigned char>(row_samples * size_t(this->tf_bytes_per_sample_));
+
+	for (int row = 0; row < this->height; row++)
+	{
+		std::fill(row_data.begin(), row_data.end(), static_cast<unsigned char>(0));
+
+		int sample;
+		for (size_t i = 0; i < row_samples && stream >> sample; i++)
+		{
+			const int value = clip(sample, 0, 65535);
+
+			// PPM samples wider than a byte are big endian
+			if (this->tf_bytes_per_sample_ == 2)
+			{
+				row_data[i * 2] = static_cast<unsigned char>(value >> 8);
+				row_data[(i * 2) + 1] = static_cast<unsigned char>(value & 0xFF);
+			}
+			else
+			{
+				row_data[i] = static_cast<unsigned char>(std::min(value, 255));
+			}
+		}
+
+		output_file.write(reinterpret_cast<const char *>(row_data.data()), static_cast<std::streamsize>(row_data.size()));
+	}
+
+	if (!output_file)
+	{
+		output_file.close();
+		std::filesystem::remove(data_path, error);
+		throw std::runtime_error("Unable to write the converted pixels of " + this->path);
+	}
+}
+
+Color TextureFile::tf_decode_(const unsigned char * data) const
+{
+	if (this->format == PFMFormat)
+	{
+		float samples[3];
+
+		for (int channel = 0; channel < this->tf_channels_; channel++)
+		{
+			unsigned char bytes[4];
+			memcpy(bytes, data + channel * 4, 4);
+
+			if (this->tf_little_endian_ != host_is_little_endian())
+			{
+				std::swap(bytes[0], bytes[3]);
+				std::swap(bytes[1], bytes[2]);
+			}
+
+			memcpy(&samples[channel], bytes, 4);
+		}
+
+		// Greyscale files repeat their only channel
+		if (this->tf_channels_ == 1)
+		{
+			return Color(samples[0]);
+		}
+
+		return Color(samples[0], samples[1], samples[2]);
+	}
+
+	// PPM samples wider than a byte are big endian
+	double samples[3];
+
+	for (int channel = 0; channel < 3; channel++)
+	{
+		if (this->tf_bytes_per_sample_ == 2)
+		{
+			samples[channel] = double((data[channel * 2] << 8) | data[(channel * 2) + 1]);
+		}
+		else
+		{
+			samples[channel] = double(data[channel]);
+		}
+	}
+
+	return Color(
+		samples[0] / this->tf_max_value_,
+		samples[1] / this->tf_max_value_,
+		samples[2] / this->tf_max_value_
+	).convert_srgb_to_linear();
+}
+
+// ------------------------------------------------------------------------
+//
+// TextureTile
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+TextureTile::TextureTile(const int width, const int height)
+{
+	this->width = width;
+	this->height = height;
+	this->texels = std::vector<float>(size_t(width) * size_t(height) * 3, 0.0f);
+}
+
+TextureTile::~TextureTile()
+= default;
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+Color TextureTile::texel(const int x, const int y) const
+{
+	const float * t = &this->texels[(size_t(y) * size_t(this->width) + size_t(x)) * 3];
+	return Color(t[0], t[1], t[2]);
+}
+
+void TextureTile::set_texel(const int x, const int y, const Color & col)
+{
+	float * t = &this->texels[(size_t(y) * size_t(this->width) + size_t(x)) * 3];
+	t[0] = static_cast<float>(col.x);
+	t[1] = static_cast<float>(col.y);
+	t[2] = static_cast<float>(col.z);
+}
+
+size_t TextureTile::bytes() const
+{
+	return sizeof(TextureTile) + this->texels.size() * sizeof(float);
+}
+
+// ------------------------------------------------------------------------
+//
+// TextureCache
+//
+// ------------------------------------------------------------------------
+// Constructors
+// ------------------------------------------------------------------------
+
+TextureCache::TextureCache() : TextureCache(size_t(256) * 1024 * 1024)
+{
+}
+
+TextureCache::TextureCache(const size_t memory_limit) : tc_hits_(0), tc_misses_(0)
+{
+	this->tc_memory_limit_ = memory_limit;
+	this->tc_resident_bytes_ = 0;
+}
+
+TextureCache::~TextureCache()
+= default;
+
+std::shared_ptr<TextureCache> TextureCache::global()
+{
+	static std::shared_ptr<TextureCache> cache = std::make_shared<TextureCache>();
+	return cache;
+}
+
+// ------------------------------------------------------------------------
+// Methods
+// ------------------------------------------------------------------------
+
+std::shared_ptr<TextureFile> TextureCache::open(const std::string & file_path)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->tc_mutex_);
+
+		const auto found = this->tc_files_.find(file_path);
+		if (found != this->tc_files_.end())
+		{
+			return found->second;
+		}
+	}
+
+	// Parse the header outside of the lock, ASCII files can take a while
+	std::shared_ptr<TextureFile> file = std::make_shared<TextureFile>(file_path);
+
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+
+	const auto found = this->tc_files_.find(file_path);
+	if (found != this->tc_files_.end())
+	{
+		return found->second;
+	}
+
+	file->id = static_cast<int>(this->tc_files_.size());
+	this->tc_files_[file_path] = file;
+
+	return file;
+}
+
+Color TextureCache::texel(const TextureFile & file, int level, int x, int y)
+{
+	level = clip(level, 0, file.num_levels - 1);
+
+	TilePtr last_tile = nullptr;
+	uint64_t last_key = 0;
+
+	return this->tc_texel_(file, level, x, y, last_tile, last_key);
+}
+
+Color TextureCache::bilinear(const TextureFile & file, int level, const double u, const double v)
+{
+	level = clip(level, 0, file.num_levels - 1);
+
+	const int level_w = file.level_width(level);
+	const int level_h = file.level_height(level);
+
+	// Texel centers sit on the half integers
+	const double fx = (u * level_w) - 0.5;
+	const double fy = (v * level_h) - 0.5;
+
+	const double floor_x = floor(fx);
+	const double floor_y = floor(fy);
+
+	const double tx = fx - floor_x;
+	const double ty = fy - floor_y;
+
+	// Repeat wrapping
+	const int x0 = ((static_cast<int>(floor_x) % level_w) + level_w) % level_w;
+	const int y0 = ((static_cast<int>(floor_y) % level_h) + level_h) % level_h;
+	const int x1 = (x0 + 1) % level_w;
+	const int y1 = (y0 + 1) % level_h;
+
+	TilePtr last_tile = nullptr;
+	uint64_t last_key = 0;
+
+	const Color c00 = this->tc_texel_(file, level, x0, y0, last_tile, last_key);
+	const Color c10 = this->tc_texel_(file, level, x1, y0, last_tile, last_key);
+	const Color c01 = this->tc_texel_(file, level, x0, y1, last_tile, last_key);
+	const Color c11 = this->tc_texel_(file, level, x1, y1, last_tile, last_key);
+
+	return lerp(ty, lerp(tx, c00, c10), lerp(tx, c01, c11));
+}
+
+Color TextureCache::trilinear(const TextureFile & file, const double u, const double v, const double footprint)
+{
+	const double level = clip(log2(std::max(footprint, 1.0)), 0.0, double(file.num_levels - 1));
+	const int lower_level = static_cast<int>(floor(level));
+	const double t = level - lower_level;
+
+	const Color lower = this->bilinear(file, lower_level, u, v);
+
+	if (t <= 0.0 || lower_level + 1 >= file.num_levels)
+	{
+		return lower;
+	}
+
+	return lerp(t, lower, this->bilinear(file, lower_level + 1, u, v));
+}
+
+void TextureCache::set_memory_limit(const size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+
+	this->tc_memory_limit_ = bytes;
+	this->tc_evict_();
+}
+
+size_t TextureCache::memory_limit() const
+{
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+	return this->tc_memory_limit_;
+}
+
+size_t TextureCache::resident_bytes() const
+{
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+	return this->tc_resident_bytes_;
+}
+
+size_t TextureCache::resident_tiles() const
+{
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+	return this->tc_tiles_.size();
+}
+
+size_t TextureCache::hits() const
+{
+	return this->tc_hits_.load(std::memory_order_relaxed);
+}
+
+size_t TextureCache::misses() const
+{
+	return this->tc_misses_.load(std::memory_order_relaxed);
+}
+
+double TextureCache::hit_rate() const
+{
+	const double h = double(this->hits());
+	const double total = h + double(this->misses());
+
+	if (total <= 0.0)
+	{
+		return 0.0;
+	}
+
+	return h / total;
+}
+
+void TextureCache::reset_stats()
+{
+	this->tc_hits_.store(0, std::memory_order_relaxed);
+	this->tc_misses_.store(0, std::memory_order_relaxed);
+}
+
+void TextureCache::clear()
+{
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+
+	this->tc_tiles_.clear();
+	this->tc_lru_.clear();
+	this->tc_resident_bytes_ = 0;
+}
+
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+uint64_t TextureCache::tc_key_(const int file_id, const int level, const int tile_x, const int tile_y)
+{
+	// 16 bits of file, 8 of level and 20 for each tile coordinate
+	return (uint64_t(file_id & 0xFFFF) << 48) |
+		(uint64_t(level & 0xFF) << 40) |
+		(uint64_t(tile_x & 0xFFFFF) << 20) |
+		uint64_t(tile_y & 0xFFFFF);
+}
+
+TextureCache::TilePtr TextureCache::tc_tile_(const TextureFile & file, const int level, const int tile_x, const int tile_y)
+{
+	const uint64_t key = tc_key_(file.id, level, tile_x, tile_y);
+
+	{
+		std::lock_guard<std::mutex> lock(this->tc_mutex_);
+
+		const auto found = this->tc_tiles_.find(key);
+		if (found != this->tc_tiles_.end())
+		{
+			this->tc_lru_.splice(this->tc_lru_.begin(), this->tc_lru_, found->second.lru_position);
+			this->tc_hits_.fetch_add(1, std::memory_order_relaxed);
+			return found->second.tile;
+		}
+	}
+
+	this->tc_misses_.fetch_add(1, std::memory_order_relaxed);
+
+	// Built without the lock held, two threads racing for the same tile both build it and the first one in wins
+	TilePtr tile = this->tc_build_tile_(file, level, tile_x, tile_y);
+
+	std::lock_guard<std::mutex> lock(this->tc_mutex_);
+
+	const auto found = this->tc_tiles_.find(key);
+	if (found != this->tc_tiles_.end())
+	{
+		return found->second.tile;
+	}
+
+	this->tc_lru_.push_front(key);
+	this->tc_tiles_[key] = TCEntry{ tile, this->tc_lru_.begin() };
+	this->tc_resident_bytes_ += tile->bytes();
+
+	this->tc_evict_();
+
+	return tile;
+}
+
+Color TextureCache::tc_texel_(const TextureFile & file, const int level, const int x, const int y, TilePtr & last_tile, uint64_t & last_key)
+{
+	const int cx = clip(x, 0, file.level_width(level) - 1);
+	const int cy = clip(y, 0, file.level_height(level) - 1);
+
+	const int tile_x = cx / TILE_SIZE;
+	const int tile_y = cy / TILE_SIZE;
+	const uint64_t key = tc_key_(file.id, level, tile_x, tile_y);
+
+	if (last_tile == nullptr || key != last_key)
+	{
+		last_tile = this->tc_tile_(file, level, tile_x, tile_y);
+		last_key = key;
+	}
+
+	return last_tile->texel(cx - (tile_x * TILE_SIZE), cy - (tile_y * TILE_SIZE));
+}
+
+TextureCache::TilePtr TextureCache::tc_build_tile_(const TextureFile & file, const int level, const int tile_x, const int tile_y)
+{
+	const int level_w = file.level_width(level);
+	const int level_h = file.level_height(level);
+
+	const int x = tile_x * TILE_SIZE;
+	const int y = tile_y * TILE_SIZE;
+	const int tile_w = std::min(TILE_SIZE, level_w - x);
+	const int tile_h = std::min(TILE_SIZE, level_h - y);
+
+	std::shared_ptr<TextureTile> tile = std::make_shared<TextureTile>(tile_w, tile_h);
+
+	if (level == 0)
+	{
+		file.read_block(x, y, tile_w, tile_h, tile->texels);
+		return tile;
+	}
+
+	// Box filters the 2x2 texels of the level above, which is pulled through the cache as well
+	TilePtr last_tile = nullptr;
+	uint64_t last_key = 0;
+
+	for (int row = 0; row < tile_h; row++)
+	{
+		for (int col = 0; col < tile_w; col++)
+		{
+			const int src_x = (x + col) * 2;
+			const int src_y = (y + row) * 2;
+
+			const Color sum =
+				this->tc_texel_(file, level - 1, src_x, src_y, last_tile, last_key) +
+				this->tc_texel_(file, level - 1, src_x + 1, src_y, last_tile, last_key) +
+				this->tc_texel_(file, level - 1, src_x, src_y + 1, last_tile, last_key) +
+				this->tc_texel_(file, level - 1, src_x + 1, src_y + 1, last_tile, last_key);
+
+			tile->set_texel(col, row, sum * 0.25);
+		}
+	}
+
+	return tile;
+}
+
+void TextureCache::tc_evict_()
+{
+	// The newest tile always stays, even when it alone is over the limit
+	while (this->tc_resident_bytes_ > this->tc_memory_limit_ && this->tc_lru_.size() > 1)
+	{
+		const uint64_t key = this->tc_lru_.back();
+		this->tc_lru_.pop_back();
+
+		const auto found = this->tc_tiles_.find(key);
+		this->tc_resident_bytes_ -= found->second.tile->bytes();
+		this->tc_tiles_.erase(found);
+	}
+}
@@ -0,0 +1,141 @@
+#ifndef H_RAYMOND_TEXTURECACHE
+#define H_RAYMOND_TEXTURECACHE
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "Color.h"
+
+enum TextureFileFormat { PPMAsciiFormat, PPMBinaryFormat, PFMFormat };
+
+// An image on disk.  Only the header is read when the file is opened,
+// pixel data is read a tile at a time as the cache asks for it.
+// ASCII files cannot be seeked into, so their pixels are converted once to binary samples in
+// a temporary file, which is read like any other and removed with the TextureFile.
+class TextureFile
+{
+public:
+	explicit TextureFile(const std::string & file_path);
+	~TextureFile();
+
+	TextureFile(const TextureFile &) = delete;
+	TextureFile & operator=(const TextureFile &) = delete;
+
+	// Methods
+	int level_width(int level) const;
+	int level_height(int level) const;
+
+	// Reads a block of level 0 as linear RGB floats
+	void read_block(int x, int y, int block_width, int block_height, std::vector<float> & texels) const;
+
+	// Properties
+	std::string path;
+	TextureFileFormat format;
+	int width, height;
+	int num_levels;
+	int id;
+
+private:
+	Color tf_decode_(const unsigned char * data) const;
+	// Writes the samples after the header to a temporary file, in the binary PPM layout
+	void tf_convert_ascii_(std::istream & stream);
+
+	std::streamoff tf_data_offset_;
+	int tf_channels_;
+	int tf_bytes_per_sample_;
+	double tf_max_value_;
+	bool tf_little_endian_;
+	std::vector<int> tf_level_widths_, tf_level_heights_;
+
+	// Where the pixel data is read from, the converted samples for ASCII files
+	std::string tf_data_path_;
+};
+
+// A square block of one mip level, stored as linear RGB floats
+class TextureTile
+{
+public:
+	TextureTile(int width, int height);
+	~TextureTile();
+
+	// Methods
+	Color texel(int x, int y) const;
+	void set_texel(int x, int y, const Color & col);
+	size_t bytes() const;
+
+	// Properties
+	int width, height;
+	std::vector<float> texels;
+};
+
+// Tiled, mip-mapped texture cache shared by every ImageMap.
+// Tiles are loaded or downsampled on demand and evicted least recently used first
+// once the resident size exceeds the memory limit.  Safe to use from the render threads.
+class TextureCache
+{
+public:
+	TextureCache();
+	explicit TextureCache(size_t memory_limit);
+	~TextureCache();
+
+	static std::shared_ptr<TextureCache> global();
+
+	// Methods
+	// Returns the already opened file when the path has been seen before
+	std::shared_ptr<TextureFile> open(const std::string & file_path);
+
+	Color texel(const TextureFile & file, int level, int x, int y);
+	Color bilinear(const TextureFile & file, int level, double u, double v);
+	// Blends the two mip levels around a filter footprint, measured in level 0 texels
+	Color trilinear(const TextureFile & file, double u, double v, double footprint);
+
+	void set_memory_limit(size_t bytes);
+	size_t memory_limit() const;
+	size_t resident_bytes() const;
+	size_t resident_tiles() const;
+
+	size_t hits() const;
+	size_t misses() const;
+	double hit_rate() const;
+	void reset_stats();
+
+	// Drops every tile, open files stay open
+	void clear();
+
+	static const int TILE_SIZE = 64;
+
+private:
+	typedef std::shared_ptr<const TextureTile> TilePtr;
+
+	struct TCEntry
+	{
+		TilePtr tile;
+		std::list<uint64_t>::iterator lru_position;
+	};
+
+	static uint64_t tc_key_(int file_id, int level, int tile_x, int tile_y);
+
+	TilePtr tc_tile_(const TextureFile & file, int level, int tile_x, int tile_y);
+	// Reuses the last tile when consecutive lookups land in it
+	Color tc_texel_(const TextureFile & file, int level, int x, int y, TilePtr & last_tile, uint64_t & last_key);
+	TilePtr tc_build_tile_(const TextureFile & file, int level, int tile_x, int tile_y);
+	void tc_evict_();
+
+	mutable std::mutex tc_mutex_;
+	std::unordered_map<uint64_t, TCEntry> tc_tiles_;
+	std::list<uint64_t> tc_lru_;
+	std::unordered_map<std::string, std::shared_ptr<TextureFile>> tc_files_;
+
+	size_t tc_memory_limit_;
+	size_t tc_resident_bytes_;
+
+	std::atomic<size_t> tc_hits_, tc_misses_;
+};
+
+#endif
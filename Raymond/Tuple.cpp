@@ -65,6 +65,33 @@ Tuple Tuple::RandomInUnitSphere()
 	}
 }
 
+// Malley's method, uniform points on the disk projected up onto the hemisphere.
+Tuple Tuple::CosineHemisphere(const Tuple & normal, double u1, double u2)
+{
+	double r = sqrt(u1);
+	double phi = 2.0 * M_PI * u2;
+	double local_x = r * cos(phi);
+	double local_y = r * sin(phi);
+	double local_z = sqrt(std::max(0.0, 1.0 - u1));
+
+	Tuple tangent, bitangent;
+	Tuple::OrthonormalBasis(normal, tangent, bitangent);
+
+	return (tangent * local_x) + (bitangent * local_y) + (normal * local_z);
+}
+
+// Duff et al., Building an Orthonormal Basis, Revisited
+// https://jcgt.org/published/0006/01/01/
+void Tuple::OrthonormalBasis(const Tuple & normal, Tuple & tangent, Tuple & bitangent)
+{
+	double sign = copysign(1.0, normal.z);
+	double a = -1.0 / (sign + normal.z);
+	double b = normal.x * normal.y * a;
+
+	tangent = Tuple::Vector(1.0 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+	bitangent = Tuple::Vector(b, sign + normal.y * normal.y * a, -normal.y);
+}
+
 // Destructor
 
 Tuple::~Tuple()
@@ -22,6 +22,11 @@ public:
 	static Tuple Vector(double x_axis, double y_axis, double z_axis);
 	static Tuple RandomVector(double min, double max);
 	static Tuple RandomInUnitSphere();
+	// Direction in the hemisphere around normal, distributed by the cosine to the normal.
+	// u1 and u2 are in [0,1), passing stratified values spreads the directions out.
+	static Tuple CosineHemisphere(const Tuple & normal, double u1, double u2);
+	// Two unit vectors perpendicular to normal and to each other
+	static void OrthonormalBasis(const Tuple & normal, Tuple & tangent, Tuple & bitangent);
 
 	// Destructor
 	~Tuple();
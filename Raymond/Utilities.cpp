@@ -1,5 +1,14 @@
 #include "Utilities.h"
 
+#include <atomic>
+#include <cstring>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 double deg_to_rad(double degrees)
 {
 	return (degrees * M_PI) / 180.0;
@@ -22,12 +31,41 @@ double random_double(double min, double max)
 	return min + (max - min)*random_double();
 }
 
+double radical_inverse(int base, uint64_t index)
+{
+	const double inverse_base = 1.0 / double(base);
+	double digit_scale = inverse_base;
+	double result = 0.0;
+
+	while (index > 0)
+	{
+		result += double(index % uint64_t(base)) * digit_scale;
+		index /= uint64_t(base);
+		digit_scale *= inverse_base;
+	}
+
+	return result;
+}
+
 std::string pad_num(int num, int pad)
 {
 	std::string ts = std::to_string(num);
 	return std::string(pad - ts.length(), '0') + ts;
 }
 
+std::string temp_file_path(const std::string& path)
+{
+	static std::atomic<uint64_t> counter{ 0 };
+
+#ifdef _WIN32
+	const long long pid = _getpid();
+#else
+	const long long pid = getpid();
+#endif
+
+	return path + ".tmp" + std::to_string(pid) + "-" + std::to_string(counter++);
+}
+
 std::string generate_name(const std::string& name, const std::string& folder, int version, const std::string& suffix, std::chrono::duration<double, std::nano> dur)
 {
 	time_t rawtime = time(0);
@@ -107,6 +145,103 @@ bool flt_cmp(const double & left_double, const double & right_double)
 	return fabs(left_double - right_double) < EPSILON;
 }
 
+uint16_t float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+	// Infinity and NaN keep their class
+	if (magnitude >= 0x7F800000)
+		return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x0200 : 0x0000);
+
+	// Anything from 65520 up rounds to infinity
+	if (magnitude >= 0x477FF000)
+		return sign | 0x7C00;
+
+	// Below 2^-14 the result is subnormal
+	if (magnitude < 0x38800000)
+	{
+		// Below half the smallest subnormal rounds to zero
+		if (magnitude < 0x33000000)
+			return sign;
+
+		const uint32_t mantissa = (magnitude & 0x007FFFFF) | 0x00800000;
+		const int shift = 126 - static_cast<int>(magnitude >> 23);
+
+		uint32_t half = mantissa >> shift;
+		const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+		const uint32_t halfway = 1u << (shift - 1);
+
+		// Round to nearest, ties to even
+		if (remainder > halfway || (remainder == halfway && (half & 1u)))
+			half++;
+
+		return sign | static_cast<uint16_t>(half);
+	}
+
+	// Rebias the exponent from 127 to 15 and drop 13 bits of mantissa
+	uint32_t half = (magnitude - 0x38000000) >> 13;
+	const uint32_t remainder = magnitude & 0x1FFF;
+
+	// A carry out of the mantissa correctly bumps the exponent
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1u)))
+		half++;
+
+	return sign | static_cast<uint16_t>(half);
+}
+
+float half_to_float(uint16_t value)
+{
+	const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	const uint32_t exponent = (value >> 10) & 0x1F;
+	const uint32_t mantissa = value & 0x03FF;
+
+	uint32_t bits;
+
+	if (exponent == 0)
+	{
+		// Zero and subnormals
+		float subnormal = std::ldexp(static_cast<float>(mantissa), -24);
+		return sign ? -subnormal : subnormal;
+	}
+	else if (exponent == 0x1F)
+	{
+		// Infinity and NaN
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+uint64_t hash_bytes(uint64_t hash, const void * data, size_t size)
+{
+	const auto * bytes = static_cast<const unsigned char *>(data);
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+uint64_t hash_string(uint64_t hash, const std::string & str)
+{
+	// The length keeps neighbouring strings from running together
+	hash = hash_value(hash, str.size());
+	return hash_bytes(hash, str.data(), str.size());
+}
+
 double SincFunction(double x)
 {
     // Absolute value
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <iomanip>
 #include <cmath>
+#include <cstdint>
 
 #include "Constants.h"
 
@@ -22,12 +23,21 @@ double random_double();
 
 double random_double(double min, double max);
 
+// The index-th value of the Halton sequence in base, the digits of index mirrored about the
+// point.  Consecutive indices fill [0,1) evenly, and sequences in different prime bases can be
+// used together as the dimensions of one stratified sample.
+double radical_inverse(int base, uint64_t index);
+
 // Files
 
 std::string pad_num(int num, int pad);
 
 std::string generate_name(const std::string& name, const std::string& folder, int version, const std::string& suffix, std::chrono::duration<double, std::nano> dur);
 
+// A name next to path for writing a file before renaming it into place.  The process id and a
+// per-process counter keep concurrent writers, in this process or another, off each other's files.
+std::string temp_file_path(const std::string& path);
+
 // Display
 
 std::ostream& clock_display(std::ostream& os, std::chrono::duration<double, std::nano> dur);
@@ -36,8 +46,31 @@ std::ostream& clock_display(std::ostream& os, std::chrono::duration<double, std:
 
 bool flt_cmp(const double & left_double, const double & right_double);
 
+// Half Floats
+// IEEE 754 binary16, rounds to the nearest representable value
+
+uint16_t float_to_half(float value);
+
+float half_to_float(uint16_t value);
+
+// Hashing
+// 64 bit FNV-1a, stable between runs so hashes can name files on disk
+
+const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+uint64_t hash_bytes(uint64_t hash, const void * data, size_t size);
+
+uint64_t hash_string(uint64_t hash, const std::string & str);
+
 // Templates
 
+template<typename T>
+inline uint64_t hash_value(uint64_t hash, const T & value)
+{
+	return hash_bytes(hash, &value, sizeof(T));
+}
+
+
 template<typename T>
 inline T clip(const T & n, const T & lower, const T & upper)
 {
@@ -1,4 +1,7 @@
 #include "World.h"
+#include "RenderStats.h"
+
+#include <unordered_set>
 
 // ------------------------------------------------------------------------
 //
@@ -20,9 +23,15 @@ World::World()
     this->shadow_subdivs = 4;
     this->reflection_subdivs = 1;
     this->refraction_subdivs = 1;
-    this->gi_subdivs = 1;
+    this->gi_subdivs = 0;
     this->sample_size = 1.5;
     this->noise_threshold = 0.01;
+    this->max_ray_depth = RAY_DEPTH_LIMIT;
+
+    this->irradiance_cache = std::make_shared<IrradianceCache>();
+    this->light_samples = 0;
+    this->environment_samples = 0;
+    this->w_light_tree_ = std::make_shared<LightTreeSlot>();
 }
 
 World::~World()
@@ -93,83 +102,84 @@ Intersections World::intersect_world(const Ray & r) const
 
 Sample World::shade(IxComps & comps) const
 {
-    // TODO: convert this function to return a sample
-    // TODO: Break up lighting into Diffuse, Specular, and Lighting
-    // TODO: Determine Depth, Position, Normal, and Alpha
-    Sample sample = Sample();
-    sample.Position = Color(comps.point);
-    sample.Normal = Color(comps.normal_v);
-    sample.Depth = comps.ray_depth;
+    Sample sample = this->w_shade_surface_(comps);
+    this->w_add_global_illumination_(comps, sample);
 
-    sample.Diffuse = Color(1.0);
-    sample.Alpha = 1.0;
-    Color smp_lighting = Color(0.0);
+    Ray next;
+    Color weight;
+    bool reflected;
 
-	auto obj_prim = std::static_pointer_cast<PrimitiveBase>(comps.object);
+    // Only the chosen branch is traced, so the cost of a sample grows linearly with depth
+    if (this->w_continue_path_(comps, sample, next, weight, reflected))
+    {
+        Color traced = this->color_at(next) * weight;
 
-	for (std::shared_ptr<Light> lgt : this->w_lights_) // NOLINT(performance-for-range-copy)
-	{
-        // Each Sample can have multiple shadow subdivs
-        Color shadow_average = Color(0.0);
-        for (int i = 0; i < this->shadow_subdivs; ++i)
+        if (reflected)
         {
-            shadow_average = shadow_average + this->shadowed(lgt, comps.over_point, comps.ray_depth);
+            sample.Reflection = traced;
         }
-		comps.shadow_multiplier = (shadow_average / double(this->shadow_subdivs));
+        else
+        {
+            sample.Refraction = traced;
+        }
+    }
 
-		if (lgt->falloff)
-		{
-			// Calculate quadratic intensity using formula I = 1/d^2
-			double distance = Tuple::distance(lgt->position(), comps.point);
-			double quad_multiplier = 1.0 / (distance * distance);
-			double intensity = lgt->color.magnitude() * quad_multiplier * lgt->multiplier;
-			
-			// If value is less than cutoff value, do not calculate sample
-			if (intensity > lgt->cutoff)
-			{
-                smp_lighting = smp_lighting + (obj_prim->material->lighting(lgt, comps) * intensity);
-			}
-		}
-		else
-		{
-            smp_lighting = smp_lighting + obj_prim->material->lighting(lgt, comps);
-		}
-	}
+	return sample;
+}
 
-    sample.Lighting = smp_lighting;
+Color World::color_at(const Ray & ray) const
+{
+    Color radiance = Color(0.0);
+    Color throughput = Color(1.0);
+    Ray current = Ray(ray);
 
-	// Reflection
-	Color refl = (obj_prim->material->reflect(*this, comps));
+    while (true)
+    {
+        Intersections xs = this->intersect_world(current);
 
-	// Refraction
-	Color rafr =  (obj_prim->material->refract(*this, comps));
+        if (xs.empty())
+        {
+            IxComps comps = IxComps::Background(current);
+            Sample sample = this->background->sample_at(comps);
 
-	// Use Schlick approximation Effect
-	if (obj_prim->material->use_schlick)
-	{
-		double reflectance = schlick(comps);
+            radiance = radiance + (throughput * sample.get_calculated_rgb());
+            break;
+        }
 
-        sample.ReflectionFilter = reflectance;
-        sample.RefractionFilter = 1.0 - reflectance;
-	}
-	else
-	{
-        sample.ReflectionFilter = 1.0;
-        sample.RefractionFilter = 1.0;
-	}
+        IxComps comps = IxComps(xs.hit(), current, xs);
+        Sample sample = this->w_shade_surface_(comps);
+        this->w_add_global_illumination_(comps, sample);
 
-    sample.Reflection = refl;
-    sample.Refraction = rafr;
+        radiance = radiance + (throughput * sample.get_calculated_rgb());
 
-	return sample;
-}
+        Ray next;
+        Color weight;
+        bool reflected;
 
-Color World::color_at(const Ray & ray) const
-{
-    Sample sample = this->sample_at(ray);
-    sample.calculate_sample();
+        if (!this->w_continue_path_(comps, sample, next, weight, reflected))
+        {
+            break;
+        }
+
+        throughput = throughput * weight * (reflected ? sample.ReflectionFilter : sample.RefractionFilter);
+
+        // Russian roulette, dim paths are ended early and the survivors are brightened to compensate
+        if (next.depth >= RUSSIAN_ROULETTE_DEPTH)
+        {
+            double survival = clip(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.05, 1.0);
+
+            if (random_double() >= survival)
+            {
+                break;
+            }
+
+            throughput = throughput / survival;
+        }
+
+        current = next;
+    }
 
-	return sample.get_calculated_rgb();
+	return radiance;
 }
 
 Sample World::sample_at(const Ray &ray) const
@@ -190,13 +200,14 @@ Sample World::sample_at(const Ray &ray) const
     }
 }
 
-bool World::is_shadowed(const std::shared_ptr<Light>& light, const Tuple & point) const
+bool World::is_shadowed(const std::shared_ptr<Light>& light, const Tuple & point, const double time) const
 {
 	Tuple v = light->position() - point;
 	double distance = v.magnitude();
 	Tuple direction = v.normalize();
 
-	Ray r = Ray(point, direction);
+	Ray r = Ray(point, direction, 0, time);
+	thread_counters().shadow_rays++;
 	Intersections ix = this->intersect_world(r);
 
 	Intersection h = ix.hit();
@@ -204,16 +215,22 @@ bool World::is_shadowed(const std::shared_ptr<Light>& light, const Tuple & point
 	return (h.is_valid() && h.t_value < distance);
 }
 
-Color World::shadowed(const std::shared_ptr<Light>& light, const Tuple & point, const int depth) const
+Color World::shadowed(const std::shared_ptr<Light>& light, const Tuple & point, const int depth, const double time) const
+{
+	return this->shadowed_to(light, point, light->area_position(), depth, time);
+}
+
+Color World::shadowed_to(const std::shared_ptr<Light>& light, const Tuple & point, const Tuple & target, const int depth, const double time) const
 {
     // Get vector between sample point and light
-	Tuple v = light->area_position() - point;
+	Tuple v = target - point;
     // Calculate distance and direction
 	double distance = v.magnitude();
 	Tuple direction = v.normalize();
 
     // Cast a ray between the point and the light
-	Ray r = Ray(point, direction, depth);
+	Ray r = Ray(point, direction, depth, time);
+	thread_counters().shadow_rays++;
 	Intersections ix = this->intersect_world(r);
 
 	Intersection h = ix.hit();
@@ -229,6 +246,465 @@ Color World::shadowed(const std::shared_ptr<Light>& light, const Tuple & point,
 	return {1.0};
 }
 
+// ------------------------------------------------------------------------
+// Private Methods
+// ------------------------------------------------------------------------
+
+Sample World::w_shade_surface_(IxComps & comps) const
+{
+    // TODO: Break up lighting into Diffuse, Specular, and Lighting
+    // TODO: Determine Depth, Position, Normal, and Alpha
+    thread_counters().shading_calls++;
+
+    Sample sample = Sample();
+    sample.Position = Color(comps.point);
+    sample.Normal = Color(comps.normal_v);
+    sample.Depth = comps.ray_depth;
+
+    sample.Diffuse = Color(1.0);
+    sample.Alpha = 1.0;
+    Color smp_lighting = Color(0.0);
+
+	auto obj_prim = std::static_pointer_cast<PrimitiveBase>(comps.object);
+
+	const BaseMaterial & material = *obj_prim->material;
+
+	// The tree holds no more lights than the world, so small scenes never build it
+	std::shared_ptr<const LightTree> light_tree;
+
+	if (this->light_samples > 0 && this->w_lights_.size() > size_t(this->light_samples))
+	{
+		light_tree = this->w_get_light_tree_();
+	}
+
+	if (light_tree != nullptr && light_tree->size() > size_t(this->light_samples))
+	{
+		// Lights the tree does not hold are always evaluated
+		for (const std::shared_ptr<Light> & lgt : this->w_lights_)
+		{
+			if (!LightTree::accepts(*lgt))
+			{
+				smp_lighting = smp_lighting + this->w_light_contribution_(lgt, comps, material);
+			}
+		}
+
+		// Stratified picks, each weighted by how likely it was
+		for (int i = 0; i < this->light_samples; i++)
+		{
+			std::shared_ptr<Light> lgt;
+			double pdf;
+
+			if (light_tree->sample(comps.point, (i + random_double()) / this->light_samples, lgt, pdf))
+			{
+				smp_lighting = smp_lighting + (this->w_light_contribution_(lgt, comps, material) / (pdf * this->light_samples));
+			}
+		}
+	}
+	else
+	{
+		for (const std::shared_ptr<Light> & lgt : this->w_lights_)
+		{
+			smp_lighting = smp_lighting + this->w_light_contribution_(lgt, comps, material);
+		}
+	}
+
+	if (this->w_lights_background_())
+	{
+		smp_lighting = smp_lighting + this->w_background_contribution_(comps, material);
+	}
+
+    sample.Lighting = smp_lighting;
+
+	// Use Schlick approximation Effect
+	if (obj_prim->material->use_schlick)
+	{
+		double reflectance = schlick(comps);
+
+        sample.ReflectionFilter = reflectance;
+        sample.RefractionFilter = 1.0 - reflectance;
+	}
+	else
+	{
+        sample.ReflectionFilter = 1.0;
+        sample.RefractionFilter = 1.0;
+	}
+
+	return sample;
+}
+
+Color World::w_light_contribution_(const std::shared_ptr<Light> & lgt, IxComps & comps, const BaseMaterial & material) const
+{
+	double intensity = 1.0;
+
+	if (lgt->falloff)
+	{
+		// Calculate quadratic intensity using formula I = 1/d^2
+		double distance = Tuple::distance(lgt->position(), comps.point);
+		double quad_multiplier = 1.0 / (distance * distance);
+		intensity = lgt->color.magnitude() * quad_multiplier * lgt->multiplier;
+
+		// If value is less than cutoff value, do not calculate sample
+		// Checked before any shadow rays are cast
+		if (intensity <= lgt->cutoff)
+		{
+			return Color(0.0);
+		}
+	}
+
+	// A light entirely behind the surface only adds its ambient term, no shadow rays are needed
+	if (Tuple::dot(lgt->position() - comps.point, comps.normal_v) < -lgt->bounding_radius())
+	{
+		comps.shadow_multiplier = Color(0.0);
+		return material.lighting(lgt, comps) * intensity;
+	}
+
+	if (lgt->has_area())
+	{
+		// The ambient term, as lighting() gives it in full shadow
+		comps.shadow_multiplier = Color(0.0);
+		Color ambient = material.lighting(lgt, comps) * intensity;
+
+		return ambient + this->w_area_light_contribution_(lgt, comps, material);
+	}
+
+	if (!lgt->casts_shadows)
+	{
+		comps.shadow_multiplier = Color(1.0);
+	}
+	else
+	{
+		// Each Sample can have multiple shadow subdivs
+		Color shadow_average = Color(0.0);
+		for (int i = 0; i < this->shadow_subdivs; ++i)
+		{
+			shadow_average = shadow_average + this->shadowed(lgt, comps.over_point, comps.ray_depth, comps.time);
+		}
+		comps.shadow_multiplier = (shadow_average / double(this->shadow_subdivs));
+	}
+
+	if (lgt->falloff)
+	{
+		return material.lighting(lgt, comps) * intensity;
+	}
+
+	return material.lighting(lgt, comps);
+}
+
+Color World::w_area_light_contribution_(const std::shared_ptr<Light> & lgt, const IxComps & comps, const BaseMaterial & material) const
+{
+	// The shadow rays are split between the strategies by how glossy the response is, so a
+	// diffuse surface spends all of them on the light and an area light costs no more than
+	// a jittered point light
+	const int subdivs = std::max(this->shadow_subdivs, 1);
+	const int response_samples = std::min(int(std::lround(subdivs * material.glossy_fraction(comps))), subdivs - 1);
+	const int light_samples = subdivs - response_samples;
+
+	// Both strategies take their points from one Halton sequence, the light the first ones and
+	// the material the rest, so every run of points is spread over the whole square.  The
+	// sequence is shifted at random for every shading point.
+	const double shift_u = random_double();
+	const double shift_v = random_double();
+	auto point = [shift_u, shift_v](int index, double & u, double & v)
+	{
+		u = radical_inverse(2, uint64_t(index));
+		v = radical_inverse(3, uint64_t(index));
+		u = (u + shift_u >= 1.0) ? u + shift_u - 1.0 : u + shift_u;
+		v = (v + shift_v >= 1.0) ? v + shift_v - 1.0 : v + shift_v;
+	};
+
+	Color result = Color(0.0);
+
+	for (int i = 0; i < light_samples; i++)
+	{
+		LightSample lgt_sample;
+		double u, v;
+		point(i, u, v);
+
+		if (lgt->sample_light(comps.point, u, v, lgt_sample))
+		{
+			Color response = material.light_response(comps, lgt_sample.direction);
+
+			if (response != Color(0.0))
+			{
+				// Densities are scaled by the samples each strategy takes
+				double weight = (response_samples == 0) ? 1.0 :
+					power_heuristic(light_samples * lgt_sample.pdf, response_samples * material.light_response_pdf(comps, lgt_sample.direction));
+				Color visibility = lgt->casts_shadows ?
+					this->shadowed_to(lgt, comps.over_point, lgt_sample.point, comps.ray_depth, comps.time) :
+					Color(1.0);
+
+				result = result + (response * lgt_sample.radiance * visibility * (weight / (light_samples * lgt_sample.pdf)));
+			}
+		}
+	}
+
+	for (int i = 0; i < response_samples; i++)
+	{
+		// A direction from the material, which only counts if it reaches the light
+		LightSample lgt_sample;
+		Tuple light_v;
+		double pdf;
+		double u, v;
+		point(light_samples + i, u, v);
+
+		if (material.sample_light_response(comps, u, v, light_v, pdf) && lgt->intersect_light(comps.point, light_v, lgt_sample))
+		{
+			Color response = material.light_response(comps, light_v);
+
+			if (response != Color(0.0))
+			{
+				double weight = power_heuristic(response_samples * pdf, light_samples * lgt_sample.pdf);
+				Color visibility = lgt->casts_shadows ?
+					this->shadowed_to(lgt, comps.over_point, lgt_sample.point, comps.ray_depth, comps.time) :
+					Color(1.0);
+
+				result = result + (response * lgt_sample.radiance * visibility * (weight / (response_samples * pdf)));
+			}
+		}
+	}
+
+	return result;
+}
+
+Color World::w_background_contribution_(const IxComps & comps, const BaseMaterial & material) const
+{
+	const int samples = this->environment_samples;
+	Color result = Color(0.0);
+
+	for (int i = 0; i < samples; i++)
+	{
+		Tuple direction;
+		double pdf;
+
+		// A direction from the background
+		if (this->background->sample_direction((i + random_double()) / samples, random_double(), direction, pdf))
+		{
+			Color response = material.light_response(comps, direction);
+
+			if (response != Color(0.0))
+			{
+				Ray background_ray = Ray(comps.over_point, direction, comps.ray_depth + 1, comps.time);
+				thread_counters().indirect_rays++;
+
+				if (!this->intersect_world(background_ray).hit().is_valid())
+				{
+					double weight = power_heuristic(pdf, material.light_response_pdf(comps, direction));
+					result = result + (response * this->background->radiance(direction) * (weight / pdf));
+				}
+			}
+		}
+
+		// A direction from the material, which only counts if it escapes
+		if (material.sample_light_response(comps, (i + random_double()) / samples, random_double(), direction, pdf))
+		{
+			Color response = material.light_response(comps, direction);
+
+			if (response != Color(0.0))
+			{
+				Ray background_ray = Ray(comps.over_point, direction, comps.ray_depth + 1, comps.time);
+				thread_counters().indirect_rays++;
+
+				if (!this->intersect_world(background_ray).hit().is_valid())
+				{
+					double weight = power_heuristic(pdf, this->background->direction_pdf(direction));
+					result = result + (response * this->background->radiance(direction) * (weight / pdf));
+				}
+			}
+		}
+	}
+
+	// light_response leaves out the 1 / pi of a diffuse surface, global illumination does not
+	return result / (M_PI * samples);
+}
+
+bool World::w_continue_path_(const IxComps & comps, const Sample & sample, Ray & next, Color & weight, bool & reflected) const
+{
+	if (comps.ray_depth >= this->max_ray_depth)
+	{
+		return false;
+	}
+
+	auto obj_prim = std::static_pointer_cast<PrimitiveBase>(comps.object);
+
+	Ray reflect_ray, refract_ray;
+	Color reflect_weight, refract_weight;
+
+	bool can_reflect = obj_prim->material->reflected_ray(comps, reflect_ray, reflect_weight);
+	bool can_refract = obj_prim->material->refracted_ray(comps, refract_ray, refract_weight);
+
+	if (can_reflect && can_refract)
+	{
+		// Russian roulette on the split
+		double reflect_importance = std::max(0.0, (reflect_weight * sample.ReflectionFilter).luminosity());
+		double refract_importance = std::max(0.0, (refract_weight * sample.RefractionFilter).luminosity());
+		double total = reflect_importance + refract_importance;
+		double reflect_probability = total > 0.0 ? reflect_importance / total : 0.5;
+
+		if (random_double() < reflect_probability)
+		{
+			can_refract = false;
+			reflect_weight = reflect_weight / reflect_probability;
+		}
+		else
+		{
+			can_reflect = false;
+			refract_weight = refract_weight / (1.0 - reflect_probability);
+		}
+	}
+
+	if (can_reflect)
+	{
+		thread_counters().reflection_rays++;
+		next = reflect_ray;
+		weight = reflect_weight;
+		reflected = true;
+		return true;
+	}
+
+	if (can_refract)
+	{
+		thread_counters().refraction_rays++;
+		next = refract_ray;
+		weight = refract_weight;
+		reflected = false;
+		return true;
+	}
+
+	return false;
+}
+
+std::shared_ptr<const LightTree> World::w_get_light_tree_() const
+{
+	LightTreeSlot & slot = *this->w_light_tree_;
+	std::shared_ptr<const LightTree> tree = std::atomic_load(&slot.tree);
+
+	if (tree == nullptr)
+	{
+		// Threads that get here together each build one, and all but the first throw theirs
+		// away.  It only happens on the first sample, so it is not worth a lock.
+		std::shared_ptr<const LightTree> expected;
+		tree = std::make_shared<const LightTree>(this->w_lights_);
+
+		if (!std::atomic_compare_exchange_strong(&slot.tree, &expected, tree))
+		{
+			tree = expected;
+		}
+	}
+
+	return tree;
+}
+
+bool World::w_lights_background_() const
+{
+	return this->environment_samples > 0 && this->background->is_importance_sampled();
+}
+
+void World::w_add_global_illumination_(const IxComps & comps, Sample & sample) const
+{
+	if (this->gi_subdivs <= 0)
+	{
+		return;
+	}
+
+	auto obj_prim = std::static_pointer_cast<PrimitiveBase>(comps.object);
+	Color albedo = obj_prim->material->diffuse_albedo(comps);
+
+	if (albedo == Color(0.0))
+	{
+		return;
+	}
+
+	Color irradiance;
+
+	if (this->irradiance_cache == nullptr)
+	{
+		double mean_distance;
+		irradiance = this->w_gather_irradiance_(comps, mean_distance);
+	}
+	else if (!this->irradiance_cache->lookup(comps.point, comps.normal_v, irradiance))
+	{
+		double mean_distance;
+		irradiance = this->w_gather_irradiance_(comps, mean_distance);
+		this->irradiance_cache->insert(comps.point, comps.normal_v, irradiance, mean_distance);
+	}
+
+	sample.GlobalIllumination = irradiance * albedo;
+}
+
+Color World::w_gather_irradiance_(const IxComps & comps, double & mean_distance) const
+{
+	Color total = Color(0.0);
+	double inverse_distance_total = 0.0;
+
+	// Backgrounds that can be importance sampled get rays of their own, and the light
+	// they bring is shared between the two kinds of ray with multiple importance sampling.
+	// When the background lights surfaces directly the gather only collects bounced light.
+	const bool direct_background = this->w_lights_background_();
+	const bool sample_background = !direct_background && this->background->is_importance_sampled();
+
+	for (int i = 0; i < this->gi_subdivs; i++)
+	{
+		// Stratified on the distance from the normal
+		double u1 = (i + random_double()) / this->gi_subdivs;
+		Ray gather_ray = Ray(comps.over_point, Tuple::CosineHemisphere(comps.normal_v, u1, random_double()), comps.ray_depth + 1, comps.time);
+		thread_counters().indirect_rays++;
+
+		Intersections xs = this->intersect_world(gather_ray);
+		Intersection hit = xs.hit();
+
+		if (!hit.is_valid())
+		{
+			if (direct_background)
+			{
+				continue;
+			}
+
+			IxComps bg_comps = IxComps::Background(gather_ray);
+			Color background = this->background->sample_at(bg_comps).get_calculated_rgb();
+
+			if (sample_background)
+			{
+				double cosine_pdf = Tuple::dot(gather_ray.direction, comps.normal_v) / M_PI;
+				background = background * power_heuristic(cosine_pdf, this->background->direction_pdf(gather_ray.direction));
+			}
+
+			total = total + background;
+		}
+		else
+		{
+			// One bounce, the hit is lit without global illumination of its own
+			IxComps hit_comps = IxComps(hit, gather_ray, xs);
+			total = total + this->w_shade_surface_(hit_comps).get_calculated_rgb();
+			inverse_distance_total += 1.0 / std::max(hit_comps.t_value, EPSILON);
+		}
+
+		Tuple direction;
+		double pdf;
+
+		if (sample_background && this->background->sample_direction((i + random_double()) / this->gi_subdivs, random_double(), direction, pdf))
+		{
+			double cosine = Tuple::dot(direction, comps.normal_v);
+			Ray background_ray = Ray(comps.over_point, direction, comps.ray_depth + 1, comps.time);
+			thread_counters().indirect_rays++;
+
+			if (cosine > 0.0 && !this->intersect_world(background_ray).hit().is_valid())
+			{
+				IxComps bg_comps = IxComps::Background(background_ray);
+				Color background = this->background->sample_at(bg_comps).get_calculated_rgb();
+				double cosine_pdf = cosine / M_PI;
+
+				total = total + (background * (cosine_pdf * power_heuristic(pdf, cosine_pdf) / pdf));
+			}
+		}
+	}
+
+	// Rays that escape count as infinitely far away
+	mean_distance = inverse_distance_total > 0.0 ? this->gi_subdivs / inverse_distance_total : std::numeric_limits<double>::infinity();
+
+	// The cosine weighting cancels the cosine in the irradiance integral
+	return total / double(this->gi_subdivs);
+}
+
 // ------------------------------------------------------------------------
 // Accessors
 // ------------------------------------------------------------------------
@@ -251,6 +727,7 @@ void World::remove_primitive(int index)
 void World::remove_light(int index)
 {
 	this->w_lights_.erase(this->w_lights_.begin() + index);
+	this->rebuild_light_tree();
 }
 
 void World::add_object(const std::shared_ptr<PrimitiveBase>& obj)
@@ -261,5 +738,41 @@ void World::add_object(const std::shared_ptr<PrimitiveBase>& obj)
 void World::add_object(const std::shared_ptr<Light>& obj)
 {
 	this->w_lights_.push_back(obj);
+	this->rebuild_light_tree();
+}
+
+void World::rebuild_light_tree()
+{
+	// Copies made before the change keep the slot for their own lights
+	this->w_light_tree_ = std::make_shared<LightTreeSlot>();
+}
+
+void World::begin_frame() const
+{
+	if (this->irradiance_cache != nullptr)
+	{
+		this->irradiance_cache->clear();
+	}
+
+	// Materials shared by many primitives are compiled once
+	std::unordered_set<const BaseMaterial *> compiled;
+	std::vector<std::shared_ptr<ObjectBase>> pending = std::vector<std::shared_ptr<ObjectBase>>(this->w_primitives_.begin(), this->w_primitives_.end());
+
+	while (!pending.empty())
+	{
+		std::shared_ptr<ObjectBase> object = pending.back();
+		pending.pop_back();
+
+		auto primitive = std::dynamic_pointer_cast<PrimitiveBase>(object);
+		if (primitive != nullptr && primitive->material != nullptr && compiled.insert(primitive->material.get()).second)
+		{
+			primitive->material->compile_maps();
+		}
+
+		for (const std::shared_ptr<ObjectBase> & child : object->get_children())
+		{
+			pending.push_back(child);
+		}
+	}
 }
 
@@ -10,6 +10,8 @@
 #include "Color.h"
 #include "Background.h"
 #include "Sample.h"
+#include "IrradianceCache.h"
+#include "LightTree.h"
 
 class World
 {
@@ -25,11 +27,16 @@ public:
 	[[nodiscard]] Intersections intersect_world(const Ray & ray) const;
 
 	// Shade
+	// Direct lighting at the hit, plus one reflected or refracted path
 	Sample shade(IxComps& comps) const;
+	// Follows a single path through reflections and refractions, iteratively
 	[[nodiscard]] Color color_at(const Ray & ray) const;
     [[nodiscard]] Sample sample_at(const Ray & ray) const;
-	[[nodiscard]] bool is_shadowed(const std::shared_ptr<Light>& light, const Tuple & point) const;
-	[[nodiscard]] Color shadowed(const std::shared_ptr<Light>& light, const Tuple & point, int depth) const;
+	// Shadow rays are cast at time, which only matters to moving objects
+	[[nodiscard]] bool is_shadowed(const std::shared_ptr<Light>& light, const Tuple & point, double time = 0.0) const;
+	[[nodiscard]] Color shadowed(const std::shared_ptr<Light>& light, const Tuple & point, int depth, double time = 0.0) const;
+	// Light transmitted from target, a point on the light, to point
+	[[nodiscard]] Color shadowed_to(const std::shared_ptr<Light>& light, const Tuple & point, const Tuple & target, int depth, double time = 0.0) const;
 
 	// accessors
 	const std::vector<std::shared_ptr<PrimitiveBase>> & get_primitives();
@@ -41,17 +48,73 @@ public:
 	void add_object(const std::shared_ptr<PrimitiveBase>& obj);
 	void add_object(const std::shared_ptr<Light>& obj);
 
+	// Lights are indexed the first time one is sampled after they change.  Adding and removing
+	// them does this already, call it after moving them or changing their power.
+	void rebuild_light_tree();
+
+	// Drops what earlier frames stored about the scene, which the renders call before their
+	// first bucket.  Copies of the world share the irradiance cache, so this clears it for
+	// them as well.  Map graphs edited since the last frame are compiled again here, not
+	// while they are sampled.
+	void begin_frame() const;
+
 	// Public Properties
 	std::shared_ptr<Background> background;
     // Sampling
     int aa_sample_min, aa_sample_max, bucket_size;
     int shadow_subdivs, reflection_subdivs, refraction_subdivs, gi_subdivs;
     double sample_size, noise_threshold;
+    // Reflection and refraction bounces past this are not traced.  Materials have their own
+    // limit of RAY_DEPTH_LIMIT, so raising it past that has no effect.
+    int max_ray_depth;
+    // Global illumination is off while gi_subdivs is 0.
+    // Without a cache every diffuse hit is estimated from scratch.  The cache lasts one frame.
+    // Its records do not know the time of the rays that made them, so in a motion blurred
+    // frame moving objects are lit by indirect light from anywhere in the shutter interval.
+    std::shared_ptr<IrradianceCache> irradiance_cache;
+    // Lights with falloff sampled per shading point, taken from a light tree.
+    // 0, or a scene with no more lights than this, evaluates every light.
+    int light_samples;
+    // Rays per shading point aimed at an importance sampled background, so it lights the
+    // scene directly.  While 0 it only lights the scene through global illumination.
+    int environment_samples;
 
 private:
+	// Lighting, without reflection or refraction
+	Sample w_shade_surface_(IxComps & comps) const;
+	// A single light's contribution, with its shadows
+	Color w_light_contribution_(const std::shared_ptr<Light> & lgt, IxComps & comps, const BaseMaterial & material) const;
+	// Integrates an area light over the solid angle it covers.  The shadow_subdivs samples are
+	// shared between the light and the material by the material's glossy_fraction, and
+	// combined with multiple importance sampling, so both small lights and glossy highlights
+	// stay clean.
+	Color w_area_light_contribution_(const std::shared_ptr<Light> & lgt, const IxComps & comps, const BaseMaterial & material) const;
+	// Light from the background, sampled from its own distribution and from the material's,
+	// in the same units as global illumination
+	Color w_background_contribution_(const IxComps & comps, const BaseMaterial & material) const;
+	bool w_lights_background_() const;
+	// The light tree, built the first time it is needed after the lights change
+	std::shared_ptr<const LightTree> w_get_light_tree_() const;
+	// Picks the ray the path continues along.  When the surface both reflects and refracts,
+	// one of the two is chosen in proportion to its contribution and weighted to compensate.
+	bool w_continue_path_(const IxComps & comps, const Sample & sample, Ray & next, Color & weight, bool & reflected) const;
+	// Diffuse light bounced onto the surface from the rest of the scene
+	void w_add_global_illumination_(const IxComps & comps, Sample & sample) const;
+	// Averages gi_subdivs cosine weighted rays, lit by direct light only
+	Color w_gather_irradiance_(const IxComps & comps, double & mean_distance) const;
+
 	// private properties
 	std::vector<std::shared_ptr<PrimitiveBase>> w_primitives_;
 	std::vector<std::shared_ptr<Light>> w_lights_;
+	// Shared by copies of the world until their lights change, so a tree built for one copy,
+	// such as a bucket's, serves the others
+	struct LightTreeSlot
+	{
+		// Empty until w_get_light_tree_ builds it
+		std::shared_ptr<const LightTree> tree;
+	};
+
+	std::shared_ptr<LightTreeSlot> w_light_tree_;
 };
 
 #endif
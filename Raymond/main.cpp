@@ -3,250 +3,77 @@
 
 #include "pch.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <filesystem>
 #include <typeinfo>
+#include <vector>
 
-World render_ch13_world()
+// Traces on the render nodes of coordinator when one is given, otherwise on this machine.
+// With dump_samples every pixel's samples are written next to the image, for tracking down
+// bad pixels.
+int render_still(const std::string & scene_path, RenderCoordinator * coordinator = nullptr, bool dump_samples = false)
 {
-	World w = World();
-
-	w.background = std::make_shared<NormalGradientBackground>();
-
-	// Lights
-
-	auto light_000 = std::make_shared<PointLight>(Tuple::Point(-20.0, 5.0, -4.0), Color(1.0), 100.0);
-	light_000->falloff = true;
-	light_000->set_name("light 000");
-	w.add_object(light_000);
-
-	auto light_001 = std::make_shared<PointLight>(Tuple::Point(0.0, 1.0, 5.0), Color(1.0, 0.0, 0.0), 500.0, 0.2);
-	light_001->falloff = true;
-	light_001->set_name("light 001");
-	w.add_object(light_001);
-
-	// Materials
-
-	auto matte_gray_mtl = std::make_shared<PhongMaterial>();
-	matte_gray_mtl->color = Color(0.18);
-	matte_gray_mtl->specular = 0.0;
-	matte_gray_mtl->ambient = Color(0.01);
-
-	auto gray_checkers_tex = std::make_shared<CheckerMap>(Color(0.18), Color(0.36));
-	auto gray_ring_tex = std::make_shared<RingMap>(Color(0.18), Color(0.36));
-	auto gray_gradient_tex = std::make_shared<GradientMap>(Color(0.18), Color(0.36));
-	auto gray_stripe_tex = std::make_shared<StripeMap>(Color(0.18), Color(0.36));
-
-	auto stripe1 = std::make_shared<StripeMap>(Color(1.0, 0.0, 0.0), Color(0.5, 0.0, 0.0));
-	stripe1->transform->set_transform(Matrix4::Scaling(0.5, 0.5, 0.5) * Matrix4::Rotation_Y(deg_to_rad(90)));
-	auto stripe2 = std::make_shared<StripeMap>(Color(0.0, 1.0, 0.0), Color(0.0, 0.5, 0.0));
-	stripe2->transform->set_transform(Matrix4::Scaling(0.5, 0.5, 0.5));
-
-	auto c_map_1 = std::make_shared <CompositeMap>(stripe1, stripe2, CompAdd, 1.0);
-
-	auto perlin_noise = std::make_shared<ColoredPerlin>(32255);
-	perlin_noise->octaves = 6;
-
-	//matte_gray_mtl->color.connect(perlin_noise);
-
-	auto shiny_purple_mtl = std::make_shared<PhongMaterial>();
-	Color purple = Color(Color8Bit(57, 0, 214)).convert_srgb_to_linear();
-	shiny_purple_mtl->color.set_value(purple);
-	shiny_purple_mtl->specular.set_value(0.9);
-	shiny_purple_mtl->ambient.set_value(0.01);
-	shiny_purple_mtl->reflection.set_value(Color(1.0));
-	shiny_purple_mtl->ior = 20.0;
-
-	// Reflection Map
-	auto purple_stripe_tex = std::make_shared<StripeMap>(purple, Color(0.1));
-	purple_stripe_tex->set_mapping_space(ObjectSpace);
-	purple_stripe_tex->transform->set_transform(Matrix4::Scaling(0.1, 0.1, 0.1));
-
-	auto purple_stripe_perturb = std::make_shared<PerturbMap>(purple_stripe_tex, perlin_noise);
-	purple_stripe_perturb->displacement_remap = true;
-	purple_stripe_perturb->scale = 0.1;
-
-	// Shininess Map
-	auto bw_stripe_tex = std::make_shared<StripeMap>(Color(200.0), Color(10.0));
-	bw_stripe_tex->set_mapping_space(ObjectSpace);
-	bw_stripe_tex->transform->set_transform(Matrix4::Scaling(0.1, 0.1, 0.1));
-
-	auto bw_stripe_perturb = std::make_shared<PerturbMap>(bw_stripe_tex, perlin_noise);
-	bw_stripe_perturb->displacement_remap = true;
-	bw_stripe_perturb->scale = 0.1;
-
-	// Maps
-	//shiny_purple_mtl->color.connect(purple_stripe_perturb);
-	shiny_purple_mtl->reflection.connect(purple_stripe_perturb);
-	shiny_purple_mtl->shininess.connect(bw_stripe_tex);
-
-	auto shiny_yellow_mtl = std::make_shared<PhongMaterial>();
-	shiny_yellow_mtl->color = Color(Color8Bit(245, 209, 66)).convert_srgb_to_linear();
-	shiny_yellow_mtl->specular = 0.9;
-	shiny_yellow_mtl->ambient = Color(0.01);
-
-	auto gold_metal_mtl = std::make_shared<PhongMaterial>();
-	gold_metal_mtl->ior.set_value(12.0);
-	gold_metal_mtl->color.set_value(Color(0.0));
-	gold_metal_mtl->reflection.set_value(Color(Color8Bit(212, 175, 55)).convert_srgb_to_linear());
-	gold_metal_mtl->specular.set_value(0.9);
-	gold_metal_mtl->shininess.set_value(600.0);
-	gold_metal_mtl->ambient.set_value(0.0);
-
-	auto matte_blue_mtl = std::make_shared<PhongMaterial>();
-	matte_blue_mtl->color = Color(Color8Bit(21, 80, 117)).convert_srgb_to_linear();
-	matte_blue_mtl->specular = 0.0;
-	matte_blue_mtl->ambient = Color(0.01);
-
-	auto nor_mtl = std::make_shared<NormalsMaterial>();
-
-	// Objects
-
-	auto gs = Sphere::GlassSphere();
-	gs->set_name("Glass Sphere 001");
-	gs->set_transform(Matrix4::Translation(-2.0, 0.5, -1.0) * Matrix4::Scaling(0.5, 0.5, 0.5));
-	w.add_object(gs);
-
-	auto gs2 = Sphere::GlassSphere();
-	gs2->set_name("Glass Sphere 002");
-	gs2->set_transform(Matrix4::Translation(-2.0, 0.5, -1.0) * Matrix4::Scaling(0.45, 0.45, 0.45));
-	w.add_object(gs2);
-
-	auto glass_mtl = std::static_pointer_cast<PhongMaterial>(gs->material);
-	glass_mtl->reflection.set_value(Color(1.0));
-	glass_mtl->color.set_value(Color(0.0));
-
-	auto air_mtl = std::static_pointer_cast<PhongMaterial>(gs2->material);
-	air_mtl->reflection.set_value(Color(1.0));
-	air_mtl->color.set_value(Color(0.0));
-	air_mtl->ior = 1.0;
-
-	auto floor_000 = std::make_shared<InfinitePlane>("floor 000");
-	floor_000->material = matte_gray_mtl;
-	w.add_object(floor_000);
-
-	auto purple_sphere = std::make_shared<Sphere>("purple sphere");
-	purple_sphere->material = shiny_purple_mtl;
-	purple_sphere->set_transform(Matrix4::Translation(0.0, 1.0, 0.0) * Matrix4::Rotation_Z(deg_to_rad(45.0)));
-	w.add_object(purple_sphere);
-
-	auto yellow_sphere_000 = std::make_shared<Sphere>("yellow sphere 000");
-	yellow_sphere_000->material = shiny_yellow_mtl;
-	yellow_sphere_000->set_transform(Matrix4::Translation(-1.5, 0.5, -0.0) * Matrix4::Scaling(0.5, 0.5, 0.5));
-	w.add_object(yellow_sphere_000);
-
-	auto yellow_sphere_001 = std::make_shared<Sphere>("yellow sphere 001");
-	yellow_sphere_001->material = shiny_yellow_mtl;
-	yellow_sphere_001->set_transform(Matrix4::Translation(2.0, 0.5, -0.5) * Matrix4::Scaling(0.5, 0.5, 0.5));
-	w.add_object(yellow_sphere_001);
-
-	auto gold_inf_cylinder_000 = std::make_shared<Cylinder>("Gold Infinite Cylinder 000");
-	gold_inf_cylinder_000->material = gold_metal_mtl;
-	gold_inf_cylinder_000->set_transform(Matrix4::Rotation_X(deg_to_rad(-45.0)) * Matrix4::Translation(0.0, 0.0, 10.0) * Matrix4::Scaling(4.0, 4.0, 4.0));
-	w.add_object(gold_inf_cylinder_000);
-
-	auto gold_inf_cylinder_001 = std::make_shared<Cylinder>("Gold Infinite Cylinder 001");
-	gold_inf_cylinder_001->material = gold_metal_mtl;
-	gold_inf_cylinder_001->set_transform(Matrix4::Rotation_X(deg_to_rad(45.0)) * Matrix4::Translation(-10.0, 0.0, 10.0) * Matrix4::Scaling(4.0, 1.0, 4.0));
-	w.add_object(gold_inf_cylinder_001);
-
-	auto gold_inf_cylinder_002 = std::make_shared<Cylinder>("Gold Infinite Cylinder 002");
-	gold_inf_cylinder_002->material = gold_metal_mtl;
-	gold_inf_cylinder_002->set_transform(Matrix4::Rotation_X(deg_to_rad(45.0)) * Matrix4::Translation(10.0, 0.0, 10.0) * Matrix4::Scaling(4.0, 1.0, 4.0));
-	w.add_object(gold_inf_cylinder_002);
-
-	auto gold_inf_cylinder_003 = std::make_shared<Cylinder>("Gold Infinite Cylinder 003");
-	gold_inf_cylinder_003->material = gold_metal_mtl;
-	gold_inf_cylinder_003->set_transform(Matrix4::Rotation_X(deg_to_rad(-45.0)) * Matrix4::Translation(0.0, 0.0, -10.0) * Matrix4::Scaling(4.0, 1.0, 4.0));
-	w.add_object(gold_inf_cylinder_003);
-
-	auto gold_inf_cylinder_004 = std::make_shared<Cylinder>("Gold Infinite Cylinder 004");
-	gold_inf_cylinder_004->material = gold_metal_mtl;
-	gold_inf_cylinder_004->set_transform(Matrix4::Rotation_X(deg_to_rad(45.0)) * Matrix4::Translation(-10.0, 0.0, -10.0) * Matrix4::Scaling(4.0, 1.0, 4.0));
-	w.add_object(gold_inf_cylinder_004);
-
-	auto gold_inf_cylinder_005 = std::make_shared<Cylinder>("Gold Infinite Cylinder 005");
-	gold_inf_cylinder_005->material = gold_metal_mtl;
-	gold_inf_cylinder_005->set_transform(Matrix4::Rotation_X(deg_to_rad(45.0)) * Matrix4::Translation(10.0, 0.0, -10.0) * Matrix4::Scaling(4.0, 1.0, 4.0));
-	w.add_object(gold_inf_cylinder_005);
-
-	auto purple_cone = std::make_shared<DoubleNappedCone>(-1.0, -0.8, "blue cone 000");
-	purple_cone->set_closed(true);
-	purple_cone->material = glass_mtl;
-	purple_cone->set_transform(Matrix4::Translation(-1.0, 1.0, -2.0) * Matrix4::Rotation_Y(deg_to_rad(-90.0)) * Matrix4::Rotation_Z(deg_to_rad(90.0)) * Matrix4::Scaling(0.5, 0.5, 0.5));
-	w.add_object(purple_cone);
-
-	auto purple_cyl = std::make_shared<Cylinder>(-1.0, -0.95, "blue cylinder 000");
-	purple_cyl->set_closed(true);
-	purple_cyl->material = glass_mtl;
-	purple_cyl->set_transform(Matrix4::Translation(0.0, 2.0, -2.0) * Matrix4::Rotation_Y(deg_to_rad(-45.0)) * Matrix4::Rotation_Z(deg_to_rad(90.0)) * Matrix4::Scaling(0.5, 0.5, 0.5));
-	w.add_object(purple_cyl);
-
-	int num_blue_cubes = 7;
-
-	for (int i = 0; i < num_blue_cubes; i++)
-	{
-		auto sx = double(num_blue_cubes - 1);
-
-		auto blue_cube_inst = std::make_shared<Cube>("Blue Cube " + pad_num(i, 3));
-		blue_cube_inst->material = matte_blue_mtl;
-
-		blue_cube_inst->set_transform(
-			Matrix4::Translation((i * 2.0) - sx, 0.0, 2.0) *
-			Matrix4::Rotation_Z((((M_PI / 2.0) / sx) * (num_blue_cubes - i)) - (M_PI / 4.0)) *
-			Matrix4::Scaling(0.25, 2.0, 0.25)
-		);
-
-		w.add_object(blue_cube_inst);
-	}
-	return w;
-}
-
-int render_still()
-{
-	std::string chapter = "Cylinders_CH13";
+	std::string chapter = std::filesystem::path(scene_path).stem().string();
 	std::string folder = R"(I:\projects\Raymond\frames)";
 	int version = 2;
 
-	// 560 x 315
-
-	int width = 256;
-	int height = 256;
-	double fov = 45.0;
-
 	std::cout << "Executing Render " << chapter << " v" << pad_num(version, 2) << std::endl << std::endl;
 
 	// Start time
 	auto start = std::chrono::steady_clock::now();
 
 	// Build World
-	std::cout << "Building World...\n";
-	World w = render_ch13_world();
+	std::cout << "Loading " << scene_path << "...\n";
+	Scene scene;
 
-    w.aa_sample_min = 4;
-    w.aa_sample_max = 32;
-
-    w.shadow_subdivs = 8;
+	try
+	{
+		// Reads the compiled copy when the scene has not changed since the last run
+		scene = SceneCache::load(scene_path);
+	}
+	catch (const std::exception& ex)
+	{
+		std::cout << ex.what() << std::endl;
+		return 1;
+	}
 
-    w.bucket_size = 32;
+	World & w = scene.world;
+	Camera & c = scene.camera;
 
 	// Execution
 	SampleBuffer image;
-
-	Camera c = Camera(width, height, deg_to_rad(fov));
-
-	Tuple from = Tuple::Point(0.0, 0.8, -5.0);
-	Tuple to = Tuple::Point(0.0, 1.0, 0.0);
-	Tuple up = Tuple::Vector(0.0, 1.0, 0.0);
-
-	c.set_transform(Matrix4::ViewTransform(from, to, up));
+	RenderStats stats;
+	// Finished buckets are kept next to the scene until the image is written, so a render
+	// that is stopped carries on where it was the next time
+	std::unique_ptr<RenderCheckpoint> checkpoint;
 
 	try
 	{
 		std::cout << "Tracing...\n";
 
 
-		image = c.multi_sample_threaded_render(w);
+		if (coordinator == nullptr)
+		{
+			const std::string cache_path = SceneCache::cache_path_for(scene_path);
+			const uint64_t scene_hash = SceneCache::hash_file(cache_path);
+			const uint64_t render_hash = RenderCheckpoint::render_hash(c, w, scene_hash, SceneCache(cache_path).asset_paths());
+			checkpoint = std::make_unique<RenderCheckpoint>(scene_path + ".checkpoint", render_hash);
+
+			if (checkpoint->get_restored_buckets() > 0)
+			{
+				std::cout << "Resuming with " << checkpoint->get_restored_buckets() << " buckets from " << checkpoint->get_path() << "\n";
+			}
+
+			image = c.multi_sample_threaded_render(w, stats, *checkpoint);
+		}
+		else
+		{
+			std::cout << "Waiting for render nodes on " << coordinator->get_address() << "...\n";
+			image = coordinator->render(scene_path, stats);
+			std::cout << coordinator->get_nodes_served() << " nodes, " << coordinator->get_buckets_retried() << " buckets retried\n";
+		}
 		//image = c.render(w);
 
 		//image = c.render_scanline(w, 160);
@@ -283,6 +110,28 @@ int render_still()
 	canvas_to_ppm(image.to_canvas(rgb), file_path);
 	std::cout << "Complete" << std::endl;
 
+	// Statistics and heat maps, next to the image
+	std::string stats_root = file_path.substr(0, file_path.size() - std::string("_rgb.ppm").size());
+
+	std::cout << "Writing statistics: " << stats_root << "_stats.json" << std::endl;
+	stats.write_json(stats_root + "_stats.json");
+	canvas_to_pfm(image.to_canvas(sampletime), stats_root + "_time.pfm");
+	canvas_to_pfm(image.to_canvas(raycount), stats_root + "_rays.pfm");
+	std::cout << "Complete" << std::endl;
+
+	if (dump_samples)
+	{
+		std::cout << "Writing samples: " << stats_root << "_samples.txt" << std::endl;
+		std::ofstream dump_file(stats_root + "_samples.txt");
+		image.debug_dump(dump_file);
+		std::cout << "Complete" << std::endl;
+	}
+
+	if (checkpoint)
+	{
+		checkpoint->remove();
+	}
+
 	return 0;
 }
 
@@ -294,92 +143,166 @@ int render_animation()
 	int width = 1920;
 	int height = 1080;
 	double fov = 90.0;
-	size_t frames = 240;
+	int frames = 240;
+	// Seconds each frame has to finish in
+	double frame_budget = 30.0;
 
 	std::cout << std::string(50, '*') << std::endl << "Executing Animation Render" << std::endl << frames << " Frames" << std::endl << std::string(50, '*') << std::endl << std::endl;
 
-	auto total_start = std::chrono::steady_clock::now();
-
-	// Build World
+	// Build World, once for every frame
 	std::cout << "Building World...\n";
-	World w = render_ch13_world();
+	World w = SceneCache::load("scenes/cylinders_ch13.scene").world;
 	std::cout << "Complete\n\n";
 
-	for (size_t i = 0; i < frames; i++)
+	AnimationRenderer renderer = AnimationRenderer(w);
+	// Kept across frames, so each frame starts from the timings of the last
+	renderer.scheduler = std::make_shared<DeadlineScheduler>(frame_budget);
+
+	auto view_at = [&](int frame)
 	{
-		std::cout << std::string(50, '*') << std::endl << "Frame: " << pad_num(int(i) + 1, 3) << "/" << frames << std::endl << std::string(50, '*') << std::endl << std::endl;
+		double perc = (3.0 / double(frames) * double(frame)) - 1.5;
 
-		// Start time
-		auto frame_start = std::chrono::steady_clock::now();
+		Tuple from = Tuple::Point(perc, 0.8, -5.0);
+		Tuple to = Tuple::Point(0.0, 1.0, 0.0);
+		Tuple up = Tuple::Vector(0.0, 1.0, 0.0);
 
-		// Execution
-		Canvas image;
+		return Matrix4::ViewTransform(from, to, up);
+	};
 
+	// Only the camera moves, and it is blurred over half of each frame
+	auto camera_for_frame = [&](int frame)
+	{
 		Camera c = Camera(width, height, deg_to_rad(fov));
 
-		double perc = (3.0 / double(frames) * double(i)) - 1.5;
+		c.add_keyframe(double(frame), view_at(frame));
+		c.add_keyframe(double(frame + 1), view_at(frame + 1));
+		c.shutter_open = double(frame);
+		c.shutter_close = double(frame) + 0.5;
 
-		Tuple from = Tuple::Point(perc, 0.8, -5.0);
-		Tuple to = Tuple::Point(0.0, 1.0, 0.0);
-		Tuple up = Tuple::Vector(0.0, 1.0, 0.0);
+		return c;
+	};
 
-		c.set_transform(Matrix4::ViewTransform(from, to, up));
+	// Runs while the next frame traces
+	auto write_frame = [&](int frame, SampleBuffer & image)
+	{
+		std::string file_path = folder + "\\" + file_name_root + pad_num(frame, 4) + ".ppm"; // NOLINT(performance-inefficient-string-concatenation)
+		canvas_to_ppm(image.to_canvas(rgb), file_path);
+	};
 
-		try
-		{
-			std::cout << "Tracing...\n";
+	try
+	{
+		renderer.render(0, frames, camera_for_frame, write_frame);
+	}
+	catch (const std::exception& ex)
+	{
+		std::cout << ex.what() << std::endl;
+		return 10;
+	}
+	catch (...)
+	{
+		std::cout << "unknown exception\n";
+		return 100;
+	}
 
+	double trace_seconds = 0.0;
+	double overhead_seconds = 0.0;
 
-			image = c.threaded_render(w);
-			//image = c.render(w);
+	for (const FrameStats & frame : renderer.get_frame_stats())
+	{
+		trace_seconds += frame.trace_seconds;
+		overhead_seconds += frame.overhead_seconds();
+	}
 
-			//image = c.render_scanline(w, 160);
+	std::cout << std::endl << "Total Time: ";
+	clock_display(std::cout, std::chrono::duration<double>(renderer.get_wall_seconds()));
+	std::cout << std::endl << "Tracing: " << trace_seconds << "s, Frame Overhead: " << overhead_seconds << "s" << std::endl << std::endl;
 
-			std::cout << "Complete\n";
+	renderer.write_stats_json(folder + "\\animation_stats.json"); // NOLINT(performance-inefficient-string-concatenation)
 
+	return 0;
+}
+
+// Renders frames for the coordinator at address, one after another, until it goes away
+int render_node(const std::string & address, int threads)
+{
+	RenderNode node = RenderNode(threads);
+	int frames = 0;
+
+	std::cout << "Render node for " << address << std::endl;
+
+	while (true)
+	{
+		try
+		{
+			int buckets = node.run(address);
+			frames++;
+
+			std::cout << "Frame " << frames << ": " << buckets << " buckets" << std::endl;
 		}
 		catch (const std::exception& ex)
 		{
 			std::cout << ex.what() << std::endl;
-			return 10;
+			// A coordinator that has finished is no longer there to connect to
+			return (frames > 0) ? 0 : 1;
 		}
-		catch (...)
-		{
-			std::cout << "unknown exception\n";
-			return 100;
-		}
-
+	}
+}
 
-		// End time
-		auto frame_end = std::chrono::steady_clock::now();
+// Renders every scene file given, in order, or the chapter 13 scene when there are none.
+//
+//     Raymond [scene...]
+//     Raymond --coordinator <address> [scene...]     traces on render nodes instead
+//     Raymond --node <address> [threads]             renders buckets for a coordinator
+//
+// --dump-samples, anywhere on a render's command line, also writes every pixel's samples
+// next to each image.
+//
+// Addresses are host:port or unix:/path.  Several nodes on one machine are enough to try
+// out a distributed render.
+int main(int argc, char * argv[])
+{
+	std::vector<std::string> arguments(argv + 1, argv + argc);
 
-		auto frame_diff = frame_end - frame_start;
+	if (arguments.size() >= 2 && arguments[0] == "--node")
+	{
+		return render_node(arguments[1], (arguments.size() > 2) ? std::stoi(arguments[2]) : 0);
+	}
 
-		std::cout << std::endl << "Time: ";
-		clock_display(std::cout, frame_diff);
-		std::cout << std::endl << std::endl;
+	const auto dump_flag = std::remove(arguments.begin(), arguments.end(), std::string("--dump-samples"));
+	const bool dump_samples = dump_flag != arguments.end();
+	arguments.erase(dump_flag, arguments.end());
 
-		// File Name
-		std::string file_path = folder + "\\" + file_name_root + pad_num(int(i), 4) + ".ppm"; // NOLINT(performance-inefficient-string-concatenation)
+	std::unique_ptr<RenderCoordinator> coordinator;
 
-		std::cout << "Writing file: " << file_path << std::endl;
+	if (arguments.size() >= 2 && arguments[0] == "--coordinator")
+	{
+		try
+		{
+			coordinator = std::make_unique<RenderCoordinator>(arguments[1]);
+		}
+		catch (const std::exception& ex)
+		{
+			std::cout << ex.what() << std::endl;
+			return 1;
+		}
 
-		canvas_to_ppm(image, file_path);
-		std::cout << "Complete" << std::endl;
+		arguments.erase(arguments.begin(), arguments.begin() + 2);
 	}
 
-	auto total_end = std::chrono::steady_clock::now();
+	std::vector<std::string> scene_paths = arguments;
 
-	auto total_diff = total_end - total_start;
+	if (scene_paths.empty())
+	{
+		scene_paths.emplace_back("scenes/cylinders_ch13.scene");
+	}
 
-	std::cout << std::endl << "Total Time: ";
-	clock_display(std::cout, total_diff);
-	std::cout << std::endl << std::endl;
+	int result = 0;
 
-	return 0;
-}
+	for (const std::string & scene_path : scene_paths)
+	{
+		int scene_result = render_still(scene_path, coordinator.get(), dump_samples);
+		result = (result == 0) ? scene_result : result;
+	}
 
-int main()
-{
-	return render_still();
+	return result;
 }
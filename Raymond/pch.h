@@ -26,5 +26,19 @@
 #include "Camera.h"
 #include "Utilities.h"
 #include "Noise.h"
+#include "TexMapProgram.h"
+#include "TextureCache.h"
+#include "ImageMap.h"
+#include "BakedMap.h"
+#include "IrradianceCache.h"
+#include "LightTree.h"
+#include "DeadlineScheduler.h"
+#include "RenderStats.h"
+#include "ProgressReporter.h"
+#include "SceneFile.h"
+#include "SceneCache.h"
+#include "Animation.h"
+#include "Distributed.h"
+#include "Checkpoint.h"
 
 #endif //PCH_H
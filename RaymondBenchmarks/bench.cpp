@@ -0,0 +1,333 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <sstream>
+#include <iostream>
+
+#include "../Raymond/Tuple.h"
+#include "../Raymond/Matrix.h"
+#include "../Raymond/Ray.h"
+#include "../Raymond/PrimitiveDefinition.h"
+#include "../Raymond/Object.h"
+#include "../Raymond/Primitive.h"
+#include "../Raymond/Material.h"
+#include "../Raymond/World.h"
+#include "../Raymond/Camera.h"
+#include "../Raymond/Noise.h"
+#include "../Raymond/Texmap.h"
+#include "../Raymond/SceneFile.h"
+
+// Every benchmark reports items_per_second, which is what compare.py gates on.
+// Scenes are built outside of the timed loops, and random numbers are seeded, so runs
+// on the same machine can be compared.
+
+// ------------------------------------------------------------------------
+// Helpers
+// ------------------------------------------------------------------------
+
+static Matrix4 bench_transform()
+{
+	return Matrix4::Translation(1.0, -2.0, 3.5) * Matrix4::Rotation_Y(0.7) * Matrix4::Rotation_X(-0.3) * Matrix4::Scaling(2.0, 0.5, 1.5);
+}
+
+// Rays from outside a unit sized shape, aimed at points around it, so some miss
+static std::vector<Ray> bench_rays(int count)
+{
+	srand(1);
+
+	std::vector<Ray> rays;
+	rays.reserve(count);
+
+	for (int i = 0; i < count; i++)
+	{
+		Tuple origin = Tuple::Point(random_double(-4.0, 4.0), random_double(-4.0, 4.0), -6.0);
+		Tuple target = Tuple::Point(random_double(-1.5, 1.5), random_double(-1.5, 1.5), random_double(-1.5, 1.5));
+		rays.emplace_back(origin, (target - origin).normalize());
+	}
+
+	return rays;
+}
+
+// A grid of count spheres in front of the camera, over a floor, lit by one light
+static World bench_world(int count)
+{
+	World w = World();
+
+	auto floor = std::make_shared<InfinitePlane>();
+	floor->set_transform(Matrix4::Translation(0.0, -1.0, 0.0));
+	w.add_object(floor);
+
+	const int side = std::max(int(std::ceil(std::sqrt(double(count)))), 1);
+	const double spacing = 8.0 / double(side);
+
+	for (int i = 0; i < count; i++)
+	{
+		auto sphere = std::make_shared<Sphere>();
+		double x = (double(i % side) - (double(side) / 2.0)) * spacing;
+		double y = (double(i / side) - (double(side) / 2.0)) * spacing;
+		sphere->set_transform(Matrix4::Translation(x, y, 2.0) * Matrix4::Scaling(spacing * 0.4, spacing * 0.4, spacing * 0.4));
+		w.add_object(sphere);
+	}
+
+	w.add_object(std::make_shared<PointLight>(Tuple::Point(-10.0, 10.0, -10.0), Color(1.0)));
+
+	return w;
+}
+
+// Silences the per bucket messages while a render is timed
+class SilentCout
+{
+public:
+	SilentCout() : sc_previous_(std::cout.rdbuf(sc_sink_.rdbuf())) {}
+	~SilentCout() { std::cout.rdbuf(this->sc_previous_); }
+
+private:
+	std::ostringstream sc_sink_;
+	std::streambuf * sc_previous_;
+};
+
+// ------------------------------------------------------------------------
+// Matrices
+// ------------------------------------------------------------------------
+
+static void BM_Matrix4Inverse(benchmark::State & state)
+{
+	Matrix4 m = bench_transform();
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(m.inverse());
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Matrix4Inverse);
+
+static void BM_Matrix4Multiply(benchmark::State & state)
+{
+	Matrix4 a = bench_transform();
+	Matrix4 b = Matrix4::Rotation_Z(0.25) * Matrix4::Translation(0.5, 0.5, 0.5);
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(a * b);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Matrix4Multiply);
+
+static void BM_Matrix4TupleMultiply(benchmark::State & state)
+{
+	Matrix4 m = bench_transform();
+	Tuple t = Tuple::Point(1.0, 2.0, 3.0);
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(m * t);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Matrix4TupleMultiply);
+
+// ------------------------------------------------------------------------
+// Primitive Intersections
+// ------------------------------------------------------------------------
+
+template <class Definition>
+static void BM_LocalIntersect(benchmark::State & state, const Definition & definition)
+{
+	const std::vector<Ray> rays = bench_rays(1024);
+	size_t i = 0;
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(definition.local_intersect_t(rays[i]));
+		i = (i + 1) & 1023;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_LocalIntersect, Sphere, SphereDefinition());
+BENCHMARK_CAPTURE(BM_LocalIntersect, InfinitePlane, InfinitePlaneDefinition());
+BENCHMARK_CAPTURE(BM_LocalIntersect, Cube, CubeDefinition());
+BENCHMARK_CAPTURE(BM_LocalIntersect, Cylinder, CylinderDefinition(-1.0, 1.0, true));
+BENCHMARK_CAPTURE(BM_LocalIntersect, DoubleNappedCone, DoubleNappedConeDefinition(-1.0, 1.0, true));
+
+// ------------------------------------------------------------------------
+// World
+// ------------------------------------------------------------------------
+
+// Argument is the number of spheres
+static void BM_IntersectWorld(benchmark::State & state)
+{
+	World w = bench_world(int(state.range(0)));
+	const std::vector<Ray> rays = bench_rays(1024);
+	size_t i = 0;
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(w.intersect_world(rays[i]));
+		i = (i + 1) & 1023;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IntersectWorld)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_IxCompsConstruction(benchmark::State & state)
+{
+	World w = bench_world(16);
+	Ray r = Ray(Tuple::Point(0.0, 0.0, -5.0), Tuple::Vector(0.0, 0.0, 1.0));
+	Intersections xs = w.intersect_world(r);
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(IxComps(xs.hit(), r, xs));
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IxCompsConstruction);
+
+// ------------------------------------------------------------------------
+// Shading
+// ------------------------------------------------------------------------
+
+static void BM_PhongLighting(benchmark::State & state)
+{
+	auto sphere = std::make_shared<Sphere>();
+	auto light = std::make_shared<PointLight>(Tuple::Point(-10.0, 10.0, -10.0), Color(1.0));
+	auto material = std::dynamic_pointer_cast<PhongMaterial>(sphere->material);
+
+	Ray r = Ray(Tuple::Point(0.0, 0.0, -5.0), Tuple::Vector(0.0, 0.0, 1.0));
+	Intersections xs = sphere->intersect_i(r);
+	IxComps comps = IxComps(xs.hit(), r, xs);
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(material->lighting(light, comps));
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PhongLighting);
+
+static void BM_TexMap(benchmark::State & state, const std::shared_ptr<TexMap> & map)
+{
+	ColorMapSlot slot = ColorMapSlot();
+	slot.connect(map);
+
+	IxComps comps = IxComps();
+	int i = 0;
+
+	for (auto _ : state)
+	{
+		comps.texmap_point = Tuple::Point(i * 0.0137, i * 0.0071, i * 0.0029);
+		benchmark::DoNotOptimize(slot.sample_at(comps));
+		i++;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_TexMap, Checker, std::make_shared<CheckerMap>(Color(0.2), Color(0.8)));
+BENCHMARK_CAPTURE(BM_TexMap, Perlin, std::make_shared<PerlinMap>(32255));
+
+// ------------------------------------------------------------------------
+// Noise
+// ------------------------------------------------------------------------
+
+static std::shared_ptr<TexMap> bench_perlin(NoiseBasis basis, bool compatibility_mode)
+{
+	auto map = std::make_shared<PerlinMap>(32255);
+	map->octaves = 6;
+	map->basis = basis;
+	map->compatibility_mode = compatibility_mode;
+	return map;
+}
+
+static std::shared_ptr<TexMap> bench_colored_perlin(NoiseBasis basis, bool compatibility_mode)
+{
+	auto map = std::make_shared<ColoredPerlin>(32255);
+	map->basis = basis;
+	map->compatibility_mode = compatibility_mode;
+	return map;
+}
+
+// The noise kernels on their own, sampled straight from the map.  Items are samples.
+static void BM_Noise(benchmark::State & state, const std::shared_ptr<TexMap> & map)
+{
+	IxComps comps = IxComps();
+	int i = 0;
+
+	for (auto _ : state)
+	{
+		comps.texmap_point = Tuple::Point(i * 0.0137, i * 0.0071, i * 0.0029);
+		benchmark::DoNotOptimize(map->local_sample_at(comps));
+		i++;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_Noise, PerlinCompatibility, bench_perlin(PerlinNoiseBasis, true));
+BENCHMARK_CAPTURE(BM_Noise, Perlin, bench_perlin(PerlinNoiseBasis, false));
+BENCHMARK_CAPTURE(BM_Noise, Simplex, bench_perlin(SimplexNoiseBasis, false));
+BENCHMARK_CAPTURE(BM_Noise, ColoredPerlinCompatibility, bench_colored_perlin(PerlinNoiseBasis, true));
+BENCHMARK_CAPTURE(BM_Noise, ColoredPerlin, bench_colored_perlin(PerlinNoiseBasis, false));
+BENCHMARK_CAPTURE(BM_Noise, ColoredSimplex, bench_colored_perlin(SimplexNoiseBasis, false));
+
+// ------------------------------------------------------------------------
+// Rendering
+// ------------------------------------------------------------------------
+
+// A 32x32 frame of 16 spheres, 4 samples per pixel, on one thread.  Items are pixels.
+static void BM_RenderSmallFrame(benchmark::State & state)
+{
+	World w = bench_world(16);
+	w.aa_sample_max = 4;
+
+	Camera c = Camera(32, 32, M_PI / 3.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 1.0, -8.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	SilentCout silent = SilentCout();
+	srand(1);
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(c.multi_sample_render_bucket(w, 0, 0, 32, 32, 1));
+	}
+
+	state.SetItemsProcessed(state.iterations() * 32 * 32);
+}
+BENCHMARK(BM_RenderSmallFrame)->Unit(benchmark::kMillisecond);
+
+// ------------------------------------------------------------------------
+// Scene Files
+// ------------------------------------------------------------------------
+
+// Argument is the number of spheres in the file.  Items are objects loaded.
+static void BM_ParseScene(benchmark::State & state)
+{
+	const int count = int(state.range(0));
+
+	std::ostringstream text;
+	text << "material gray phong\n\tcolor 0.5\nend\n";
+	for (int i = 0; i < count; i++)
+	{
+		text << "sphere \"sphere " << i << "\"\n\tmaterial gray\n\ttranslate " << i % 100 << " " << i / 100 << " 0\n\tscale 0.4\nend\n";
+	}
+	const std::string scene_text = text.str();
+
+	for (auto _ : state)
+	{
+		std::istringstream input(scene_text);
+		SceneParser parser = SceneParser();
+		benchmark::DoNotOptimize(parser.parse(input));
+	}
+
+	state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ParseScene)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Compares two raymond_bench runs and fails when throughput dropped.
+
+Record a run with
+    raymond_bench --benchmark_format=json --benchmark_out=run.json --benchmark_repetitions=5
+
+then compare a baseline against it with
+    compare.py baseline.json run.json --threshold 5
+
+Benchmarks are matched by name and compared on items_per_second.  With repetitions, the
+median is used.  Exits with 1 when any benchmark is slower than the threshold allows.
+"""
+
+import argparse
+import json
+import statistics
+import sys
+
+
+def load(path):
+    with open(path) as json_file:
+        data = json.load(json_file)
+
+    runs = {}
+    medians = {}
+
+    for bench in data.get("benchmarks", []):
+        if bench.get("error_occurred"):
+            continue
+
+        name = bench.get("run_name", bench["name"])
+        aggregate = bench.get("aggregate_name")
+
+        if aggregate == "median":
+            medians[name] = bench["items_per_second"]
+        elif aggregate is None and "items_per_second" in bench:
+            runs.setdefault(name, []).append(bench["items_per_second"])
+
+    # Prefer the reported median, and take one when only the repetitions were written
+    throughput = {name: statistics.median(values) for name, values in runs.items()}
+    throughput.update(medians)
+
+    return throughput
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline", help="JSON from the reference build")
+    parser.add_argument("contender", help="JSON from the build being checked")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="percent of throughput a benchmark may lose before failing (default 5)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    contender = load(args.contender)
+
+    names = [name for name in baseline if name in contender]
+    if not names:
+        print("No benchmarks in common")
+        return 1
+
+    width = max(len(name) for name in names)
+    regressions = []
+
+    print(f"{'Benchmark':<{width}}  {'Baseline':>14}  {'Contender':>14}  {'Change':>8}")
+
+    for name in names:
+        before = baseline[name]
+        after = contender[name]
+        change = 100.0 * (after - before) / before if before > 0.0 else 0.0
+
+        flag = ""
+        if change < -args.threshold:
+            flag = "  REGRESSION"
+            regressions.append(name)
+
+        print(f"{name:<{width}}  {before:>14.4g}  {after:>14.4g}  {change:>+7.1f}%{flag}")
+
+    for name in sorted(set(baseline) ^ set(contender)):
+        print(f"{name}: only in {'baseline' if name in baseline else 'contender'}")
+
+    if regressions:
+        print(f"\n{len(regressions)} benchmarks lost more than {args.threshold}% throughput")
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
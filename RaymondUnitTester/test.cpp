@@ -13,6 +13,20 @@
 #include "../Raymond/Primitive.h"
 #include "../Raymond/World.h"
 #include "../Raymond/Camera.h"
+#include "../Raymond/Noise.h"
+#include "../Raymond/ImageMap.h"
+#include "../Raymond/BakedMap.h"
+#include "../Raymond/IrradianceCache.h"
+#include "../Raymond/LightTree.h"
+#include "../Raymond/DeadlineScheduler.h"
+#include "../Raymond/RenderStats.h"
+#include "../Raymond/ProgressReporter.h"
+#include "../Raymond/SceneFile.h"
+#include "../Raymond/SceneCache.h"
+#include "../Raymond/Animation.h"
+#include "../Raymond/Distributed.h"
+#include "../Raymond/Checkpoint.h"
+#include "../Raymond/TexMapProgram.h"
 
 // ------------------------------------------------------------------------
 // Constants
@@ -3516,6 +3530,56 @@ TEST(Chapter14Tests, GettingAGroupedObjectsWorldTransformationMatrix)
 	ASSERT_EQ(x, Matrix4::Translation(5.0, 0.0, 0.0) * Matrix4::Scaling(1.0, 2.0, 3.0) * Matrix4::Rotation_Y(M_PI / 2.0));
 }
 
+TEST(Chapter14Tests, ChangingAParentTransformUpdatesTheCachedWorldTransform)
+{
+	auto g1 = std::make_shared<Group>();
+
+	auto s = std::make_shared<Sphere>();
+	s->set_transform(Matrix4::Translation(5.0, 0.0, 0.0));
+
+	g1->parent_children(std::vector<std::shared_ptr<ObjectBase>>({ s }));
+
+	// Populates the cache before the parent changes
+	ASSERT_EQ(s->point_to_object_space(Tuple::Point(5.0, 0.0, 0.0)), Tuple::Point(0.0, 0.0, 0.0));
+
+	g1->set_transform(Matrix4::Scaling(2.0, 2.0, 2.0));
+
+	ASSERT_EQ(s->point_to_object_space(Tuple::Point(10.0, 0.0, 0.0)), Tuple::Point(0.0, 0.0, 0.0));
+	ASSERT_EQ(s->get_world_transform(), Matrix4::Translation(5.0, 0.0, 0.0) * Matrix4::Scaling(2.0, 2.0, 2.0));
+}
+
+TEST(Chapter14Tests, ParentingAnObjectUpdatesTheCachedWorldTransform)
+{
+	auto g1 = std::make_shared<Group>();
+	g1->set_transform(Matrix4::Rotation_Y(M_PI / 2.0));
+
+	auto s = std::make_shared<Sphere>();
+
+	// Populates the cache before the object is parented
+	ASSERT_EQ(s->normal_at(Tuple::Point(0.0, 0.0, -1.0)), Tuple::Vector(0.0, 0.0, -1.0));
+
+	g1->parent_child(s);
+
+	ASSERT_EQ(s->normal_at(Tuple::Point(-1.0, 0.0, 0.0)), Tuple::Vector(-1.0, 0.0, 0.0));
+
+	g1->freeze_children();
+
+	ASSERT_FALSE(s->has_parent());
+	ASSERT_EQ(s->normal_at(Tuple::Point(-1.0, 0.0, 0.0)), Tuple::Vector(-1.0, 0.0, 0.0));
+}
+
+TEST(Chapter14Tests, ACopiedObjectHasAnIndependentTransform)
+{
+	Sphere s1 = Sphere();
+	s1.set_transform(Matrix4::Translation(1.0, 0.0, 0.0));
+
+	Sphere s2 = Sphere(s1);
+	s2.set_transform(Matrix4::Translation(0.0, 2.0, 0.0));
+
+	ASSERT_EQ(s1.point_to_world_space(Tuple::Origin()), Tuple::Point(1.0, 0.0, 0.0));
+	ASSERT_EQ(s2.point_to_world_space(Tuple::Origin()), Tuple::Point(0.0, 2.0, 0.0));
+}
+
 TEST(Chapter14Tests, ABoundingBoxHasDefaultDimensions)
 {
 	BoundingBox box = BoundingBox();
@@ -3623,6 +3687,9 @@ TEST(Quadtrees, InsertingAPoint)
 TEST(Quadtrees, InsertingManyPoints)
 {
 
+	// The points come from rand(), seed it so the result does not depend on the tests run before
+	srand(2);
+
 	auto qt = std::make_shared<QuadBranch<Sample>>(Tuple::Point2D(0.0, 0.0), Tuple::Point2D(1.0, 1.0), 7);
 
 	for (size_t i = 0; i < 200; i++)
@@ -4385,4 +4452,3495 @@ TEST(BoundingBox, IntersectingATranslatedSphereWithARay)
     bool bb_hit = S->get_definition()->bounding_box().intersect(r);
     EXPECT_FALSE(bb_hit);
 
-}
\ No newline at end of file
+}
+
+// ------------------------------------------------------------------------
+// Ray Differentials and Texture Filtering
+// ------------------------------------------------------------------------
+
+TEST(RayDifferentials, CameraRaysCarryDifferentialsToTheNeighboringPixels)
+{
+	Camera c = Camera(201, 101, M_PI / 2.0);
+
+	Ray r = c.ray_from_pixel(100, 50);
+	Ray rx = c.ray_from_pixel(101, 50);
+	Ray ry = c.ray_from_pixel(100, 51);
+
+	ASSERT_TRUE(r.has_differentials);
+	ASSERT_EQ(r.rx_origin, rx.origin);
+	ASSERT_EQ(r.rx_direction, rx.direction);
+	ASSERT_EQ(r.ry_origin, ry.origin);
+	ASSERT_EQ(r.ry_direction, ry.direction);
+}
+
+TEST(RayDifferentials, ScalingDifferentialsMovesThemTowardsTheMainRay)
+{
+	Ray r = Ray(Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 0.0, 1.0));
+	r.set_differentials(
+		Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(1.0, 0.0, 1.0), 
+		Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 1.0)
+	);
+
+	r.scale_differentials(0.5);
+
+	ASSERT_EQ(r.rx_direction, Tuple::Vector(0.5, 0.0, 1.0));
+	ASSERT_EQ(r.ry_direction, Tuple::Vector(0.0, 0.5, 1.0));
+}
+
+TEST(RayDifferentials, IntersectionsFindTheFootprintOfThePixel)
+{
+	auto p = std::make_shared<InfinitePlane>();
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+	r.set_differentials(
+		Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.1, -1.0, 0.0), 
+		Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.2)
+	);
+
+	IxComps comps = IxComps(Intersection(1.0, p), r);
+
+	ASSERT_TRUE(comps.has_differentials);
+	ASSERT_EQ(comps.dpdx, Tuple::Vector(0.1, 0.0, 0.0));
+	ASSERT_EQ(comps.dpdy, Tuple::Vector(0.0, 0.0, 0.2));
+}
+
+TEST(RayDifferentials, ARayWithoutDifferentialsHasNoFootprint)
+{
+	auto p = std::make_shared<InfinitePlane>();
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+
+	IxComps comps = IxComps(Intersection(1.0, p), r);
+
+	ASSERT_FALSE(comps.has_differentials);
+	ASSERT_EQ(comps.dpdx, Tuple::Vector(0.0, 0.0, 0.0));
+}
+
+TEST(RayDifferentials, AStripePatternAveragesAFootprintSpanningBothStripes)
+{
+	StripeMap pattern = StripeMap(WHITE, BLACK);
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(1.0, 0.0, 0.0);
+	comps.has_differentials = true;
+	comps.dpdx = Tuple::Vector(1.0, 0.0, 0.0);
+
+	ASSERT_EQ(pattern.sample_at(comps), Color(0.5));
+
+	// A footprint inside one stripe is unchanged
+	comps.point = Tuple::Point(0.5, 0.0, 0.0);
+	comps.dpdx = Tuple::Vector(0.1, 0.0, 0.0);
+
+	ASSERT_EQ(pattern.sample_at(comps), WHITE);
+}
+
+TEST(RayDifferentials, ACheckerPatternFadesToGrayWithALargeFootprint)
+{
+	CheckerMap pattern = CheckerMap(WHITE, BLACK);
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(0.3, 0.0, 0.3);
+	comps.has_differentials = true;
+	comps.dpdx = Tuple::Vector(2.0, 0.0, 0.0);
+	comps.dpdy = Tuple::Vector(0.0, 0.0, 2.0);
+
+	ASSERT_EQ(pattern.sample_at(comps), Color(0.5));
+}
+
+TEST(RayDifferentials, PerlinNoiseDropsOctavesSmallerThanTheFootprint)
+{
+	PerlinMap noise = PerlinMap(1234);
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(0.37, 1.21, 2.73);
+
+	Color unfiltered = noise.sample_at(comps);
+
+	// A tiny footprint keeps every octave
+	comps.has_differentials = true;
+	comps.dpdx = Tuple::Vector(0.0001, 0.0, 0.0);
+
+	ASSERT_EQ(noise.sample_at(comps), unfiltered);
+
+	// A footprint larger than the base lattice averages every octave away
+	comps.dpdx = Tuple::Vector(4.0, 0.0, 0.0);
+
+	ASSERT_EQ(noise.sample_at(comps), Color(0.5));
+}
+
+// ------------------------------------------------------------------------
+// Image Textures and the Texture Cache
+// ------------------------------------------------------------------------
+
+static std::string texture_test_path(const std::string & file_name)
+{
+	std::filesystem::path file_path = std::filesystem::temp_directory_path();
+	file_path /= "Raymond";
+	file_path /= "textures";
+	std::filesystem::create_directories(file_path);
+
+	file_path /= file_name;
+
+	return file_path.string();
+}
+
+// Black and white checks, one texel each
+static Canvas checker_canvas(int width, int height)
+{
+	Canvas c = Canvas(width, height);
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			c.write_pixel(x, y, ((x + y) % 2 == 0) ? WHITE : BLACK);
+		}
+	}
+
+	return c;
+}
+
+TEST(ImageMap, OpeningAPPMFileReadsItsHeader)
+{
+	const std::string path = texture_test_path("OpeningAPPMFileReadsItsHeader.ppm");
+	// Black and white are unchanged by the sRGB curve, so the file is written without it
+	canvas_to_ppm(checker_canvas(4, 2), path, false);
+
+	TextureCache cache = TextureCache();
+	std::shared_ptr<TextureFile> file = cache.open(path);
+
+	ASSERT_EQ(file->width, 4);
+	ASSERT_EQ(file->height, 2);
+	ASSERT_EQ(file->num_levels, 3);
+	ASSERT_EQ(file->level_width(1), 2);
+	ASSERT_EQ(file->level_height(1), 1);
+
+	// Nothing is loaded until a texel is asked for
+	ASSERT_EQ(cache.resident_tiles(), 0);
+
+	ASSERT_EQ(cache.texel(*file, 0, 0, 0), WHITE);
+	ASSERT_EQ(cache.texel(*file, 0, 1, 0), BLACK);
+	ASSERT_EQ(cache.texel(*file, 0, 1, 1), WHITE);
+
+	// Opening the same path again shares the file
+	ASSERT_EQ(cache.open(path), file);
+}
+
+TEST(ImageMap, AnASCIIFileWithWideSamplesIsReadFromItsConversion)
+{
+	const std::string path = texture_test_path("AnASCIIFileWithWideSamplesIsReadFromItsConversion.ppm");
+	{
+		std::ofstream ppm_file(path);
+		ppm_file << "P3\n# comment\n2 2\n65535\n65535 0 65535\n0 0 0\n0 65535 0\n65535 65535 65535\n";
+	}
+
+	TextureCache cache = TextureCache();
+	std::shared_ptr<TextureFile> file = cache.open(path);
+
+	ASSERT_EQ(file->format, PPMAsciiFormat);
+	ASSERT_EQ(cache.texel(*file, 0, 0, 0), Color(1.0, 0.0, 1.0));
+	ASSERT_EQ(cache.texel(*file, 0, 1, 0), BLACK);
+	ASSERT_EQ(cache.texel(*file, 0, 0, 1), Color(0.0, 1.0, 0.0));
+	ASSERT_EQ(cache.texel(*file, 0, 1, 1), WHITE);
+}
+
+TEST(ImageMap, TheGraphHashFollowsTheFile)
+{
+	const std::string path = texture_test_path("TheGraphHashFollowsTheFile.ppm");
+	canvas_to_ppm(checker_canvas(4, 2), path, false);
+
+	ImageMap image = ImageMap(path, std::make_shared<TextureCache>());
+	const uint64_t before = image.graph_hash();
+	ASSERT_EQ(image.graph_hash(), before);
+
+	// A file rewritten in place keeps its path, so baked copies of it are told apart by time
+	const auto modified = std::filesystem::last_write_time(path);
+	std::filesystem::last_write_time(path, modified + std::chrono::seconds(10));
+	ASSERT_NE(image.graph_hash(), before);
+}
+
+TEST(ImageMap, APFMFileKeepsLinearValues)
+{
+	const std::string path = texture_test_path("APFMFileKeepsLinearValues.pfm");
+
+	Canvas c = Canvas(3, 2);
+	c.write_pixel(0, 0, Color(2.5, 0.25, 0.0));
+	c.write_pixel(2, 1, Color(0.0, 8.0, 0.5));
+	canvas_to_pfm(c, path);
+
+	TextureCache cache = TextureCache();
+	std::shared_ptr<TextureFile> file = cache.open(path);
+
+	ASSERT_EQ(file->format, PFMFormat);
+	ASSERT_EQ(cache.texel(*file, 0, 0, 0), Color(2.5, 0.25, 0.0));
+	ASSERT_EQ(cache.texel(*file, 0, 2, 1), Color(0.0, 8.0, 0.5));
+	ASSERT_EQ(cache.texel(*file, 0, 1, 0), BLACK);
+}
+
+TEST(ImageMap, MipLevelsAverageTheLevelAbove)
+{
+	const std::string path = texture_test_path("MipLevelsAverageTheLevelAbove.pfm");
+	canvas_to_pfm(checker_canvas(4, 4), path);
+
+	TextureCache cache = TextureCache();
+	std::shared_ptr<TextureFile> file = cache.open(path);
+
+	ASSERT_EQ(cache.texel(*file, 1, 0, 0), Color(0.5));
+	ASSERT_EQ(cache.texel(*file, 2, 0, 0), Color(0.5));
+}
+
+TEST(ImageMap, PlanarMappingSamplesTexelCenters)
+{
+	const std::string path = texture_test_path("PlanarMappingSamplesTexelCenters.pfm");
+
+	Canvas c = Canvas(2, 2);
+	c.write_pixel(0, 0, Color(1.0, 0.0, 0.0));
+	c.write_pixel(1, 0, Color(0.0, 1.0, 0.0));
+	c.write_pixel(0, 1, Color(0.0, 0.0, 1.0));
+	c.write_pixel(1, 1, WHITE);
+	canvas_to_pfm(c, path);
+
+	ImageMap image = ImageMap(path, std::make_shared<TextureCache>());
+
+	// v runs up the image, so the top row is at the far end of z
+	ASSERT_EQ(image.sample_at_point(Tuple::Point(0.25, 0.0, 0.75)), Color(1.0, 0.0, 0.0));
+	ASSERT_EQ(image.sample_at_point(Tuple::Point(0.75, 0.0, 0.75)), Color(0.0, 1.0, 0.0));
+	ASSERT_EQ(image.sample_at_point(Tuple::Point(1.25, 0.0, -0.75)), Color(0.0, 0.0, 1.0));
+
+	// Halfway between two texels blends them
+	ASSERT_EQ(image.sample_at_point(Tuple::Point(0.5, 0.0, 0.75)), Color(0.5, 0.5, 0.0));
+}
+
+TEST(ImageMap, ALargeFootprintSamplesACoarserMipLevel)
+{
+	const std::string path = texture_test_path("ALargeFootprintSamplesACoarserMipLevel.pfm");
+	canvas_to_pfm(checker_canvas(8, 8), path);
+
+	ImageMap image = ImageMap(path, std::make_shared<TextureCache>());
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(0.0625, 0.0, 0.0625);
+	comps.has_differentials = true;
+
+	// Well under a texel, the checks stay sharp
+	comps.dpdx = Tuple::Vector(0.01, 0.0, 0.0);
+	comps.dpdy = Tuple::Vector(0.0, 0.0, 0.01);
+
+	ASSERT_EQ(image.sample_at(comps), BLACK);
+
+	// The footprint covers the whole image
+	comps.dpdx = Tuple::Vector(1.0, 0.0, 0.0);
+	comps.dpdy = Tuple::Vector(0.0, 0.0, 1.0);
+
+	ASSERT_EQ(image.sample_at(comps), Color(0.5));
+}
+
+TEST(ImageMap, TheCacheEvictsTheLeastRecentlyUsedTile)
+{
+	const std::string path = texture_test_path("TheCacheEvictsTheLeastRecentlyUsedTile.pfm");
+	canvas_to_pfm(checker_canvas(TextureCache::TILE_SIZE * 3, 1), path);
+
+	TextureCache cache = TextureCache();
+	std::shared_ptr<TextureFile> file = cache.open(path);
+
+	// Room for two tiles of 64 x 1 texels
+	cache.set_memory_limit(2 * TextureTile(TextureCache::TILE_SIZE, 1).bytes());
+
+	cache.texel(*file, 0, 0, 0);
+	cache.texel(*file, 0, TextureCache::TILE_SIZE, 0);
+	cache.texel(*file, 0, 0, 0);
+	cache.texel(*file, 0, TextureCache::TILE_SIZE * 2, 0);
+
+	ASSERT_EQ(cache.resident_tiles(), 2);
+	ASSERT_LE(cache.resident_bytes(), cache.memory_limit());
+	ASSERT_EQ(cache.misses(), 3);
+	ASSERT_EQ(cache.hits(), 1);
+
+	// The second tile was the least recently used, the first is still resident
+	cache.texel(*file, 0, 0, 0);
+	ASSERT_EQ(cache.hits(), 2);
+
+	cache.texel(*file, 0, TextureCache::TILE_SIZE, 0);
+	ASSERT_EQ(cache.misses(), 4);
+	ASSERT_DOUBLE_EQ(cache.hit_rate(), 2.0 / 6.0);
+}
+
+// ------------------------------------------------------------------------
+// Compiled TexMap Graphs
+// ------------------------------------------------------------------------
+
+TEST(TexMapProgram, SolidColorBranchesFoldToAConstant)
+{
+	auto composite = std::make_shared<CompositeMap>(Color(0.25), Color(0.5), CompAdd, 1.0);
+	auto stripes = std::make_shared<StripeMap>(
+		std::static_pointer_cast<TexMap>(composite), 
+		std::static_pointer_cast<TexMap>(std::make_shared<SolidColorMap>(Color(0.75)))
+	);
+
+	std::shared_ptr<TexMapProgram> program = TexMapProgram::compile(stripes);
+
+	ASSERT_TRUE(program != nullptr);
+	ASSERT_TRUE(program->is_constant());
+	ASSERT_EQ(program->size(), 1);
+	ASSERT_EQ(program->evaluate(IxComps()), Color(0.75));
+}
+
+TEST(TexMapProgram, MapsWithTheSameTransformShareAFrame)
+{
+	auto stripe1 = std::make_shared<StripeMap>(WHITE, BLACK);
+	stripe1->transform->set_transform(Matrix4::Scaling(0.5, 0.5, 0.5));
+	auto stripe2 = std::make_shared<StripeMap>(Color(0.5), BLACK);
+	stripe2->transform->set_transform(Matrix4::Scaling(0.5, 0.5, 0.5));
+
+	auto composite = std::make_shared<CompositeMap>(stripe1, stripe2, CompAdd, 1.0);
+
+	std::shared_ptr<TexMapProgram> program = TexMapProgram::compile(composite);
+
+	int transforms = 0;
+	for (const TexMapInstruction & ins : program->get_instructions())
+	{
+		if (ins.op == TexOpTransform)
+		{
+			transforms++;
+		}
+	}
+
+	ASSERT_EQ(transforms, 1);
+}
+
+TEST(TexMapProgram, ACompiledGraphMatchesTheNodeGraph)
+{
+	auto s = std::make_shared<Sphere>();
+	s->set_transform(Matrix4::Translation(0.5, 1.0, -0.25) * Matrix4::Scaling(2.0, 2.0, 2.0));
+
+	auto noise = std::make_shared<ColoredPerlin>(32255);
+
+	auto stripes = std::make_shared<StripeMap>(Color(1.0, 0.0, 0.0), Color(0.1));
+	stripes->set_mapping_space(ObjectSpace);
+	stripes->transform->set_transform(Matrix4::Scaling(0.1, 0.1, 0.1));
+
+	auto perturb = std::make_shared<PerturbMap>(stripes, noise);
+	perturb->displacement_remap = true;
+	perturb->scale = 0.1;
+
+	auto checkers = std::make_shared<CheckerMap>(
+		std::static_pointer_cast<TexMap>(perturb), 
+		std::static_pointer_cast<TexMap>(std::make_shared<RingMap>(WHITE, Color(0.0, 0.0, 1.0)))
+	);
+	checkers->transform->set_transform(Matrix4::Rotation_Y(0.5) * Matrix4::Scaling(0.3, 0.3, 0.3));
+
+	auto gradient = std::make_shared<GradientMap>(std::make_shared<TestMap>(), checkers);
+
+	auto root = std::make_shared<ChannelMap>(gradient, checkers, std::make_shared<CompositeMap>(checkers, noise, CompOverlay, 0.5));
+
+	std::shared_ptr<TexMapProgram> program = TexMapProgram::compile(root);
+	ASSERT_TRUE(program != nullptr);
+
+	IxComps comps = IxComps();
+	comps.object = s;
+	comps.normal_v = Tuple::Vector(0.0, 1.0, 0.0);
+
+	for (int i = 0; i < 200; i++)
+	{
+		comps.point = Tuple::Point(sin(i * 0.37) * 3.0, cos(i * 0.91) * 2.0, (i * 0.05) - 5.0);
+
+		comps.has_differentials = (i % 2 == 1);
+		comps.dpdx = Tuple::Vector(0.01 * (i % 7), 0.0, 0.02);
+		comps.dpdy = Tuple::Vector(0.0, 0.03 * (i % 5), 0.01);
+
+		ASSERT_EQ(program->evaluate(comps), root->sample_at(comps));
+	}
+}
+
+TEST(TexMapProgram, ConnectingASlotCompilesTheGraph)
+{
+	ColorMapSlot slot = ColorMapSlot();
+	slot.connect(std::make_shared<StripeMap>(WHITE, BLACK));
+
+	ASSERT_TRUE(slot.get_program() != nullptr);
+
+	slot.disconnect();
+
+	ASSERT_TRUE(slot.get_program() == nullptr);
+}
+
+TEST(TexMapProgram, EditingAConnectedGraphIsSeenByTheSlot)
+{
+	auto solid = std::make_shared<SolidColorMap>(WHITE);
+	auto stripes = std::make_shared<StripeMap>(std::static_pointer_cast<TexMap>(solid), std::make_shared<SolidColorMap>(BLACK));
+
+	ColorMapSlot slot = ColorMapSlot();
+	slot.connect(stripes);
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(0.5, 0.0, 0.0);
+	ASSERT_EQ(slot.sample_at(comps), WHITE);
+
+	// Moves the point into the second stripe
+	stripes->transform->set_transform(Matrix4::Translation(-1.0, 0.0, 0.0));
+	std::shared_ptr<const TexMapProgram> before = slot.get_program();
+	slot.compile();
+	ASSERT_NE(slot.get_program(), before);
+	ASSERT_EQ(slot.sample_at(comps), BLACK);
+	ASSERT_EQ(slot.sample_at(comps), stripes->sample_at(comps));
+
+	// An unchanged graph keeps its program
+	before = slot.get_program();
+	slot.compile();
+	ASSERT_EQ(slot.get_program(), before);
+
+	// Folded constants follow their maps too
+	stripes->transform->set_transform(Matrix4::Identity());
+	solid->col = Color(0.2, 0.4, 0.6);
+	slot.compile();
+	ASSERT_EQ(slot.sample_at(comps), Color(0.2, 0.4, 0.6));
+
+	stripes->a = std::make_shared<SolidColorMap>(Color(1.0, 0.0, 0.0));
+	slot.compile();
+	ASSERT_EQ(slot.sample_at(comps), Color(1.0, 0.0, 0.0));
+}
+
+TEST(TexMapProgram, EveryRenderCompilesTheEditedGraphsOfItsMaterials)
+{
+	auto stripes = std::make_shared<StripeMap>(WHITE, BLACK);
+
+	auto sphere = std::make_shared<Sphere>();
+	auto material = std::dynamic_pointer_cast<PhongMaterial>(sphere->material);
+	material->color.connect(stripes);
+
+	// Inside a group, so children are reached too
+	auto group = std::make_shared<Group>();
+	group->parent_child(sphere);
+
+	World w = World();
+	w.add_object(group);
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(0.5, 0.0, 0.0);
+	ASSERT_EQ(material->color.sample_at(comps), WHITE);
+
+	stripes->transform->set_transform(Matrix4::Translation(-1.0, 0.0, 0.0));
+	w.begin_frame();
+	ASSERT_EQ(material->color.sample_at(comps), BLACK);
+}
+
+// ------------------------------------------------------------------------
+// Batched Noise
+// ------------------------------------------------------------------------
+
+TEST(BatchedNoise, BatchedPerlinMatchesCompatibilityMode)
+{
+	PerlinMap batched = PerlinMap(4321);
+	batched.octaves = 6;
+	batched.persistence = 0.6;
+
+	PerlinMap compatible = PerlinMap(4321);
+	compatible.octaves = 6;
+	compatible.persistence = 0.6;
+	compatible.compatibility_mode = true;
+
+	IxComps comps = IxComps();
+
+	for (int i = 0; i < 500; i++)
+	{
+		comps.point = Tuple::Point(sin(i * 0.37) * 30.0, cos(i * 0.91) * 20.0, (i * 0.13) - 25.0);
+
+		comps.has_differentials = (i % 2 == 1);
+		comps.dpdx = Tuple::Vector(0.01 * (i % 11), 0.0, 0.0);
+
+		// The batched kernel rounds to float
+		ASSERT_NEAR(batched.sample_at(comps).x, compatible.sample_at(comps).x, 1.0e-6);
+	}
+}
+
+TEST(BatchedNoise, BatchedColoredPerlinMatchesCompatibilityMode)
+{
+	ColoredPerlin batched = ColoredPerlin(32255);
+	ColoredPerlin compatible = ColoredPerlin(32255);
+	compatible.compatibility_mode = true;
+
+	for (int i = 0; i < 500; i++)
+	{
+		Tuple point = Tuple::Point(i * 0.173, i * -0.061, i * 0.029);
+
+		ASSERT_EQ(batched.sample_at_point(point), compatible.sample_at_point(point));
+	}
+}
+
+TEST(BatchedNoise, SimplexNoiseStaysInRange)
+{
+	PerlinMap noise = PerlinMap(99);
+	noise.basis = SimplexNoiseBasis;
+	noise.octaves = 4;
+
+	double lowest = 1.0;
+	double highest = 0.0;
+
+	for (int i = 0; i < 2000; i++)
+	{
+		double value = noise.sample_at_point(Tuple::Point(i * 0.0731, i * 0.0419, i * -0.0177)).x;
+
+		lowest = std::min(lowest, value);
+		highest = std::max(highest, value);
+	}
+
+	ASSERT_GE(lowest, 0.0);
+	ASSERT_LE(highest, 1.0);
+	// Not flat
+	ASSERT_GT(highest - lowest, 0.2);
+}
+
+TEST(BatchedNoise, FilteredSimplexNoiseFadesToGray)
+{
+	PerlinMap noise = PerlinMap(99);
+	noise.basis = SimplexNoiseBasis;
+
+	IxComps comps = IxComps();
+	comps.point = Tuple::Point(0.37, 1.21, 2.73);
+	comps.has_differentials = true;
+	comps.dpdx = Tuple::Vector(4.0, 0.0, 0.0);
+
+	ASSERT_EQ(noise.sample_at(comps), Color(0.5));
+}
+
+// ------------------------------------------------------------------------
+// Baked Maps
+// ------------------------------------------------------------------------
+
+TEST(BakedMap, HalfFloatsRoundTrip)
+{
+	ASSERT_EQ(half_to_float(float_to_half(0.0f)), 0.0f);
+	ASSERT_EQ(half_to_float(float_to_half(1.0f)), 1.0f);
+	ASSERT_EQ(half_to_float(float_to_half(-0.5f)), -0.5f);
+	ASSERT_EQ(half_to_float(float_to_half(65504.0f)), 65504.0f);
+	// Smallest subnormal
+	ASSERT_EQ(half_to_float(float_to_half(5.9604645e-8f)), 5.9604645e-8f);
+	ASSERT_TRUE(std::isinf(half_to_float(float_to_half(70000.0f))));
+	ASSERT_NEAR(half_to_float(float_to_half(1.0f / 3.0f)), 1.0f / 3.0f, 1.0e-4f);
+}
+
+TEST(BakedMap, BakedSamplesMatchTheSource)
+{
+	auto source = std::make_shared<TestMap>();
+	BakedMap baked = BakedMap(source, BoundingBox(Tuple::Point(-1.0, -2.0, -1.0), Tuple::Point(1.0, 2.0, 1.0)), 9);
+	baked.cache_directory = "";
+
+	ASSERT_FALSE(baked.bake());
+	ASSERT_TRUE(baked.is_baked());
+	ASSERT_EQ(baked.grid_width(), 5);
+	ASSERT_EQ(baked.grid_height(), 9);
+	ASSERT_EQ(baked.grid_depth(), 5);
+
+	// A linear source is reproduced exactly by trilinear interpolation, up to half precision
+	for (int i = 0; i < 100; i++)
+	{
+		Tuple point = Tuple::Point(sin(i * 1.3), 2.0 * cos(i * 0.7), sin(i * 2.9));
+		Color expected = source->sample_at_point(point);
+		Color result = baked.sample_at_point(point);
+
+		ASSERT_NEAR(result.x, expected.x, 2.0e-3);
+		ASSERT_NEAR(result.y, expected.y, 2.0e-3);
+		ASSERT_NEAR(result.z, expected.z, 2.0e-3);
+	}
+}
+
+TEST(BakedMap, PointsOutsideTheBoundsSampleTheSource)
+{
+	auto source = std::make_shared<TestMap>();
+	BakedMap baked = BakedMap(source, BoundingBox(Tuple::Point(-1.0, -1.0, -1.0), Tuple::Point(1.0, 1.0, 1.0)), 4);
+	baked.cache_directory = "";
+	baked.bake();
+
+	Tuple point = Tuple::Point(3.0, -5.0, 0.25);
+	ASSERT_EQ(baked.sample_at_point(point), source->sample_at_point(point));
+}
+
+TEST(BakedMap, TheGraphHashFollowsTheParameters)
+{
+	auto noise_a = std::make_shared<PerlinMap>(7);
+	auto noise_b = std::make_shared<PerlinMap>(7);
+
+	ASSERT_EQ(noise_a->graph_hash(), noise_b->graph_hash());
+
+	noise_b->octaves = noise_a->octaves + 1;
+	ASSERT_NE(noise_a->graph_hash(), noise_b->graph_hash());
+
+	// Seeds change the permutation table
+	ASSERT_NE(PerlinMap(7).graph_hash(), PerlinMap(8).graph_hash());
+
+	// Children and transforms are part of the hash
+	StripeMap stripes_a = StripeMap(Color(0.0), Color(1.0));
+	StripeMap stripes_b = StripeMap(Color(0.0), Color(0.5));
+	ASSERT_NE(stripes_a.graph_hash(), stripes_b.graph_hash());
+
+	stripes_b.b = std::make_shared<SolidColorMap>(Color(1.0));
+	ASSERT_EQ(stripes_a.graph_hash(), stripes_b.graph_hash());
+
+	stripes_b.transform->set_transform(Matrix4::Scaling(2.0, 2.0, 2.0));
+	ASSERT_NE(stripes_a.graph_hash(), stripes_b.graph_hash());
+}
+
+TEST(BakedMap, ASecondBakeLoadsTheFirstFromDisk)
+{
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "raymond_bake_test";
+	std::filesystem::remove_all(directory);
+
+	auto noise = std::make_shared<PerlinMap>(3);
+	BoundingBox bounds = BoundingBox(Tuple::Point(0.0, 0.0, 0.0), Tuple::Point(2.0, 1.0, 1.0));
+
+	BakedMap first = BakedMap(noise, bounds, 16);
+	first.cache_directory = directory.string();
+	ASSERT_FALSE(first.bake());
+	ASSERT_TRUE(std::filesystem::exists(first.cache_path()));
+
+	BakedMap second = BakedMap(std::make_shared<PerlinMap>(3), bounds, 16);
+	second.cache_directory = directory.string();
+	ASSERT_EQ(second.cache_path(), first.cache_path());
+	ASSERT_TRUE(second.bake());
+
+	for (int i = 0; i < 20; i++)
+	{
+		Tuple point = Tuple::Point(i * 0.1, i * 0.05, i * 0.03);
+		ASSERT_EQ(second.sample_at_point(point), first.sample_at_point(point));
+	}
+
+	// A different graph does not pick up the old bake
+	BakedMap other = BakedMap(std::make_shared<PerlinMap>(4), bounds, 16);
+	other.cache_directory = directory.string();
+	ASSERT_NE(other.cache_path(), first.cache_path());
+	ASSERT_FALSE(other.bake());
+
+	std::filesystem::remove_all(directory);
+}
+
+TEST(BakedMap, TempFileNamesAreUniqueWithinTheProcess)
+{
+	const std::string first = temp_file_path("bake.rbk");
+	const std::string second = temp_file_path("bake.rbk");
+
+	ASSERT_NE(first, second);
+	ASSERT_EQ(first.rfind("bake.rbk.tmp", 0), size_t(0));
+}
+
+// ------------------------------------------------------------------------
+// Integrator
+// ------------------------------------------------------------------------
+
+TEST(Integrator, ASurfaceThatReflectsAndRefractsTracesOneBranch)
+{
+	World w = World();
+	w.background = std::make_shared<NormalGradientBackground>();
+
+	auto floor = std::make_shared<InfinitePlane>();
+	w.add_object(floor);
+
+	auto floor_mat = std::dynamic_pointer_cast<PhongMaterial>(floor->material);
+	floor_mat->reflection.set_value(Color(0.6));
+	floor_mat->refraction.set_value(Color(0.2));
+	floor_mat->use_schlick = false;
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+	Intersections xs = Intersections({ Intersection(sqrt(2.0), floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	// Both branches only see the background, so tracing them both is exact
+	Color expected = floor_mat->reflect(w, comps) + floor_mat->refract(w, comps);
+
+	Color total = Color(0.0);
+	const int samples = 2000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		Sample sample = w.shade(comps);
+
+		// Only one of the two is traced
+		ASSERT_TRUE(sample.Reflection == Color(0.0) || sample.Refraction == Color(0.0));
+
+		total = total + sample.get_calculated_rgb();
+	}
+
+	Color average = total / double(samples);
+
+	ASSERT_NEAR(average.x, expected.x, 0.02);
+	ASSERT_NEAR(average.y, expected.y, 0.02);
+	ASSERT_NEAR(average.z, expected.z, 0.02);
+}
+
+TEST(Integrator, RussianRouletteKeepsTheAverageOfADimPath)
+{
+	World w = World();
+	w.background = std::make_shared<NormalGradientBackground>();
+
+	auto mirror = std::make_shared<InfinitePlane>();
+	w.add_object(mirror);
+
+	auto mirror_mat = std::dynamic_pointer_cast<PhongMaterial>(mirror->material);
+	mirror_mat->reflection.set_value(Color(0.2));
+	mirror_mat->use_schlick = false;
+
+	// Deep enough that the reflected ray is subject to russian roulette
+	Ray r = Ray(Tuple::Point(0.0, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0), RUSSIAN_ROULETTE_DEPTH - 1);
+	Intersections xs = Intersections({ Intersection(sqrt(2.0), mirror) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	Color expected = mirror_mat->reflect(w, comps);
+
+	Color total = Color(0.0);
+	int terminated = 0;
+	const int samples = 4000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		Color c = w.color_at(r);
+
+		if (c == Color(0.0))
+		{
+			terminated++;
+		}
+
+		total = total + c;
+	}
+
+	Color average = total / double(samples);
+
+	// Most of the paths end early, the survivors make up for them
+	ASSERT_GT(terminated, samples / 2);
+	ASSERT_NEAR(average.x, expected.x, 0.02);
+	ASSERT_NEAR(average.y, expected.y, 0.02);
+	ASSERT_NEAR(average.z, expected.z, 0.02);
+}
+
+// ------------------------------------------------------------------------
+// Global Illumination
+// ------------------------------------------------------------------------
+
+// A floor inside a sphere that glows with ambient light only, so every gather ray sees 1.0
+static World enclosed_gi_world(std::shared_ptr<InfinitePlane> & floor)
+{
+	World w = World();
+	w.add_object(std::make_shared<PointLight>(Tuple::Point(0.0, 5.0, 0.0), Color(1.0)));
+
+	auto dome = std::make_shared<Sphere>();
+	dome->set_transform(Matrix4::Scaling(10.0, 10.0, 10.0));
+	auto dome_mat = std::dynamic_pointer_cast<PhongMaterial>(dome->material);
+	dome_mat->color.set_value(Color(1.0));
+	dome_mat->ambient.set_value(Color(1.0));
+	dome_mat->diffuse.set_value(0.0);
+	dome_mat->specular.set_value(0.0);
+	w.add_object(dome);
+
+	floor = std::make_shared<InfinitePlane>();
+	auto floor_mat = std::dynamic_pointer_cast<PhongMaterial>(floor->material);
+	floor_mat->color.set_value(Color(0.5, 0.25, 1.0));
+	floor_mat->diffuse.set_value(0.8);
+	w.add_object(floor);
+
+	w.gi_subdivs = 16;
+
+	return w;
+}
+
+TEST(GlobalIllumination, CosineHemisphereDirectionsFaceTheNormal)
+{
+	Tuple normal = Tuple::Vector(1.0, 2.0, -3.0).normalize();
+	double cosine_total = 0.0;
+	const int samples = 1000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		Tuple d = Tuple::CosineHemisphere(normal, random_double(), random_double());
+
+		ASSERT_NEAR(d.magnitude(), 1.0, EPSILON);
+		ASSERT_GE(Tuple::dot(d, normal), 0.0);
+		ASSERT_EQ(d.w, 0.0);
+
+		cosine_total += Tuple::dot(d, normal);
+	}
+
+	// The mean cosine of a cosine weighted hemisphere is 2/3
+	ASSERT_NEAR(cosine_total / samples, 2.0 / 3.0, 0.03);
+}
+
+TEST(GlobalIllumination, GlobalIlluminationIsOffByDefault)
+{
+	std::shared_ptr<InfinitePlane> floor;
+	World w = enclosed_gi_world(floor);
+	w.gi_subdivs = 0;
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+	Intersections xs = Intersections({ Intersection(sqrt(2.0), floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	ASSERT_EQ(w.shade(comps).GlobalIllumination, Color(0.0));
+	ASSERT_EQ(w.irradiance_cache->size(), 0);
+}
+
+TEST(GlobalIllumination, ABruteForceGatherSeesTheSurroundings)
+{
+	std::shared_ptr<InfinitePlane> floor;
+	World w = enclosed_gi_world(floor);
+	w.irradiance_cache = nullptr;
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+	Intersections xs = Intersections({ Intersection(sqrt(2.0), floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	ASSERT_EQ(w.shade(comps).GlobalIllumination, Color(0.4, 0.2, 0.8));
+}
+
+TEST(GlobalIllumination, NearbyPointsReuseACachedEstimate)
+{
+	std::shared_ptr<InfinitePlane> floor;
+	World w = enclosed_gi_world(floor);
+
+	for (double x : { 0.0, 0.01, -0.02 })
+	{
+		Ray r = Ray(Tuple::Point(x, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+		Intersections xs = Intersections({ Intersection(sqrt(2.0), floor) });
+		IxComps comps = IxComps(xs[0], r, xs);
+
+		ASSERT_EQ(w.shade(comps).GlobalIllumination, Color(0.4, 0.2, 0.8));
+	}
+
+	ASSERT_EQ(w.irradiance_cache->size(), 1);
+
+	// Far enough away to need its own estimate
+	Ray r = Ray(Tuple::Point(5.0, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+	Intersections xs = Intersections({ Intersection(sqrt(2.0), floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+	w.shade(comps);
+
+	ASSERT_EQ(w.irradiance_cache->size(), 2);
+}
+
+TEST(GlobalIllumination, EveryRenderStartsWithAnEmptyCache)
+{
+	std::shared_ptr<InfinitePlane> floor;
+	World w = enclosed_gi_world(floor);
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, -1.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+	Intersections xs = Intersections({ Intersection(sqrt(2.0), floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+	w.shade(comps);
+	ASSERT_EQ(w.irradiance_cache->size(), 1);
+
+	// An empty scene sharing the cache stores nothing of its own, and keeps nothing from before
+	World empty = World();
+	empty.irradiance_cache = w.irradiance_cache;
+	empty.gi_subdivs = w.gi_subdivs;
+
+	Camera c = Camera(4, 4, M_PI / 2.0);
+	c.render(empty);
+	ASSERT_EQ(w.irradiance_cache->size(), 0);
+
+	w.shade(comps);
+	ASSERT_EQ(w.irradiance_cache->size(), 1);
+	c.multi_sample_threaded_render(empty);
+	ASSERT_EQ(w.irradiance_cache->size(), 0);
+}
+
+TEST(GlobalIllumination, RecordsAreOnlyValidNearbyAndFacingTheSameWay)
+{
+	IrradianceCache cache = IrradianceCache();
+	cache.insert(Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), Color(0.5), 1.0);
+
+	Color irradiance;
+
+	ASSERT_TRUE(cache.lookup(Tuple::Point(0.1, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), irradiance));
+	ASSERT_EQ(irradiance, Color(0.5));
+
+	ASSERT_FALSE(cache.lookup(Tuple::Point(2.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), irradiance));
+	ASSERT_FALSE(cache.lookup(Tuple::Point(0.1, 0.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0), irradiance));
+
+	cache.clear();
+	ASSERT_EQ(cache.size(), 0);
+	ASSERT_FALSE(cache.lookup(Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), irradiance));
+}
+
+// ------------------------------------------------------------------------
+// Light Tree
+// ------------------------------------------------------------------------
+
+static std::vector<std::shared_ptr<Light>> light_grid(int count)
+{
+	std::vector<std::shared_ptr<Light>> lights;
+
+	for (int i = 0; i < count; i++)
+	{
+		auto lgt = std::make_shared<PointLight>(Tuple::Point((i % 5) * 4.0 - 8.0, 3.0 + (i % 3), (i / 5) * 4.0), Color(1.0), 10.0 + i);
+		lgt->falloff = true;
+		lights.push_back(lgt);
+	}
+
+	return lights;
+}
+
+TEST(LightTree, OnlyLightsWithFalloffAreIndexed)
+{
+	auto lights = light_grid(6);
+	lights.push_back(std::make_shared<PointLight>(Tuple::Point(0.0, 10.0, 0.0), Color(1.0)));
+
+	LightTree tree = LightTree(lights);
+
+	ASSERT_EQ(tree.size(), 6);
+}
+
+TEST(LightTree, InversePicksAverageToTheNumberOfLights)
+{
+	LightTree tree = LightTree(light_grid(13));
+	Tuple point = Tuple::Point(1.0, 0.0, 2.0);
+
+	// Every light must be reachable, and pdf must match how often it is picked
+	const int samples = 100000;
+	double total = 0.0;
+
+	for (int i = 0; i < samples; i++)
+	{
+		std::shared_ptr<Light> lgt;
+		double pdf;
+
+		ASSERT_TRUE(tree.sample(point, (i + 0.5) / samples, lgt, pdf));
+		total += 1.0 / pdf;
+	}
+
+	ASSERT_NEAR(total / samples, 13.0, 0.05);
+}
+
+TEST(LightTree, NearbyLightsArePickedMostOften)
+{
+	auto lights = light_grid(10);
+	LightTree tree = LightTree(lights);
+
+	Tuple point = lights[7]->position() - Tuple::Vector(0.0, 0.5, 0.0);
+	int picked = 0;
+
+	for (int i = 0; i < 100; i++)
+	{
+		std::shared_ptr<Light> lgt;
+		double pdf;
+
+		tree.sample(point, (i + 0.5) / 100.0, lgt, pdf);
+		if (lgt == lights[7])
+		{
+			picked++;
+		}
+	}
+
+	// Three times as often as picking uniformly would
+	ASSERT_GT(picked, 30);
+}
+
+TEST(LightTree, SampledLightsMatchEvaluatingEveryLight)
+{
+	World w = World();
+	w.shadow_subdivs = 1;
+
+	auto floor = std::make_shared<InfinitePlane>();
+	w.add_object(floor);
+
+	for (const std::shared_ptr<Light> & lgt : light_grid(20))
+	{
+		std::static_pointer_cast<PointLight>(lgt)->radius = 0.0;
+		w.add_object(lgt);
+	}
+
+	Ray r = Ray(Tuple::Point(0.5, 1.0, 3.0), Tuple::Vector(0.0, -1.0, 0.0));
+	Intersections xs = Intersections({ Intersection(1.0, floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	Color expected = w.shade(comps).Lighting;
+
+	w.light_samples = 4;
+	Color total = Color(0.0);
+	const int samples = 4000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		total = total + w.shade(comps).Lighting;
+	}
+
+	Color average = total / double(samples);
+
+	ASSERT_NEAR(average.x / expected.x, 1.0, 0.03);
+	ASSERT_NEAR(average.y / expected.y, 1.0, 0.03);
+	ASSERT_NEAR(average.z / expected.z, 1.0, 0.03);
+}
+
+TEST(LightTree, RemovedLightsAreNoLongerSampled)
+{
+	World w = World();
+	w.shadow_subdivs = 1;
+	w.light_samples = 1;
+
+	auto floor = std::make_shared<InfinitePlane>();
+	w.add_object(floor);
+
+	for (const std::shared_ptr<Light> & lgt : light_grid(20))
+	{
+		std::static_pointer_cast<PointLight>(lgt)->radius = 0.0;
+		w.add_object(lgt);
+	}
+
+	Ray r = Ray(Tuple::Point(0.5, 1.0, 3.0), Tuple::Vector(0.0, -1.0, 0.0));
+	Intersections xs = Intersections({ Intersection(1.0, floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	// Sampled once, so the tree is built before the lights change
+	w.shade(comps);
+	while (w.get_lights().size() > 2)
+	{
+		w.remove_light(0);
+	}
+
+	Color total = Color(0.0);
+	const int samples = 4000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		total = total + w.shade(comps).Lighting;
+	}
+
+	Color average = total / double(samples);
+
+	w.light_samples = 0;
+	Color expected = w.shade(comps).Lighting;
+
+	ASSERT_NEAR(average.x / expected.x, 1.0, 0.03);
+	ASSERT_NEAR(average.y / expected.y, 1.0, 0.03);
+	ASSERT_NEAR(average.z / expected.z, 1.0, 0.03);
+}
+
+// ------------------------------------------------------------------------
+// Area Lights
+// ------------------------------------------------------------------------
+
+static std::vector<std::shared_ptr<Light>> area_lights(double height, double size)
+{
+	auto rect = std::make_shared<RectLight>(Color(1.0, 0.8, 0.6), 10.0, size, size * 0.5);
+	rect->set_transform(Matrix4::Translation(0.0, height, 0.0));
+
+	auto disk = std::make_shared<DiskLight>(Color(1.0, 0.8, 0.6), 10.0, size * 0.5);
+	disk->set_transform(Matrix4::Translation(0.0, height, 0.0));
+
+	auto sphere = std::make_shared<SphereLight>(Tuple::Point(0.0, height, 0.0), Color(1.0, 0.8, 0.6), 10.0, size * 0.5);
+
+	return { rect, disk, sphere };
+}
+
+// Lighting at the origin of a floor, averaged over many shades
+static Color average_floor_lighting(World & w, int samples)
+{
+	Ray r = Ray(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+	Intersections xs = Intersections({ Intersection(1.0, w.get_primitives()[0]) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	Color total = Color(0.0);
+	for (int i = 0; i < samples; i++)
+	{
+		total = total + w.shade(comps).Lighting;
+	}
+
+	return total / double(samples);
+}
+
+TEST(AreaLights, SamplesMatchIntersections)
+{
+	Tuple point = Tuple::Point(0.3, 0.0, 0.2);
+
+	for (const std::shared_ptr<Light> & lgt : area_lights(3.0, 1.0))
+	{
+		for (int i = 0; i < 50; i++)
+		{
+			LightSample sample, hit;
+
+			ASSERT_TRUE(lgt->sample_light(point, random_double(), random_double(), sample));
+			ASSERT_TRUE(lgt->intersect_light(point, sample.direction, hit));
+			ASSERT_NEAR(sample.distance, hit.distance, 1e-6);
+			ASSERT_NEAR(sample.pdf / hit.pdf, 1.0, 1e-6);
+			ASSERT_TRUE(hit.point == sample.point);
+		}
+	}
+}
+
+TEST(AreaLights, OnlyTheFrontOfARectEmits)
+{
+	RectLight lgt = RectLight(Color(1.0), 1.0, 1.0, 1.0);
+	LightSample sample;
+
+	ASSERT_TRUE(lgt.sample_light(Tuple::Point(0.0, -1.0, 0.0), 0.5, 0.5, sample));
+	ASSERT_FALSE(lgt.sample_light(Tuple::Point(0.0, 1.0, 0.0), 0.5, 0.5, sample));
+	ASSERT_FALSE(lgt.intersect_light(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0), sample));
+}
+
+TEST(AreaLights, RectIsSampledByItsSolidAngle)
+{
+	const double a = 2.0, b = 1.0, d = 1.5;
+	RectLight lgt = RectLight(Color(1.0), 1.0, a, b);
+	lgt.set_transform(Matrix4::Translation(0.0, d, 0.0));
+
+	// Solid angle of a rectangle seen from a point on its axis
+	double solid_angle = 4.0 * asin((a * b) / sqrt(((a * a) + (4.0 * d * d)) * ((b * b) + (4.0 * d * d))));
+
+	LightSample sample;
+	ASSERT_TRUE(lgt.sample_light(Tuple::Point(0.0, 0.0, 0.0), 0.3, 0.7, sample));
+	ASSERT_NEAR(sample.pdf, 1.0 / solid_angle, 1e-6);
+}
+
+TEST(AreaLights, DistantAreaLightsMatchAPointLight)
+{
+	auto reference = std::make_shared<PointLight>(Tuple::Point(0.0, 10.0, 0.0), Color(1.0, 0.8, 0.6), 10.0, 0.0);
+	reference->falloff = true;
+
+	World pw = World();
+	pw.add_object(std::make_shared<InfinitePlane>());
+	pw.add_object(reference);
+	Color expected = average_floor_lighting(pw, 1);
+
+	for (const std::shared_ptr<Light> & lgt : area_lights(10.0, 0.2))
+	{
+		World w = World();
+		w.shadow_subdivs = 4;
+		w.add_object(std::make_shared<InfinitePlane>());
+		w.add_object(lgt);
+
+		Color average = average_floor_lighting(w, 100);
+
+		ASSERT_NEAR(average.x / expected.x, 1.0, 0.01);
+		ASSERT_NEAR(average.y / expected.y, 1.0, 0.01);
+		ASSERT_NEAR(average.z / expected.z, 1.0, 0.01);
+	}
+}
+
+TEST(AreaLights, LightsBehindTheSurfaceOnlyAddAmbient)
+{
+	auto lgt = std::make_shared<SphereLight>(Tuple::Point(0.0, -3.0, 0.0), Color(1.0), 10.0, 0.5);
+
+	World w = World();
+	w.add_object(std::make_shared<InfinitePlane>());
+	w.add_object(lgt);
+
+	double intensity = lgt->color.magnitude() * lgt->multiplier / 9.0;
+	Color expected = PhongMaterial().lighting(lgt, Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0), true) * intensity;
+
+	ASSERT_TRUE(average_floor_lighting(w, 1) == expected);
+}
+
+TEST(AreaLights, LightsCanSkipShadows)
+{
+	auto lgt = std::make_shared<PointLight>(Tuple::Point(0.0, 10.0, 0.0), Color(1.0));
+	lgt->casts_shadows = false;
+
+	World w = World();
+	w.add_object(std::make_shared<InfinitePlane>());
+	w.add_object(lgt);
+	Color unblocked = average_floor_lighting(w, 1);
+
+	auto blocker = std::make_shared<Sphere>();
+	blocker->set_transform(Matrix4::Translation(0.0, 5.0, 0.0));
+	w.add_object(blocker);
+
+	ASSERT_TRUE(average_floor_lighting(w, 1) == unblocked);
+}
+
+TEST(AreaLights, SamplesAreSplitByHowGlossyTheMaterialIs)
+{
+	Ray r = Ray(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+	auto floor = std::make_shared<InfinitePlane>();
+	Intersections xs = Intersections({ Intersection(1.0, floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	auto material = std::dynamic_pointer_cast<PhongMaterial>(floor->material);
+	material->specular.set_value(0.0);
+	ASSERT_EQ(material->glossy_fraction(comps), 0.0);
+
+	material->diffuse.set_value(0.0);
+	material->specular.set_value(0.9);
+	ASSERT_EQ(material->glossy_fraction(comps), 1.0);
+
+	// A glossy highlight of the light, which both strategies see.  However the samples are
+	// split, the estimate is the same.
+	material->diffuse.set_value(0.3);
+	material->shininess.set_value(20.0);
+	ASSERT_GT(material->glossy_fraction(comps), 0.1);
+	ASSERT_LT(material->glossy_fraction(comps), 0.9);
+
+	auto lighting = [&floor](int subdivs)
+	{
+		World w = World();
+		w.shadow_subdivs = subdivs;
+		w.add_object(floor);
+		w.add_object(std::make_shared<SphereLight>(Tuple::Point(0.0, 3.0, 0.0), Color(1.0), 10.0, 1.0));
+
+		return average_floor_lighting(w, 4000 / subdivs);
+	};
+
+	Color few = lighting(2);
+	Color many = lighting(40);
+
+	ASSERT_NEAR(few.x / many.x, 1.0, 0.02);
+}
+
+TEST(AreaLights, PenumbraIsLessNoisyThanAJitteredPointLight)
+{
+	auto noise = [](const std::shared_ptr<Light> & lgt)
+	{
+		World w = World();
+		w.shadow_subdivs = 16;
+		w.add_object(std::make_shared<InfinitePlane>());
+		auto blocker = std::make_shared<Sphere>();
+		blocker->set_transform(Matrix4::Translation(0.0, 2.0, 0.0));
+		w.add_object(blocker);
+		w.add_object(lgt);
+
+		double deviation = 0.0;
+
+		// Points across the edge of the blocker's shadow
+		for (double x : { 1.2, 1.5, 1.8 })
+		{
+			Ray r = Ray(Tuple::Point(x, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+			Intersections xs = Intersections({ Intersection(1.0, w.get_primitives()[0]) });
+			IxComps comps = IxComps(xs[0], r, xs);
+
+			double sum = 0.0, sum_squared = 0.0;
+			const int samples = 300;
+
+			for (int i = 0; i < samples; i++)
+			{
+				double value = w.shade(comps).Lighting.x;
+				sum += value;
+				sum_squared += value * value;
+			}
+
+			double mean = sum / samples;
+			deviation += sqrt(std::max(0.0, (sum_squared / samples) - (mean * mean))) / mean;
+		}
+
+		return deviation;
+	};
+
+	auto point = std::make_shared<PointLight>(Tuple::Point(0.0, 6.0, 0.0), Color(1.0), 20.0, 1.0);
+	point->falloff = true;
+	auto sphere = std::make_shared<SphereLight>(Tuple::Point(0.0, 6.0, 0.0), Color(1.0), 20.0, 1.0);
+
+	ASSERT_LT(noise(sphere), noise(point));
+}
+
+// ------------------------------------------------------------------------
+// Preetham Sky Background
+// ------------------------------------------------------------------------
+
+TEST(PreethamSky, TableMatchesTheModel)
+{
+	PreethamSkyBackground sky = PreethamSkyBackground(Tuple::Vector(1.0, 0.4, 0.2));
+
+	for (int i = 0; i < 100; i++)
+	{
+		Tuple direction = Tuple::Vector(random_double(-1.0, 1.0), random_double(0.05, 1.0), random_double(-1.0, 1.0));
+		Color expected = sky.evaluate(direction);
+		Color looked_up = sky.radiance(direction);
+
+		ASSERT_NEAR(looked_up.luminosity() / expected.luminosity(), 1.0, 0.02);
+	}
+}
+
+TEST(PreethamSky, BelowTheHorizonIsBlack)
+{
+	PreethamSkyBackground sky = PreethamSkyBackground(Tuple::Vector(1.0, 0.4, 0.2));
+
+	ASSERT_TRUE(sky.radiance(Tuple::Vector(0.3, -0.5, 0.2)) == Color(0.0));
+	ASSERT_EQ(sky.direction_pdf(Tuple::Vector(0.3, -0.5, 0.2)), 0.0);
+}
+
+TEST(PreethamSky, SkyIsBrightestAroundTheSun)
+{
+	Tuple sun = Tuple::Vector(1.0, 0.4, 0.2).normalize();
+	PreethamSkyBackground sky = PreethamSkyBackground(sun);
+
+	Tuple away = Tuple::Vector(-sun.x, sun.y, -sun.z);
+
+	ASSERT_GT(sky.radiance(sun).luminosity(), 2.0 * sky.radiance(away).luminosity());
+	ASSERT_GT(sky.direction_pdf(sun), 2.0 * sky.direction_pdf(away));
+}
+
+TEST(PreethamSky, SampledDirectionsMatchTheirDensity)
+{
+	PreethamSkyBackground sky = PreethamSkyBackground(Tuple::Vector(1.0, 0.4, 0.2));
+
+	for (int i = 0; i < 100; i++)
+	{
+		Tuple direction;
+		double pdf;
+
+		ASSERT_TRUE(sky.sample_direction(random_double(), random_double(), direction, pdf));
+		ASSERT_GT(direction.y, 0.0);
+		ASSERT_NEAR(sky.direction_pdf(direction) / pdf, 1.0, 1e-6);
+	}
+
+	// The density integrates to one over the sphere
+	double total = 0.0;
+	const int steps = 400;
+
+	for (int row = 0; row < steps; row++)
+	{
+		double theta = ((row + 0.5) / steps) * M_PI;
+
+		for (int column = 0; column < steps * 2; column++)
+		{
+			double phi = ((column + 0.5) / (steps * 2)) * 2.0 * M_PI;
+			Tuple direction = Tuple::Vector(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+			total += sky.direction_pdf(direction) * sin(theta) * (M_PI / steps) * (M_PI / steps);
+		}
+	}
+
+	ASSERT_NEAR(total, 1.0, 0.01);
+}
+
+TEST(PreethamSky, ImportanceSampledSkyLightIsUnbiased)
+{
+	auto sky = std::make_shared<PreethamSkyBackground>(Tuple::Vector(1.0, 0.2, 0.2));
+
+	World w = World();
+	w.background = sky;
+	w.gi_subdivs = 8;
+	w.irradiance_cache = nullptr;
+
+	auto floor = std::make_shared<InfinitePlane>();
+	w.add_object(floor);
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+	Intersections xs = Intersections({ Intersection(1.0, floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	// Irradiance over pi on the open floor, from the model directly
+	Color expected = Color(0.0);
+	const int steps = 200;
+
+	for (int row = 0; row < steps; row++)
+	{
+		double theta = ((row + 0.5) / steps) * (M_PI / 2.0);
+
+		for (int column = 0; column < steps * 4; column++)
+		{
+			double phi = ((column + 0.5) / (steps * 4)) * 2.0 * M_PI;
+			Tuple direction = Tuple::Vector(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+			double solid_angle = sin(theta) * ((M_PI / 2.0) / steps) * ((2.0 * M_PI) / (steps * 4));
+
+			expected = expected + (sky->evaluate(direction) * (cos(theta) / M_PI * solid_angle));
+		}
+	}
+
+	expected = expected * floor->material->diffuse_albedo(comps);
+
+	Color total = Color(0.0);
+	const int samples = 2000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		total = total + w.shade(comps).GlobalIllumination;
+	}
+
+	Color average = total / double(samples);
+
+	ASSERT_NEAR(average.x / expected.x, 1.0, 0.02);
+	ASSERT_NEAR(average.y / expected.y, 1.0, 0.02);
+	ASSERT_NEAR(average.z / expected.z, 1.0, 0.02);
+}
+
+// ------------------------------------------------------------------------
+// Hosek Wilkie Background
+// ------------------------------------------------------------------------
+
+// A dataset in the published file's layout, with the comments it has inside its arrays.
+// Every curve has C = F = 1 and the rest 0, so F(theta, gamma) = 1 + cos^2 gamma, and the
+// radiance of albedo a, turbidity t and control point p is 100 a + t + p.
+static std::string write_hosek_wilkie_dataset(const std::string & file_name)
+{
+	const std::string path = (std::filesystem::temp_directory_path() / file_name).string();
+	std::ofstream dataset_file(path);
+
+	dataset_file << "/* Hosek Wilkie RGB dataset, made up for testing */\n";
+
+	for (int channel = 1; channel <= 3; channel++)
+	{
+		dataset_file << "double datasetRGB" << channel << "[] =\n{\n";
+		for (int albedo = 0; albedo < 2; albedo++)
+		{
+			for (int turbidity = 1; turbidity <= 10; turbidity++)
+			{
+				dataset_file << "\t// albedo " << albedo << ", turbidity " << turbidity << "\n";
+				for (int point = 0; point < 6; point++)
+				{
+					dataset_file << "\t0.0, 0.0, 1.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0,\n";
+				}
+			}
+		}
+		dataset_file << "};\n\n";
+
+		dataset_file << "double datasetRGBRad" << channel << "[] =\n{\n";
+		for (int albedo = 0; albedo < 2; albedo++)
+		{
+			for (int turbidity = 1; turbidity <= 10; turbidity++)
+			{
+				dataset_file << "\t// albedo " << albedo << ", turbidity " << turbidity << "\n\t";
+				for (int point = 0; point < 6; point++)
+				{
+					dataset_file << (100 * albedo) + turbidity + point << ".0e+0, ";
+				}
+				dataset_file << "\n";
+			}
+		}
+		dataset_file << "};\n\n";
+	}
+
+	dataset_file << "double* datasetsRGB[] = { datasetRGB1, datasetRGB2, datasetRGB3 };\n";
+
+	return path;
+}
+
+TEST(HosekWilkie, TheDatasetIsInterpolatedOverTurbidityAlbedoAndElevation)
+{
+	const std::string path = write_hosek_wilkie_dataset("raymond_hosek_wilkie.h");
+
+	HosekWilkieDataset dataset = HosekWilkieBackground::read_dataset(path);
+	ASSERT_EQ(dataset.coefficients[2].size(), size_t(HosekWilkieDataset::COEFFICIENT_COUNT));
+	ASSERT_EQ(dataset.radiances[0][HosekWilkieDataset::RADIANCE_COUNT - 1], 100.0 + 10.0 + 5.0);
+
+	const Tuple sun = Tuple::Vector(1.0, 0.4, 0.2).normalize();
+	HosekWilkieBackground sky = HosekWilkieBackground(path, sun, 2.5, 0.25);
+	sky.multiplier = 1.0;
+
+	// Control points 0 to 5 of a quintic Bezier curve sum to 5 t, with t the cube root of
+	// the elevation over a right angle
+	const double t = cbrt((M_PI / 2.0 - acos(sun.y)) / (M_PI / 2.0));
+	const double radiance = 2.5 + (5.0 * t) + (100.0 * 0.25);
+
+	Tuple across = Tuple::cross(sun, Tuple::Vector(0.0, 0.0, 1.0)).normalize();
+	if (across.y < 0.0)
+	{
+		across = across * -1.0;
+	}
+
+	ASSERT_NEAR(sky.evaluate(sun).x, radiance * 2.0, 1e-9);
+	ASSERT_NEAR(sky.evaluate(across).z, radiance, 1e-9);
+	ASSERT_EQ(sky.evaluate(Tuple::Vector(0.0, -1.0, 0.0)), Color(0.0));
+
+	// The whole of the top turbidity has no neighbour above it
+	HosekWilkieBackground hazy = HosekWilkieBackground(path, sun, 10.0, 0.0);
+	hazy.multiplier = 1.0;
+	ASSERT_NEAR(hazy.evaluate(across).y, 10.0 + (5.0 * t), 1e-9);
+
+	std::filesystem::remove(path);
+}
+
+TEST(HosekWilkie, TheTableAndItsSamplingSitOnTheModel)
+{
+	const std::string path = write_hosek_wilkie_dataset("raymond_hosek_wilkie_table.h");
+	const Tuple sun = Tuple::Vector(1.0, 0.4, 0.2).normalize();
+	HosekWilkieBackground sky = HosekWilkieBackground(path, sun);
+
+	for (int i = 0; i < 100; i++)
+	{
+		Tuple direction = Tuple::Vector(random_double(-1.0, 1.0), random_double(0.05, 1.0), random_double(-1.0, 1.0));
+		ASSERT_NEAR(sky.radiance(direction).luminosity() / sky.evaluate(direction).luminosity(), 1.0, 0.02);
+
+		double pdf;
+		ASSERT_TRUE(sky.sample_direction(random_double(), random_double(), direction, pdf));
+		ASSERT_NEAR(sky.direction_pdf(direction) / pdf, 1.0, 1e-6);
+	}
+
+	ASSERT_GT(sky.direction_pdf(sun), sky.direction_pdf(Tuple::Vector(-sun.x, sun.y, -sun.z)));
+
+	std::filesystem::remove(path);
+}
+
+TEST(HosekWilkie, BadDatasetsAndParametersAreRefused)
+{
+	const std::string path = write_hosek_wilkie_dataset("raymond_hosek_wilkie_bad.h");
+	const Tuple sun = Tuple::Vector(0.0, 1.0, 0.0);
+
+	ASSERT_THROW(HosekWilkieBackground(path, sun, 0.5, 0.0), std::invalid_argument);
+	ASSERT_THROW(HosekWilkieBackground(path, sun, 3.0, 1.5), std::invalid_argument);
+	ASSERT_THROW(HosekWilkieBackground::read_dataset(path + ".missing"), std::runtime_error);
+
+	// Cut short
+	{
+		std::ofstream dataset_file(path);
+		dataset_file << "double datasetRGB1[] = { 1.0, 2.0 };\n";
+	}
+	ASSERT_THROW(HosekWilkieBackground::read_dataset(path), std::runtime_error);
+
+	std::filesystem::remove(path);
+}
+
+TEST(HosekWilkie, SceneFilesReadTheDatasetNextToThem)
+{
+	const std::string path = write_hosek_wilkie_dataset("raymond_hosek_wilkie_scene.h");
+	const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+
+	std::istringstream input(
+		"background hosek_wilkie \"raymond_hosek_wilkie_scene.h\"\n"
+		"\tsun 1 1 0\n"
+		"\tturbidity 4\n"
+		"\talbedo 0.5\n"
+		"\tmultiplier 2\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input, "test.scene", directory.string());
+
+	auto sky = std::dynamic_pointer_cast<HosekWilkieBackground>(scene.world.background);
+	ASSERT_NE(sky, nullptr);
+	ASSERT_EQ(sky->get_turbidity(), 4.0);
+	ASSERT_EQ(sky->get_albedo(), 0.5);
+	ASSERT_EQ(sky->multiplier, 2.0);
+	ASSERT_EQ(parser.asset_files().size(), 1);
+
+	std::istringstream hazy("background hosek_wilkie \"raymond_hosek_wilkie_scene.h\"\n\tturbidity 12\nend\n");
+	ASSERT_THROW(SceneParser().parse(hazy, "test.scene", directory.string()), std::runtime_error);
+
+	std::filesystem::remove(path);
+}
+
+// ------------------------------------------------------------------------
+// Environment Maps
+// ------------------------------------------------------------------------
+
+TEST(AliasTable, PicksInProportionToWeight)
+{
+	std::vector<double> weights = { 1.0, 0.0, 3.0, 6.0 };
+	AliasTable table = AliasTable(weights);
+
+	std::vector<int> counts = std::vector<int>(weights.size(), 0);
+	double remapped_total = 0.0;
+	const int samples = 10000;
+
+	for (int i = 0; i < samples; i++)
+	{
+		double remapped;
+		counts[table.sample((i + 0.5) / samples, remapped)]++;
+		remapped_total += remapped;
+	}
+
+	ASSERT_EQ(counts[1], 0);
+	ASSERT_NEAR(counts[0] / double(samples), 0.1, 0.001);
+	ASSERT_NEAR(counts[2] / double(samples), 0.3, 0.001);
+	ASSERT_NEAR(counts[3] / double(samples), 0.6, 0.001);
+	ASSERT_NEAR(table.probability(3), 0.6, 1e-12);
+
+	// What is left of u is still spread evenly
+	ASSERT_NEAR(remapped_total / samples, 0.5, 0.01);
+}
+
+// A dim sky with a small bright patch, written as a PFM
+static std::string environment_test_map(const std::string & file_name)
+{
+	Canvas c = Canvas(32, 16);
+
+	for (int y = 0; y < 16; y++)
+	{
+		for (int x = 0; x < 32; x++)
+		{
+			bool patch = (x >= 20 && x < 22 && y >= 4 && y < 6);
+			c.write_pixel(x, y, patch ? Color(50.0, 40.0, 30.0) : Color(0.2, 0.25, 0.3));
+		}
+	}
+
+	const std::string path = texture_test_path(file_name);
+	canvas_to_pfm(c, path);
+
+	return path;
+}
+
+TEST(EnvironmentMap, LooksUpTheImageByDirection)
+{
+	EnvironmentMapBackground env = EnvironmentMapBackground(environment_test_map("LooksUpTheImageByDirection.pfm"));
+
+	ASSERT_EQ(env.get_width(), 32);
+	ASSERT_EQ(env.get_height(), 16);
+
+	// The center of the patch, where the four texels meet
+	double theta = (5.0 / 16.0) * M_PI;
+	double phi = ((21.0 / 32.0) * 2.0 * M_PI) - M_PI;
+	Tuple direction = Tuple::Vector(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+	ASSERT_TRUE(env.radiance(direction) == Color(50.0, 40.0, 30.0));
+	ASSERT_TRUE(env.radiance(Tuple::Vector(0.0, -1.0, 0.0)) == Color(0.2, 0.25, 0.3));
+}
+
+TEST(EnvironmentMap, OnlyReadsPFMFiles)
+{
+	const std::string path = texture_test_path("OnlyReadsPFMFiles.ppm");
+	canvas_to_ppm(checker_canvas(4, 2), path, false);
+
+	ASSERT_THROW(EnvironmentMapBackground env = EnvironmentMapBackground(path), std::runtime_error);
+}
+
+TEST(EnvironmentMap, SampledDirectionsMatchTheirDensity)
+{
+	EnvironmentMapBackground env = EnvironmentMapBackground(environment_test_map("SampledDirectionsMatchTheirDensity.pfm"));
+	int near_patch = 0;
+
+	double theta = (5.0 / 16.0) * M_PI;
+	double phi = ((21.0 / 32.0) * 2.0 * M_PI) - M_PI;
+	Tuple patch = Tuple::Vector(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+	for (int i = 0; i < 1000; i++)
+	{
+		Tuple direction;
+		double pdf;
+
+		ASSERT_TRUE(env.sample_direction(random_double(), random_double(), direction, pdf));
+		ASSERT_NEAR(env.direction_pdf(direction) / pdf, 1.0, 1e-6);
+
+		// Within two texels of its center
+		if (Tuple::dot(direction.normalize(), patch) > cos(0.4))
+		{
+			near_patch++;
+		}
+	}
+
+	// The patch is 1% of the texels and holds most of the light
+	ASSERT_GT(near_patch, 600);
+}
+
+TEST(EnvironmentMap, DirectLightingMatchesGlobalIllumination)
+{
+	auto env = std::make_shared<EnvironmentMapBackground>(environment_test_map("DirectLightingMatchesGlobalIllumination.pfm"));
+
+	auto floor = std::make_shared<InfinitePlane>();
+	auto material = std::make_shared<PhongMaterial>();
+	material->specular = 0.0;
+	floor->material = material;
+
+	World w = World();
+	w.background = env;
+	w.gi_subdivs = 8;
+	w.irradiance_cache = nullptr;
+	w.add_object(floor);
+
+	Ray r = Ray(Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, -1.0, 0.0));
+	Intersections xs = Intersections({ Intersection(1.0, floor) });
+	IxComps comps = IxComps(xs[0], r, xs);
+
+	auto average = [&w, &comps]()
+	{
+		Color total = Color(0.0);
+		const int samples = 2000;
+
+		for (int i = 0; i < samples; i++)
+		{
+			Sample sample = w.shade(comps);
+			total = total + sample.Lighting + sample.GlobalIllumination;
+		}
+
+		return total / double(samples);
+	};
+
+	Color through_gi = average();
+
+	w.environment_samples = 4;
+	Color direct = average();
+
+	ASSERT_NEAR(direct.x / through_gi.x, 1.0, 0.03);
+	ASSERT_NEAR(direct.y / through_gi.y, 1.0, 0.03);
+	ASSERT_NEAR(direct.z / through_gi.z, 1.0, 0.03);
+}
+
+// ------------------------------------------------------------------------ //
+// Progressive Rendering
+// ------------------------------------------------------------------------ //
+
+TEST(ProgressiveRendering, AccumulatedSamplesAreAveraged)
+{
+	SampledPixel pixel = SampledPixel();
+
+	Sample first = Sample();
+	first.set_rgb(Color(1.0));
+	Sample second = Sample();
+	second.set_rgb(Color(3.0));
+
+	pixel.accumulate_sample(first);
+	ASSERT_EQ(pixel.sample_count(), 1);
+	ASSERT_EQ(pixel.relative_error(), 0.0);
+
+	pixel.accumulate_sample(second);
+	ASSERT_EQ(pixel.sample_count(), 2);
+	ASSERT_EQ(pixel.get_channel(rgb), Color(2.0));
+	ASSERT_GT(pixel.relative_error(), 0.0);
+	// Only the running sum is kept
+	ASSERT_TRUE(pixel.get_samples().empty());
+}
+
+TEST(ProgressiveRendering, IdenticalSamplesHaveNoError)
+{
+	SampledPixel pixel = SampledPixel();
+
+	Sample sample = Sample();
+	sample.set_rgb(Color(0.5, 0.25, 0.75));
+
+	for (int i = 0; i < 8; i++)
+	{
+		pixel.accumulate_sample(sample);
+	}
+
+	ASSERT_EQ(pixel.sample_count(), 8);
+	ASSERT_NEAR(pixel.relative_error(), 0.0, EPSILON);
+}
+
+TEST(ProgressiveRendering, EveryPassSamplesEveryPixelOnce)
+{
+	World w = World::Default();
+	w.bucket_size = 3;
+
+	Camera c = Camera(7, 5, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	std::vector<int> passes;
+	ProgressiveSettings settings = ProgressiveSettings();
+	settings.max_passes = 3;
+	settings.on_pass = [&passes](const ProgressiveStats & stats) { passes.push_back(stats.pass); };
+
+	SampleBuffer image = c.progressive_render(w, settings);
+
+	ASSERT_EQ(passes, std::vector<int>({ 1, 2, 3 }));
+	ASSERT_EQ(image.width(), 7);
+	ASSERT_EQ(image.height(), 5);
+
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		ASSERT_EQ(pixel->sample_count(), 3);
+	}
+}
+
+TEST(ProgressiveRendering, StopsOnceTheNoiseTargetIsMet)
+{
+	// Nothing to hit, so every sample in a pixel is the same
+	World w = World();
+	Camera c = Camera(4, 4, M_PI / 2.0);
+
+	ProgressiveStats last = ProgressiveStats();
+	ProgressiveSettings settings = ProgressiveSettings();
+	settings.max_passes = 50;
+	settings.noise_target = 0.01;
+	settings.on_pass = [&last](const ProgressiveStats & stats) { last = stats; };
+
+	c.progressive_render(w, settings);
+
+	ASSERT_EQ(last.pass, 2);
+	ASSERT_EQ(last.converged_fraction, 1.0);
+}
+
+TEST(ProgressiveRendering, StopsWithinTheTimeBudget)
+{
+	World w = World();
+	Camera c = Camera(4, 4, M_PI / 2.0);
+
+	ProgressiveStats last = ProgressiveStats();
+	ProgressiveSettings settings = ProgressiveSettings();
+	settings.time_budget = 0.05;
+	settings.on_pass = [&last](const ProgressiveStats & stats) { last = stats; };
+
+	c.progressive_render(w, settings);
+
+	ASSERT_GT(last.pass, 1);
+	// Passes are timed to finish inside the budget, with room for a slow pass on a busy machine
+	ASSERT_LT(last.elapsed_seconds, 0.5);
+}
+
+TEST(ProgressiveRendering, NeedsALimit)
+{
+	World w = World();
+	Camera c = Camera(4, 4, M_PI / 2.0);
+
+	ASSERT_THROW(c.progressive_render(w, ProgressiveSettings()), std::invalid_argument);
+}
+
+TEST(ProgressiveRendering, PreviewIsReplacedAfterEveryPass)
+{
+	const std::string path = texture_test_path("PreviewIsReplacedAfterEveryPass.pfm");
+	std::filesystem::remove(path);
+
+	World w = World();
+	Camera c = Camera(4, 3, M_PI / 2.0);
+
+	ProgressiveSettings settings = ProgressiveSettings();
+	settings.max_passes = 2;
+	settings.preview_path = path;
+
+	c.progressive_render(w, settings);
+
+	ASSERT_TRUE(std::filesystem::exists(path));
+	ASSERT_FALSE(std::filesystem::exists(path + ".tmp"));
+
+	TextureCache cache = TextureCache();
+	std::shared_ptr<TextureFile> file = cache.open(path);
+	ASSERT_EQ(file->format, PFMFormat);
+}
+
+// ------------------------------------------------------------------------ //
+// Deadline Scheduling
+// ------------------------------------------------------------------------ //
+
+TEST(DeadlineScheduling, ReflectionsStopAtTheWorldsRayDepth)
+{
+	World w = World::Default();
+	w.max_ray_depth = 0;
+
+	Ray r = Ray(Tuple::Point(0.0, 0.0, -3.0), Tuple::Vector(0.0, -sqrt(2.0) / 2.0, sqrt(2.0) / 2.0));
+
+	auto shape = std::make_shared<InfinitePlane>();
+	shape->set_transform(Matrix4::Translation(0.0, -1.0, 0.0));
+	w.add_object(shape);
+
+	auto ms1 = std::dynamic_pointer_cast<PhongMaterial>(shape->material);
+	ms1->reflection.set_value(Color(0.5));
+
+	Intersection i = Intersection(sqrt(2.0), shape);
+	IxComps comps = IxComps(i, r);
+
+	ASSERT_EQ(w.shade(comps).Reflection, Color(0.0));
+}
+
+TEST(DeadlineScheduling, FullScaleKeepsEverySetting)
+{
+	RenderQuality full = { 32, 8, 5 };
+	RenderQuality quality = DeadlineScheduler::scale_quality(full, 1.0);
+
+	ASSERT_EQ(quality.aa_sample_max, 32);
+	ASSERT_EQ(quality.shadow_subdivs, 8);
+	ASSERT_EQ(quality.max_ray_depth, 5);
+	ASSERT_EQ(DeadlineScheduler::relative_cost(quality, full), 1.0);
+}
+
+TEST(DeadlineScheduling, AntialiasingIsLoweredFirst)
+{
+	RenderQuality full = { 32, 8, 5 };
+	RenderQuality quality = DeadlineScheduler::scale_quality(full, 0.25);
+
+	ASSERT_EQ(quality.aa_sample_max, 8);
+	ASSERT_EQ(quality.shadow_subdivs, 8);
+	ASSERT_EQ(quality.max_ray_depth, 5);
+}
+
+TEST(DeadlineScheduling, SamplesGetCheaperOnceAntialiasingRunsOut)
+{
+	RenderQuality full = { 4, 8, 5 };
+	RenderQuality quality = DeadlineScheduler::scale_quality(full, 0.05);
+
+	ASSERT_EQ(quality.aa_sample_max, 1);
+	ASSERT_LT(quality.shadow_subdivs, 8);
+	ASSERT_LE(quality.aa_sample_max * DeadlineScheduler::relative_cost(quality, full), 4 * 0.05 + EPSILON);
+
+	// Nothing goes below a single sample, subdivision and bounce
+	RenderQuality lowest = DeadlineScheduler::scale_quality(full, 0.0);
+	ASSERT_EQ(lowest.aa_sample_max, 1);
+	ASSERT_EQ(lowest.shadow_subdivs, 1);
+	ASSERT_EQ(lowest.max_ray_depth, 1);
+}
+
+TEST(DeadlineScheduling, SlowBucketsLowerTheQualityOfTheRest)
+{
+	World w = World();
+	w.aa_sample_max = 16;
+	w.shadow_subdivs = 4;
+
+	DeadlineScheduler scheduler = DeadlineScheduler(1.0);
+	scheduler.begin_frame(w, 100, 1);
+
+	// The first bucket is rendered as the scene asks, there is nothing to go on yet
+	RenderQuality first = scheduler.next_bucket(10, 1);
+	ASSERT_EQ(first.aa_sample_max, 16);
+
+	// Half the budget on a tenth of the frame
+	scheduler.finish_bucket(first, 10, 0.5);
+	ASSERT_NEAR(scheduler.ns_per_sample(), 0.5e9 / 160.0, 1.0);
+
+	RenderQuality second = scheduler.next_bucket(10, 2);
+	ASSERT_LT(second.aa_sample_max, 16);
+	ASSERT_EQ(scheduler.lowest_quality().aa_sample_max, second.aa_sample_max);
+}
+
+TEST(DeadlineScheduling, FastFramesKeepFullQuality)
+{
+	World w = World::Default();
+	w.aa_sample_max = 2;
+	w.bucket_size = 4;
+
+	Camera c = Camera(8, 6, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	DeadlineScheduler scheduler = DeadlineScheduler(60.0);
+	SampleBuffer image = c.deadline_render(w, scheduler);
+
+	ASSERT_EQ(image.width(), 8);
+	ASSERT_EQ(image.height(), 6);
+	ASSERT_GT(scheduler.ns_per_sample(), 0.0);
+	ASSERT_EQ(scheduler.lowest_quality().aa_sample_max, 2);
+
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		ASSERT_EQ(pixel->get_samples().size(), 2);
+	}
+}
+
+TEST(DeadlineScheduling, NeedsABudget)
+{
+	DeadlineScheduler scheduler = DeadlineScheduler(0.0);
+
+	ASSERT_THROW(scheduler.begin_frame(World(), 100, 1), std::invalid_argument);
+}
+
+// ------------------------------------------------------------------------ //
+// Render Statistics
+// ------------------------------------------------------------------------ //
+
+TEST(RenderStatistics, CountersAddAndSubtract)
+{
+	RenderCounters a = RenderCounters();
+	a.camera_rays = 4;
+	a.shadow_rays = 10;
+	a.indirect_rays = 2;
+	a.primitive_tests = 7;
+
+	RenderCounters b = a;
+	b += a;
+
+	ASSERT_EQ(b.camera_rays, 8);
+	ASSERT_EQ(b.primitive_tests, 14);
+	ASSERT_EQ(b.total_rays(), 32);
+
+	RenderCounters c = b - a;
+	ASSERT_EQ(c.shadow_rays, 10);
+	ASSERT_EQ(c.total_rays(), 16);
+}
+
+TEST(RenderStatistics, TracingCountsOnTheCallingThread)
+{
+	World w = World::Default();
+	w.shadow_subdivs = 1;
+	Ray r = Ray(Tuple::Point(0.0, 0.0, -5.0), Tuple::Vector(0.0, 0.0, 1.0));
+
+	const RenderCounters before = thread_counters();
+	Color c = w.color_at(r);
+	const RenderCounters counted = thread_counters() - before;
+
+	ASSERT_EQ(counted.shading_calls, 1);
+	ASSERT_EQ(counted.shadow_rays, 1);
+	// Both spheres are tested for the camera ray and the shadow ray
+	ASSERT_EQ(counted.bounds_tests, 4);
+	ASSERT_GE(counted.bounds_tests, counted.primitive_tests);
+	ASSERT_EQ(counted.camera_rays, 0);
+}
+
+TEST(RenderStatistics, ThreadedRendersMergeTheirBuckets)
+{
+	World w = World::Default();
+	w.aa_sample_min = 1;
+	w.aa_sample_max = 2;
+	w.bucket_size = 4;
+
+	Camera c = Camera(8, 8, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	RenderStats stats = RenderStats();
+	SampleBuffer image = c.multi_sample_threaded_render(w, stats);
+
+	ASSERT_EQ(stats.get_buckets().size(), 4);
+	ASSERT_EQ(stats.totals().camera_rays, 8 * 8 * 2);
+	ASSERT_EQ(stats.totals().samples, 8 * 8 * 2);
+	ASSERT_EQ(stats.min_samples_per_pixel(), 2);
+	ASSERT_EQ(stats.max_samples_per_pixel(), 2);
+	ASSERT_GT(stats.totals().shading_calls, 0);
+	ASSERT_GT(stats.wall_seconds, 0.0);
+
+	uint64_t bucket_rays = 0;
+	for (const BucketStats & bucket : stats.get_buckets())
+	{
+		bucket_rays += bucket.counters.total_rays();
+	}
+	ASSERT_EQ(bucket_rays, stats.totals().total_rays());
+}
+
+TEST(RenderStatistics, HeatMapsAreSummedOverThePixel)
+{
+	World w = World::Default();
+	w.aa_sample_max = 3;
+	w.bucket_size = 4;
+
+	Camera c = Camera(4, 4, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	RenderStats stats = RenderStats();
+	SampleBuffer image = c.multi_sample_threaded_render(w, stats);
+
+	double rays = 0.0;
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		// At least the camera ray of each sample
+		ASSERT_GE(pixel->get_channel(raycount).x, 3.0);
+		ASSERT_GT(pixel->get_channel(sampletime).x, 0.0);
+		rays += pixel->get_channel(raycount).x;
+	}
+
+	ASSERT_NEAR(rays, double(stats.totals().total_rays()), 0.5);
+}
+
+TEST(RenderStatistics, WrittenAsJSON)
+{
+	RenderStats stats = RenderStats();
+	stats.wall_seconds = 1.5;
+
+	BucketStats bucket = BucketStats();
+	bucket.id = 3;
+	bucket.x = 32;
+	bucket.y = 0;
+	bucket.width = 32;
+	bucket.height = 16;
+	bucket.seconds = 0.25;
+	bucket.counters.camera_rays = 512;
+	bucket.counters.shadow_rays = 1024;
+	stats.add_bucket(bucket);
+
+	const std::string path = texture_test_path("WrittenAsJSON.json");
+	ASSERT_TRUE(stats.write_json(path));
+
+	std::ifstream input_file(path);
+	std::stringstream contents;
+	contents << input_file.rdbuf();
+	const std::string json = contents.str();
+
+	ASSERT_NE(json.find("\"wall_seconds\": 1.5"), std::string::npos);
+	ASSERT_NE(json.find("\"camera\": 512, \"shadow\": 1024"), std::string::npos);
+	ASSERT_NE(json.find("\"total\": 1536"), std::string::npos);
+	ASSERT_NE(json.find("{ \"id\": 3, \"x\": 32, \"y\": 0, \"width\": 32, \"height\": 16, \"seconds\": 0.25"), std::string::npos);
+}
+
+// ------------------------------------------------------------------------ //
+// Progress Reporting
+// ------------------------------------------------------------------------ //
+
+TEST(ProgressReporting, LinesShowTheTimeLeftAndRaysPerSecond)
+{
+	ASSERT_EQ(
+		ProgressReporter::format_line("Rendering", 25, 100, 10.0, 5000000),
+		"Rendering: 25.0% - 10.0s elapsed, 30.0s left - 0.50M rays/s"
+	);
+	ASSERT_EQ(ProgressReporter::format_line("Rendering", 0, 100, 0.0, 0), "Rendering: 0.0% - 0.0s elapsed");
+	ASSERT_EQ(ProgressReporter::format_line("Rendering", 100, 100, 4.0, 0), "Rendering: 100.0% - 4.0s elapsed");
+}
+
+TEST(ProgressReporting, WorkersAdvanceWithoutLocking)
+{
+	std::ostringstream output;
+	ProgressReporter progress = ProgressReporter("Test", 4000, output);
+	progress.interval = 0.01;
+	progress.start();
+
+	auto workers = std::vector<std::future<void>>();
+	for (int t = 0; t < 4; t++)
+	{
+		workers.push_back(std::async(std::launch::async, [&progress]()
+		{
+			for (int i = 0; i < 1000; i++)
+			{
+				progress.advance(1);
+				progress.add_rays(3);
+			}
+		}));
+	}
+
+	for (auto & worker : workers)
+	{
+		worker.get();
+	}
+
+	progress.finish();
+
+	ASSERT_EQ(progress.completed(), 4000);
+	ASSERT_EQ(progress.rays(), 12000);
+
+	// The last line is printed by finish
+	const std::string lines = output.str();
+	const std::string last = lines.substr(lines.rfind("Test:"));
+	ASSERT_EQ(last.rfind("Test: 100.0%", 0), 0);
+}
+
+TEST(ProgressReporting, BucketRendersDoNotPrintPerBucket)
+{
+	World w = World::Default();
+	w.aa_sample_max = 1;
+	w.bucket_size = 2;
+
+	Camera c = Camera(8, 8, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	std::ostringstream output;
+	std::streambuf * previous = std::cout.rdbuf(output.rdbuf());
+	SampleBuffer image = c.multi_sample_threaded_render(w);
+	std::cout.rdbuf(previous);
+
+	// 16 buckets, and a render this small should finish inside a single progress interval
+	const std::string printed = output.str();
+	ASSERT_LT(std::count(printed.begin(), printed.end(), '\n'), 4);
+	ASSERT_EQ(printed.find("SampleBuffer"), std::string::npos);
+}
+
+TEST(ProgressReporting, ScanlineRendersReportTheirRays)
+{
+	World w = World::Default();
+
+	Camera c = Camera(8, 8, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	auto last_line = [](const std::string & printed)
+	{
+		return printed.substr(printed.rfind("Rendering:"));
+	};
+
+	std::ostringstream output;
+	std::streambuf * previous = std::cout.rdbuf(output.rdbuf());
+	Canvas image = c.render(w);
+	std::cout.rdbuf(previous);
+
+	ASSERT_NE(last_line(output.str()).find("M rays/s"), std::string::npos);
+
+	std::ostringstream threaded_output;
+	previous = std::cout.rdbuf(threaded_output.rdbuf());
+	image = c.threaded_render(w);
+	std::cout.rdbuf(previous);
+
+	ASSERT_NE(last_line(threaded_output.str()).find("M rays/s"), std::string::npos);
+}
+
+TEST(ProgressReporting, DebugDumpListsEveryPixel)
+{
+	SampleBuffer buffer = SampleBuffer(3, 2, AABB2D(Tuple::Point2D(0.0, 0.0), Tuple::Point2D(3.0, 3.0)));
+
+	std::ostringstream output;
+	buffer.debug_dump(output);
+
+	const std::string dump = output.str();
+	ASSERT_EQ(std::count(dump.begin(), dump.end(), '\n'), 1 + 6);
+	ASSERT_NE(dump.find("(2, 1) 0 samples"), std::string::npos);
+}
+
+// ------------------------------------------------------------------------ //
+// Scene Files
+// ------------------------------------------------------------------------ //
+
+TEST(SceneFiles, SettingsCameraAndLightsAreRead)
+{
+	std::istringstream input(
+		"# render settings\n"
+		"settings\n"
+		"\taa_sample_max 16\n"
+		"\tshadow_subdivs 2\n"
+		"end\n"
+		"camera\n"
+		"\tsize 160 90\n"
+		"\tfov 60\n"
+		"\tfrom 0 1 -5\n"
+		"\tto 0 1 0\n"
+		"\tup 0 1 0\n"
+		"end\n"
+		"light point \"key light\"\n"
+		"\tposition -10 10 -10\n"
+		"\tcolor 1 0.5 0.25\n"
+		"\tmultiplier 2\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	ASSERT_EQ(scene.world.aa_sample_max, 16);
+	ASSERT_EQ(scene.world.shadow_subdivs, 2);
+
+	ASSERT_EQ(scene.camera.get_horizontal_size(), 160);
+	ASSERT_EQ(scene.camera.get_vertical_size(), 90);
+	ASSERT_TRUE(flt_cmp(scene.camera.get_fov(), deg_to_rad(60.0)));
+	ASSERT_EQ(scene.camera.get_transform(), Matrix4::ViewTransform(Tuple::Point(0.0, 1.0, -5.0), Tuple::Point(0.0, 1.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	ASSERT_EQ(scene.world.get_lights().size(), 1);
+	auto light = scene.world.get_lights()[0];
+	ASSERT_EQ(light->get_name(), "key light");
+	ASSERT_EQ(light->position(), Tuple::Point(-10.0, 10.0, -10.0));
+	ASSERT_EQ(light->color, Color(1.0, 0.5, 0.25));
+	ASSERT_TRUE(flt_cmp(light->multiplier, 2.0));
+}
+
+TEST(SceneFiles, PrimitivesGetTheirMaterialsAndTransforms)
+{
+	std::istringstream input(
+		"material red phong\n"
+		"\tcolor 1 0 0\n"
+		"\tspecular 0.25\n"
+		"end\n"
+		"sphere \"red sphere\"\n"
+		"\tmaterial red\n"
+		"\ttranslate 0 1 0\n"
+		"\trotate_z 45\n"
+		"\tscale 0.5\n"
+		"end\n"
+		"cylinder\n"
+		"\tminimum -1\n"
+		"\tmaximum 2\n"
+		"\tclosed true\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	ASSERT_EQ(scene.world.get_primitives().size(), 2);
+
+	auto sphere = scene.world.get_primitives()[0];
+	ASSERT_EQ(sphere->get_name(), "red sphere");
+	ASSERT_EQ(sphere->material, parser.get_material("red"));
+	ASSERT_EQ(sphere->get_transform(), Matrix4::Translation(0.0, 1.0, 0.0) * Matrix4::Rotation_Z(deg_to_rad(45.0)) * Matrix4::Scaling(0.5, 0.5, 0.5));
+
+	auto material = std::dynamic_pointer_cast<PhongMaterial>(sphere->material);
+	ASSERT_EQ(material->color.value(), Color(1.0, 0.0, 0.0));
+	ASSERT_TRUE(flt_cmp(material->specular.value(), 0.25));
+
+	auto cylinder = std::dynamic_pointer_cast<Cylinder>(scene.world.get_primitives()[1]);
+	ASSERT_NE(cylinder, nullptr);
+	ASSERT_TRUE(flt_cmp(cylinder->get_minimum(), -1.0));
+	ASSERT_TRUE(flt_cmp(cylinder->get_maximum(), 2.0));
+	ASSERT_TRUE(cylinder->get_closed());
+}
+
+TEST(SceneFiles, TexMapGraphsAreConnectedByName)
+{
+	std::istringstream input(
+		"texmap noise perlin 7\n"
+		"\toctaves 3\n"
+		"end\n"
+		"texmap stripes stripe\n"
+		"\ta 1\n"
+		"\tb srgb 255 0 0\n"
+		"\tspace object\n"
+		"\tscale 0.1\n"
+		"end\n"
+		"texmap wobbly perturb\n"
+		"\tmain stripes\n"
+		"\tdisplacement noise\n"
+		"\tscale 0.2\n"
+		"end\n"
+		"material striped phong\n"
+		"\tcolor wobbly\n"
+		"\tshininess noise\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	auto stripes = std::dynamic_pointer_cast<StripeMap>(parser.get_texmap("stripes"));
+	ASSERT_NE(stripes, nullptr);
+	ASSERT_EQ(stripes->get_mapping_space(), ObjectSpace);
+	ASSERT_EQ(stripes->transform->get_transform(), Matrix4::Scaling(0.1, 0.1, 0.1));
+	ASSERT_EQ(stripes->b->sample_at_point(Tuple::Point(0.0, 0.0, 0.0)), Color(1.0, 0.0, 0.0));
+
+	auto wobbly = std::dynamic_pointer_cast<PerturbMap>(parser.get_texmap("wobbly"));
+	ASSERT_EQ(wobbly->main, parser.get_texmap("stripes"));
+	ASSERT_EQ(wobbly->displacement, parser.get_texmap("noise"));
+	ASSERT_EQ(std::dynamic_pointer_cast<PerlinMap>(parser.get_texmap("noise"))->octaves, 3);
+
+	auto material = std::dynamic_pointer_cast<PhongMaterial>(parser.get_material("striped"));
+	ASSERT_EQ(material->color.connection, parser.get_texmap("wobbly"));
+	ASSERT_EQ(material->shininess.connection, parser.get_texmap("noise"));
+}
+
+TEST(SceneFiles, TexMapsWithABakeAreBakedOnLoad)
+{
+	std::istringstream input(
+		"texmap noise perlin 7\n"
+		"\tbake 8 -1 -1 -1 1 1 1\n"
+		"end\n"
+		"material marble phong\n"
+		"\tcolor noise\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	auto baked = std::dynamic_pointer_cast<BakedMap>(parser.get_texmap("noise"));
+	ASSERT_NE(baked, nullptr);
+	ASSERT_TRUE(baked->is_baked());
+	ASSERT_EQ(baked->grid_width(), 8);
+
+	auto material = std::dynamic_pointer_cast<PhongMaterial>(parser.get_material("marble"));
+	ASSERT_EQ(material->color.connection, baked);
+
+	// Grid points hold the source's values
+	PerlinMap source = PerlinMap(7);
+	Tuple corner = Tuple::Point(-1.0, -1.0, -1.0);
+	ASSERT_NEAR(baked->sample_at_point(corner).x, source.sample_at_point(corner).x, 2.0e-3);
+
+	auto error_of = [](const std::string & text)
+	{
+		std::istringstream input(text);
+		SceneParser parser = SceneParser();
+
+		try
+		{
+			parser.parse(input, "test.scene");
+		}
+		catch (const std::runtime_error & ex)
+		{
+			return std::string(ex.what());
+		}
+
+		return std::string();
+	};
+
+	ASSERT_EQ(error_of("texmap n perlin 1\n\tbake 1 0 0 0 1 1 1\nend\n").rfind("test.scene:2: bake resolution must be at least 2", 0), 0);
+	ASSERT_EQ(error_of("texmap n perlin 1\n\tbake 4 1 1 1 1 1 1\nend\n").rfind("test.scene:2: bake box is empty", 0), 0);
+	ASSERT_NE(error_of("texmap n perlin 1\n\tspace object\n\tbake 4 0 0 0 1 1 1\nend\n").find("cannot be baked"), std::string::npos);
+}
+
+TEST(SceneFiles, GroupsParentTheirPrimitives)
+{
+	std::istringstream input(
+		"group \"pair\"\n"
+		"\ttranslate 5 0 0\n"
+		"\tsphere\n"
+		"\t\ttranslate -1 0 0\n"
+		"\tend\n"
+		"\tgroup\n"
+		"\t\tcube\n"
+		"\t\tend\n"
+		"\tend\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	ASSERT_EQ(scene.world.get_primitives().size(), 1);
+
+	auto group = scene.world.get_primitives()[0];
+	ASSERT_EQ(group->get_name(), "pair");
+	ASSERT_EQ(group->num_children(), 2);
+
+	auto sphere = group->get_children()[0];
+	ASSERT_EQ(sphere->get_parent(), group);
+	ASSERT_EQ(sphere->get_world_transform(), Matrix4::Translation(5.0, 0.0, 0.0) * Matrix4::Translation(-1.0, 0.0, 0.0));
+	ASSERT_EQ(group->get_children()[1]->num_children(), 1);
+}
+
+TEST(SceneFiles, ErrorsNameTheLine)
+{
+	auto error_of = [](const std::string & text)
+	{
+		std::istringstream input(text);
+		SceneParser parser = SceneParser();
+
+		try
+		{
+			parser.parse(input, "test.scene");
+		}
+		catch (const std::runtime_error & ex)
+		{
+			return std::string(ex.what());
+		}
+
+		return std::string();
+	};
+
+	ASSERT_EQ(error_of("sphere\n\ttranslate 1 2\nend\n").rfind("test.scene:2:", 0), 0);
+	ASSERT_EQ(error_of("\n\nteapot\nend\n").rfind("test.scene:3: unknown keyword teapot", 0), 0);
+	ASSERT_EQ(error_of("sphere\n\tmaterial chrome\nend\n").rfind("test.scene:2: material chrome is not defined", 0), 0);
+	ASSERT_EQ(error_of("sphere\n\tscale x\nend\n").rfind("test.scene:2: expected a number, not x", 0), 0);
+	ASSERT_EQ(error_of("group\n\tlight point\n\tend\nend\n").rfind("test.scene:2: light cannot be inside a group", 0), 0);
+	ASSERT_EQ(error_of("cube\n").rfind("test.scene:1: missing end for cube", 0), 0);
+	ASSERT_EQ(error_of("end\n").rfind("test.scene:1: end without a block", 0), 0);
+}
+
+TEST(SceneFiles, IncludesAreReadRelativeToTheirFile)
+{
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "raymond_scene_test";
+	std::filesystem::create_directories(directory / "parts");
+
+	{
+		std::ofstream main_file(directory / "main.scene");
+		main_file << "material blue phong\n\tcolor 0 0 1\nend\n"
+			<< "group \"included\"\n\tinclude \"parts/cubes.scene\"\nend\n"
+			<< "include \"parts/cubes.scene\"\n";
+
+		std::ofstream part_file(directory / "parts" / "cubes.scene");
+		part_file << "cube\n\tmaterial blue\nend\ncube\n\tmaterial blue\nend\n";
+
+		std::ofstream self_file(directory / "parts" / "self.scene");
+		self_file << "include \"self.scene\"\n";
+	}
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.load((directory / "main.scene").string());
+
+	// The group's copy is parented to it, the second include adds to the world
+	ASSERT_EQ(scene.world.get_primitives().size(), 3);
+	ASSERT_EQ(scene.world.get_primitives()[0]->num_children(), 2);
+	ASSERT_EQ(scene.world.get_primitives()[1]->material, parser.get_material("blue"));
+
+	ASSERT_THROW(parser.load((directory / "parts" / "self.scene").string()), std::runtime_error);
+	ASSERT_THROW(parser.load((directory / "missing.scene").string()), std::runtime_error);
+
+	std::filesystem::remove_all(directory);
+}
+
+TEST(SceneFiles, LargeScenesLoadQuickly)
+{
+	const int count = 20000;
+
+	std::ostringstream text;
+	text << "material gray phong\n\tcolor 0.5\nend\n";
+	for (int i = 0; i < count; i++)
+	{
+		text << "sphere \"sphere " << i << "\"\n\tmaterial gray\n\ttranslate " << i % 100 << " " << i / 100 << " 0\n\tscale 0.4\nend\n";
+	}
+
+	std::istringstream input(text.str());
+	SceneParser parser = SceneParser();
+
+	auto start = std::chrono::steady_clock::now();
+	Scene scene = parser.parse(input);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	ASSERT_EQ(scene.world.get_primitives().size(), count);
+	ASSERT_EQ(parser.lines_read(), 3 + 5 * count);
+	// Generous, so unoptimized builds pass too
+	ASSERT_LT(seconds, 2.0);
+}
+
+TEST(SceneFiles, ScenesWithManyLightsLoadQuickly)
+{
+	const int count = 50000;
+
+	std::ostringstream text;
+	for (int i = 0; i < count; i++)
+	{
+		text << "light point\n\tposition " << i % 100 << " 10 " << i / 100 << "\nend\n";
+	}
+
+	std::istringstream input(text.str());
+	SceneParser parser = SceneParser();
+
+	// The light tree is built once, when it is first sampled, not once for every light
+	auto start = std::chrono::steady_clock::now();
+	Scene scene = parser.parse(input);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	ASSERT_EQ(scene.world.get_lights().size(), count);
+	ASSERT_LT(seconds, 2.0);
+}
+
+// ------------------------------------------------------------------------ //
+// Scene Caches
+// ------------------------------------------------------------------------ //
+
+// Writes a scene with a material, a map, a light, a group and an include into a fresh directory
+static std::filesystem::path write_cache_test_scene(const std::string & directory_name)
+{
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / directory_name;
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+
+	std::ofstream main_file(directory / "main.scene");
+	main_file << "camera\n\tsize 32 24\n\tfov 60\nend\n"
+		<< "texmap checks checker\n\ta 0.2\n\tb 0.8\nend\n"
+		<< "material checked phong\n\tcolor checks\nend\n"
+		<< "light point \"key\"\n\tposition -10 10 -10\nend\n"
+		<< "plane \"floor\"\n\tmaterial checked\nend\n"
+		<< "group \"pair\"\n\ttranslate 0 1 0\n"
+		<< "\tsphere \"left\"\n\t\ttranslate -1 0 0\n\t\tscale 0.5\n\tend\n"
+		<< "\tcylinder \"right\"\n\t\tminimum 0\n\t\tmaximum 2\n\t\tclosed true\n\t\tmaterial checked\n\tend\n"
+		<< "end\n"
+		<< "include \"more.scene\"\n";
+
+	std::ofstream more_file(directory / "more.scene");
+	more_file << "glass_sphere \"glass\"\n\ttranslate 0 0 -2\nend\n";
+
+	return directory;
+}
+
+TEST(SceneCaches, ABuiltSceneMatchesTheParsedOne)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_cache_match");
+	const std::string scene_path = (directory / "main.scene").string();
+	const std::string cache_path = SceneCache::cache_path_for(scene_path);
+
+	SceneParser parser = SceneParser();
+	parser.record_primitives = true;
+	Scene parsed = parser.load(scene_path);
+
+	ASSERT_TRUE(SceneCache::write(cache_path, parser));
+
+	SceneCache cache = SceneCache(cache_path);
+	ASSERT_TRUE(cache.is_valid());
+	ASSERT_EQ(cache.source_paths().size(), 2);
+
+	Scene built = cache.build();
+
+	ASSERT_EQ(built.camera.get_horizontal_size(), 32);
+	ASSERT_EQ(built.world.get_lights().size(), 1);
+	ASSERT_EQ(built.world.get_lights()[0]->position(), Tuple::Point(-10.0, 10.0, -10.0));
+
+	const auto & parsed_primitives = parsed.world.get_primitives();
+	const auto & built_primitives = built.world.get_primitives();
+	ASSERT_EQ(built_primitives.size(), parsed_primitives.size());
+	ASSERT_EQ(built_primitives.size(), 3);
+
+	for (size_t i = 0; i < built_primitives.size(); i++)
+	{
+		ASSERT_EQ(built_primitives[i]->get_name(), parsed_primitives[i]->get_name());
+		ASSERT_EQ(built_primitives[i]->get_transform(), parsed_primitives[i]->get_transform());
+		ASSERT_EQ(built_primitives[i]->get_inverse_transform(), parsed_primitives[i]->get_inverse_transform());
+		ASSERT_EQ(built_primitives[i]->num_children(), parsed_primitives[i]->num_children());
+	}
+
+	// The group's children, in order, with their world transforms
+	auto built_children = built_primitives[1]->get_children();
+	auto parsed_children = parsed_primitives[1]->get_children();
+	ASSERT_EQ(built_children[0]->get_name(), "left");
+	ASSERT_EQ(built_children[0]->get_world_transform(), parsed_children[0]->get_world_transform());
+
+	auto cylinder = std::dynamic_pointer_cast<Cylinder>(built_children[1]);
+	ASSERT_NE(cylinder, nullptr);
+	ASSERT_TRUE(flt_cmp(cylinder->get_maximum(), 2.0));
+	ASSERT_TRUE(cylinder->get_closed());
+
+	// Materials are shared by name, and map connections come back with them
+	auto floor_material = std::dynamic_pointer_cast<PhongMaterial>(built_primitives[0]->material);
+	ASSERT_EQ(floor_material->name, "checked");
+	ASSERT_EQ(cylinder->material, built_primitives[0]->material);
+	ASSERT_NE(std::dynamic_pointer_cast<CheckerMap>(floor_material->color.connection), nullptr);
+
+	// Glass spheres keep their own glass material
+	auto glass_material = std::dynamic_pointer_cast<PhongMaterial>(built_primitives[2]->material);
+	ASSERT_TRUE(flt_cmp(glass_material->ior.value(), 1.5));
+
+	std::filesystem::remove_all(directory);
+}
+
+TEST(SceneCaches, ChangingAnyIncludedFileInvalidatesTheCache)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_cache_stale");
+	const std::string scene_path = (directory / "main.scene").string();
+	const std::string cache_path = SceneCache::cache_path_for(scene_path);
+
+	Scene first = SceneCache::load(scene_path);
+	ASSERT_TRUE(std::filesystem::exists(cache_path));
+	ASSERT_TRUE(SceneCache(cache_path).is_valid());
+
+	{
+		std::ofstream more_file(directory / "more.scene", std::ios::app);
+		more_file << "cube \"added\"\nend\n";
+	}
+
+	ASSERT_FALSE(SceneCache(cache_path).is_valid());
+
+	// Loading again parses the changed files and replaces the cache
+	Scene second = SceneCache::load(scene_path);
+	ASSERT_EQ(second.world.get_primitives().size(), first.world.get_primitives().size() + 1);
+	ASSERT_TRUE(SceneCache(cache_path).is_valid());
+
+	std::filesystem::remove_all(directory);
+}
+
+TEST(SceneCaches, CachesSentFromElsewhereAreBuiltFromTheirBytes)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_cache_bytes");
+	const std::string scene_path = (directory / "main.scene").string();
+	const std::string cache_path = SceneCache::cache_path_for(scene_path);
+
+	SceneCache::load(scene_path);
+
+	std::string bytes;
+	{
+		MappedFile cache_file = MappedFile(cache_path);
+		bytes.assign(cache_file.data(), cache_file.size());
+	}
+
+	// The sources are not looked for, they are files on the machine that wrote the cache
+	std::filesystem::remove_all(directory);
+	ASSERT_FALSE(SceneCache(cache_path).is_valid());
+
+	SceneCache cache = SceneCache::from_bytes(bytes, "sent scene");
+	ASSERT_TRUE(cache.is_valid());
+	ASSERT_EQ(cache.build().world.get_primitives().size(), 3);
+
+	// The layout is still checked
+	ASSERT_FALSE(SceneCache::from_bytes(bytes.substr(0, bytes.size() - 8), "sent scene").is_valid());
+	ASSERT_FALSE(SceneCache::from_bytes("not a cache", "sent scene").is_valid());
+}
+
+TEST(SceneCaches, DamagedCachesAreNotUsed)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_cache_damaged");
+	const std::string scene_path = (directory / "main.scene").string();
+	const std::string cache_path = SceneCache::cache_path_for(scene_path);
+
+	SceneCache::load(scene_path);
+	const uintmax_t size = std::filesystem::file_size(cache_path);
+
+	// A changed byte keeps the layout but not the file's hash
+	std::string bytes;
+	{
+		MappedFile cache_file = MappedFile(cache_path);
+		bytes.assign(cache_file.data(), cache_file.size());
+	}
+	ASSERT_TRUE(SceneCache::from_bytes(bytes, "damaged scene").is_valid());
+
+	bytes[bytes.size() - 3] ^= 0x10;
+	ASSERT_FALSE(SceneCache::from_bytes(bytes, "damaged scene").is_valid());
+	ASSERT_TRUE(SceneCache::from_bytes(bytes, "damaged scene").source_paths().empty());
+
+	// Cut short, the records run past the end of the file
+	std::filesystem::resize_file(cache_path, size - 8);
+	ASSERT_FALSE(SceneCache(cache_path).is_valid());
+	ASSERT_THROW(SceneCache(cache_path).build(), std::runtime_error);
+
+	{
+		std::ofstream cache_file(cache_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		cache_file << "not a cache";
+	}
+	ASSERT_FALSE(SceneCache(cache_path).is_valid());
+	ASSERT_FALSE(SceneCache((directory / "missing.cache").string()).is_valid());
+
+	// And the scene still loads
+	ASSERT_EQ(SceneCache::load(scene_path).world.get_primitives().size(), 3);
+
+	std::filesystem::remove_all(directory);
+}
+
+// ------------------------------------------------------------------------ //
+// Animation
+// ------------------------------------------------------------------------ //
+
+TEST(Animation, WorkerPoolRunsEveryTaskOnceForEveryJob)
+{
+	RenderWorkerPool pool = RenderWorkerPool(4);
+	ASSERT_EQ(pool.size(), 4);
+
+	std::vector<std::atomic<int>> runs(1000);
+
+	// The same threads take every job
+	for (int job = 0; job < 3; job++)
+	{
+		pool.run(runs.size(), [&](size_t index) { runs[index]++; });
+	}
+
+	for (const std::atomic<int> & r : runs)
+	{
+		ASSERT_EQ(r.load(), 3);
+	}
+}
+
+TEST(Animation, WorkerPoolRethrowsTheFirstError)
+{
+	RenderWorkerPool pool = RenderWorkerPool(2);
+
+	ASSERT_THROW(pool.run(100, [](size_t index)
+	{
+		if (index == 10)
+		{
+			throw std::runtime_error("bucket failed");
+		}
+	}), std::runtime_error);
+
+	// And is still usable
+	std::atomic<int> count(0);
+	pool.run(50, [&](size_t) { count++; });
+	ASSERT_EQ(count.load(), 50);
+}
+
+TEST(Animation, FramesAreWrittenInOrderFromTheirOwnCamera)
+{
+	World w = World::Default();
+	w.bucket_size = 4;
+	w.aa_sample_min = 1;
+	w.aa_sample_max = 1;
+
+	std::ostringstream output;
+	AnimationRenderer renderer = AnimationRenderer(w, 2, output);
+
+	auto camera_for_frame = [](int frame)
+	{
+		// Every frame a different size, so the writer can tell which camera it came from
+		Camera c = Camera(6 + frame, 5, M_PI / 2.0);
+		c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+		return c;
+	};
+
+	std::vector<int> written;
+	std::vector<int> widths;
+
+	renderer.render(3, 4, camera_for_frame, [&](int frame, SampleBuffer & image)
+	{
+		Canvas canvas = image.to_canvas(rgb);
+		written.push_back(frame);
+		widths.push_back(canvas.width());
+	});
+
+	ASSERT_EQ(written, std::vector<int>({ 3, 4, 5, 6 }));
+	ASSERT_EQ(widths, std::vector<int>({ 9, 10, 11, 12 }));
+
+	const std::vector<FrameStats> & frames = renderer.get_frame_stats();
+	ASSERT_EQ(frames.size(), 4);
+
+	for (const FrameStats & frame : frames)
+	{
+		ASSERT_GT(frame.trace_seconds, 0.0);
+		ASSERT_EQ(frame.counters.camera_rays, uint64_t(6 + frame.frame) * 5);
+		ASSERT_GE(frame.overhead_seconds(), frame.setup_seconds);
+	}
+
+	const std::string json = renderer.stats_json();
+	ASSERT_NE(json.find("\"overhead_seconds\""), std::string::npos);
+	ASSERT_NE(json.find("\"trace_seconds\""), std::string::npos);
+}
+
+// ------------------------------------------------------------------------ //
+// Motion Blur
+// ------------------------------------------------------------------------ //
+
+TEST(MotionBlur, KeyframesAreInterpolated)
+{
+	TransformController ctrl = TransformController();
+	ctrl.add_keyframe(0.0, Matrix4::Translation(0.0, 0.0, 0.0) * Matrix4::Rotation_Y(0.0));
+	ctrl.add_keyframe(2.0, Matrix4::Translation(10.0, 0.0, 0.0) * Matrix4::Rotation_Y(M_PI / 2.0));
+
+	ASSERT_TRUE(ctrl.is_animated());
+
+	// Halfway moves half as far and turns half as much
+	Matrix4 halfway = ctrl.get_transform_at(1.0);
+	Matrix4 expected = Matrix4::Translation(5.0, 0.0, 0.0) * Matrix4::Rotation_Y(M_PI / 4.0);
+	for (int k = 0; k < 16; k++)
+	{
+		ASSERT_NEAR(halfway.at(k), expected.at(k), 1.0e-9);
+	}
+
+	// And holds still outside the keyframes
+	ASSERT_EQ(ctrl.point_to_world_space(Tuple::Point(0.0, 0.0, 0.0), -1.0), Tuple::Point(0.0, 0.0, 0.0));
+	ASSERT_EQ(ctrl.point_to_world_space(Tuple::Point(0.0, 0.0, 0.0), 3.0), Tuple::Point(10.0, 0.0, 0.0));
+
+	// Setting a transform stops the motion
+	ctrl.set_transform(Matrix4::Scaling(2.0, 2.0, 2.0));
+	ASSERT_FALSE(ctrl.is_animated());
+	ASSERT_EQ(ctrl.point_to_world_space(Tuple::Point(1.0, 0.0, 0.0), 1.0), Tuple::Point(2.0, 0.0, 0.0));
+}
+
+TEST(MotionBlur, ScaleIsInterpolatedApartFromRotation)
+{
+	TransformController ctrl = TransformController();
+	ctrl.add_keyframe(0.0, Matrix4::Rotation_Z(0.0) * Matrix4::Scaling(1.0, 1.0, 1.0));
+	ctrl.add_keyframe(1.0, Matrix4::Rotation_Z(M_PI / 2.0) * Matrix4::Scaling(3.0, 3.0, 3.0));
+
+	// Blending the matrices would shrink the point through the turn, decomposing keeps it on its arc
+	Tuple p = ctrl.point_to_world_space(Tuple::Point(1.0, 0.0, 0.0), 0.5);
+	ASSERT_NEAR(sqrt(p.x * p.x + p.y * p.y), 2.0, 1.0e-6);
+	ASSERT_NEAR(p.x, p.y, 1.0e-6);
+}
+
+TEST(MotionBlur, AMovingSphereIsHitWhereItIsAtTheRaysTime)
+{
+	auto s = std::make_shared<Sphere>();
+	s->add_keyframe(0.0, Matrix4::Translation(0.0, 0.0, 0.0));
+	s->add_keyframe(1.0, Matrix4::Translation(4.0, 0.0, 0.0));
+
+	ASSERT_TRUE(s->is_moving());
+
+	Ray r = Ray(Tuple::Point(4.0, 0.0, -5.0), Tuple::Vector(0.0, 0.0, 1.0));
+
+	r.time = 0.0;
+	ASSERT_EQ(s->intersect_i(r).size(), 0);
+
+	r.time = 1.0;
+	Intersections xs = s->intersect_i(r);
+	ASSERT_EQ(xs.size(), 2);
+	ASSERT_NEAR(xs[0].t_value, 4.0, EPSILON);
+
+	// The normal is the one of the sphere where it is at that time
+	IxComps comps = IxComps(xs.hit(), r);
+	ASSERT_EQ(comps.time, 1.0);
+	ASSERT_EQ(comps.normal_v, Tuple::Vector(0.0, 0.0, -1.0));
+}
+
+TEST(MotionBlur, RaysMissingTheSweptBoundsSkipTheShape)
+{
+	auto s = std::make_shared<Sphere>();
+	s->add_keyframe(0.0, Matrix4::Translation(0.0, 0.0, 0.0));
+	s->add_keyframe(1.0, Matrix4::Translation(4.0, 0.0, 0.0));
+
+	RenderCounters before = thread_counters();
+
+	// Above the whole path of the sphere
+	Ray r = Ray(Tuple::Point(2.0, 3.0, -5.0), Tuple::Vector(0.0, 0.0, 1.0));
+	ASSERT_EQ(s->intersect_i(r).size(), 0);
+
+	RenderCounters counted = thread_counters() - before;
+	ASSERT_EQ(counted.bounds_tests, 1);
+	ASSERT_EQ(counted.primitive_tests, 0);
+}
+
+TEST(MotionBlur, TranslatedShapesAreNotCulled)
+{
+	auto s = std::make_shared<Sphere>();
+	s->set_transform(Matrix4::Translation(5.0, 0.0, 0.0));
+
+	Ray r = Ray(Tuple::Point(5.0, 0.0, -5.0), Tuple::Vector(0.0, 0.0, 1.0));
+	ASSERT_EQ(s->intersect_i(r).size(), 2);
+}
+
+TEST(MotionBlur, CameraSamplesAreSpreadOverTheShutter)
+{
+	Camera c = Camera(11, 11, M_PI / 2.0);
+	c.add_keyframe(0.0, Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+	c.add_keyframe(1.0, Matrix4::ViewTransform(Tuple::Point(2.0, 0.0, -5.0), Tuple::Point(2.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	ASSERT_EQ(c.ray_from_pixel(5, 5, 0.5, 0.5, 0.0).origin, Tuple::Point(0.0, 0.0, -5.0));
+	ASSERT_EQ(c.ray_from_pixel(5, 5, 0.5, 0.5, 0.5).origin, Tuple::Point(1.0, 0.0, -5.0));
+
+	Ray r = c.ray_from_pixel(5, 5, 0.5, 0.5, 0.25);
+	ASSERT_EQ(r.time, 0.25);
+	// Rays cast on from a hit keep its time
+	ASSERT_EQ(r.transform(Matrix4::Scaling(2.0, 2.0, 2.0)).time, 0.25);
+
+	// A sphere that moves with the camera stays in the middle of the frame the whole time
+	World w = World();
+	auto s = std::make_shared<Sphere>();
+	s->add_keyframe(0.0, Matrix4::Translation(0.0, 0.0, 0.0));
+	s->add_keyframe(1.0, Matrix4::Translation(2.0, 0.0, 0.0));
+	w.add_object(s);
+
+	for (double t = 0.0; t <= 1.0; t += 0.125)
+	{
+		Intersection hit = w.intersect_world(c.ray_from_pixel(5, 5, 0.5, 0.5, t)).hit();
+		ASSERT_TRUE(hit.is_valid());
+		ASSERT_NEAR(hit.t_value, 4.0, EPSILON);
+	}
+}
+
+// ------------------------------------------------------------------------
+// Depth Of Field
+// ------------------------------------------------------------------------
+
+TEST(DepthOfField, RadicalInverseMirrorsTheDigits)
+{
+	ASSERT_EQ(radical_inverse(2, 0), 0.0);
+	ASSERT_EQ(radical_inverse(2, 1), 0.5);
+	ASSERT_EQ(radical_inverse(2, 2), 0.25);
+	ASSERT_EQ(radical_inverse(2, 3), 0.75);
+	ASSERT_NEAR(radical_inverse(3, 1), 1.0 / 3.0, EPSILON);
+	ASSERT_NEAR(radical_inverse(3, 5), 7.0 / 9.0, EPSILON);
+}
+
+TEST(DepthOfField, NoApertureIsAPinhole)
+{
+	Camera c = Camera(11, 11, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	CameraSample sample = CameraSample();
+	sample.px_os_x = 0.25;
+	sample.px_os_y = 0.75;
+	sample.lens_u = 0.9;
+	sample.lens_v = 0.1;
+
+	Ray lens_ray = c.ray_from_sample(3, 7, sample);
+	Ray pinhole_ray = c.ray_from_pixel(3, 7, 0.25, 0.75);
+
+	ASSERT_EQ(lens_ray.origin, pinhole_ray.origin);
+	ASSERT_EQ(lens_ray.direction, pinhole_ray.direction);
+}
+
+TEST(DepthOfField, LensPointsStayInTheAperture)
+{
+	Camera c = Camera(11, 11, M_PI / 2.0);
+	c.aperture = 0.5;
+
+	for (int i = 0; i < 256; i++)
+	{
+		Tuple p = c.lens_point(radical_inverse(2, i), radical_inverse(3, i));
+		ASSERT_EQ(p.z, 0.0);
+		ASSERT_LE(sqrt(p.x * p.x + p.y * p.y), 0.25 + EPSILON);
+	}
+
+	// A square aperture turned so its corners are on the axes has |x| + |y| within the radius
+	c.aperture_blades = 4;
+	c.aperture_rotation = 0.0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		Tuple p = c.lens_point(radical_inverse(2, i), radical_inverse(3, i));
+		ASSERT_LE(std::abs(p.x) + std::abs(p.y), 0.25 + EPSILON);
+	}
+}
+
+TEST(DepthOfField, PointsInFocusAreSeenThroughTheWholeLens)
+{
+	Camera c = Camera(11, 11, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+	c.aperture = 1.0;
+	c.focal_distance = 5.0;
+
+	// Where the center of the lens sees the pixel, on the plane in focus
+	CameraSample center = CameraSample();
+	Ray center_ray = c.ray_from_sample(2, 8, center);
+	Tuple in_focus = center_ray.position(5.0 / -(c.get_transform() * (center_ray.origin + center_ray.direction)).z);
+
+	for (int i = 0; i < 16; i++)
+	{
+		CameraSample sample = c.pixel_sample(2, 8, i, 1.0);
+		sample.px_os_x = 0.5;
+		sample.px_os_y = 0.5;
+
+		Ray r = c.ray_from_sample(2, 8, sample);
+		ASSERT_EQ((in_focus - r.origin).normalize(), r.direction);
+	}
+}
+
+TEST(DepthOfField, PixelsOutOfFocusTakeMoreSamples)
+{
+	World w = World();
+	w.add_object(std::make_shared<Sphere>());
+
+	Camera c = Camera(11, 11, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+
+	// A pinhole has no blur
+	ASSERT_EQ(c.circle_of_confusion(w, 5, 5), 0.0);
+	ASSERT_EQ(c.min_samples(w, 5, 5), w.aa_sample_min);
+
+	// Focused on the front of the sphere
+	c.aperture = 2.0;
+	c.focal_distance = 4.0;
+	ASSERT_NEAR(c.circle_of_confusion(w, 5, 5), 0.0, EPSILON);
+	ASSERT_EQ(c.min_samples(w, 5, 5), w.aa_sample_min);
+
+	// Focused in front of it
+	c.focal_distance = 2.0;
+	ASSERT_GT(c.circle_of_confusion(w, 5, 5), 1.0);
+	ASSERT_GT(c.min_samples(w, 5, 5), w.aa_sample_min);
+	ASSERT_LE(c.min_samples(w, 5, 5), w.aa_sample_max);
+}
+
+TEST(DepthOfField, SceneFilesSetTheLens)
+{
+	std::istringstream input(
+		"camera\n"
+		"\tfrom 0 0 -5\n"
+		"\tto 0 0 0\n"
+		"\taperture 0.2\n"
+		"\tblades 6 30\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	ASSERT_EQ(scene.camera.aperture, 0.2);
+	// Focused on the point looked at
+	ASSERT_NEAR(scene.camera.focal_distance, 5.0, EPSILON);
+	ASSERT_EQ(scene.camera.aperture_blades, 6);
+	ASSERT_NEAR(scene.camera.aperture_rotation, M_PI / 6.0, EPSILON);
+}
+
+// ------------------------------------------------------------------------
+// Distributed Rendering
+// ------------------------------------------------------------------------
+
+TEST(Distributed, PackedBucketsKeepEveryChannel)
+{
+	Camera c = Camera(4, 4, M_PI / 2.0);
+	SampleBuffer bucket = c.frame_buffer();
+
+	Sample sample = Sample();
+	sample.set_rgb(Color(0.25, 0.5, 0.75));
+	sample.Normal = Color(0.0, 1.0, 0.0);
+	sample.Depth = 3.0;
+	sample.BucketID = 7;
+	bucket.write_sample(1, 2, sample);
+	bucket.write_sample(1, 2, sample);
+
+	for (std::shared_ptr<SampledPixel> & pixel : bucket)
+	{
+		pixel->full_average();
+	}
+
+	NodeBucketResult result = NodeBucketResult();
+	result.bucket.id = 7;
+	result.bucket.width = 4;
+	result.bucket.height = 4;
+	result.counters.camera_rays = 2;
+
+	const std::string packed = pack_bucket(result, bucket);
+	ASSERT_EQ(packed.size(), sizeof(NodeBucketResult) + 16 * sizeof(PackedPixel));
+
+	SampleBuffer image = c.frame_buffer();
+	NodeBucketResult unpacked = unpack_bucket(packed, image);
+
+	ASSERT_EQ(unpacked.bucket.id, 7);
+	ASSERT_EQ(unpacked.counters.camera_rays, 2);
+
+	std::shared_ptr<SampledPixel> pixel = image.pixel_at(1, 2);
+	ASSERT_EQ(pixel->sample_count(), 2);
+	ASSERT_EQ(pixel->get_channel(rgb), Color(0.25, 0.5, 0.75));
+	ASSERT_EQ(pixel->get_channel(normal), Color(0.0, 1.0, 0.0));
+	ASSERT_EQ(pixel->get_channel(depth), Color(3.0));
+	ASSERT_EQ(pixel->get_calculated_average().BucketID, 7);
+
+	// A bucket that does not fit the frame is refused
+	SampleBuffer small = Camera(2, 2, M_PI / 2.0).frame_buffer();
+	ASSERT_THROW(unpack_bucket(packed, small), std::runtime_error);
+}
+
+TEST(Distributed, NodesRenderTheWholeFrame)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_distributed_frame");
+	const std::string scene_path = (directory / "main.scene").string();
+
+	std::ostringstream output;
+	RenderCoordinator coordinator = RenderCoordinator("unix:" + (directory / "coordinator.sock").string(), output);
+	coordinator.idle_timeout = 10.0;
+
+	auto run_node = [&coordinator]() { return RenderNode(1).run(coordinator.get_address()); };
+	std::future<int> first_node = std::async(std::launch::async, run_node);
+	std::future<int> second_node = std::async(std::launch::async, run_node);
+
+	RenderStats stats = RenderStats();
+	SampleBuffer image = coordinator.render(scene_path, stats);
+
+	ASSERT_EQ(first_node.get() + second_node.get(), int(stats.get_buckets().size()));
+	ASSERT_EQ(coordinator.get_nodes_served(), 2);
+	ASSERT_EQ(coordinator.get_nodes_lost(), 0);
+
+	// The same pixels as rendering the scene here, apart from the random light sampling
+	Scene scene = SceneCache::load(scene_path);
+	SampleBuffer local = scene.camera.multi_sample_threaded_render(scene.world);
+
+	ASSERT_EQ(image.width(), 32);
+	ASSERT_EQ(image.height(), 24);
+
+	for (int y = 0; y < image.height(); y++)
+	{
+		for (int x = 0; x < image.width(); x++)
+		{
+			ASSERT_EQ(image.pixel_at(x, y)->sample_count(), local.pixel_at(x, y)->sample_count());
+
+			const Color remote_color = image.pixel_at(x, y)->get_channel(rgb);
+			const Color local_color = local.pixel_at(x, y)->get_channel(rgb);
+			ASSERT_NEAR(remote_color.x, local_color.x, 0.001);
+			ASSERT_NEAR(remote_color.y, local_color.y, 0.001);
+			ASSERT_NEAR(remote_color.z, local_color.z, 0.001);
+		}
+	}
+}
+
+TEST(Distributed, BucketsOfALostNodeAreRenderedAgain)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_distributed_lost");
+	const std::string scene_path = (directory / "main.scene").string();
+
+	std::ostringstream output;
+	RenderCoordinator coordinator = RenderCoordinator("unix:" + (directory / "coordinator.sock").string(), output);
+	coordinator.idle_timeout = 10.0;
+
+	RenderStats stats = RenderStats();
+	std::future<SampleBuffer> render = std::async(std::launch::async, [&]() { return coordinator.render(scene_path, stats); });
+
+	// A node that takes a bucket and goes away without rendering it
+	{
+		NodeSocket socket = NodeSocket::connect(coordinator.get_address());
+
+		NodeHello hello = NodeHello();
+		hello.version = 1;
+		hello.threads = 1;
+		socket.send_message(NodeHelloMessage, std::string(reinterpret_cast<const char *>(&hello), sizeof(NodeHello)));
+
+		std::string payload;
+		ASSERT_EQ(socket.receive_message(payload, 10.0), NodeSceneMessage);
+		ASSERT_EQ(socket.receive_message(payload, 10.0), NodeBucketMessage);
+	}
+
+	const int rendered = RenderNode(1).run(coordinator.get_address());
+	SampleBuffer image = render.get();
+
+	ASSERT_EQ(rendered, int(stats.get_buckets().size()));
+	ASSERT_EQ(coordinator.get_nodes_lost(), 1);
+	ASSERT_EQ(coordinator.get_buckets_retried(), 1);
+
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		ASSERT_GT(pixel->sample_count(), 0);
+	}
+}
+
+TEST(Distributed, NodesBuildTheSceneWithoutItsFiles)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_distributed_no_files");
+	const std::string scene_path = (directory / "main.scene").string();
+	const std::filesystem::path socket_directory = std::filesystem::temp_directory_path() / "raymond_distributed_no_files_socket";
+	std::filesystem::create_directories(socket_directory);
+
+	std::ostringstream output;
+	RenderCoordinator coordinator = RenderCoordinator("unix:" + (socket_directory / "coordinator.sock").string(), output);
+	coordinator.idle_timeout = 10.0;
+
+	RenderStats stats = RenderStats();
+	std::future<SampleBuffer> render = std::async(std::launch::async, [&]() { return coordinator.render(scene_path, stats); });
+
+	// Once a scene has been sent the coordinator has read it, and from then on the files are
+	// only on "another machine"
+	{
+		NodeSocket socket = NodeSocket::connect(coordinator.get_address());
+
+		NodeHello hello = NodeHello();
+		hello.version = 1;
+		hello.threads = 1;
+		socket.send_message(NodeHelloMessage, std::string(reinterpret_cast<const char *>(&hello), sizeof(NodeHello)));
+
+		std::string payload;
+		ASSERT_EQ(socket.receive_message(payload, 10.0), NodeSceneMessage);
+		ASSERT_EQ(socket.receive_message(payload, 10.0), NodeBucketMessage);
+	}
+
+	std::filesystem::remove_all(directory);
+
+	const int rendered = RenderNode(1).run(coordinator.get_address());
+	SampleBuffer image = render.get();
+
+	ASSERT_EQ(rendered, int(stats.get_buckets().size()));
+
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		ASSERT_GT(pixel->sample_count(), 0);
+	}
+
+	std::filesystem::remove_all(socket_directory);
+}
+
+TEST(Distributed, ScenesWithImagesAreRefused)
+{
+	const std::filesystem::path directory = write_cache_test_scene("raymond_distributed_images");
+	const std::string scene_path = (directory / "main.scene").string();
+	canvas_to_ppm(checker_canvas(4, 2), (directory / "checks.ppm").string(), false);
+
+	{
+		std::ofstream main_file(directory / "main.scene", std::ios::app);
+		main_file << "texmap photo image \"checks.ppm\"\nend\n";
+	}
+
+	std::ostringstream output;
+	RenderCoordinator coordinator = RenderCoordinator("unix:" + (directory / "coordinator.sock").string(), output);
+	coordinator.idle_timeout = 10.0;
+
+	RenderStats stats = RenderStats();
+	ASSERT_THROW(coordinator.render(scene_path, stats), std::runtime_error);
+
+	// The cache lists the image, so the coordinator knows without parsing the scene again
+	const std::vector<std::string> assets = SceneCache(SceneCache::cache_path_for(scene_path)).asset_paths();
+	ASSERT_EQ(assets.size(), 1);
+	ASSERT_EQ(assets[0], std::filesystem::absolute(directory / "checks.ppm").string());
+
+	std::filesystem::remove_all(directory);
+}
+
+// ------------------------------------------------------------------------
+// Checkpoints
+// ------------------------------------------------------------------------
+
+// A small render with buckets of 3 by 3, so 3 by 2 of them
+static void checkpoint_test_render(World & w, Camera & c)
+{
+	w = World::Default();
+	w.bucket_size = 3;
+	w.aa_sample_max = 2;
+
+	c = Camera(7, 5, M_PI / 2.0);
+	c.set_transform(Matrix4::ViewTransform(Tuple::Point(0.0, 0.0, -5.0), Tuple::Point(0.0, 0.0, 0.0), Tuple::Vector(0.0, 1.0, 0.0)));
+}
+
+static std::string fresh_checkpoint_path(const std::string & name)
+{
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+	std::filesystem::remove(path);
+	return path.string();
+}
+
+TEST(Checkpoints, FinishedBucketsAreNotRenderedAgain)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	const std::string path = fresh_checkpoint_path("raymond_checkpoint_buckets");
+	const uint64_t hash = RenderCheckpoint::render_hash(c, w, 0);
+
+	RenderStats first_stats = RenderStats();
+	SampleBuffer first;
+	{
+		RenderCheckpoint checkpoint = RenderCheckpoint(path, hash);
+		ASSERT_EQ(checkpoint.get_restored_buckets(), 0);
+
+		first = c.multi_sample_threaded_render(w, first_stats, checkpoint);
+	}
+	ASSERT_EQ(first_stats.get_buckets().size(), 6);
+
+	RenderCheckpoint checkpoint = RenderCheckpoint(path, hash);
+	ASSERT_EQ(checkpoint.get_restored_buckets(), 6);
+
+	RenderStats stats = RenderStats();
+	SampleBuffer resumed = c.multi_sample_threaded_render(w, stats, checkpoint);
+	ASSERT_EQ(stats.get_buckets().size(), 0);
+
+	for (int y = 0; y < 5; y++)
+	{
+		for (int x = 0; x < 7; x++)
+		{
+			ASSERT_EQ(resumed.pixel_at(x, y)->sample_count(), first.pixel_at(x, y)->sample_count());
+			ASSERT_NEAR(resumed.pixel_at(x, y)->get_channel(rgb).x, first.pixel_at(x, y)->get_channel(rgb).x, 0.0001);
+		}
+	}
+
+	checkpoint.remove();
+	ASSERT_FALSE(std::filesystem::exists(path));
+}
+
+TEST(Checkpoints, ABucketCutShortIsRenderedAgain)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	const std::string path = fresh_checkpoint_path("raymond_checkpoint_torn");
+	const uint64_t hash = RenderCheckpoint::render_hash(c, w, 0);
+
+	{
+		RenderCheckpoint checkpoint = RenderCheckpoint(path, hash);
+		RenderStats stats = RenderStats();
+		c.multi_sample_threaded_render(w, stats, checkpoint);
+	}
+
+	// As if the render was killed while the last bucket was being written
+	const uintmax_t whole_size = std::filesystem::file_size(path);
+	std::filesystem::resize_file(path, whole_size - 10);
+
+	RenderCheckpoint checkpoint = RenderCheckpoint(path, hash);
+	ASSERT_EQ(checkpoint.get_restored_buckets(), 5);
+
+	RenderStats stats = RenderStats();
+	SampleBuffer image = c.multi_sample_threaded_render(w, stats, checkpoint);
+	ASSERT_EQ(stats.get_buckets().size(), 1);
+
+	// The bucket is written whole after the five that were kept
+	ASSERT_EQ(std::filesystem::file_size(path), whole_size);
+
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		ASSERT_GT(pixel->sample_count(), 0);
+	}
+}
+
+TEST(Checkpoints, ADifferentRenderStartsOver)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	const std::string path = fresh_checkpoint_path("raymond_checkpoint_changed");
+
+	{
+		RenderCheckpoint checkpoint = RenderCheckpoint(path, RenderCheckpoint::render_hash(c, w, 0));
+		RenderStats stats = RenderStats();
+		c.multi_sample_threaded_render(w, stats, checkpoint);
+	}
+
+	w.aa_sample_max = 4;
+	ASSERT_EQ(RenderCheckpoint(path, RenderCheckpoint::render_hash(c, w, 0)).get_restored_buckets(), 0);
+
+	// And so does a change to the scene
+	w.aa_sample_max = 2;
+	ASSERT_EQ(RenderCheckpoint(path, RenderCheckpoint::render_hash(c, w, 1)).get_restored_buckets(), 0);
+}
+
+TEST(Checkpoints, EditedImagesChangeTheRenderHash)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	// The scene cache only names its images, so an edited texture leaves the cache the same
+	const std::string image_path = fresh_checkpoint_path("raymond_checkpoint_image.ppm");
+	canvas_to_ppm(checker_canvas(4, 2), image_path, false);
+
+	const uint64_t before = RenderCheckpoint::render_hash(c, w, 0, { image_path });
+	ASSERT_EQ(RenderCheckpoint::render_hash(c, w, 0, { image_path }), before);
+	ASSERT_NE(RenderCheckpoint::render_hash(c, w, 0), before);
+
+	std::filesystem::last_write_time(image_path, std::filesystem::last_write_time(image_path) + std::chrono::seconds(10));
+	ASSERT_NE(RenderCheckpoint::render_hash(c, w, 0, { image_path }), before);
+
+	std::filesystem::remove(image_path);
+}
+
+TEST(Checkpoints, ProgressiveRendersCarryOnFromTheirLastPass)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	const std::string path = fresh_checkpoint_path("raymond_checkpoint_passes");
+	const uint64_t hash = RenderCheckpoint::render_hash(c, w, 0);
+
+	ProgressiveSettings settings = ProgressiveSettings();
+	settings.max_passes = 2;
+	settings.checkpoint = std::make_shared<RenderCheckpoint>(path, hash);
+	c.progressive_render(w, settings);
+	settings.checkpoint.reset();
+
+	std::vector<int> passes;
+	settings.max_passes = 4;
+	settings.on_pass = [&passes](const ProgressiveStats & stats) { passes.push_back(stats.pass); };
+	settings.checkpoint = std::make_shared<RenderCheckpoint>(path, hash);
+	ASSERT_EQ(settings.checkpoint->get_restored_passes(), 2);
+
+	SampleBuffer image = c.progressive_render(w, settings);
+
+	ASSERT_EQ(passes, std::vector<int>({ 3, 4 }));
+
+	for (std::shared_ptr<SampledPixel> & pixel : image)
+	{
+		ASSERT_EQ(pixel->sample_count(), 4);
+	}
+
+	settings.checkpoint.reset();
+	ASSERT_EQ(RenderCheckpoint(path, hash).get_restored_passes(), 4);
+}
+
+// ------------------------------------------------------------------------
+// Crop Window
+// ------------------------------------------------------------------------
+
+TEST(CropWindow, IsClippedToTheFrame)
+{
+	Camera c = Camera(7, 5, M_PI / 2.0);
+	ASSERT_FALSE(c.has_crop_window());
+
+	PixelRect full = c.get_crop_window();
+	ASSERT_EQ(full.width, 7);
+	ASSERT_EQ(full.height, 5);
+
+	c.set_crop_window(5, -1, 10, 3);
+	PixelRect crop = c.get_crop_window();
+	ASSERT_TRUE(c.has_crop_window());
+	ASSERT_EQ(crop.x, 5);
+	ASSERT_EQ(crop.y, 0);
+	ASSERT_EQ(crop.width, 2);
+	ASSERT_EQ(crop.height, 2);
+
+	ASSERT_THROW(c.set_crop_window(7, 0, 2, 2), std::invalid_argument);
+
+	c.clear_crop_window();
+	ASSERT_FALSE(c.has_crop_window());
+	ASSERT_EQ(c.get_crop_window().width, 7);
+}
+
+TEST(CropWindow, CanvasRendersOnlyTraceTheWindow)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	Canvas full = c.render(w);
+
+	Canvas previous = Canvas(7, 5);
+	for (int y = 0; y < 5; y++)
+	{
+		for (int x = 0; x < 7; x++)
+		{
+			previous.write_pixel(x, y, Color(1.0, 0.0, 1.0));
+		}
+	}
+
+	c.set_crop_window(2, 1, 3, 2);
+	Canvas cropped = c.render(w);
+	Canvas pasted = c.threaded_render(w, previous);
+
+	for (int y = 0; y < 5; y++)
+	{
+		for (int x = 0; x < 7; x++)
+		{
+			const bool inside = x >= 2 && x < 5 && y >= 1 && y < 3;
+
+			ASSERT_EQ(cropped.pixel_at(x, y), inside ? full.pixel_at(x, y) : Color(0.0, 0.0, 0.0));
+			ASSERT_EQ(pasted.pixel_at(x, y), inside ? full.pixel_at(x, y) : Color(1.0, 0.0, 1.0));
+		}
+	}
+
+	ASSERT_THROW(c.render(w, Canvas(3, 3)), std::invalid_argument);
+}
+
+TEST(CropWindow, OnlyBucketsInsideTheWindowAreRenderedOverThePreviousFrame)
+{
+	World w;
+	Camera c;
+	checkpoint_test_render(w, c);
+
+	SampleBuffer previous = c.multi_sample_threaded_render(w);
+
+	// Overlaps the first two buckets of the top row, and only part of each
+	c.set_crop_window(2, 1, 3, 2);
+
+	RenderStats stats = RenderStats();
+	SampleBuffer image = c.multi_sample_threaded_render(w, stats, previous);
+
+	const std::vector<BucketStats> & buckets = stats.get_buckets();
+	ASSERT_EQ(buckets.size(), 2);
+
+	int pixels = 0;
+	for (const BucketStats & bucket : buckets)
+	{
+		ASSERT_EQ(bucket.y, 1);
+		ASSERT_EQ(bucket.height, 2);
+		pixels += bucket.width * bucket.height;
+	}
+	ASSERT_EQ(pixels, 6);
+
+	for (int y = 0; y < 5; y++)
+	{
+		for (int x = 0; x < 7; x++)
+		{
+			const bool inside = x >= 2 && x < 5 && y >= 1 && y < 3;
+
+			// Pixels outside the window are the previous frame's own
+			ASSERT_EQ(image.pixel_at(x, y) == previous.pixel_at(x, y), !inside);
+			ASSERT_GT(image.pixel_at(x, y)->sample_count(), 0);
+		}
+	}
+
+	ASSERT_THROW(c.multi_sample_threaded_render(w, stats, SampleBuffer(3, 3, AABB2D(Tuple::Point2D(0.0, 0.0), Tuple::Point2D(1.0, 1.0)))), std::invalid_argument);
+}
+
+TEST(CropWindow, IsReadFromTheCamera)
+{
+	std::istringstream input(
+		"camera\n"
+		"\tsize 160 90\n"
+		"\tcrop 100 80 100 20\n"
+		"end\n"
+	);
+
+	SceneParser parser = SceneParser();
+	Scene scene = parser.parse(input);
+
+	PixelRect crop = scene.camera.get_crop_window();
+	ASSERT_EQ(crop.x, 100);
+	ASSERT_EQ(crop.y, 80);
+	ASSERT_EQ(crop.width, 60);
+	ASSERT_EQ(crop.height, 10);
+}